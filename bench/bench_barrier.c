@@ -0,0 +1,700 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Benchmark of barrier synchronization latency
+ *
+ * For each configuration (CMG, window, team size, injected skew), threads bound
+ * to PEs of a CMG perform warm-up and then measured barrier episodes. Time spent
+ * in each barrier call of each thread is recorded in a log-linear histogram
+ * (6% precision) and min/median/p99/p99.9/max are reported.
+ *
+ * Methods:
+ *  fhwb    : fhwb_sync() of the backend in use. Run with FUJITSU_HWBLIB_BACKEND=sw
+ *            to measure the software barrier of the library (see "backend" column)
+ *  pthread : pthread_barrier_wait()
+ *  omp     : "omp barrier" (only when built with OpenMP)
+ *
+ * If skew is not 0, one thread (rotated every episode) busy-waits skew_ns before
+ * arriving at the barrier.
+ *
+ * Usage: ./bench_barrier [-c cmg,..] [-w window,..] [-n threads,..] [-s skew_ns,..]
+ *                        [-m method,..] [-i iterations] [-W warmup] [-f csv|json] [-o file]
+ * Team size 0 (default) means all PEs of the CMG.
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#ifdef __aarch64__
+/* Read system clock counter directly from EL0 */
+static inline uint64_t read_clock(void)
+{
+	uint64_t x;
+
+	__asm__ __volatile__("isb \n\t"
+		"mrs %[output], cntvct_el0"
+		: [output]"=r"(x)
+		:
+		: "memory");
+
+	return x;
+}
+
+static inline uint64_t read_clock_freq(void)
+{
+	uint64_t x;
+
+	__asm__ __volatile__("mrs %[output], cntfrq_el0"
+		: [output]"=r"(x)
+		:
+		: "memory");
+
+	return x;
+}
+#else
+/* Use monotonic clock in nanoseconds on other architectures */
+static inline uint64_t read_clock(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000UL * 1000 * 1000 + ts.tv_nsec;
+}
+
+static inline uint64_t read_clock_freq(void)
+{
+	return 1000UL * 1000 * 1000;
+}
+#endif
+
+#define MAX_LIST 16
+
+/* Log-linear histogram: 16 sub-buckets per power of two */
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+struct hist {
+	uint64_t count[HIST_BUCKETS];
+	uint64_t num;
+	uint64_t sum;
+	uint64_t min;
+	uint64_t max;
+};
+
+enum method_id {
+	METHOD_FHWB,
+	METHOD_PTHREAD,
+	METHOD_OMP,
+	NR_METHODS,
+};
+
+static const char *method_names[NR_METHODS] = {
+	[METHOD_FHWB] = "fhwb",
+	[METHOD_PTHREAD] = "pthread",
+	[METHOD_OMP] = "omp",
+};
+
+/* One configuration to measure */
+struct run {
+	int method;
+	int cmg;
+	int window;
+	int nr_threads;
+	long skew_ns;
+	long iterations;
+	long warmup;
+	int cpus[CPU_SETSIZE];
+	int bd;
+	pthread_barrier_t pbarrier;
+	/* All threads start measurement only if setup succeeds in all threads */
+	pthread_barrier_t start;
+	atomic_int setup_failed;
+};
+
+struct worker {
+	struct run *run;
+	pthread_t thread_id;
+	int id;
+	int window;
+	int ret;
+	struct hist hist;
+};
+
+static uint64_t clock_freq;
+
+/* Output settings */
+static FILE *out;
+static int json;
+static int nr_results;
+
+static inline uint64_t ticks_to_ns(uint64_t ticks)
+{
+	return ticks * (1000UL * 1000 * 1000) / clock_freq;
+}
+
+static inline void spin_ns(long ns)
+{
+	uint64_t end = read_clock() + ns * clock_freq / (1000UL * 1000 * 1000);
+
+	while (read_clock() < end)
+		;
+}
+
+static int hist_index(uint64_t val)
+{
+	int exp;
+
+	if (val < HIST_SUB)
+		return val;
+
+	exp = 63 - __builtin_clzl(val);
+
+	return (exp - HIST_SUB_BITS + 1) * HIST_SUB + ((val >> (exp - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* Lower bound of values in bucket @idx */
+static uint64_t hist_lower(int idx)
+{
+	int exp;
+
+	if (idx < HIST_SUB)
+		return idx;
+
+	exp = idx / HIST_SUB + HIST_SUB_BITS - 1;
+
+	return (uint64_t)(HIST_SUB + idx % HIST_SUB) << (exp - HIST_SUB_BITS);
+}
+
+static void hist_init(struct hist *h)
+{
+	memset(h, 0, sizeof(*h));
+	h->min = UINT64_MAX;
+}
+
+static inline void hist_add(struct hist *h, uint64_t val)
+{
+	h->count[hist_index(val)]++;
+	h->num++;
+	h->sum += val;
+	if (val < h->min)
+		h->min = val;
+	if (val > h->max)
+		h->max = val;
+}
+
+static void hist_merge(struct hist *dst, const struct hist *src)
+{
+	int i;
+
+	for (i = 0; i < HIST_BUCKETS; i++)
+		dst->count[i] += src->count[i];
+	dst->num += src->num;
+	dst->sum += src->sum;
+	if (src->min < dst->min)
+		dst->min = src->min;
+	if (src->max > dst->max)
+		dst->max = src->max;
+}
+
+/* Return value at quantile @q (0 < q <= 1), with precision of the bucket */
+static uint64_t hist_quantile(const struct hist *h, double q)
+{
+	uint64_t rank = (uint64_t)(q * h->num + 0.999999);
+	uint64_t seen = 0;
+	uint64_t val;
+	int i;
+
+	if (rank == 0)
+		rank = 1;
+
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		seen += h->count[i];
+		if (seen >= rank)
+			break;
+	}
+
+	val = hist_lower(i);
+	if (val < h->min)
+		val = h->min;
+	if (val > h->max)
+		val = h->max;
+
+	return val;
+}
+
+static void fhwb_barrier(struct worker *w)
+{
+	fhwb_sync(w->window);
+}
+
+static void pthread_barrier(struct worker *w)
+{
+	pthread_barrier_wait(&w->run->pbarrier);
+}
+
+#ifdef _OPENMP
+static void omp_barrier(struct worker *w)
+{
+	(void)w;
+#pragma omp barrier
+}
+#endif
+
+/* Measure barrier episodes of calling thread */
+static void measure(struct worker *w, void (*barrier)(struct worker *))
+{
+	struct run *run = w->run;
+	long total = run->warmup + run->iterations;
+	uint64_t t1, t2;
+	long i;
+
+	hist_init(&w->hist);
+
+	for (i = 0; i < total; i++) {
+		if (run->skew_ns && i % run->nr_threads == w->id)
+			spin_ns(run->skew_ns);
+
+		t1 = read_clock();
+		barrier(w);
+		t2 = read_clock();
+
+		if (i >= run->warmup)
+			hist_add(&w->hist, ticks_to_ns(t2 - t1));
+	}
+}
+
+static int bind_cpu(int cpu)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &set) < 0) {
+		perror("sched_setaffinity");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void *worker_main(void *arg)
+{
+	struct worker *w = (struct worker *)arg;
+	struct run *run = w->run;
+
+	w->window = -1;
+	w->ret = bind_cpu(run->cpus[w->id]);
+	if (!w->ret && run->method == METHOD_FHWB) {
+		w->window = fhwb_assign(run->bd, run->window);
+		if (w->window < 0)
+			w->ret = w->window;
+	}
+	if (w->ret)
+		atomic_store(&run->setup_failed, 1);
+
+	pthread_barrier_wait(&run->start);
+	if (atomic_load(&run->setup_failed))
+		goto out;
+
+	if (run->method == METHOD_PTHREAD)
+		measure(w, pthread_barrier);
+	else
+		measure(w, fhwb_barrier);
+
+out:
+	if (w->window >= 0) {
+		int ret = fhwb_unassign(run->bd);
+
+		if (!w->ret)
+			w->ret = ret;
+	}
+
+	return NULL;
+}
+
+static int run_threads(struct run *run, struct worker *workers)
+{
+	cpu_set_t set;
+	int ret = 0;
+	int i;
+
+	if (run->method == METHOD_FHWB) {
+		CPU_ZERO(&set);
+		for (i = 0; i < run->nr_threads; i++)
+			CPU_SET(run->cpus[i], &set);
+		run->bd = fhwb_init(sizeof(cpu_set_t), &set);
+		if (run->bd < 0)
+			return run->bd;
+	} else {
+		pthread_barrier_init(&run->pbarrier, NULL, run->nr_threads);
+	}
+	pthread_barrier_init(&run->start, NULL, run->nr_threads);
+	atomic_store(&run->setup_failed, 0);
+
+	for (i = 0; i < run->nr_threads; i++) {
+		ret = pthread_create(&workers[i].thread_id, NULL, worker_main, &workers[i]);
+		if (ret) {
+			/* Threads already created would wait for the rest forever */
+			fprintf(stderr, "pthread_create: %s\n", strerror(ret));
+			exit(1);
+		}
+	}
+
+	for (i = 0; i < run->nr_threads; i++) {
+		pthread_join(workers[i].thread_id, NULL);
+		if (workers[i].ret && !ret)
+			ret = workers[i].ret;
+	}
+
+	pthread_barrier_destroy(&run->start);
+	if (run->method == METHOD_FHWB) {
+		i = fhwb_fini(run->bd);
+		if (i && !ret)
+			ret = i;
+	} else {
+		pthread_barrier_destroy(&run->pbarrier);
+	}
+
+	return ret;
+}
+
+#ifdef _OPENMP
+static int run_omp(struct run *run, struct worker *workers)
+{
+	cpu_set_t orig;
+	int ret = 0;
+
+	/* The master thread joins the team, so restore its affinity afterwards */
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &orig) < 0) {
+		perror("sched_getaffinity");
+		return -1;
+	}
+
+#pragma omp parallel num_threads(run->nr_threads)
+	{
+		struct worker *w = &workers[omp_get_thread_num()];
+		int failed;
+
+		if (omp_get_num_threads() != run->nr_threads || bind_cpu(run->cpus[w->id])) {
+#pragma omp atomic write
+			ret = -1;
+		}
+#pragma omp barrier
+#pragma omp atomic read
+		failed = ret;
+		if (!failed)
+			measure(w, omp_barrier);
+	}
+
+	sched_setaffinity(0, sizeof(cpu_set_t), &orig);
+	if (ret)
+		fprintf(stderr, "cannot run %d OpenMP threads bound to PEs\n", run->nr_threads);
+
+	return ret;
+}
+#endif
+
+static void print_header(void)
+{
+	if (json) {
+		fprintf(out, "{\n  \"clock_hz\": %lu,\n  \"results\": [", clock_freq);
+		return;
+	}
+
+	fprintf(out, "method,backend,cmg,window,threads,skew_ns,iterations,"
+			"min_ns,median_ns,p99_ns,p999_ns,max_ns,mean_ns\n");
+}
+
+static void print_footer(void)
+{
+	if (json)
+		fprintf(out, "\n  ]\n}\n");
+}
+
+static void print_result(const struct run *run, const struct hist *h)
+{
+	const char *backend = run->method == METHOD_FHWB ? fhwb_get_backend_name() : "-";
+	int window = run->method == METHOD_FHWB ? run->window : -1;
+	double mean = h->num ? (double)h->sum / h->num : 0;
+	int first = 1;
+	int i;
+
+	if (!json) {
+		fprintf(out, "%s,%s,%d,%d,%d,%ld,%ld,%lu,%lu,%lu,%lu,%lu,%.1f\n",
+				method_names[run->method], backend, run->cmg, window,
+				run->nr_threads, run->skew_ns, run->iterations,
+				h->min, hist_quantile(h, 0.5), hist_quantile(h, 0.99),
+				hist_quantile(h, 0.999), h->max, mean);
+		fflush(out);
+		return;
+	}
+
+	fprintf(out, "%s\n    {\"method\": \"%s\", \"backend\": \"%s\", \"cmg\": %d, \"window\": %d, "
+			"\"threads\": %d, \"skew_ns\": %ld, \"iterations\": %ld,\n"
+			"     \"min_ns\": %lu, \"median_ns\": %lu, \"p99_ns\": %lu, \"p999_ns\": %lu, "
+			"\"max_ns\": %lu, \"mean_ns\": %.1f,\n"
+			"     \"histogram\": [",
+			nr_results ? "," : "",
+			method_names[run->method], backend, run->cmg, window,
+			run->nr_threads, run->skew_ns, run->iterations,
+			h->min, hist_quantile(h, 0.5), hist_quantile(h, 0.99),
+			hist_quantile(h, 0.999), h->max, mean);
+	/* Pairs of [lower bound in ns, count] of non-empty buckets */
+	for (i = 0; i < HIST_BUCKETS; i++) {
+		if (!h->count[i])
+			continue;
+		fprintf(out, "%s[%lu, %lu]", first ? "" : ", ", hist_lower(i), h->count[i]);
+		first = 0;
+	}
+	fprintf(out, "]}");
+	fflush(out);
+}
+
+static int run_one(struct run *run)
+{
+	struct worker *workers;
+	struct hist *total;
+	int ret;
+	int i;
+
+	workers = calloc(run->nr_threads, sizeof(struct worker));
+	total = malloc(sizeof(struct hist));
+	if (!workers || !total) {
+		perror("calloc");
+		exit(1);
+	}
+	for (i = 0; i < run->nr_threads; i++) {
+		workers[i].run = run;
+		workers[i].id = i;
+	}
+
+#ifdef _OPENMP
+	if (run->method == METHOD_OMP)
+		ret = run_omp(run, workers);
+	else
+#endif
+		ret = run_threads(run, workers);
+
+	if (!ret) {
+		hist_init(total);
+		for (i = 0; i < run->nr_threads; i++)
+			hist_merge(total, &workers[i].hist);
+		print_result(run, total);
+		nr_results++;
+	} else {
+		fprintf(stderr, "%s: cmg %d, window %d, %d threads failed: %d\n",
+				method_names[run->method], run->cmg, run->window, run->nr_threads, ret);
+	}
+
+	free(total);
+	free(workers);
+
+	return ret;
+}
+
+/* Parse comma separated list of integers. Return number of entries or -1 */
+static int parse_list(const char *arg, long *list, long min)
+{
+	const char *p = arg;
+	char *end;
+	int num = 0;
+
+	while (*p) {
+		if (num == MAX_LIST)
+			return -1;
+		errno = 0;
+		list[num] = strtol(p, &end, 0);
+		if (errno || end == p || list[num] < min || (*end && *end != ','))
+			return -1;
+		num++;
+		p = *end ? end + 1 : end;
+	}
+
+	return num ? num : -1;
+}
+
+static int parse_methods(const char *arg, int *methods)
+{
+	char *str = strdup(arg);
+	char *save = NULL;
+	char *tok;
+	int num = 0;
+	int i;
+
+	for (tok = strtok_r(str, ",", &save); tok; tok = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < NR_METHODS; i++)
+			if (!strcmp(tok, method_names[i]))
+				break;
+#ifndef _OPENMP
+		if (i == METHOD_OMP) {
+			fprintf(stderr, "built without OpenMP\n");
+			i = NR_METHODS;
+		}
+#endif
+		if (i == NR_METHODS || num == MAX_LIST) {
+			free(str);
+			return -1;
+		}
+		methods[num++] = i;
+	}
+	free(str);
+
+	return num ? num : -1;
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Benchmark of barrier synchronization latency\n\n");
+	fprintf(stderr, "Usage: ./bench_barrier [options]\n");
+	fprintf(stderr, "  -c cmg,..        CMG numbers (default: 0)\n");
+	fprintf(stderr, "  -w window,..     window numbers of fhwb, -1 for any (default: -1)\n");
+	fprintf(stderr, "  -n threads,..    team sizes, 0 for all PEs of CMG (default: 0)\n");
+	fprintf(stderr, "  -s skew_ns,..    delay of one thread before each episode (default: 0)\n");
+	fprintf(stderr, "  -m method,..     fhwb, pthread, omp (default: all available)\n");
+	fprintf(stderr, "  -i iterations    measured episodes per configuration (default: 1000000)\n");
+	fprintf(stderr, "  -W warmup        episodes before measurement (default: 1000)\n");
+	fprintf(stderr, "  -f csv|json      output format (default: csv)\n");
+	fprintf(stderr, "  -o file          output file (default: stdout)\n");
+}
+
+int main(int argc, char *argv[])
+{
+	long cmgs[MAX_LIST] = {0}, windows[MAX_LIST] = {-1}, teams[MAX_LIST] = {0}, skews[MAX_LIST] = {0};
+	int nr_cmgs = 1, nr_windows = 1, nr_teams = 1, nr_skews = 1;
+	int methods[MAX_LIST] = {METHOD_FHWB, METHOD_PTHREAD, METHOD_OMP};
+#ifdef _OPENMP
+	int nr_methods = 3;
+#else
+	int nr_methods = 2;
+#endif
+	long iterations = 1000 * 1000;
+	long warmup = 1000;
+	struct run *run;
+	int failed = 0;
+	int c, t, s, m, w;
+	int opt;
+
+	out = stdout;
+	while ((opt = getopt(argc, argv, "c:w:n:s:m:i:W:f:o:h")) != -1) {
+		switch (opt) {
+		case 'c':
+			nr_cmgs = parse_list(optarg, cmgs, 0);
+			break;
+		case 'w':
+			nr_windows = parse_list(optarg, windows, -1);
+			break;
+		case 'n':
+			nr_teams = parse_list(optarg, teams, 0);
+			break;
+		case 's':
+			nr_skews = parse_list(optarg, skews, 0);
+			break;
+		case 'm':
+			nr_methods = parse_methods(optarg, methods);
+			break;
+		case 'i':
+			iterations = atol(optarg);
+			break;
+		case 'W':
+			warmup = atol(optarg);
+			break;
+		case 'f':
+			if (!strcmp(optarg, "json"))
+				json = 1;
+			else if (strcmp(optarg, "csv"))
+				nr_methods = -1;
+			break;
+		case 'o':
+			out = fopen(optarg, "w");
+			if (!out) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		default:
+			usage();
+			return 1;
+		}
+	}
+	if (nr_cmgs < 0 || nr_windows < 0 || nr_teams < 0 || nr_skews < 0 ||
+	    nr_methods < 0 || iterations <= 0 || warmup < 0) {
+		usage();
+		return 1;
+	}
+
+	clock_freq = read_clock_freq();
+	run = malloc(sizeof(struct run));
+	if (!run) {
+		perror("malloc");
+		return 1;
+	}
+
+	print_header();
+	for (c = 0; c < nr_cmgs; c++) {
+		cpu_set_t cmg_set;
+		int nr_cpus = 0;
+		int cpu;
+
+		if (fhwb_get_cmg_cpumask(cmgs[c], sizeof(cpu_set_t), &cmg_set) < 0) {
+			fprintf(stderr, "CMG %ld has no available PE\n", cmgs[c]);
+			failed = 1;
+			continue;
+		}
+		for (cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			if (CPU_ISSET(cpu, &cmg_set))
+				run->cpus[nr_cpus++] = cpu;
+
+		for (t = 0; t < nr_teams; t++) {
+			int nr_threads = teams[t] ? teams[t] : nr_cpus;
+
+			if (nr_threads < 2 || nr_threads > nr_cpus) {
+				fprintf(stderr, "CMG %ld does not have %d PEs\n", cmgs[c], nr_threads);
+				failed = 1;
+				continue;
+			}
+
+			for (s = 0; s < nr_skews; s++) {
+				for (m = 0; m < nr_methods; m++) {
+					/* Window only matters for fhwb */
+					for (w = 0; w < (methods[m] == METHOD_FHWB ? nr_windows : 1); w++) {
+						run->method = methods[m];
+						run->cmg = cmgs[c];
+						run->window = windows[w];
+						run->nr_threads = nr_threads;
+						run->skew_ns = skews[s];
+						run->iterations = iterations;
+						run->warmup = warmup;
+						if (run_one(run))
+							failed = 1;
+					}
+				}
+			}
+		}
+	}
+	print_footer();
+
+	free(run);
+	if (out != stdout)
+		fclose(out);
+
+	return failed;
+}
@@ -0,0 +1,965 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Userspace emulator of fujitsu_hwb driver (used by LD_PRELOAD)
+ *
+ * open/ioctl/close of FHWB_DEV_FILE are intercepted and the driver's ioctls
+ * are performed on a virtual A64FX node. Driver state is shared by all processes
+ * of the user through a file under FUJITSU_HWB_SYSFS_ROOT (default: per user
+ * directory under /tmp), where the same entries as the driver's sysfs are also
+ * published. The state file is private to the user so that other users cannot
+ * corrupt its lock or the device state. Resources left by a process are freed
+ * upon close of the device file, process exit, or when another process finds
+ * the owner process has gone.
+ *
+ * Since the virtual node usually has more PEs than the host, CPU affinity of
+ * each thread is also virtualized (sched_setaffinity/sched_getaffinity/
+ * sched_getcpu/get_nprocs_conf are intercepted). Threads are not actually bound.
+ *
+ * Usage: LD_PRELOAD=libFJhwb-emu.so FUJITSU_HWB_SYSFS_ROOT=<dir> ./a.out
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hpc_ioctl.h"
+#include "fujitsu_hwb_emu_ioctl.h"
+#include "internal.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/* Topology of the virtual node as "<num_cmg>x<pe_per_cmg>" (default: A64FX) */
+#define EMU_TOPOLOGY_ENV_NAME "FUJITSU_HWB_EMU_TOPOLOGY"
+/* Followed by ".<uid>" */
+#define EMU_DEFAULT_ROOT "/tmp/fujitsu_hwb"
+#define EMU_STATE_FILE ".emu_state"
+
+#define EMU_MAGIC   0x46485742
+#define EMU_VERSION 1
+
+#define EMU_DEFAULT_CMG        4
+#define EMU_DEFAULT_PE_PER_CMG 12
+#define EMU_MAX_CMG            16
+#define EMU_MAX_PE_PER_CMG     16
+#define EMU_MAX_PE             (EMU_MAX_CMG * EMU_MAX_PE_PER_CMG)
+#define EMU_NUM_BB             FHWB_SW_NUM_BB
+#define EMU_NUM_BW             FHWB_SW_NUM_BW
+#define EMU_MAX_FILES          256
+#define EMU_MAX_FD             4096
+
+#define EMU_PATH_MAX 256
+
+#define emu_error(fmt, ...) \
+	fprintf(stderr, "libFJhwb-emu: ERROR: %s:%d: " fmt "\n", __func__, __LINE__, ##__VA_ARGS__)
+
+/* Opened device file (pid is 0 if unused) */
+struct emu_file {
+	pid_t pid;
+};
+
+struct emu_bb {
+	int owner;      /* index of emu_file, -1 if not allocated */
+	uint32_t mask;  /* bitmap of physical PE number */
+};
+
+struct emu_pe {
+	int8_t bb[EMU_NUM_BW]; /* bb number assigned to each window, -1 if unused */
+};
+
+/* Driver state shared by all processes */
+struct emu_state {
+	uint32_t magic;
+	uint32_t version;
+	int num_cmg;
+	int pe_per_cmg;
+	pthread_mutex_t lock;
+	struct emu_file files[EMU_MAX_FILES];
+	struct emu_bb bbs[EMU_MAX_CMG][EMU_NUM_BB];
+	struct emu_pe pes[EMU_MAX_PE];
+	/* used_bw_bmap of the CMG is not published yet */
+	bool bw_dirty[EMU_MAX_CMG];
+};
+
+static struct emu_state *emu;
+static pthread_once_t emu_once = PTHREAD_ONCE_INIT;
+static char emu_root[EMU_PATH_MAX];
+static int emu_num_pe;
+
+/* fd -> index of emu_file + 1 (0 for files other than the device) */
+static int emu_fds[EMU_MAX_FD];
+static pthread_mutex_t emu_fd_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Virtual affinity of each thread (all PEs if not set) */
+static __thread cpu_set_t emu_affinity;
+static __thread bool emu_affinity_set;
+
+static int (*real_open)(const char *, int, ...);
+static int (*real_close)(int);
+static int (*real_ioctl)(int, unsigned long, ...);
+static int (*real_sched_setaffinity)(pid_t, size_t, const cpu_set_t *);
+static int (*real_sched_getaffinity)(pid_t, size_t, cpu_set_t *);
+
+static void resolve_real_functions(void)
+{
+	if (real_open)
+		return;
+
+	real_close = dlsym(RTLD_NEXT, "close");
+	real_ioctl = dlsym(RTLD_NEXT, "ioctl");
+	real_sched_setaffinity = dlsym(RTLD_NEXT, "sched_setaffinity");
+	real_sched_getaffinity = dlsym(RTLD_NEXT, "sched_getaffinity");
+	real_open = dlsym(RTLD_NEXT, "open");
+}
+
+/*
+ * Publish sysfs entries. These are called under emu->lock (or under
+ * flock of state file upon initialization)
+ */
+static void publish(const char *name, const char *buf)
+{
+	char path[EMU_PATH_MAX * 2];
+	char tmp[EMU_PATH_MAX * 2 + 16];
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/%s", emu_root, name);
+	snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid());
+
+	fp = fopen(tmp, "w");
+	if (fp == NULL) {
+		emu_error("fopen %s: %m", tmp);
+		return;
+	}
+	fputs(buf, fp);
+	fclose(fp);
+
+	/* Readers always see complete contents */
+	rename(tmp, path);
+}
+
+static void publish_bb(int cmg)
+{
+	char name[EMU_PATH_MAX];
+	char buf[64];
+	unsigned int bmap = 0;
+	int bb;
+
+	for (bb = 0; bb < EMU_NUM_BB; bb++) {
+		struct emu_bb *b = &emu->bbs[cmg][bb];
+
+		if (b->owner >= 0)
+			bmap |= (1U << bb);
+
+		snprintf(name, EMU_PATH_MAX, "CMG%d/init_sync_bb%d", cmg, bb);
+		/* BST is not emulated as synchronization is done in the library */
+		snprintf(buf, sizeof(buf), "%04x\n%04x\n", b->owner >= 0 ? b->mask : 0, 0);
+		publish(name, buf);
+	}
+
+	snprintf(name, EMU_PATH_MAX, "CMG%d/used_bb_bmap", cmg);
+	snprintf(buf, sizeof(buf), "%04x\n", bmap);
+	publish(name, buf);
+}
+
+static void publish_bw(int cmg)
+{
+	char name[EMU_PATH_MAX];
+	char buf[EMU_MAX_PE_PER_CMG * 16];
+	int len = 0;
+	int cpu;
+	int i, w;
+
+	for (i = 0; i < emu->pe_per_cmg; i++) {
+		unsigned int bmap = 0;
+
+		cpu = cmg * emu->pe_per_cmg + i;
+		for (w = 0; w < EMU_NUM_BW; w++)
+			if (emu->pes[cpu].bb[w] >= 0)
+				bmap |= (1U << w);
+		len += snprintf(buf + len, sizeof(buf) - len, "%d %04x\n", cpu, bmap);
+	}
+
+	snprintf(name, EMU_PATH_MAX, "CMG%d/used_bw_bmap", cmg);
+	publish(name, buf);
+	emu->bw_dirty[cmg] = false;
+}
+
+/*
+ * As assign/unassign is called very frequently, used_bw_bmap is published
+ * lazily upon bb alloc/free, file release and process start/exit
+ */
+static void publish_dirty_bw(void)
+{
+	int cmg;
+
+	for (cmg = 0; cmg < emu->num_cmg; cmg++)
+		if (emu->bw_dirty[cmg])
+			publish_bw(cmg);
+}
+
+static void publish_all(void)
+{
+	char name[EMU_PATH_MAX];
+	char buf[EMU_MAX_PE_PER_CMG * 16];
+	int len;
+	int cmg;
+	int i;
+
+	snprintf(buf, sizeof(buf), "%d %d %d %d\n",
+			emu->num_cmg, EMU_NUM_BB, EMU_NUM_BW, emu->pe_per_cmg);
+	publish("hwinfo", buf);
+
+	for (cmg = 0; cmg < emu->num_cmg; cmg++) {
+		len = 0;
+		for (i = 0; i < emu->pe_per_cmg; i++)
+			len += snprintf(buf + len, sizeof(buf) - len, "%d %d\n",
+						cmg * emu->pe_per_cmg + i, i);
+		snprintf(name, EMU_PATH_MAX, "CMG%d/core_map", cmg);
+		publish(name, buf);
+
+		publish_bb(cmg);
+		publish_bw(cmg);
+	}
+}
+
+static void emu_lock(void)
+{
+	/* Previous owner died while holding the lock. Keep going */
+	if (pthread_mutex_lock(&emu->lock) == EOWNERDEAD)
+		pthread_mutex_consistent(&emu->lock);
+}
+
+static void emu_unlock(void)
+{
+	pthread_mutex_unlock(&emu->lock);
+}
+
+/* Free bb and windows assigned to it. Called under emu->lock */
+static void free_bb(int cmg, int bb)
+{
+	int cpu;
+	int w;
+
+	for (cpu = cmg * emu->pe_per_cmg; cpu < (cmg + 1) * emu->pe_per_cmg; cpu++)
+		for (w = 0; w < EMU_NUM_BW; w++)
+			if (emu->pes[cpu].bb[w] == bb)
+				emu->pes[cpu].bb[w] = -1;
+
+	emu->bbs[cmg][bb].owner = -1;
+	emu->bbs[cmg][bb].mask = 0;
+}
+
+/* Same as driver's release of file. Called under emu->lock */
+static void release_file(int f)
+{
+	int cmg;
+	int bb;
+
+	for (cmg = 0; cmg < emu->num_cmg; cmg++) {
+		bool freed = false;
+
+		for (bb = 0; bb < EMU_NUM_BB; bb++) {
+			if (emu->bbs[cmg][bb].owner == f) {
+				free_bb(cmg, bb);
+				freed = true;
+			}
+		}
+		if (freed) {
+			publish_bb(cmg);
+			publish_bw(cmg);
+		}
+	}
+	publish_dirty_bw();
+
+	emu->files[f].pid = 0;
+}
+
+/* Release files of processes which have gone. Called under emu->lock */
+static void reap_files(void)
+{
+	int f;
+
+	for (f = 0; f < EMU_MAX_FILES; f++) {
+		if (emu->files[f].pid == 0)
+			continue;
+		if (kill(emu->files[f].pid, 0) < 0 && errno == ESRCH)
+			release_file(f);
+	}
+}
+
+static int parse_topology(int *num_cmg, int *pe_per_cmg)
+{
+	const char *topology = getenv(EMU_TOPOLOGY_ENV_NAME);
+
+	*num_cmg = EMU_DEFAULT_CMG;
+	*pe_per_cmg = EMU_DEFAULT_PE_PER_CMG;
+	if (topology == NULL)
+		return 0;
+
+	if (sscanf(topology, "%dx%d", num_cmg, pe_per_cmg) != 2 ||
+	    *num_cmg < 1 || *num_cmg > EMU_MAX_CMG ||
+	    *pe_per_cmg < 1 || *pe_per_cmg > EMU_MAX_PE_PER_CMG) {
+		emu_error("invalid %s: %s", EMU_TOPOLOGY_ENV_NAME, topology);
+		return -1;
+	}
+
+	return 0;
+}
+
+/* mkdir -p */
+static int make_dir(const char *dir)
+{
+	char path[EMU_PATH_MAX * 2];
+	char *p;
+
+	snprintf(path, sizeof(path), "%s", dir);
+	for (p = path + 1; *p; p++) {
+		if (*p != '/')
+			continue;
+		*p = '\0';
+		if (mkdir(path, 0700) < 0 && errno != EEXIST)
+			return -1;
+		*p = '/';
+	}
+	if (mkdir(path, 0700) < 0 && errno != EEXIST)
+		return -1;
+
+	return 0;
+}
+
+static void init_state(struct emu_state *state, int num_cmg, int pe_per_cmg)
+{
+	pthread_mutexattr_t attr;
+	int cmg, bb;
+
+	memset(state, 0, sizeof(*state));
+	state->num_cmg = num_cmg;
+	state->pe_per_cmg = pe_per_cmg;
+
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(&state->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
+	for (cmg = 0; cmg < EMU_MAX_CMG; cmg++)
+		for (bb = 0; bb < EMU_NUM_BB; bb++)
+			state->bbs[cmg][bb].owner = -1;
+	memset(state->pes, 0xFF, sizeof(state->pes));
+
+	state->version = EMU_VERSION;
+	state->magic = EMU_MAGIC;
+}
+
+static void emu_setup(void)
+{
+	char path[EMU_PATH_MAX * 2];
+	struct emu_state *state;
+	const char *root;
+	struct stat st;
+	int num_cmg, pe_per_cmg;
+	int fd;
+	int i;
+
+	resolve_real_functions();
+
+	if (parse_topology(&num_cmg, &pe_per_cmg))
+		return;
+
+	root = getenv(FHWB_SYSFS_ROOT_ENV_NAME);
+	if (root)
+		snprintf(emu_root, EMU_PATH_MAX, "%s", root);
+	else
+		snprintf(emu_root, EMU_PATH_MAX, "%s.%u", EMU_DEFAULT_ROOT, (unsigned int)getuid());
+	for (i = 0; i < num_cmg; i++) {
+		snprintf(path, sizeof(path), "%s/CMG%d", emu_root, i);
+		if (make_dir(path)) {
+			emu_error("mkdir %s: %m", path);
+			return;
+		}
+	}
+
+	snprintf(path, sizeof(path), "%s/%s", emu_root, EMU_STATE_FILE);
+	fd = real_open(path, O_RDWR | O_CREAT | O_CLOEXEC | O_NOFOLLOW, 0600);
+	if (fd < 0) {
+		emu_error("open %s: %m", path);
+		return;
+	}
+	if (fstat(fd, &st) < 0 || st.st_uid != getuid()) {
+		emu_error("%s is not owned by the user", path);
+		real_close(fd);
+		return;
+	}
+	/* State files created by older versions were readable and writable by all */
+	if ((st.st_mode & 0077) && fchmod(fd, 0600) < 0) {
+		emu_error("chmod %s: %m", path);
+		real_close(fd);
+		return;
+	}
+
+	/* Only one process initializes the state */
+	flock(fd, LOCK_EX);
+	if (ftruncate(fd, sizeof(struct emu_state)) < 0) {
+		emu_error("ftruncate %s: %m", path);
+		goto out;
+	}
+	state = mmap(NULL, sizeof(struct emu_state), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (state == MAP_FAILED) {
+		emu_error("mmap %s: %m", path);
+		goto out;
+	}
+
+	emu = state;
+	if (state->magic != EMU_MAGIC || state->version != EMU_VERSION ||
+	    state->num_cmg != num_cmg || state->pe_per_cmg != pe_per_cmg) {
+		init_state(state, num_cmg, pe_per_cmg);
+		publish_all();
+	}
+	emu_num_pe = num_cmg * pe_per_cmg;
+
+out:
+	flock(fd, LOCK_UN);
+	real_close(fd);
+
+	if (emu) {
+		emu_lock();
+		reap_files();
+		publish_dirty_bw();
+		emu_unlock();
+	}
+}
+
+/*
+ * Setup upon load. As other libraries' constructor may use the device
+ * before this, intercepted functions also call emu_ready()
+ */
+__attribute__((constructor))
+static void emu_load(void)
+{
+	pthread_once(&emu_once, emu_setup);
+}
+
+static inline bool emu_ready(void)
+{
+	pthread_once(&emu_once, emu_setup);
+
+	return emu != NULL;
+}
+
+/* Kernel releases files upon process exit */
+__attribute__((destructor))
+static void emu_unload(void)
+{
+	pid_t pid = getpid();
+	int f;
+
+	if (emu == NULL)
+		return;
+
+	emu_lock();
+	for (f = 0; f < EMU_MAX_FILES; f++)
+		if (emu->files[f].pid == pid)
+			release_file(f);
+	publish_dirty_bw();
+	emu_unlock();
+}
+
+/* Virtual affinity of calling thread */
+static void get_affinity(cpu_set_t *set)
+{
+	int i;
+
+	if (emu_affinity_set) {
+		*set = emu_affinity;
+		return;
+	}
+
+	CPU_ZERO(set);
+	for (i = 0; i < emu_num_pe; i++)
+		CPU_SET(i, set);
+}
+
+/* Return virtual cpu if calling thread is bound to one PE, otherwise -1 */
+static int get_bound_cpu(void)
+{
+	int i;
+
+	if (!emu_affinity_set || CPU_COUNT(&emu_affinity) != 1)
+		return -1;
+
+	for (i = 0; i < emu_num_pe; i++)
+		if (CPU_ISSET(i, &emu_affinity))
+			return i;
+
+	return -1;
+}
+
+static inline bool is_self(pid_t pid)
+{
+	return pid == 0 || pid == syscall(SYS_gettid);
+}
+
+int sched_setaffinity(pid_t pid, size_t cpusetsize, const cpu_set_t *mask)
+{
+	cpu_set_t set;
+	int i;
+
+	if (!emu_ready() || !is_self(pid))
+		return real_sched_setaffinity(pid, cpusetsize, mask);
+
+	CPU_ZERO(&set);
+	for (i = 0; i < emu_num_pe && i < (int)(cpusetsize * 8); i++)
+		if (CPU_ISSET_S(i, cpusetsize, mask))
+			CPU_SET(i, &set);
+
+	/* The same as kernel, fail if there is no valid PE */
+	if (CPU_COUNT(&set) == 0) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	emu_affinity = set;
+	emu_affinity_set = true;
+
+	return 0;
+}
+
+int sched_getaffinity(pid_t pid, size_t cpusetsize, cpu_set_t *mask)
+{
+	cpu_set_t set;
+	int i;
+
+	if (!emu_ready() || !is_self(pid))
+		return real_sched_getaffinity(pid, cpusetsize, mask);
+
+	get_affinity(&set);
+	CPU_ZERO_S(cpusetsize, mask);
+	for (i = 0; i < emu_num_pe && i < (int)(cpusetsize * 8); i++)
+		if (CPU_ISSET(i, &set))
+			CPU_SET_S(i, cpusetsize, mask);
+
+	return 0;
+}
+
+int sched_getcpu(void)
+{
+	cpu_set_t set;
+	int i;
+
+	if (!emu_ready()) {
+		unsigned int cpu;
+
+		if (syscall(SYS_getcpu, &cpu, NULL, NULL) < 0)
+			return -1;
+		return cpu;
+	}
+
+	/* Thread is considered to be running on the first PE of its affinity */
+	get_affinity(&set);
+	for (i = 0; i < emu_num_pe; i++)
+		if (CPU_ISSET(i, &set))
+			return i;
+
+	return 0;
+}
+
+int get_nprocs_conf(void)
+{
+	if (!emu_ready())
+		return sysconf(_SC_NPROCESSORS_CONF);
+
+	return emu_num_pe;
+}
+
+static int ioc_bb_alloc(int f, struct fujitsu_hwb_ioc_bb_ctl *ctl)
+{
+	uint32_t mask = 0;
+	int nr_pe = 0;
+	int cmg = -1;
+	int retry;
+	int bb;
+	int i;
+
+	if (ctl->pemask == NULL)
+		return -EFAULT;
+
+	for (i = 0; i < (int)(ctl->size * 8); i++) {
+		if (!CPU_ISSET_S(i, ctl->size, (cpu_set_t *)ctl->pemask))
+			continue;
+
+		if (i >= emu_num_pe)
+			return -EINVAL;
+		if (cmg < 0)
+			cmg = i / emu->pe_per_cmg;
+		else if (cmg != i / emu->pe_per_cmg)
+			return -EINVAL;
+
+		mask |= (1U << (i % emu->pe_per_cmg));
+		nr_pe++;
+	}
+	if (nr_pe < 2)
+		return -EINVAL;
+
+	emu_lock();
+	for (retry = 0; retry < 2; retry++) {
+		for (bb = 0; bb < EMU_NUM_BB; bb++)
+			if (emu->bbs[cmg][bb].owner < 0)
+				break;
+		if (bb < EMU_NUM_BB)
+			break;
+
+		/* Resources may be held by a process which has gone */
+		reap_files();
+	}
+	if (bb == EMU_NUM_BB) {
+		emu_unlock();
+		return -EBUSY;
+	}
+
+	emu->bbs[cmg][bb].owner = f;
+	emu->bbs[cmg][bb].mask = mask;
+	publish_bb(cmg);
+	publish_dirty_bw();
+	emu_unlock();
+
+	ctl->cmg = cmg;
+	ctl->bb = bb;
+
+	return 0;
+}
+
+static int ioc_bb_free(int f, struct fujitsu_hwb_ioc_bb_ctl *ctl)
+{
+	if (ctl->cmg >= emu->num_cmg || ctl->bb >= EMU_NUM_BB)
+		return -EINVAL;
+
+	emu_lock();
+	if (emu->bbs[ctl->cmg][ctl->bb].owner != f) {
+		emu_unlock();
+		return -EINVAL;
+	}
+
+	free_bb(ctl->cmg, ctl->bb);
+	publish_bb(ctl->cmg);
+	publish_bw(ctl->cmg);
+	publish_dirty_bw();
+	emu_unlock();
+
+	return 0;
+}
+
+/*
+ * Change PEs of allocated bb. PEs leaving the bb must have unassigned their
+ * windows and the bb must stay in its CMG
+ */
+static int ioc_bb_remask(int f, struct fujitsu_hwb_ioc_bb_ctl *ctl)
+{
+	uint32_t mask = 0;
+	int nr_pe = 0;
+	int cpu;
+	int w;
+	int i;
+
+	if (ctl->pemask == NULL)
+		return -EFAULT;
+	if (ctl->cmg >= emu->num_cmg || ctl->bb >= EMU_NUM_BB)
+		return -EINVAL;
+
+	for (i = 0; i < (int)(ctl->size * 8); i++) {
+		if (!CPU_ISSET_S(i, ctl->size, (cpu_set_t *)ctl->pemask))
+			continue;
+
+		if (i >= emu_num_pe || i / emu->pe_per_cmg != ctl->cmg)
+			return -EINVAL;
+
+		mask |= (1U << (i % emu->pe_per_cmg));
+		nr_pe++;
+	}
+	if (nr_pe < 2)
+		return -EINVAL;
+
+	emu_lock();
+	if (emu->bbs[ctl->cmg][ctl->bb].owner != f) {
+		emu_unlock();
+		return -EINVAL;
+	}
+
+	for (i = 0; i < emu->pe_per_cmg; i++) {
+		if (mask & (1U << i))
+			continue;
+		cpu = ctl->cmg * emu->pe_per_cmg + i;
+		for (w = 0; w < EMU_NUM_BW; w++) {
+			if (emu->pes[cpu].bb[w] == ctl->bb) {
+				emu_unlock();
+				return -EBUSY;
+			}
+		}
+	}
+
+	emu->bbs[ctl->cmg][ctl->bb].mask = mask;
+	publish_bb(ctl->cmg);
+	publish_dirty_bw();
+	emu_unlock();
+
+	return 0;
+}
+
+static int ioc_bw_assign(int f, struct fujitsu_hwb_ioc_bw_ctl *ctl)
+{
+	struct emu_pe *pe;
+	int window = ctl->window;
+	int cpu, cmg, ppe;
+	int w;
+
+	cpu = get_bound_cpu();
+	if (cpu < 0)
+		return -EPERM;
+	cmg = cpu / emu->pe_per_cmg;
+	ppe = cpu % emu->pe_per_cmg;
+
+	if (ctl->bb >= EMU_NUM_BB || window < -1 || window >= EMU_NUM_BW)
+		return -EINVAL;
+
+	emu_lock();
+	if (emu->bbs[cmg][ctl->bb].owner != f || !(emu->bbs[cmg][ctl->bb].mask & (1U << ppe))) {
+		emu_unlock();
+		return -EINVAL;
+	}
+
+	pe = &emu->pes[cpu];
+	for (w = 0; w < EMU_NUM_BW; w++) {
+		if (pe->bb[w] == ctl->bb) {
+			emu_unlock();
+			return -EINVAL;
+		}
+	}
+
+	if (window == -1) {
+		for (w = 0; w < EMU_NUM_BW; w++)
+			if (pe->bb[w] < 0)
+				break;
+		window = w;
+	}
+	if (window == EMU_NUM_BW || pe->bb[window] >= 0) {
+		emu_unlock();
+		return -EBUSY;
+	}
+
+	pe->bb[window] = ctl->bb;
+	emu->bw_dirty[cmg] = true;
+	emu_unlock();
+
+	ctl->window = window;
+
+	return 0;
+}
+
+static int ioc_bw_unassign(int f, struct fujitsu_hwb_ioc_bw_ctl *ctl)
+{
+	struct emu_pe *pe;
+	int cpu, cmg;
+	int w;
+
+	cpu = get_bound_cpu();
+	if (cpu < 0)
+		return -EPERM;
+	cmg = cpu / emu->pe_per_cmg;
+
+	if (ctl->bb >= EMU_NUM_BB)
+		return -EINVAL;
+
+	emu_lock();
+	if (emu->bbs[cmg][ctl->bb].owner != f) {
+		emu_unlock();
+		return -EINVAL;
+	}
+
+	pe = &emu->pes[cpu];
+	for (w = 0; w < EMU_NUM_BW; w++)
+		if (pe->bb[w] == ctl->bb)
+			break;
+	if (w == EMU_NUM_BW) {
+		emu_unlock();
+		return -EINVAL;
+	}
+
+	pe->bb[w] = -1;
+	emu->bw_dirty[cmg] = true;
+	emu_unlock();
+
+	return 0;
+}
+
+static int ioc_get_pe_info(struct fujitsu_hwb_ioc_pe_info *info)
+{
+	int cpu = sched_getcpu();
+
+	info->cmg = cpu / emu->pe_per_cmg;
+	info->ppe = cpu % emu->pe_per_cmg;
+
+	return 0;
+}
+
+static int emu_ioctl(int f, unsigned long request, void *arg)
+{
+	if (arg == NULL)
+		return -EFAULT;
+
+	switch (request) {
+	case FUJITSU_HWB_IOC_BB_ALLOC:
+		return ioc_bb_alloc(f, arg);
+	case FUJITSU_HWB_IOC_BB_FREE:
+		return ioc_bb_free(f, arg);
+	case FUJITSU_HWB_EMU_IOC_BB_REMASK:
+		return ioc_bb_remask(f, arg);
+	case FUJITSU_HWB_IOC_BW_ASSIGN:
+		return ioc_bw_assign(f, arg);
+	case FUJITSU_HWB_IOC_BW_UNASSIGN:
+		return ioc_bw_unassign(f, arg);
+	case FUJITSU_HWB_IOC_GET_PE_INFO:
+		return ioc_get_pe_info(arg);
+	default:
+		return -ENOTTY;
+	}
+}
+
+static int open_device(int flags)
+{
+	int fd;
+	int f;
+
+	if (!emu_ready()) {
+		errno = ENODEV;
+		return -1;
+	}
+
+	/* Use real file so that fd number is not used by others */
+	fd = real_open("/dev/null", flags);
+	if (fd < 0)
+		return fd;
+	if (fd >= EMU_MAX_FD) {
+		real_close(fd);
+		errno = EMFILE;
+		return -1;
+	}
+
+	emu_lock();
+	reap_files();
+	for (f = 0; f < EMU_MAX_FILES; f++)
+		if (emu->files[f].pid == 0)
+			break;
+	if (f == EMU_MAX_FILES) {
+		emu_unlock();
+		real_close(fd);
+		errno = ENFILE;
+		return -1;
+	}
+	emu->files[f].pid = getpid();
+	emu_unlock();
+
+	pthread_mutex_lock(&emu_fd_mutex);
+	emu_fds[fd] = f + 1;
+	pthread_mutex_unlock(&emu_fd_mutex);
+
+	return fd;
+}
+
+static int device_file(int fd)
+{
+	if (fd < 0 || fd >= EMU_MAX_FD)
+		return -1;
+
+	return emu_fds[fd] - 1;
+}
+
+int open(const char *pathname, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	resolve_real_functions();
+	if (strcmp(pathname, FHWB_DEV_FILE) == 0)
+		return open_device(flags);
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return real_open(pathname, flags, mode);
+}
+
+int open64(const char *pathname, int flags, ...)
+{
+	mode_t mode = 0;
+	va_list ap;
+
+	if (flags & (O_CREAT | O_TMPFILE)) {
+		va_start(ap, flags);
+		mode = va_arg(ap, mode_t);
+		va_end(ap);
+	}
+
+	return open(pathname, flags | O_LARGEFILE, mode);
+}
+
+int close(int fd)
+{
+	int f;
+
+	resolve_real_functions();
+	f = device_file(fd);
+	if (f >= 0) {
+		pthread_mutex_lock(&emu_fd_mutex);
+		emu_fds[fd] = 0;
+		pthread_mutex_unlock(&emu_fd_mutex);
+
+		emu_lock();
+		release_file(f);
+		emu_unlock();
+	}
+
+	return real_close(fd);
+}
+
+int ioctl(int fd, unsigned long request, ...)
+{
+	void *arg;
+	va_list ap;
+	int ret;
+	int f;
+
+	va_start(ap, request);
+	arg = va_arg(ap, void *);
+	va_end(ap);
+
+	resolve_real_functions();
+	f = device_file(fd);
+	if (f < 0)
+		return real_ioctl(fd, request, arg);
+
+	ret = emu_ioctl(f, request, arg);
+	if (ret < 0) {
+		errno = -ret;
+		return -1;
+	}
+
+	return ret;
+}
@@ -4,7 +4,9 @@
 #ifndef _FUJITSU_HWBLIB_H
 #define _FUJITSU_HWBLIB_H
 
+#ifndef _GNU_SOURCE
 #define _GNU_SOURCE
+#endif
 
 #include <stdint.h>
 #include <sched.h>
@@ -17,9 +19,40 @@ extern "C" {
 #define FUJITSU_HWBLIB_VERSION_MINOR 0
 #define FUJITSU_HWBLIB_VERSION_PATCH 0
 
-/* When this environment variable is set, debug message will be shown */
+/* When this environment variable is set at program start, debug message will be shown */
 #define FHWB_DEBUG_ENV_NAME "FUJITSU_HWBLIB_DEBUG"
 
+/*
+ * When this environment variable is set at program start, init/fini/assign/unassign
+ * and begin/end of fhwb_sync() are recorded in a ring buffer of each thread and
+ * written to "<value>.<pid>" in binary at exit (use fhwb_trace_decode to read it).
+ * FHWB_TRACE_SIZE_ENV_NAME changes the number of events kept per thread (default 16384).
+ * If FHWB_TRACE_SIGNAL_ENV_NAME is set to a signal number, the file is also written
+ * when the process receives the signal.
+ * FHWB_TRACE_FORMAT_ENV_NAME=chrome writes "<value>.<pid>.json" in Chrome trace event
+ * format (chrome://tracing, Perfetto UI) at exit instead, where each CMG is a process
+ * and each PE is a thread (the signal still writes binary).
+ * FHWB_TRACE_SAMPLE_ENV_NAME=N records only one in N fhwb_sync() of each window.
+ */
+#define FHWB_TRACE_ENV_NAME        "FUJITSU_HWBLIB_TRACE"
+#define FHWB_TRACE_SIZE_ENV_NAME   "FUJITSU_HWBLIB_TRACE_SIZE"
+#define FHWB_TRACE_SIGNAL_ENV_NAME "FUJITSU_HWBLIB_TRACE_SIGNAL"
+#define FHWB_TRACE_FORMAT_ENV_NAME "FUJITSU_HWBLIB_TRACE_FORMAT"
+#define FHWB_TRACE_SAMPLE_ENV_NAME "FUJITSU_HWBLIB_TRACE_SAMPLE"
+
+/*
+ * This environment variable selects barrier backend at library load time.
+ *   hwb  ... fujitsu_hwb driver and hardware barrier registers (A64FX only)
+ *   sw   ... barrier resources and synchronization emulated in the library
+ *   emu  ... fujitsu_hwb driver interface (e.g. libFJhwb-emu.so) and software synchronization
+ *   auto ... (default) hwb if the driver is available on A64FX, emu if the driver
+ *            is available on other CPUs, otherwise sw
+ */
+#define FHWB_BACKEND_ENV_NAME "FUJITSU_HWBLIB_BACKEND"
+
+/* This environment variable sets the initial size of blade pool (see fhwb_pool_set_size()) */
+#define FHWB_POOL_ENV_NAME "FUJITSU_HWBLIB_POOL"
+
 #define FHWB_WINDOW_0 0
 #define FHWB_WINDOW_1 1
 #define FHWB_WINDOW_2 2
@@ -50,6 +83,68 @@ struct fhwb_pe_info {
  */
 int fhwb_init(size_t pemask_size, cpu_set_t *pemask);
 
+/**
+ * Allocate barrier blade like fhwb_init(), but wait up to @timeout_ns nanoseconds
+ * while all barrier blades of the CMG are used.
+ *
+ * Waiters of the same CMG, including other processes, are served in FIFO order
+ * and woken up when a bb of the CMG is freed by fhwb_fini() of any process
+ * (waiters also retry every 10ms for bb freed otherwise, e.g. by exit). Only
+ * the final timeout is reported as error. Waiters which have died or timed out
+ * are skipped. The wait queue is kept in shared memory under /dev/shm, which
+ * is private to the user (per process with sw backend). A waiter does not
+ * overtake queued waiters, while fhwb_init() of other callers does not wait in
+ * the queue.
+ *
+ * @param[in] pemask_size size of @pemask in bytes
+ * @param[in] pemask cpumask of PEs joining synchronization
+ * @param[in] timeout_ns maximum time to wait in nanoseconds (0: the same as fhwb_init())
+ *
+ * @return 0>= barrier descriptor (bd)
+ *         <0 error
+ *            -ETIMEDOUT ... no bb became available in @timeout_ns
+ *            -EBUSY     ... too many processes are waiting for the CMG and no bb is free
+ *            others     ... the same as fhwb_init()
+ */
+int fhwb_init_wait(size_t pemask_size, cpu_set_t *pemask, uint64_t timeout_ns);
+
+/**
+ * Allocate one barrier blade for each CMG of @pemask, like calling fhwb_init()
+ * with PEs of each CMG. Unlike fhwb_init(), PEs in @pemask can belong to different
+ * CMGs. If allocation fails on a CMG, blades already allocated are freed.
+ *
+ * Library allocates the table of bd indexed by cpuid (-1 for cpus not in @pemask),
+ * so each PE can call fhwb_assign() with (*bds)[cpu]. Free all blades and the table
+ * by fhwb_fini_multi().
+ *
+ * @param[in] pemask_size size of @pemask in bytes
+ * @param[in] pemask cpumask of PEs joining synchronization
+ * @param[out] bds table of bd of each cpu
+ * @param[out] num_bd entry size of @bds
+ *
+ * @return 0 success
+ *        <0 error
+ *           -ENOMEM ... failed to allocate memory
+ *           -EINVAL ... @pemask contains less than 2 PEs or unavailable PEs
+ *           -EINVAL ... @pemask contains only one PE of some CMG
+ *           (and errors of fhwb_init())
+ */
+int fhwb_init_multi(size_t pemask_size, cpu_set_t *pemask, int **bds, int *num_bd);
+
+/**
+ * Free barrier blades and the table allocated by fhwb_init_multi(), like calling
+ * fhwb_fini() for each blade.
+ *
+ * @param[in] bds table of bd returned by fhwb_init_multi()
+ * @param[in] num_bd entry size of @bds
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @bds is NULL
+ *           (and errors of fhwb_fini(). Other blades and @bds are freed anyway)
+ */
+int fhwb_fini_multi(int *bds, int num_bd);
+
 /**
  * Free allocated barrier blade.
  *
@@ -103,6 +198,120 @@ int fhwb_assign(int bd, int window);
  */
 int fhwb_unassign(int bd);
 
+/**
+ * Bind the caller thread to @cpu and assign barrier window on it, for threads
+ * which are not pinned by the application (e.g. threads of a runtime).
+ *
+ * The affinity of the caller before the first fhwb_assign_on() is saved and restored
+ * when its last window is freed by fhwb_unassign_on(), fhwb_unassign() or fhwb_fini()
+ * of the caller. All windows assigned by fhwb_assign_on() on a thread must be on the
+ * same @cpu.
+ *
+ * If FHWB_DEBUG_ENV_NAME is set, the cpu of each window is recorded upon assign and
+ * fhwb_sync() reports when the caller has moved to other cpu (inline fhwb_sync_w0()..
+ * fhwb_sync_w3() and split-phase functions are not checked).
+ *
+ * @param[in] bd barrier descriptor returned by fhwb_init()
+ * @param[in] cpu cpu number of the PE joining synchronization
+ * @param[in] window barrier window number to be used (-1 for automatic choice)
+ *
+ * @return 0>= window number to be used
+ *         <0 error
+ *            -EINVAL ... @cpu is invalid or differs from cpu of other windows of the caller
+ *            -EPERM  ... the caller cannot run on @cpu
+ *            (and errors of sched_setaffinity(2) and fhwb_assign())
+ */
+int fhwb_assign_on(int bd, int cpu, int window);
+
+/**
+ * Free barrier window assigned by fhwb_assign_on() and restore the affinity of
+ * the caller thread when it has no more windows assigned by fhwb_assign_on().
+ *
+ * @param[in] bd barrier descriptor given to fhwb_assign_on()
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... the caller has no window of @bd assigned by fhwb_assign_on()
+ *           (and errors of fhwb_unassign())
+ */
+int fhwb_unassign_on(int bd);
+
+/**
+ * Change PEs joining synchronization of allocated barrier blade, so that a team
+ * can shrink or grow without fhwb_fini()/fhwb_init() and assigning windows on all PEs.
+ *
+ * PEs of @bd must hand over the bb as follows:
+ *   1. all current PEs complete the last synchronization with the current PEs
+ *   2. leaving PEs call fhwb_unassign()
+ *   3. one thread calls fhwb_remask() while no PE is synchronizing on @bd
+ *   4. joining PEs call fhwb_assign() and all PEs synchronize with the new PEs
+ * PEs staying in the team keep their windows. fhwb_allreduce() follows the new PEs,
+ * while statistics and profiles of @bd keep the PEs given to fhwb_init().
+ *
+ * The driver cannot change PEs of bb, so this is only supported by sw backend and
+ * the emulator. With hwb backend, call fhwb_fini() and fhwb_init() instead.
+ *
+ * @param[in] bd barrier descriptor returned by fhwb_init()
+ * @param[in] pemask_size size of @pemask in bytes
+ * @param[in] pemask cpumask of PEs joining synchronization (in the CMG of @bd)
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EBUSY      ... a leaving PE is still assigned to a window
+ *           -EINVAL     ... @bd is invalid
+ *           -EINVAL     ... @pemask contains PEs of other CMG or less than 2 PEs
+ *           -EOPNOTSUPP ... the backend cannot change PEs of bb (hwb backend)
+ *           -ENOMEM     ... failed to allocate memory
+ */
+int fhwb_remask(int bd, size_t pemask_size, cpu_set_t *pemask);
+
+/*
+ * Context of barrier resources
+ *
+ * The driver binds barrier blades to the device file used to allocate them.
+ * fhwb_init()/fhwb_fini()/fhwb_assign()/fhwb_unassign()/fhwb_remask() use the default context
+ * of the process, which opens the device file at the first fhwb_init() and closes
+ * it when the last bb is freed. Libraries which manage barrier resources independently
+ * can use their own context so that the lifetime of the device file is not shared.
+ * The fhwb_ctx_*() functions are the same as the functions without ctx_ except that
+ * a bb must be freed and assigned through the context which allocated it
+ * (NULL means the default context). fhwb_sync() and other functions taking
+ * a window number do not depend on the context.
+ */
+typedef struct fhwb_ctx fhwb_ctx_t;
+
+/**
+ * Create a context. The device file is opened when it is used first.
+ *
+ * @param[out] ctx will be set to the created context
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @ctx is NULL
+ *           -ENOMEM ... failed to allocate memory
+ */
+int fhwb_ctx_open(fhwb_ctx_t **ctx);
+
+/**
+ * Release a context created by fhwb_ctx_open(). Barrier blades still allocated
+ * through @ctx keep the device file opened until they are freed by fhwb_ctx_fini().
+ * Other functions must not be called with @ctx afterwards except fhwb_ctx_fini()
+ * and fhwb_ctx_unassign() of those blades.
+ *
+ * @param[in] ctx context created by fhwb_ctx_open()
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @ctx is NULL
+ */
+int fhwb_ctx_close(fhwb_ctx_t *ctx);
+
+int fhwb_ctx_init(fhwb_ctx_t *ctx, size_t pemask_size, cpu_set_t *pemask);
+int fhwb_ctx_fini(fhwb_ctx_t *ctx, int bd);
+int fhwb_ctx_assign(fhwb_ctx_t *ctx, int bd, int window);
+int fhwb_ctx_unassign(fhwb_ctx_t *ctx, int bd);
+int fhwb_ctx_remask(fhwb_ctx_t *ctx, int bd, size_t pemask_size, cpu_set_t *pemask);
+
 /**
  * Perform synchronization using hardware barrier. This will block until
  * synchronization completes. This function can be called repeatedly.
@@ -116,6 +325,74 @@ int fhwb_unassign(int bd);
  */
 void fhwb_sync(int window);
 
+/**
+ * Perform synchronization like fhwb_sync(), but give up waiting after @timeout_ns
+ * nanoseconds so that the caller can detect PEs which do not arrive.
+ *
+ * When this returns -ETIMEDOUT, the PE has already arrived at the barrier.
+ * Calling fhwb_sync_timeout() or fhwb_sync() again on the same window continues
+ * waiting for the same synchronization instead of arriving at the next one
+ * (fhwb_arrive() returns its token). Inlined fhwb_sync_w0..w3() must not be used
+ * to complete the synchronization since they always arrive at the next one.
+ * With hardware barrier, the timeout is checked each time the PE wakes up from WFE.
+ *
+ * The caller thread must be bound to one PE.
+ *
+ * @param[in] window barrier window number to be synced
+ * @param[in] timeout_ns maximum time to wait in nanoseconds
+ *
+ * @return 0 success
+ *        <0 error
+ *           -ETIMEDOUT ... synchronization did not complete in @timeout_ns
+ *           -EINVAL    ... @window is invalid
+ */
+int fhwb_sync_timeout(int window, uint64_t timeout_ns);
+
+/**
+ * Arrive at synchronization without waiting for other PEs (first half of fhwb_sync()).
+ * This writes BST_SYNC register and returns a token which is passed to
+ * fhwb_test()/fhwb_wait() to check completion of the synchronization.
+ * The caller can perform work independent of other PEs between these calls.
+ *
+ * fhwb_arrive() must not be called again on the window before the synchronization
+ * completes. If fhwb_sync_timeout() has timed out on the window, this returns
+ * the token of that synchronization instead of arriving at the next one.
+ *
+ * The caller thread must be bound to one PE.
+ *
+ * @param[in] window barrier window number to be synced
+ *
+ * @return 0/1 token of the synchronization (the LBSY_SYNC value when it completes)
+ *         <0 error
+ *            -EINVAL ... @window is invalid
+ */
+int fhwb_arrive(int window);
+
+/**
+ * Check synchronization started by fhwb_arrive() has completed. This does not block.
+ *
+ * @param[in] window barrier window number passed to fhwb_arrive()
+ * @param[in] token token returned by fhwb_arrive()
+ *
+ * @return 1 synchronization has completed
+ *         0 some PEs have not arrived yet
+ *        <0 error
+ *           -EINVAL ... @window or @token is invalid
+ */
+int fhwb_test(int window, int token);
+
+/**
+ * Wait for synchronization started by fhwb_arrive() to complete (second half of fhwb_sync()).
+ *
+ * @param[in] window barrier window number passed to fhwb_arrive()
+ * @param[in] token token returned by fhwb_arrive()
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @window or @token is invalid
+ */
+int fhwb_wait(int window, int token);
+
 /**
  * Get CMG/Physical PE number of PE on which this function is called.
  * The caller thread should be bound to one PE.
@@ -133,9 +410,11 @@ int fhwb_get_pe_info(struct fhwb_pe_info *info);
  * Get list of CMG/Physical PE number of current running system.
  *
  * Index of @list corresponds to the cpuid of each PE.
- * This is implemented by calling fhwb_get_pe_info() on each available
- * PEs of caller's process. If PE is offline or restricted by cgroup,
- * its CMG/Physical PE number is set to FHWB_INVALID_{CMG,PPE}.
+ * The topology is read from sysfs of the driver (CMG<n>/core_map) once per process
+ * and cached. If the driver does not provide it, it is obtained by calling
+ * fhwb_get_pe_info() on each available PE of caller's process instead.
+ * If PE is not listed by the driver (or offline or restricted by cgroup in the
+ * latter case), its CMG/Physical PE number is set to FHWB_INVALID_{CMG,PPE}.
  *
  * Library allocates memory for @list and the caller must free it.
  *
@@ -150,6 +429,34 @@ int fhwb_get_pe_info(struct fhwb_pe_info *info);
  */
 int fhwb_get_all_pe_info(struct fhwb_pe_info **list, int *entry_num);
 
+/**
+ * Get CMG/Physical PE number of @cpu from the topology cached by the library
+ * (see fhwb_get_all_pe_info()). Unlike fhwb_get_pe_info(), the caller need not run on @cpu.
+ *
+ * @param[in] cpu cpuid
+ * @param[out] info CMG/Physical PE number of @cpu
+ *
+ * @return 0 success
+ *        <0 error
+ *           -ENOMEM ... failed to allocate memory
+ *           -EINVAL ... @info is NULL or @cpu is not available
+ */
+int fhwb_get_cpu_pe_info(int cpu, struct fhwb_pe_info *info);
+
+/**
+ * Get cpumask of all PEs of @cmg from the topology cached by the library.
+ *
+ * @param[in] cmg CMG number
+ * @param[in] mask_size size of @mask in bytes
+ * @param[out] mask cpumask of PEs of @cmg
+ *
+ * @return 0 success
+ *        <0 error
+ *           -ENOMEM ... failed to allocate memory
+ *           -EINVAL ... @mask is NULL or @cmg does not exist
+ */
+int fhwb_get_cmg_cpumask(int cmg, size_t mask_size, cpu_set_t *mask);
+
 /*
  * Get CMG number from bd.
  * This is only for debugging purpose to check which CMG is used by current
@@ -172,8 +479,523 @@ int fhwb_get_cmg_from_bd(int bd);
  */
 int fhwb_get_bb_from_bd(int bd);
 
+/*
+ * Get name of the barrier backend used by the library ("hwb", "sw", ...).
+ *
+ * @return name of the backend selected at library load time
+ */
+const char *fhwb_get_backend_name(void);
+
+/*
+ * Node-wide barrier among threads of a process running on PEs of several CMGs.
+ *
+ * PEs of each CMG synchronize by hardware barrier, and then the first PE of
+ * each CMG in the mask (leader) synchronizes with other leaders by shared memory.
+ * Another hardware barrier synchronization releases PEs of the CMG.
+ */
+struct fhwb_node_barrier;
+
+/**
+ * Allocate one barrier blade for each CMG of @pemask and create node-wide barrier.
+ * Unlike fhwb_init(), PEs in @pemask can belong to different CMGs.
+ *
+ * @param[in] pemask_size size of @pemask in bytes
+ * @param[in] pemask cpumask of PEs joining synchronization
+ * @param[out] barrier created barrier
+ *
+ * @return 0 success
+ *        <0 error
+ *           -ENOMEM ... failed to allocate memory
+ *           -EBUSY  ... all barrier blade in some CMG is currently used
+ *           -EINVAL ... @pemask contains less than 2 PEs or unavailable PEs
+ *           (and errors of fhwb_init())
+ */
+int fhwb_node_barrier_init(size_t pemask_size, cpu_set_t *pemask, struct fhwb_node_barrier **barrier);
+
+/**
+ * Free barrier blades of @barrier and @barrier itself.
+ * All PEs must have called fhwb_node_barrier_unassign() before.
+ *
+ * @param[in] barrier barrier created by fhwb_node_barrier_init()
+ *
+ * @return 0 success
+ *        <0 error (first error of fhwb_fini())
+ */
+int fhwb_node_barrier_fini(struct fhwb_node_barrier *barrier);
+
+/**
+ * Allocate barrier window of calling PE for @barrier (see fhwb_assign()).
+ * The caller thread must be bound to one PE of the mask.
+ *
+ * @param[in] barrier barrier created by fhwb_node_barrier_init()
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EPERM  ... caller is not bound to one PE
+ *           -EINVAL ... the PE is not supposed to join synchronization
+ *           (and errors of fhwb_assign())
+ */
+int fhwb_node_barrier_assign(struct fhwb_node_barrier *barrier);
+
+/**
+ * Free barrier window of calling PE allocated by fhwb_node_barrier_assign().
+ *
+ * @param[in] barrier barrier created by fhwb_node_barrier_init()
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EPERM  ... caller is not bound to one PE
+ *           -EINVAL ... the PE is not assigned
+ *           (and errors of fhwb_unassign())
+ */
+int fhwb_node_barrier_unassign(struct fhwb_node_barrier *barrier);
+
+/**
+ * Block until all PEs of @barrier have called this function.
+ * This can only be used after fhwb_node_barrier_assign() on the PE.
+ *
+ * @param[in] barrier barrier created by fhwb_node_barrier_init()
+ */
+void fhwb_node_barrier_sync(struct fhwb_node_barrier *barrier);
+
+/*
+ * Team of threads pinned to PEs of one CMG running fork-join regions.
+ *
+ * Worker threads are created once with barrier windows assigned and wait in
+ * barrier synchronization between regions. Each region is started and
+ * finished by one hardware barrier synchronization.
+ */
+struct fhwb_team;
+
+/* Function of a region. @rank is the position of running PE in the team's pemask */
+typedef void (*fhwb_team_fn)(void *arg, int rank);
+
+/**
+ * Allocate barrier blade for @pemask and create a worker thread bound to each PE
+ * of @pemask other than calling PE. The caller thread must be bound to one PE of
+ * @pemask and becomes the master of the team.
+ *
+ * @param[in] pemask_size size of @pemask in bytes
+ * @param[in] pemask cpumask of PEs of the team
+ * @param[out] team created team
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EPERM  ... caller is not bound to one PE
+ *           -EINVAL ... argument is invalid or calling PE is not in @pemask
+ *           -ENOMEM ... failed to allocate memory
+ *           (and errors of fhwb_init()/fhwb_assign()/pthread_create())
+ */
+int fhwb_team_create(size_t pemask_size, cpu_set_t *pemask, struct fhwb_team **team);
+
+/**
+ * Call @fn on all PEs of @team and wait for their completion.
+ * Only the master thread of @team can call this.
+ *
+ * @param[in] team team created by fhwb_team_create()
+ * @param[in] fn function called with @arg and rank of each PE
+ * @param[in] arg argument of @fn
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @team or @fn is NULL
+ *           -EPERM  ... caller is not the master of @team
+ */
+int fhwb_team_run(struct fhwb_team *team, fhwb_team_fn fn, void *arg);
+
+/**
+ * Block until all PEs of @team have called this function in the current region.
+ * This can only be called by function of fhwb_team_run() with its rank.
+ *
+ * @param[in] team team created by fhwb_team_create()
+ * @param[in] rank rank passed to the function
+ */
+void fhwb_team_barrier(struct fhwb_team *team, int rank);
+
+/**
+ * Get number of PEs of @team.
+ *
+ * @param[in] team team created by fhwb_team_create()
+ *
+ * @return 0> number of PEs
+ *        <0 error
+ *           -EINVAL ... @team is NULL
+ */
+int fhwb_team_size(struct fhwb_team *team);
+
+/**
+ * Terminate worker threads of @team and free its barrier blade and @team itself.
+ * Only the master thread of @team can call this.
+ *
+ * @param[in] team team created by fhwb_team_create()
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @team is NULL
+ *           -EPERM  ... caller is not the master of @team
+ *           (and errors of fhwb_unassign()/fhwb_fini())
+ */
+int fhwb_team_destroy(struct fhwb_team *team);
+
+/*
+ * Logical barrier which is not bound to a barrier window.
+ *
+ * Any number of logical barriers can be used by a PE. A window is assigned to
+ * the barrier's blade when the PE synchronizes on it, and the least recently used
+ * logical barrier of the PE loses its window when all windows are used.
+ * Frequently used barriers can be pinned to keep their windows. If no barrier
+ * blade is available, the barrier synchronizes on shared memory and takes a
+ * blade later when another logical barrier frees one, or from the least recently
+ * used logical barrier of the CMG which has been idle (not pinned and with no PE
+ * synchronizing on it), which falls back to shared memory in turn.
+ * Each PE must be used by one thread.
+ */
+struct fhwb_lbarrier;
+
+/* Statistics of a logical barrier reported by fhwb_lbarrier_get_stats() */
+struct fhwb_lbarrier_stats {
+	int hardware;       /* 1 if currently synchronized by barrier blade, 0 if on shared memory */
+	uint64_t maps;      /* number of windows assigned to the barrier by all PEs */
+	uint64_t evictions; /* number of windows of the barrier unassigned for other barriers */
+	uint64_t blades;    /* number of barrier blades taken by the barrier */
+};
+
+/**
+ * Create a logical barrier of PEs in @pemask (PEs must belong to the same CMG).
+ *
+ * @param[in] pemask_size size of @pemask in bytes
+ * @param[in] pemask cpumask of PEs joining synchronization
+ * @param[out] barrier created barrier
+ *
+ * @return 0 success
+ *        <0 error
+ *           -ENOMEM ... failed to allocate memory
+ *           -EINVAL ... @pemask contains less than 2 PEs
+ *           (and errors of fhwb_init() except -EBUSY)
+ */
+int fhwb_lbarrier_create(size_t pemask_size, cpu_set_t *pemask, struct fhwb_lbarrier **barrier);
+
+/**
+ * Free barrier blade and windows of @barrier and @barrier itself.
+ * All PEs must have finished synchronization on @barrier.
+ *
+ * @param[in] barrier barrier created by fhwb_lbarrier_create()
+ *
+ * @return 0 success
+ *        <0 error (error of fhwb_fini())
+ */
+int fhwb_lbarrier_destroy(struct fhwb_lbarrier *barrier);
+
+/**
+ * Synchronize all PEs of @barrier, assigning a window of calling PE if needed.
+ * Memory accesses before the call are visible to all PEs after the call.
+ * The caller thread must be bound to one PE of the mask.
+ *
+ * @param[in] barrier barrier created by fhwb_lbarrier_create()
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EBUSY  ... all windows of the PE are used by fhwb_assign(), pinned barriers
+ *                       or barriers which other PEs are synchronizing on
+ *           -EINVAL ... calling PE is not in the mask of @barrier
+ *           (and errors of fhwb_assign())
+ */
+int fhwb_lbarrier_sync(struct fhwb_lbarrier *barrier);
+
+/**
+ * Pin (@pin != 0) or unpin the window of calling PE for @barrier. A pinned barrier
+ * is assigned a window now and keeps its blade and window until it is unpinned
+ * or destroyed. A barrier on shared memory has nothing to pin.
+ * At most 3 barriers can be pinned on a PE.
+ *
+ * @param[in] barrier barrier created by fhwb_lbarrier_create()
+ * @param[in] pin whether to pin the barrier
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EBUSY  ... 3 barriers are already pinned on the PE, or no window
+ *                       is available (see fhwb_lbarrier_sync())
+ *           -EINVAL ... @barrier is NULL or calling PE is not in its mask
+ *           (and errors of fhwb_assign())
+ */
+int fhwb_lbarrier_pin(struct fhwb_lbarrier *barrier, int pin);
+
+/**
+ * Get statistics of @barrier to find barriers which should be pinned.
+ *
+ * @param[in] barrier barrier created by fhwb_lbarrier_create()
+ * @param[out] stats will be filled with the statistics
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @barrier or @stats is NULL
+ */
+int fhwb_lbarrier_get_stats(struct fhwb_lbarrier *barrier, struct fhwb_lbarrier_stats *stats);
+
+/* Reduction operations of fhwb_allreduce() (LAND/LOR results are 0 or 1) */
+#define FHWB_OP_SUM  0
+#define FHWB_OP_MIN  1
+#define FHWB_OP_MAX  2
+#define FHWB_OP_LAND 3
+#define FHWB_OP_LOR  4
+
+/* Element types of fhwb_allreduce() */
+#define FHWB_TYPE_INT64  0 /* int64_t */
+#define FHWB_TYPE_DOUBLE 1 /* double */
+
+/* Maximum number of elements of fhwb_allreduce() (one cache line per PE) */
+#define FHWB_ALLREDUCE_MAX_COUNT 32
+
+/**
+ * Reduce @count elements of @in of all PEs of the bb assigned to @window and
+ * store the result in @out of all PEs. This performs only one synchronization.
+ *
+ * All PEs must call this with the same @op, @type and @count. Since contributions are
+ * exchanged through memory of the process, PEs must be threads of the process which
+ * called fhwb_init(). All PEs get bitwise identical results.
+ *
+ * The caller thread must be bound to one PE.
+ *
+ * @param[in] window barrier window number returned by fhwb_assign()
+ * @param[in] op FHWB_OP_{SUM,MIN,MAX,LAND,LOR}
+ * @param[in] type FHWB_TYPE_{INT64,DOUBLE}
+ * @param[in] in contribution of calling PE
+ * @param[out] out reduction result (can be the same as @in)
+ * @param[in] count number of elements (up to FHWB_ALLREDUCE_MAX_COUNT)
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... argument is invalid or @window is not assigned by this process
+ */
+int fhwb_allreduce(int window, int op, int type, const void *in, void *out, int count);
+
+/* Statistics of a barrier blade reported by fhwb_get_stats() */
+struct fhwb_stats {
+	uint64_t syncs;        /* number of fhwb_sync() by all PEs */
+	uint64_t wait_ns;      /* total time PEs waited for other PEs in fhwb_sync() */
+	uint64_t max_wait_ns;  /* longest wait of one fhwb_sync() */
+	uint64_t assigns;      /* number of successful fhwb_assign() */
+	uint64_t unassigns;    /* number of successful fhwb_unassign() */
+	uint64_t ioctl_errors; /* number of failed driver ioctls on the bb */
+};
+
+/**
+ * Get statistics of @bd collected since fhwb_init().
+ *
+ * Counters are kept per PE and read without stopping synchronization, so
+ * the values may be slightly behind while PEs are synchronizing.
+ * Inlined fhwb_sync_w0..w3() with hardware barrier, fhwb_sync_timeout() and
+ * split-phase synchronization are not counted.
+ *
+ * @param[in] bd barrier descriptor returned by fhwb_init() of this process
+ * @param[out] stats will be filled with the statistics
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL     ... @bd is invalid or @stats is NULL
+ *           -EOPNOTSUPP ... library is built without statistics (ENABLE_STATS=OFF)
+ */
+int fhwb_get_stats(int bd, struct fhwb_stats *stats);
+
+/* Counters of blade pool reported by fhwb_pool_get_stats() */
+struct fhwb_pool_stats {
+	uint64_t hits;      /* number of fhwb_init() which reused an idle bb */
+	uint64_t misses;    /* number of fhwb_init() which allocated a bb */
+	uint64_t evictions; /* number of idle bbs freed */
+	int idle;           /* number of idle bbs currently kept */
+};
+
+/**
+ * Set the maximum number of idle barrier blades kept by the pool of this process.
+ *
+ * While the pool is enabled (@size > 0), fhwb_fini() of a bb whose windows have
+ * all been unassigned keeps the bb allocated in the driver, and the next fhwb_init()
+ * with the same set of PEs returns it without ioctl. The bb must not be used
+ * after fhwb_fini() as before, and all PEs must have finished fhwb_sync() on it.
+ * Idle blades of a CMG are freed when fhwb_init() fails with -EBUSY on the CMG.
+ * Since idle blades are not available to other processes, the pool size should be
+ * small. Reducing the size frees idle blades exceeding it (0 frees all and disables the pool).
+ * The initial size is 0 or the value of FHWB_POOL_ENV_NAME.
+ *
+ * @param[in] size maximum number of idle barrier blades
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @size is negative
+ */
+int fhwb_pool_set_size(int size);
+
+/**
+ * Get counters of the blade pool of this process.
+ *
+ * @param[out] stats will be filled with the counters
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @stats is NULL
+ */
+int fhwb_pool_get_stats(struct fhwb_pool_stats *stats);
+
+/* Summary of one synchronization episode in fhwb_profile_report */
+struct fhwb_profile_episode {
+	uint64_t seq;      /* episode number counted from fhwb_profile_start() */
+	int last_cpu;      /* cpuid of the PE which arrived last */
+	uint64_t skew_ns;  /* time from the first arrival to the last arrival */
+	uint64_t sync_ns;  /* time from the last arrival to the first release */
+};
+
+/* Summary of one PE in fhwb_profile_report */
+struct fhwb_profile_pe {
+	int cpu;             /* cpuid, or -1 if the PE has not been assigned */
+	uint64_t episodes;   /* number of profiled synchronizations */
+	uint64_t wait_ns;    /* cumulative time spent in synchronization */
+	uint64_t late_ns;    /* cumulative time arrived after the first PE (reported episodes) */
+	uint64_t last_count; /* number of reported episodes in which this PE arrived last */
+};
+
+struct fhwb_profile_report {
+	int num_pe;
+	int num_episodes;
+	struct fhwb_profile_pe *pes;           /* PEs of bb in ascending order of cpuid */
+	struct fhwb_profile_episode *episodes; /* oldest first */
+};
+
+/**
+ * Start recording arrival/release time of fhwb_sync() by PEs of @bd.
+ * Each PE keeps the last @depth synchronizations in its ring buffer.
+ *
+ * This must be called after fhwb_init() and before PEs call fhwb_assign().
+ * fhwb_sync_w0..w3() and fhwb_allreduce() are recorded as fhwb_sync(), while
+ * fhwb_sync_timeout() and split-phase synchronization are not. Since inlined
+ * hardware barrier is disabled and every fhwb_sync() reads the clock twice,
+ * synchronization becomes slower while any profile is running.
+ * The profile is freed by fhwb_fini().
+ *
+ * @param[in] bd barrier descriptor returned by fhwb_init() of this process
+ * @param[in] depth number of synchronizations kept per PE
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @bd or @depth is invalid
+ *           -EBUSY  ... profile is already started
+ *           -ENOMEM ... failed to allocate memory
+ */
+int fhwb_profile_start(int bd, int depth);
+
+/**
+ * Make report of the profile of @bd. Episodes are the last synchronizations which
+ * all PEs have completed and still keep in their ring buffer.
+ *
+ * Call this while PEs do not synchronize on @bd (otherwise the newest episodes may
+ * be inconsistent). Timestamps of PEs are compared directly, which assumes
+ * a clock synchronized among PEs (system counter or CLOCK_MONOTONIC).
+ *
+ * @param[in] bd barrier descriptor passed to fhwb_profile_start()
+ * @param[out] report will be set to the report. Caller must free the pointer
+ *
+ * @return 0 success
+ *        <0 error
+ *           -EINVAL ... @bd is not profiled or @report is NULL
+ *           -ENOMEM ... failed to allocate memory
+ */
+int fhwb_profile_get_report(int bd, struct fhwb_profile_report **report);
+
+/*
+ * Internal state of the library used by inlined fhwb_sync_w0..w3(), not part of the API.
+ * Nonzero when the hardware barrier backend is selected and fhwb_sync_w0..w3()
+ * can access barrier window registers directly. Set by the library at load time
+ * and cleared while fhwb_profile_start() is in effect, so it is accessed by relaxed
+ * atomic load/store. Read-only for applications
+ * (use fhwb_get_backend_name() to know the backend).
+ */
+#ifdef FHWB_LIBRARY_BUILD
+extern int fhwb_hwb_sync_enabled;
+#else
+extern const int fhwb_hwb_sync_enabled;
+#endif
+
+#ifdef __aarch64__
+/*
+ * Synchronization sequence of fhwb_sync() on window register @reg:
+ * write negated LBSY bit to BST bit and wait until LBSY bit changes.
+ */
+#define FHWB_SYNC_REG(reg) do { \
+	unsigned long __bst, __lbsy; \
+	asm volatile( \
+			"mrs %0, " #reg "\n\t" /* read LBSY bit */ \
+			"mvn %0, %0\n\t" /* negate */ \
+			"and %0, %0, #1\n\t" /* clear other than first-bit */ \
+			"msr " #reg ", %0\n\t" /* update BST bit */ \
+			"sevl\n\t" \
+		"1:\n\t" \
+			"wfe\n\t" \
+			"mrs %1, " #reg "\n\t" /* read LBSY bit */ \
+			"and %1, %1, #1\n\t" /* clear other than first-bit */ \
+			"cmp %0, %1\n\t" \
+			"b.ne 1b\n\t" /* loop until LBSY bit changes */ \
+		: "=&r"(__bst), "=&r"(__lbsy) \
+		: \
+		: "cc", "memory"); \
+} while (0)
+
+#define FHWB_DEFINE_SYNC_W(num) \
+static inline void fhwb_sync_w##num(void) \
+{ \
+	if (__builtin_expect(__atomic_load_n(&fhwb_hwb_sync_enabled, __ATOMIC_RELAXED), 1)) { \
+		FHWB_SYNC_REG(s3_3_c15_c15_##num); \
+		return; \
+	} \
+	fhwb_sync(num); \
+}
+#else
+#define FHWB_DEFINE_SYNC_W(num) \
+static inline void fhwb_sync_w##num(void) \
+{ \
+	fhwb_sync(num); \
+}
+#endif
+
+/*
+ * The same as fhwb_sync(FHWB_WINDOW_N) but inlined in the caller.
+ *
+ * With hardware barrier, these compile down to the register access sequence
+ * without function call and window dispatch, which matters in tight loops.
+ * Otherwise they call fhwb_sync().
+ */
+FHWB_DEFINE_SYNC_W(0)
+FHWB_DEFINE_SYNC_W(1)
+FHWB_DEFINE_SYNC_W(2)
+FHWB_DEFINE_SYNC_W(3)
+#undef FHWB_DEFINE_SYNC_W
+
 #ifdef __cplusplus
 }
+
+/*
+ * The same as fhwb_sync_w0..w3() with window number given at compile time.
+ *
+ * @tparam W barrier window number to be synced
+ */
+template <int W>
+static inline void fhwb_sync_w(void)
+{
+	static_assert(W >= FHWB_WINDOW_0 && W <= FHWB_WINDOW_3, "window number is invalid");
+
+	switch (W) {
+	case FHWB_WINDOW_0:
+		fhwb_sync_w0();
+		break;
+	case FHWB_WINDOW_1:
+		fhwb_sync_w1();
+		break;
+	case FHWB_WINDOW_2:
+		fhwb_sync_w2();
+		break;
+	case FHWB_WINDOW_3:
+		fhwb_sync_w3();
+		break;
+	}
+}
 #endif
 
 #endif /* _FUJITSU_HWBLIB_H */
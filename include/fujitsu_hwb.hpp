@@ -0,0 +1,484 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/* Copyright 2020 FUJITSU LIMITED */
+
+/*
+ * C++17 interface of hardware barrier library
+ *
+ * fhwb::Blade owns a barrier blade (fhwb_init/fhwb_fini) and fhwb::WindowGuard
+ * owns a barrier window of calling PE (fhwb_assign/fhwb_unassign), so that
+ * resources are freed on every exit path. Errors are reported by std::system_error
+ * whose code() is the errno value returned by the C function.
+ * With C++20, fhwb::barrier provides std::barrier interface on hardware barrier.
+ */
+
+#ifndef _FUJITSU_HWBLIB_HPP
+#define _FUJITSU_HWBLIB_HPP
+
+#include <fujitsu_hwb.h>
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#endif
+
+namespace fhwb {
+
+#if defined(__cpp_lib_span)
+template <class T>
+using span = std::span<T>;
+#else
+/* Minimal std::span replacement (read-only view of contiguous elements) for C++17 */
+template <class T>
+class span {
+public:
+	constexpr span() noexcept : data_(nullptr), size_(0) {}
+	constexpr span(T *data, std::size_t size) noexcept : data_(data), size_(size) {}
+
+	constexpr T *data() const noexcept { return data_; }
+	constexpr std::size_t size() const noexcept { return size_; }
+	constexpr bool empty() const noexcept { return size_ == 0; }
+	constexpr T &operator[](std::size_t i) const noexcept { return data_[i]; }
+	constexpr T *begin() const noexcept { return data_; }
+	constexpr T *end() const noexcept { return data_ + size_; }
+
+private:
+	T *data_;
+	std::size_t size_;
+};
+#endif
+
+namespace detail {
+
+/* Throw std::system_error if @ret is a negative errno value, otherwise return @ret */
+inline int check(int ret, const char *what)
+{
+	if (ret < 0)
+		throw std::system_error(-ret, std::generic_category(), what);
+
+	return ret;
+}
+
+/* CMG/Physical PE number of all PEs, queried once by fhwb_get_all_pe_info() */
+struct topology {
+	std::vector<fhwb_pe_info> pes;
+	std::vector<std::vector<int>> cmg_cpus;
+
+	topology()
+	{
+		struct fhwb_pe_info *list;
+		int num;
+
+		check(fhwb_get_all_pe_info(&list, &num), "fhwb_get_all_pe_info");
+		pes.assign(list, list + num);
+		std::free(list);
+
+		for (int cpu = 0; cpu < num; cpu++) {
+			if (pes[cpu].cmg == FHWB_INVALID_CMG)
+				continue;
+			if ((std::size_t)pes[cpu].cmg >= cmg_cpus.size())
+				cmg_cpus.resize(pes[cpu].cmg + 1);
+			cmg_cpus[pes[cpu].cmg].push_back(cpu);
+		}
+	}
+};
+
+inline const topology &get_topology()
+{
+	static const topology topo;
+
+	return topo;
+}
+
+} /* namespace detail */
+
+/*
+ * CMG/Physical PE number of each PE indexed by cpuid (see fhwb_get_all_pe_info()).
+ * The list is queried at the first call and shared by later calls.
+ */
+inline span<const fhwb_pe_info> all_pe_info()
+{
+	const detail::topology &topo = detail::get_topology();
+
+	return span<const fhwb_pe_info>(topo.pes.data(), topo.pes.size());
+}
+
+/* Available cpuids of @cmg in ascending order (empty if @cmg has no available PE) */
+inline span<const int> cmg_cpus(int cmg)
+{
+	const detail::topology &topo = detail::get_topology();
+
+	if (cmg < 0 || (std::size_t)cmg >= topo.cmg_cpus.size())
+		return span<const int>();
+
+	return span<const int>(topo.cmg_cpus[cmg].data(), topo.cmg_cpus[cmg].size());
+}
+
+/* Barrier blade allocated by fhwb_init() and freed by fhwb_fini() on destruction */
+class Blade {
+public:
+	Blade() noexcept : bd_(-1) {}
+
+	/* Allocate bb for PEs of @pemask (see fhwb_init()) */
+	explicit Blade(const cpu_set_t &pemask)
+		: bd_(detail::check(fhwb_init(sizeof(cpu_set_t), const_cast<cpu_set_t *>(&pemask)),
+					"fhwb_init")) {}
+
+	Blade(const Blade &) = delete;
+	Blade &operator=(const Blade &) = delete;
+
+	Blade(Blade &&other) noexcept : bd_(std::exchange(other.bd_, -1)) {}
+	Blade &operator=(Blade &&other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			bd_ = std::exchange(other.bd_, -1);
+		}
+		return *this;
+	}
+
+	~Blade() { reset(); }
+
+	/* Free the bb now. Errors are ignored as in destructor */
+	void reset() noexcept
+	{
+		if (bd_ >= 0)
+			fhwb_fini(bd_);
+		bd_ = -1;
+	}
+
+	/* Give up ownership and return bd, which the caller must pass to fhwb_fini() */
+	int release() noexcept { return std::exchange(bd_, -1); }
+
+	int bd() const noexcept { return bd_; }
+	int cmg() const noexcept { return fhwb_get_cmg_from_bd(bd_); }
+	int bb() const noexcept { return fhwb_get_bb_from_bd(bd_); }
+	explicit operator bool() const noexcept { return bd_ >= 0; }
+
+private:
+	int bd_;
+};
+
+/*
+ * Barrier window of calling PE assigned by fhwb_assign() and freed by fhwb_unassign()
+ * on destruction. Like fhwb_assign(), this must be constructed and destroyed by
+ * the same thread bound to one PE, and must not outlive the Blade.
+ */
+class WindowGuard {
+public:
+	WindowGuard() noexcept : bd_(-1), window_(-1) {}
+
+	/* Assign @window (-1 chooses unused one) to @blade (see fhwb_assign()) */
+	explicit WindowGuard(const Blade &blade, int window = -1)
+		: bd_(blade.bd()), window_(detail::check(fhwb_assign(blade.bd(), window), "fhwb_assign")) {}
+
+	WindowGuard(const WindowGuard &) = delete;
+	WindowGuard &operator=(const WindowGuard &) = delete;
+
+	WindowGuard(WindowGuard &&other) noexcept
+		: bd_(std::exchange(other.bd_, -1)), window_(std::exchange(other.window_, -1)) {}
+	WindowGuard &operator=(WindowGuard &&other) noexcept
+	{
+		if (this != &other) {
+			reset();
+			bd_ = std::exchange(other.bd_, -1);
+			window_ = std::exchange(other.window_, -1);
+		}
+		return *this;
+	}
+
+	~WindowGuard() { reset(); }
+
+	/* Unassign the window now. Errors are ignored as in destructor */
+	void reset() noexcept
+	{
+		if (window_ >= 0)
+			fhwb_unassign(bd_);
+		bd_ = -1;
+		window_ = -1;
+	}
+
+	int window() const noexcept { return window_; }
+	explicit operator bool() const noexcept { return window_ >= 0; }
+
+	void sync() const noexcept { fhwb_sync(window_); }
+	/* Return false if synchronization does not complete in @timeout_ns */
+	bool sync_timeout(uint64_t timeout_ns) const
+	{
+		int ret = fhwb_sync_timeout(window_, timeout_ns);
+
+		if (ret == -ETIMEDOUT)
+			return false;
+		detail::check(ret, "fhwb_sync_timeout");
+
+		return true;
+	}
+	int arrive() const { return detail::check(fhwb_arrive(window_), "fhwb_arrive"); }
+	bool test(int token) const { return detail::check(fhwb_test(window_, token), "fhwb_test"); }
+	void wait(int token) const { detail::check(fhwb_wait(window_, token), "fhwb_wait"); }
+
+private:
+	int bd_;
+	int window_;
+};
+
+/*
+ * WindowGuard of window number @W fixed at compile time.
+ * sync() is inlined as fhwb_sync_w<W>().
+ */
+template <int W>
+class Window {
+	static_assert(W >= FHWB_WINDOW_0 && W <= FHWB_WINDOW_3, "window number is invalid");
+
+public:
+	static constexpr int number = W;
+
+	Window() noexcept = default;
+	explicit Window(const Blade &blade) : guard_(blade, W) {}
+
+	void reset() noexcept { guard_.reset(); }
+	explicit operator bool() const noexcept { return static_cast<bool>(guard_); }
+
+	void sync() const noexcept { fhwb_sync_w<W>(); }
+	bool sync_timeout(uint64_t timeout_ns) const { return guard_.sync_timeout(timeout_ns); }
+	int arrive() const { return guard_.arrive(); }
+	bool test(int token) const { return guard_.test(token); }
+	void wait(int token) const { guard_.wait(token); }
+
+private:
+	WindowGuard guard_;
+};
+
+#if __cplusplus >= 202002L
+namespace detail {
+
+/* Completion function of fhwb::barrier which does nothing */
+struct no_completion {
+	void operator()() noexcept {}
+};
+
+/* Window of calling PE assigned for fhwb::barrier of @id, indexed by window number */
+struct barrier_window {
+	std::uint64_t id;
+	unsigned int phase;
+	bool serial;
+};
+
+inline thread_local barrier_window barrier_windows[FHWB_WINDOW_3 + 1];
+inline std::atomic<std::uint64_t> barrier_next_id(1);
+
+} /* namespace detail */
+
+/*
+ * The same interface as std::barrier for threads bound to PEs of one CMG.
+ *
+ * Each thread assigns a window of its PE at its first arrival and all windows are
+ * freed on destruction. @Completion is called by the thread on the first PE of
+ * the mask between two hardware barrier synchronizations, so a phase costs one
+ * synchronization without completion function and two with it.
+ *
+ * If barrier blade cannot be allocated for the mask, or after arrive_and_drop(),
+ * the barrier works on shared memory where the last arriving thread calls @Completion.
+ * Unlike std::barrier, arrive_and_drop() on hardware barrier waits for the phase.
+ */
+template <class Completion = detail::no_completion>
+class barrier {
+	static_assert(std::is_nothrow_invocable_v<Completion &>, "completion function must be noexcept");
+
+	static constexpr bool has_completion = !std::is_same_v<Completion, detail::no_completion>;
+	/* Cache line size of A64FX */
+	static constexpr std::size_t cache_line = 256;
+
+public:
+	class arrival_token {
+		friend class barrier;
+
+		arrival_token(unsigned int phase, int token) noexcept : phase_(phase), token_(token) {}
+
+		unsigned int phase_;
+		int token_; /* token of fhwb_arrive(), or -1 on shared memory */
+	};
+
+	static constexpr std::ptrdiff_t max() noexcept { return PTRDIFF_MAX; }
+
+	/* Barrier of @expected threads on shared memory */
+	explicit barrier(std::ptrdiff_t expected, Completion completion = Completion())
+		: completion_(std::move(completion)), id_(detail::barrier_next_id++), pemask_(),
+		  expected_(expected), serial_cpu_(-1), hw_(false) {}
+
+	/* Barrier of threads bound to PEs of @pemask (on shared memory if bb cannot be allocated) */
+	explicit barrier(const cpu_set_t &pemask, Completion completion = Completion())
+		: completion_(std::move(completion)), id_(detail::barrier_next_id++), pemask_(),
+		  expected_(CPU_COUNT(&pemask)), serial_cpu_(-1), hw_(false)
+	{
+		try {
+			blade_ = Blade(pemask);
+		} catch (const std::system_error &) {
+			return;
+		}
+
+		pemask_ = pemask;
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &pemask)) {
+				serial_cpu_ = cpu;
+				break;
+			}
+		}
+		hw_ = true;
+	}
+
+	barrier(const barrier &) = delete;
+	barrier &operator=(const barrier &) = delete;
+
+	/* Whether the barrier currently uses hardware barrier */
+	bool hardware() const noexcept { return hw_.load(std::memory_order_acquire); }
+
+	[[nodiscard]] arrival_token arrive(std::ptrdiff_t n = 1)
+	{
+		if (hardware()) {
+			if (n != 1)
+				throw std::system_error(EINVAL, std::generic_category(), "fhwb::barrier::arrive");
+			int window = get_window();
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			return arrival_token(0, detail::check(fhwb_arrive(window), "fhwb_arrive"));
+		}
+
+		return arrival_token(sw_arrive(n), -1);
+	}
+
+	void wait(arrival_token &&token) const
+	{
+		if (token.token_ >= 0) {
+			int window = get_window();
+
+			detail::check(fhwb_wait(window, token.token_), "fhwb_wait");
+			end_phase(window);
+			return;
+		}
+
+		while (phase_.load(std::memory_order_acquire) == token.phase_)
+			phase_.wait(token.phase_, std::memory_order_acquire);
+	}
+
+	void arrive_and_wait()
+	{
+		if (hardware()) {
+			int window = get_window();
+
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			fhwb_sync(window);
+			end_phase(window);
+			return;
+		}
+
+		wait(arrive());
+	}
+
+	void arrive_and_drop()
+	{
+		if (hardware()) {
+			int window = get_window();
+
+			drops_[detail::barrier_windows[window].phase & 1].fetch_add(1);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			fhwb_sync(window);
+			end_phase(window);
+			return;
+		}
+
+		drops_[0].fetch_add(1);
+		(void)sw_arrive(1);
+	}
+
+private:
+	/* Window of calling PE, assigned at the first arrival of the thread */
+	int get_window() const
+	{
+		for (int i = 0; i <= FHWB_WINDOW_3; i++)
+			if (detail::barrier_windows[i].id == id_)
+				return i;
+
+		int cpu = sched_getcpu();
+		if (cpu < 0 || !CPU_ISSET(cpu, &pemask_))
+			throw std::system_error(EINVAL, std::generic_category(), "fhwb::barrier: PE is not in the mask");
+
+		int window = detail::check(fhwb_assign(blade_.bd(), -1), "fhwb_assign");
+		detail::barrier_windows[window] = detail::barrier_window{id_, 0, cpu == serial_cpu_};
+
+		return window;
+	}
+
+	/*
+	 * After all PEs arrived on hardware barrier, the serial PE calls completion
+	 * function and switches to shared memory if some PEs have dropped. Others wait
+	 * for it by another synchronization. Drops are counted per phase parity since
+	 * PEs may arrive at the next phase while others are reading the count.
+	 */
+	void end_phase(int window) const
+	{
+		detail::barrier_window &w = detail::barrier_windows[window];
+		std::ptrdiff_t drops;
+
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		drops = drops_[w.phase++ & 1].load();
+		if (!has_completion && !drops)
+			return;
+
+		if (w.serial) {
+			if constexpr (has_completion)
+				completion_();
+			if (drops) {
+				drops_[0].store(0);
+				drops_[1].store(0);
+				expected_.store(expected_.load() - drops);
+				hw_.store(false, std::memory_order_release);
+			}
+		}
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		fhwb_sync(window);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	}
+
+	/* Arrive at centralized barrier on shared memory and return the phase */
+	unsigned int sw_arrive(std::ptrdiff_t n)
+	{
+		unsigned int phase = phase_.load(std::memory_order_acquire);
+
+		if (arrived_.fetch_add(n, std::memory_order_acq_rel) + n == expected_.load(std::memory_order_relaxed)) {
+			expected_.store(expected_.load(std::memory_order_relaxed) - drops_[0].exchange(0),
+					std::memory_order_relaxed);
+			if constexpr (has_completion)
+				completion_();
+			arrived_.store(0, std::memory_order_relaxed);
+			phase_.store(phase + 1, std::memory_order_release);
+			phase_.notify_all();
+		}
+
+		return phase;
+	}
+
+	mutable Completion completion_;
+	const std::uint64_t id_;
+	Blade blade_;
+	cpu_set_t pemask_;
+	mutable std::atomic<std::ptrdiff_t> expected_;
+	int serial_cpu_;
+	mutable std::atomic<bool> hw_;
+	mutable std::atomic<std::ptrdiff_t> drops_[2] = {0, 0};
+	alignas(cache_line) std::atomic<std::ptrdiff_t> arrived_{0};
+	alignas(cache_line) mutable std::atomic<unsigned int> phase_{0};
+};
+#endif
+
+} /* namespace fhwb */
+
+#endif /* _FUJITSU_HWBLIB_HPP */
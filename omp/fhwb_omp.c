@@ -0,0 +1,370 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Hardware barrier for barriers of OpenMP (libgomp) teams confined to one CMG
+ * (used by LD_PRELOAD)
+ *
+ * GOMP_parallel() is intercepted so that each thread of the team knows its
+ * region. The first barrier of a region is performed by libgomp, and there
+ * the threads check whether the team is the same as the one which has barrier
+ * windows assigned (cached team). If so, the rest of barriers of the region are
+ * performed by fhwb_sync(). Otherwise, the master allocates a barrier blade for
+ * the new team when all threads are bound to one PE of the same CMG, and threads
+ * assign windows which are kept for later regions. Teams which do not satisfy
+ * the condition, nested teams and teams of host teams constructs just use
+ * barriers of libgomp. Each thread which starts top-level regions (master) has
+ * its own cached team as libgomp keeps a pool of threads per master, so regions
+ * of independent masters run concurrently without freeing the barrier blade of
+ * one another. Nested regions may also be created by entry points other
+ * than GOMP_parallel() (e.g. GOMP_parallel_loop_*(), GOMP_parallel_sections()),
+ * which run on the thread of the outer region, so barriers are only routed at
+ * level 1.
+ *
+ * Barriers of GOMP_barrier(), GOMP_loop_end() and GOMP_sections_end() are
+ * routed. The join barrier at the end of parallel region is internal to libgomp.
+ * Threads in fhwb_sync() cannot execute tasks, so GOMP_task() and GOMP_taskloop()
+ * are also intercepted to know whether a thread has created tasks. Threads tell
+ * it each other through the hardware barrier, and if any thread has, they all
+ * perform the barrier of libgomp as well, which completes all tasks of the team.
+ * The barrier blade of the cached team is freed when its master exits, or by the
+ * driver at process exit.
+ *
+ * Usage: LD_PRELOAD=libFJhwb-omp.so OMP_PROC_BIND=true OMP_PLACES=cores ./a.out
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <dlfcn.h>
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/* Teams larger than this cannot be confined to one CMG */
+#define OMP_MAX_THREADS 64
+
+/*
+ * Cached team of a master. Only changed by the master between libgomp barriers.
+ * gen identifies the barrier blade among all masters (0: none).
+ */
+struct omp_team {
+	int bd;
+	int nthreads;
+	unsigned int gen;
+	/* Size of the last team which could not be confined to one CMG (0: none) */
+	int rejected;
+};
+
+/* Arguments of GOMP_parallel() and agreement of threads on the first barrier */
+struct omp_region {
+	void (*fn)(void *);
+	void *data;
+	struct omp_team *team; /* cached team of the master */
+	int nthreads;        /* set by the master upon the first barrier */
+	atomic_int invalid;  /* number of threads not in the cached team */
+	atomic_int failed;   /* number of threads failed to assign window */
+	bool hw;             /* set by the master if barrier blade is allocated */
+	/* seq + 1 of barrier before which some thread has created tasks (by seq & 1) */
+	atomic_uint task_seq[2];
+	int cpus[OMP_MAX_THREADS];
+};
+
+/* State of each thread */
+struct omp_thread {
+	struct omp_region *region; /* current region (NULL if not routed) */
+	int nthreads;              /* size of the team of the region */
+	bool decided;              /* barrier of the region is decided */
+	bool hw;                   /* use fhwb_sync() for barriers of the region */
+	bool tasks;                /* tasks have been created since the last barrier */
+	unsigned int seq;          /* number of fhwb_sync() in the region */
+	/* window assigned for the cached team of the master */
+	unsigned int gen;
+	int tid;
+	int cpu;
+	int window;
+};
+
+static __thread struct omp_thread omp_thread;
+static __thread struct omp_team omp_team = { .bd = -1 };
+
+/* Incremented whenever barrier blade is allocated by any master */
+static atomic_uint omp_gen;
+/* Frees the barrier blade of the master upon its exit */
+static pthread_key_t omp_team_key;
+
+static void (*real_GOMP_parallel)(void (*)(void *), void *, unsigned, unsigned);
+static void (*real_GOMP_barrier)(void);
+static void (*real_GOMP_loop_end_nowait)(void);
+static void (*real_GOMP_sections_end_nowait)(void);
+static void (*real_GOMP_task)(void (*)(void *), void *, void (*)(void *, void *), long, long,
+			      bool, unsigned, void **, int, void *);
+static void (*real_GOMP_taskloop)(void (*)(void *), void *, void (*)(void *, void *), long, long,
+				  unsigned, unsigned long, int, long, long, long);
+static void (*real_GOMP_taskloop_ull)(void (*)(void *), void *, void (*)(void *, void *), long, long,
+				      unsigned, unsigned long, int, unsigned long long,
+				      unsigned long long, unsigned long long);
+
+static pthread_once_t omp_once = PTHREAD_ONCE_INIT;
+
+/* Threads of the pool of the exiting master are not in fhwb_sync() */
+static void omp_team_free(void *arg)
+{
+	struct omp_team *team = arg;
+
+	if (team->bd >= 0) {
+		fhwb_fini(team->bd);
+		team->bd = -1;
+	}
+}
+
+static void resolve_real_functions(void)
+{
+	real_GOMP_parallel = dlsym(RTLD_NEXT, "GOMP_parallel");
+	real_GOMP_barrier = dlsym(RTLD_NEXT, "GOMP_barrier");
+	real_GOMP_loop_end_nowait = dlsym(RTLD_NEXT, "GOMP_loop_end_nowait");
+	real_GOMP_sections_end_nowait = dlsym(RTLD_NEXT, "GOMP_sections_end_nowait");
+	real_GOMP_task = dlsym(RTLD_NEXT, "GOMP_task");
+	real_GOMP_taskloop = dlsym(RTLD_NEXT, "GOMP_taskloop");
+	real_GOMP_taskloop_ull = dlsym(RTLD_NEXT, "GOMP_taskloop_ull");
+
+	if (!real_GOMP_parallel || !real_GOMP_barrier || !real_GOMP_loop_end_nowait ||
+	    !real_GOMP_sections_end_nowait || !real_GOMP_task || !real_GOMP_taskloop ||
+	    !real_GOMP_taskloop_ull) {
+		fhwb_error("libgomp is not found: %s", dlerror());
+		abort();
+	}
+
+	if (pthread_key_create(&omp_team_key, omp_team_free)) {
+		fhwb_error("pthread_key_create failed");
+		abort();
+	}
+}
+
+/* Allocate barrier blade for CPUs of @r. Called by the master */
+static bool omp_setup(struct omp_region *r)
+{
+	struct omp_team *team = r->team;
+	struct fhwb_pe_info info;
+	cpu_set_t mask;
+	int cmg = -1;
+	int bd;
+	int i;
+
+	if (team->bd >= 0) {
+		/* Windows still assigned to the bb are freed together */
+		fhwb_fini(team->bd);
+		team->bd = -1;
+	}
+
+	CPU_ZERO(&mask);
+	for (i = 0; i < r->nthreads; i++) {
+		int cpu = r->cpus[i];
+
+		if (cpu < 0 || CPU_ISSET(cpu, &mask) || fhwb_get_cpu_pe_info(cpu, &info) < 0 ||
+		    (cmg >= 0 && info.cmg != cmg)) {
+			fhwb_debug("team of %d threads is not bound to PEs of one CMG (tid %d cpu %d)", r->nthreads, i, cpu);
+			team->rejected = r->nthreads;
+			return false;
+		}
+		cmg = info.cmg;
+		CPU_SET(cpu, &mask);
+	}
+
+	bd = fhwb_init(sizeof(cpu_set_t), &mask);
+	if (bd < 0) {
+		fhwb_debug("cannot allocate barrier blade for team of %d threads: %d", r->nthreads, bd);
+		return false;
+	}
+
+	team->bd = bd;
+	team->nthreads = r->nthreads;
+	team->gen = atomic_fetch_add(&omp_gen, 1) + 1;
+	team->rejected = 0;
+	pthread_setspecific(omp_team_key, team);
+	fhwb_debug("Route barriers of team of %d threads to bd: 0x%x", r->nthreads, bd);
+
+	return true;
+}
+
+/* First barrier of the region: decide barrier of rest of the region by all threads */
+static void omp_decide(struct omp_thread *t, int tid)
+{
+	struct omp_region *r = t->region;
+	struct omp_team *team = r->team;
+	bool cached = t->gen == team->gen && team->gen && t->tid == tid && team->nthreads == t->nthreads;
+
+	t->decided = true;
+	if (tid == 0)
+		r->nthreads = t->nthreads;
+	r->cpus[tid] = cached ? t->cpu : fhwb_get_bound_cpu();
+	if (!cached)
+		atomic_fetch_add(&r->invalid, 1);
+
+	real_GOMP_barrier();
+	if (atomic_load(&r->invalid) == 0) {
+		t->hw = true;
+		return;
+	}
+
+	if (tid == 0)
+		r->hw = omp_setup(r);
+	real_GOMP_barrier();
+	if (!r->hw)
+		return;
+
+	t->window = fhwb_assign(team->bd, -1);
+	if (t->window < 0)
+		atomic_fetch_add(&r->failed, 1);
+	real_GOMP_barrier();
+	if (atomic_load(&r->failed))
+		return;
+
+	t->gen = team->gen;
+	t->tid = tid;
+	t->cpu = r->cpus[tid];
+	t->hw = true;
+}
+
+/*
+ * Hardware barrier of the region. task_seq[] is used alternately like buffers of
+ * fhwb_allreduce(): a thread can write the slot again only after next barrier,
+ * which other threads reach after they have read it
+ */
+static void omp_hw_barrier(struct omp_thread *t)
+{
+	struct omp_region *r = t->region;
+	unsigned int seq = t->seq++;
+	atomic_uint *task_seq = &r->task_seq[seq & 1];
+
+	if (t->tasks)
+		atomic_store_explicit(task_seq, seq + 1, memory_order_relaxed);
+
+	/* Hardware barrier does not order memory access by itself */
+	atomic_thread_fence(memory_order_seq_cst);
+	fhwb_sync(t->window);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (atomic_load_explicit(task_seq, memory_order_relaxed) == seq + 1) {
+		/* Executes all tasks of the team including tasks created meanwhile */
+		real_GOMP_barrier();
+		t->tasks = false;
+	}
+}
+
+static void omp_barrier(void)
+{
+	struct omp_thread *t = &omp_thread;
+
+	/* Not in a nested region which is not created by GOMP_parallel() */
+	if (t->region && __builtin_expect(omp_get_level() == 1, 1)) {
+		if (__builtin_expect(t->hw, 1)) {
+			omp_hw_barrier(t);
+			return;
+		}
+
+		if (!t->decided) {
+			/* Barriers of libgomp in omp_decide() complete tasks */
+			omp_decide(t, omp_get_thread_num());
+			t->tasks = false;
+			return;
+		}
+	}
+
+	pthread_once(&omp_once, resolve_real_functions);
+	real_GOMP_barrier();
+}
+
+static void omp_region_main(void *arg)
+{
+	struct omp_region *r = arg;
+	struct omp_thread *t = &omp_thread;
+	struct omp_region *region = t->region;
+	int nthreads = t->nthreads;
+	bool decided = t->decided;
+	bool hw = t->hw;
+	bool tasks = t->tasks;
+	unsigned int seq = t->seq;
+
+	/* Nested regions, regions in host teams and rejected teams use barriers of libgomp */
+	t->nthreads = omp_get_num_threads();
+	t->region = omp_get_level() == 1 && omp_get_num_teams() == 1 && t->nthreads > 1 &&
+		t->nthreads <= OMP_MAX_THREADS && t->nthreads != r->team->rejected ? r : NULL;
+	t->decided = false;
+	t->hw = false;
+	t->tasks = false;
+	t->seq = 0;
+
+	r->fn(r->data);
+
+	t->region = region;
+	t->nthreads = nthreads;
+	t->decided = decided;
+	t->hw = hw;
+	t->tasks = tasks;
+	t->seq = seq;
+}
+
+void GOMP_parallel(void (*fn)(void *), void *data, unsigned num_threads, unsigned flags)
+{
+	struct omp_region r = {
+		.fn = fn,
+		.data = data,
+		.team = &omp_team,
+	};
+
+	pthread_once(&omp_once, resolve_real_functions);
+	real_GOMP_parallel(omp_region_main, &r, num_threads, flags);
+}
+
+void GOMP_barrier(void)
+{
+	omp_barrier();
+}
+
+void GOMP_loop_end(void)
+{
+	pthread_once(&omp_once, resolve_real_functions);
+	real_GOMP_loop_end_nowait();
+	omp_barrier();
+}
+
+void GOMP_sections_end(void)
+{
+	pthread_once(&omp_once, resolve_real_functions);
+	real_GOMP_sections_end_nowait();
+	omp_barrier();
+}
+
+void GOMP_task(void (*fn)(void *), void *data, void (*cpyfn)(void *, void *), long arg_size,
+	       long arg_align, bool if_clause, unsigned flags, void **depend, int priority, void *detach)
+{
+	pthread_once(&omp_once, resolve_real_functions);
+	omp_thread.tasks = true;
+	real_GOMP_task(fn, data, cpyfn, arg_size, arg_align, if_clause, flags, depend, priority, detach);
+}
+
+void GOMP_taskloop(void (*fn)(void *), void *data, void (*cpyfn)(void *, void *), long arg_size,
+		   long arg_align, unsigned flags, unsigned long num_tasks, int priority,
+		   long start, long end, long step)
+{
+	pthread_once(&omp_once, resolve_real_functions);
+	omp_thread.tasks = true;
+	real_GOMP_taskloop(fn, data, cpyfn, arg_size, arg_align, flags, num_tasks, priority,
+			   start, end, step);
+}
+
+void GOMP_taskloop_ull(void (*fn)(void *), void *data, void (*cpyfn)(void *, void *), long arg_size,
+		       long arg_align, unsigned flags, unsigned long num_tasks, int priority,
+		       unsigned long long start, unsigned long long end, unsigned long long step)
+{
+	pthread_once(&omp_once, resolve_real_functions);
+	omp_thread.tasks = true;
+	real_GOMP_taskloop_ull(fn, data, cpyfn, arg_size, arg_align, flags, num_tasks, priority,
+			       start, end, step);
+}
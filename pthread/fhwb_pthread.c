@@ -0,0 +1,335 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * pthread_barrier_t backed by hardware barrier (used by LD_PRELOAD)
+ *
+ * pthread_barrier_init/wait/destroy are intercepted. The first wait of a barrier
+ * is performed on shared memory, where the last arriving thread checks whether
+ * all participants are bound to distinct PEs of one CMG. If so, it allocates a
+ * barrier blade by fhwb_init() and each participant assigns a window of its PE
+ * by fhwb_assign() before leaving the first wait. Later waits are fhwb_sync().
+ * Otherwise the barrier keeps using the shared memory barrier.
+ *
+ * Windows are looked up by PE, so threads waiting on a hardware barrier must
+ * run on the PEs of the first wait. Process-shared barriers are passed to
+ * the original implementation.
+ *
+ * As with glibc, the barrier may be destroyed as soon as one thread has
+ * returned from the last wait (e.g. by the serial thread). Each wait counts
+ * itself in @inside until its last access to the barrier, and destroy waits
+ * until the other threads have left.
+ *
+ * Usage: LD_PRELOAD=libFJhwb-pthread.so ./a.out
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <dlfcn.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Stored in pthread_barrier_t to distinguish barriers of this file */
+#define PB_MAGIC 0x4648574250544852ULL
+
+enum pb_state {
+	PB_FIRST,    /* before the first wait finishes */
+	PB_SW,       /* shared memory barrier */
+	PB_HW,       /* hardware barrier */
+};
+
+struct pb_barrier {
+	/* Centralized barrier on shared memory */
+	atomic_uint arrived __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+	atomic_uint round __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+	atomic_uint sleepers;
+	atomic_uint slots;       /* arrivals of the first wait */
+	/* number of threads in pthread_barrier_wait() */
+	atomic_uint inside __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+
+	unsigned int count;
+	int spin_count;
+	uint64_t id;
+	/* Only changed by the last thread of a round of the shared memory barrier */
+	enum pb_state state;
+	int bd;
+	int serial_cpu;          /* PE which gets PTHREAD_BARRIER_SERIAL_THREAD */
+	atomic_int failed;       /* number of PEs failed to assign window */
+	int8_t windows[CPU_SETSIZE];
+	int cpus[];              /* PE of each arrival of the first wait */
+};
+
+/* Layout of pthread_barrier_t of this file */
+struct pb_handle {
+	uint64_t magic;
+	struct pb_barrier *pb;
+};
+
+_Static_assert(sizeof(struct pb_handle) <= sizeof(pthread_barrier_t), "pthread_barrier_t is too small");
+
+/* Barrier id of each window of calling PE, and whether the PE is the serial thread */
+static __thread uint64_t pb_window_ids[FHWB_WINDOW_3 + 1];
+static __thread bool pb_window_serial[FHWB_WINDOW_3 + 1];
+static atomic_uint_least64_t pb_next_id = 1;
+
+static int (*real_pthread_barrier_init)(pthread_barrier_t *, const pthread_barrierattr_t *, unsigned int);
+static int (*real_pthread_barrier_wait)(pthread_barrier_t *);
+static int (*real_pthread_barrier_destroy)(pthread_barrier_t *);
+
+static pthread_once_t pb_once = PTHREAD_ONCE_INIT;
+
+static void resolve_real_functions(void)
+{
+	real_pthread_barrier_init = dlsym(RTLD_NEXT, "pthread_barrier_init");
+	real_pthread_barrier_wait = dlsym(RTLD_NEXT, "pthread_barrier_wait");
+	real_pthread_barrier_destroy = dlsym(RTLD_NEXT, "pthread_barrier_destroy");
+}
+
+static inline struct pb_barrier *get_pb(pthread_barrier_t *barrier)
+{
+	struct pb_handle *h = (struct pb_handle *)barrier;
+
+	return h->magic == PB_MAGIC ? h->pb : NULL;
+}
+
+/* Wait on shared memory. @last is called by the last thread before release */
+static int pb_sw_wait(struct pb_barrier *pb, void (*last)(struct pb_barrier *pb))
+{
+	unsigned int round = atomic_load(&pb->round);
+	int spin;
+
+	if (atomic_fetch_add(&pb->arrived, 1) + 1 == pb->count) {
+		if (last)
+			last(pb);
+		atomic_store(&pb->arrived, 0);
+		atomic_store(&pb->round, round + 1);
+		if (atomic_load(&pb->sleepers))
+			fhwb_futex_wake(&pb->round);
+		return PTHREAD_BARRIER_SERIAL_THREAD;
+	}
+
+	for (spin = 0; atomic_load(&pb->round) == round; spin++) {
+		if (spin < pb->spin_count) {
+			fhwb_cpu_relax();
+			continue;
+		}
+
+		atomic_fetch_add(&pb->sleepers, 1);
+		fhwb_futex_wait(&pb->round, round, NULL);
+		atomic_fetch_sub(&pb->sleepers, 1);
+	}
+
+	return 0;
+}
+
+/* Allocate barrier blade if PEs of the first wait are distinct PEs of one CMG */
+static void pb_first_last(struct pb_barrier *pb)
+{
+	struct fhwb_pe_info info;
+	cpu_set_t mask;
+	int cmg = -1;
+	unsigned int i;
+
+	pb->state = PB_SW;
+
+	CPU_ZERO(&mask);
+	for (i = 0; i < pb->count; i++) {
+		int cpu = pb->cpus[i];
+
+		if (cpu < 0 || CPU_ISSET(cpu, &mask) || fhwb_get_cpu_pe_info(cpu, &info) < 0 ||
+		    (cmg >= 0 && info.cmg != cmg)) {
+			fhwb_debug("threads of barrier are not bound to PEs of one CMG");
+			return;
+		}
+		cmg = info.cmg;
+		CPU_SET(cpu, &mask);
+	}
+
+	pb->bd = fhwb_init(sizeof(cpu_set_t), &mask);
+	if (pb->bd < 0) {
+		fhwb_debug("cannot allocate barrier blade for barrier: %d", pb->bd);
+		return;
+	}
+
+	for (i = 0; i < CPU_SETSIZE; i++) {
+		if (CPU_ISSET(i, &mask)) {
+			pb->serial_cpu = i;
+			break;
+		}
+	}
+	pb->state = PB_HW;
+}
+
+/* Use hardware barrier only if all PEs have assigned windows */
+static void pb_assign_last(struct pb_barrier *pb)
+{
+	if (atomic_load(&pb->failed) == 0) {
+		fhwb_debug("Use hardware barrier for %u threads. bd: 0x%x", pb->count, pb->bd);
+		return;
+	}
+
+	/* Windows still assigned to the bb are freed together */
+	fhwb_fini(pb->bd);
+	pb->state = PB_SW;
+}
+
+static int pb_first_wait(struct pb_barrier *pb)
+{
+	unsigned int slot;
+	int window;
+	int cpu;
+	int ret;
+
+	/* Record PE before arrival. The last thread reads them after all arrived */
+	cpu = fhwb_get_bound_cpu();
+	slot = atomic_fetch_add(&pb->slots, 1);
+	pb->cpus[slot] = cpu;
+
+	ret = pb_sw_wait(pb, pb_first_last);
+	if (pb->state != PB_HW)
+		return ret;
+
+	window = fhwb_assign(pb->bd, -1);
+	if (window < 0) {
+		atomic_fetch_add(&pb->failed, 1);
+	} else {
+		pb->windows[cpu] = window;
+		pb_window_ids[window] = pb->id;
+		pb_window_serial[window] = cpu == pb->serial_cpu;
+	}
+	pb_sw_wait(pb, pb_assign_last);
+
+	return ret;
+}
+
+/* Find window of calling PE for @pb */
+static int pb_get_window(struct pb_barrier *pb)
+{
+	int window;
+	int cpu;
+	int i;
+
+	for (i = 0; i <= FHWB_WINDOW_3; i++)
+		if (pb_window_ids[i] == pb->id)
+			return i;
+
+	/* Another thread on the same PE has assigned the window */
+	cpu = sched_getcpu();
+	if (cpu < 0 || cpu >= CPU_SETSIZE || pb->windows[cpu] < 0) {
+		fhwb_error("PE does not join hardware barrier: %d", cpu);
+		abort();
+	}
+	window = pb->windows[cpu];
+	pb_window_ids[window] = pb->id;
+	pb_window_serial[window] = cpu == pb->serial_cpu;
+
+	return window;
+}
+
+static int pb_hw_wait(struct pb_barrier *pb)
+{
+	int window = pb_get_window(pb);
+
+	/* Barrier synchronization does not order memory access by itself */
+	atomic_thread_fence(memory_order_seq_cst);
+	fhwb_sync(window);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	return pb_window_serial[window] ? PTHREAD_BARRIER_SERIAL_THREAD : 0;
+}
+
+int pthread_barrier_init(pthread_barrier_t *barrier, const pthread_barrierattr_t *attr, unsigned int count)
+{
+	struct pb_handle *h = (struct pb_handle *)barrier;
+	struct pb_barrier *pb;
+	int pshared = PTHREAD_PROCESS_PRIVATE;
+
+	pthread_once(&pb_once, resolve_real_functions);
+
+	if (attr)
+		pthread_barrierattr_getpshared(attr, &pshared);
+	if (pshared == PTHREAD_PROCESS_SHARED)
+		return real_pthread_barrier_init(barrier, attr, count);
+
+	if (count == 0)
+		return EINVAL;
+
+	if (posix_memalign((void **)&pb, FHWB_CACHE_LINE_SIZE, sizeof(struct pb_barrier) + sizeof(int) * count))
+		return ENOMEM;
+	memset(pb, 0, sizeof(struct pb_barrier));
+	memset(pb->windows, -1, sizeof(pb->windows));
+	pb->count = count;
+	pb->spin_count = fhwb_spin_count();
+	pb->id = atomic_fetch_add(&pb_next_id, 1);
+	pb->state = count > 1 ? PB_FIRST : PB_SW;
+	pb->bd = -1;
+
+	h->magic = PB_MAGIC;
+	h->pb = pb;
+
+	return 0;
+}
+
+int pthread_barrier_wait(pthread_barrier_t *barrier)
+{
+	struct pb_barrier *pb = get_pb(barrier);
+	int ret;
+
+	if (__builtin_expect(!pb, 0)) {
+		pthread_once(&pb_once, resolve_real_functions);
+		return real_pthread_barrier_wait(barrier);
+	}
+
+	atomic_fetch_add(&pb->inside, 1);
+	switch (pb->state) {
+	case PB_HW:
+		ret = pb_hw_wait(pb);
+		break;
+	case PB_FIRST:
+		ret = pb_first_wait(pb);
+		break;
+	default:
+		ret = pb_sw_wait(pb, NULL);
+		break;
+	}
+	/* The last access to @pb. It may be freed right after */
+	atomic_fetch_sub_explicit(&pb->inside, 1, memory_order_release);
+
+	return ret;
+}
+
+int pthread_barrier_destroy(pthread_barrier_t *barrier)
+{
+	struct pb_handle *h = (struct pb_handle *)barrier;
+	struct pb_barrier *pb = get_pb(barrier);
+
+	if (!pb) {
+		pthread_once(&pb_once, resolve_real_functions);
+		return real_pthread_barrier_destroy(barrier);
+	}
+
+	if (atomic_load(&pb->arrived))
+		return EBUSY;
+
+	/* Threads released by the last wait may still be leaving it */
+	while (atomic_load_explicit(&pb->inside, memory_order_acquire))
+		sched_yield();
+
+	if (pb->state == PB_HW)
+		fhwb_fini(pb->bd);
+
+	h->magic = 0;
+	h->pb = NULL;
+	free(pb);
+
+	return 0;
+}
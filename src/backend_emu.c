@@ -0,0 +1,111 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Emulation backend
+ *
+ * Barrier resources are managed by fujitsu_hwb driver interface and
+ * synchronization is performed by software barrier. This is used with
+ * the emulated device (libFJhwb-emu.so) on machines other than A64FX.
+ *
+ * The driver may hand a freed bd to another thread as soon as it is freed, so
+ * allocation and free of a bd are paired with setup and release of its software
+ * barrier under emu_mutex.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <pthread.h>
+#include <sched.h>
+
+static pthread_mutex_t emu_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int emu_init(struct fhwb_ctx *ctx, size_t pemask_size, cpu_set_t *pemask)
+{
+	int bd;
+	int ret;
+
+	pthread_mutex_lock(&emu_mutex);
+	bd = fhwb_dev_init(ctx, pemask_size, pemask);
+	if (bd >= 0) {
+		ret = fhwb_swb_setup(bd, CPU_COUNT_S(pemask_size, pemask));
+		if (ret < 0) {
+			fhwb_dev_fini(ctx, bd);
+			bd = ret;
+		}
+	}
+	pthread_mutex_unlock(&emu_mutex);
+
+	return bd;
+}
+
+static int emu_fini(struct fhwb_ctx *ctx, int bd)
+{
+	int ret;
+
+	pthread_mutex_lock(&emu_mutex);
+	ret = fhwb_dev_fini(ctx, bd);
+	if (ret == 0)
+		fhwb_swb_release(bd);
+	pthread_mutex_unlock(&emu_mutex);
+
+	return ret;
+}
+
+static int emu_remask(struct fhwb_ctx *ctx, int bd, size_t pemask_size, cpu_set_t *pemask)
+{
+	int ret;
+
+	ret = fhwb_dev_remask(ctx, bd, pemask_size, pemask);
+	if (ret < 0)
+		return ret;
+
+	fhwb_swb_remask(bd, CPU_COUNT_S(pemask_size, pemask));
+
+	return 0;
+}
+
+static int emu_assign(struct fhwb_ctx *ctx, int bd, int window)
+{
+	int ret;
+
+	ret = fhwb_dev_assign(ctx, bd, window);
+	if (ret < 0)
+		return ret;
+
+	fhwb_swb_attach(bd, ret);
+
+	return ret;
+}
+
+static int emu_unassign(struct fhwb_ctx *ctx, int bd)
+{
+	int ret;
+
+	ret = fhwb_dev_unassign(ctx, bd);
+	if (ret < 0)
+		return ret;
+
+	fhwb_swb_detach(bd);
+
+	return 0;
+}
+
+const struct fhwb_backend fhwb_backend_emu = {
+	.name = "emu",
+	.init = emu_init,
+	.fini = emu_fini,
+	.assign = emu_assign,
+	.unassign = emu_unassign,
+	.remask = emu_remask,
+	.sync = fhwb_swb_sync,
+	.sync_timeout = fhwb_swb_sync_timeout,
+	.arrive = fhwb_swb_arrive,
+	.test = fhwb_swb_test,
+	.wait = fhwb_swb_wait,
+	.get_pe_info = fhwb_dev_get_pe_info,
+	.load_topology = fhwb_dev_load_topology,
+};
@@ -0,0 +1,278 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Hardware barrier backend (fujitsu_hwb driver + BST_SYNC/LBSY_SYNC registers)
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#ifdef __aarch64__
+
+#include <errno.h>
+#include <stdbool.h>
+
+/* Read LBSY bit of window register @reg */
+#define READ_LBSY(reg) ({ \
+	unsigned long __lbsy; \
+	asm volatile("mrs %0, " #reg : "=r"(__lbsy) : : "memory"); \
+	__lbsy & 1; \
+})
+
+/* Write BST bit of window register @reg */
+#define WRITE_BST(reg, val) \
+	asm volatile("msr " #reg ", %0" : : "r"((unsigned long)(val)) : "memory")
+
+/* Window state of calling thread used by hwb_sync_timeout() */
+struct hwb_window {
+	/* BST was written but LBSY has not changed yet (timed out) */
+	bool pending;
+	/* BST value written (LBSY becomes this value when the phase completes) */
+	unsigned long token;
+};
+
+static __thread struct hwb_window hwb_windows[FHWB_WINDOW_3 + 1];
+
+static inline unsigned long read_lbsy(int window)
+{
+	switch (window) {
+	case 0:
+		return READ_LBSY(s3_3_c15_c15_0);
+	case 1:
+		return READ_LBSY(s3_3_c15_c15_1);
+	case 2:
+		return READ_LBSY(s3_3_c15_c15_2);
+	default:
+		return READ_LBSY(s3_3_c15_c15_3);
+	}
+}
+
+static inline void write_bst(int window, unsigned long bst)
+{
+	switch (window) {
+	case 0:
+		WRITE_BST(s3_3_c15_c15_0, bst);
+		break;
+	case 1:
+		WRITE_BST(s3_3_c15_c15_1, bst);
+		break;
+	case 2:
+		WRITE_BST(s3_3_c15_c15_2, bst);
+		break;
+	default:
+		WRITE_BST(s3_3_c15_c15_3, bst);
+		break;
+	}
+}
+
+static inline uint64_t read_cntvct(void)
+{
+	uint64_t val;
+
+	asm volatile("isb; mrs %0, cntvct_el0" : "=r"(val) : : "memory");
+
+	return val;
+}
+
+/* Convert @ns to the number of generic timer ticks (saturated) */
+static uint64_t ns_to_ticks(uint64_t ns)
+{
+	unsigned __int128 ticks;
+	uint64_t freq;
+
+	asm volatile("mrs %0, cntfrq_el0" : "=r"(freq));
+	ticks = (unsigned __int128)ns * freq / 1000000000;
+
+	return ticks > UINT64_MAX ? UINT64_MAX : (uint64_t)ticks;
+}
+
+/*
+ * Complete the phase whose BST was written by hwb_sync_timeout() which timed out,
+ * instead of arriving at the next phase
+ */
+static void hwb_sync_pending(int window)
+{
+	struct hwb_window *w = &hwb_windows[window];
+	uint64_t start = 0;
+
+	if (FHWB_STATS)
+		start = fhwb_read_clock();
+	asm volatile("sevl" : : : "memory");
+	do {
+		asm volatile("wfe" : : : "memory");
+	} while (read_lbsy(window) != w->token);
+	w->pending = false;
+	if (FHWB_STATS)
+		fhwb_stats_sync(window, fhwb_read_clock() - start);
+}
+
+/* hwb_sync() which also counts statistics (only waiting PEs read the clock) */
+static void hwb_sync_stats(int window)
+{
+	unsigned long token = ~read_lbsy(window) & 1;
+	uint64_t start;
+
+	write_bst(window, token);
+	if (read_lbsy(window) == token) {
+		fhwb_stats_sync(window, 0);
+		return;
+	}
+
+	start = fhwb_read_clock();
+	asm volatile("sevl" : : : "memory");
+	do {
+		asm volatile("wfe" : : : "memory");
+	} while (read_lbsy(window) != token);
+	fhwb_stats_sync(window, fhwb_read_clock() - start);
+}
+
+static void hwb_sync(int window)
+{
+	if (window >= 0 && window <= FHWB_WINDOW_3 &&
+			__builtin_expect(hwb_windows[window].pending, 0)) {
+		hwb_sync_pending(window);
+		return;
+	}
+
+	if (FHWB_STATS && window >= 0 && window <= FHWB_WINDOW_3) {
+		hwb_sync_stats(window);
+		return;
+	}
+
+	switch (window) {
+	case 0:
+		FHWB_SYNC_REG(s3_3_c15_c15_0);
+		break;
+	case 1:
+		FHWB_SYNC_REG(s3_3_c15_c15_1);
+		break;
+	case 2:
+		FHWB_SYNC_REG(s3_3_c15_c15_2);
+		break;
+	case 3:
+		FHWB_SYNC_REG(s3_3_c15_c15_3);
+		break;
+	default:
+		fhwb_error("window number is invalid: %d", window);
+		break;
+	}
+}
+
+/*
+ * The same as SYNC() but the wait loop also checks elapsed time by cntvct_el0.
+ * WFE wakes up at least by the event stream of generic timer, which Linux
+ * enables at 10kHz, so timeout is detected in ~100us even if no event comes.
+ */
+static int hwb_sync_timeout(int window, uint64_t timeout_ns)
+{
+	struct hwb_window *w;
+	uint64_t ticks;
+	uint64_t start;
+
+	if (window < 0 || window > FHWB_WINDOW_3) {
+		fhwb_error("window number is invalid: %d", window);
+		return -EINVAL;
+	}
+
+	w = &hwb_windows[window];
+	if (!w->pending) {
+		w->token = ~read_lbsy(window) & 1;
+		write_bst(window, w->token);
+		w->pending = true;
+	}
+
+	ticks = ns_to_ticks(timeout_ns);
+	start = read_cntvct();
+	asm volatile("sevl" : : : "memory");
+	do {
+		asm volatile("wfe" : : : "memory");
+		if (read_lbsy(window) == w->token) {
+			w->pending = false;
+			return 0;
+		}
+	} while (read_cntvct() - start < ticks);
+
+	return -ETIMEDOUT;
+}
+
+static int hwb_arrive(int window)
+{
+	struct hwb_window *w;
+	unsigned long token;
+
+	if (window < 0 || window > FHWB_WINDOW_3) {
+		fhwb_error("window number is invalid: %d", window);
+		return -EINVAL;
+	}
+
+	w = &hwb_windows[window];
+	if (w->pending) {
+		/* The phase which hwb_sync_timeout() gave up waiting */
+		w->pending = false;
+		return w->token;
+	}
+
+	token = ~read_lbsy(window) & 1;
+	write_bst(window, token);
+
+	return token;
+}
+
+static int hwb_test(int window, int token)
+{
+	if (window < 0 || window > FHWB_WINDOW_3) {
+		fhwb_error("window number is invalid: %d", window);
+		return -EINVAL;
+	}
+
+	return read_lbsy(window) == (unsigned long)token;
+}
+
+static int hwb_wait(int window, int token)
+{
+	if (window < 0 || window > FHWB_WINDOW_3) {
+		fhwb_error("window number is invalid: %d", window);
+		return -EINVAL;
+	}
+
+	asm volatile("sevl" : : : "memory");
+	do {
+		asm volatile("wfe" : : : "memory");
+	} while (read_lbsy(window) != (unsigned long)token);
+
+	return 0;
+}
+
+static int hwb_assign(struct fhwb_ctx *ctx, int bd, int window)
+{
+	int ret;
+
+	ret = fhwb_dev_assign(ctx, bd, window);
+	if (ret < 0)
+		return ret;
+
+	/* Forget the phase timed out on the previous assignment */
+	hwb_windows[ret].pending = false;
+
+	return ret;
+}
+
+const struct fhwb_backend fhwb_backend_hwb = {
+	.name = "hwb",
+	.init = fhwb_dev_init,
+	.fini = fhwb_dev_fini,
+	.assign = hwb_assign,
+	.unassign = fhwb_dev_unassign,
+	.sync = hwb_sync,
+	.sync_timeout = hwb_sync_timeout,
+	.arrive = hwb_arrive,
+	.test = hwb_test,
+	.wait = hwb_wait,
+	.get_pe_info = fhwb_dev_get_pe_info,
+	.load_topology = fhwb_dev_load_topology,
+};
+
+#endif /* __aarch64__ */
@@ -0,0 +1,768 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Software barrier backend
+ *
+ * Barrier blade/window resources are emulated in the library with the same
+ * rules as fujitsu_hwb driver, and synchronization is performed by
+ * a sense-reversing barrier on shared memory (fhwb_swbar, also used by other
+ * modules). PEs are grouped into CMGs of FHWB_SW_PE_PER_CMG by cpuid.
+ * Resources are shared by all contexts (fhwb_ctx_t) of the process.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/sysinfo.h>
+#include <time.h>
+#include <unistd.h>
+
+/* State of one barrier blade */
+struct sw_blade {
+	/* bar.gen is incremented when the bb is freed to release waiting PEs */
+	struct fhwb_swbar bar;
+
+	/* below is only changed under sw_mutex */
+	bool used __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+	cpu_set_t mask;
+};
+
+/* Barrier window state of one PE (bb number or -1 for each window) */
+struct sw_pe {
+	int8_t bb[FHWB_SW_NUM_BW];
+};
+
+/* Barrier window state of calling thread */
+struct sw_window {
+	struct sw_blade *blade;
+	unsigned int gen;
+	/* arrived at a phase which is not completed yet (fhwb_sync_timeout() timed out) */
+	bool pending;
+	/* sense value which completes the pending phase */
+	unsigned int token;
+};
+
+static pthread_mutex_t sw_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t sw_once = PTHREAD_ONCE_INIT;
+
+/* Blades of each CMG (allocated upon first use) */
+static struct sw_blade *sw_blades[FHWB_BD_CMG_MASK + 1];
+static struct sw_pe *sw_pes;
+static int sw_num_pe;
+static int sw_num_cmg;
+
+static __thread struct sw_window sw_windows[FHWB_SW_NUM_BW];
+
+static void sw_setup(void)
+{
+	int i, j;
+
+	sw_num_pe = get_nprocs_conf();
+	sw_num_cmg = (sw_num_pe + FHWB_SW_PE_PER_CMG - 1) / FHWB_SW_PE_PER_CMG;
+
+	sw_pes = malloc(sizeof(struct sw_pe) * sw_num_pe);
+	if (!sw_pes)
+		return;
+	for (i = 0; i < sw_num_pe; i++)
+		for (j = 0; j < FHWB_SW_NUM_BW; j++)
+			sw_pes[i].bb[j] = -1;
+
+	fhwb_debug("software barrier: %d PE, %d CMG", sw_num_pe, sw_num_cmg);
+}
+
+static inline int sw_ready(void)
+{
+	pthread_once(&sw_once, sw_setup);
+
+	return sw_pes != NULL;
+}
+
+/*
+ * Return blade of @bd (NULL if @bd is out of range).
+ * If @alloc is true, memory of the CMG is allocated when needed. Called under sw_mutex.
+ */
+static struct sw_blade *lookup_blade(int bd, bool alloc)
+{
+	int cmg = fhwb_get_cmg_from_bd(bd);
+	int bb = fhwb_get_bb_from_bd(bd);
+	struct sw_blade *blades;
+
+	if (bd < 0 || bb >= FHWB_SW_NUM_BB)
+		return NULL;
+
+	blades = sw_blades[cmg];
+	if (!blades && alloc) {
+		if (posix_memalign((void **)&blades, FHWB_CACHE_LINE_SIZE,
+					sizeof(struct sw_blade) * FHWB_SW_NUM_BB))
+			return NULL;
+		memset(blades, 0, sizeof(struct sw_blade) * FHWB_SW_NUM_BB);
+		sw_blades[cmg] = blades;
+	}
+	if (!blades)
+		return NULL;
+
+	return &blades[bb];
+}
+
+/* Return blade of @bd if it is allocated, otherwise NULL. Called under sw_mutex */
+static struct sw_blade *get_blade(int bd)
+{
+	struct sw_blade *blade = lookup_blade(bd, false);
+
+	if (!blade || !blade->used)
+		return NULL;
+
+	return blade;
+}
+
+/* Set the number of PEs and spin count of @bar and reset its arrival count */
+void fhwb_swbar_init(struct fhwb_swbar *bar, unsigned int nr_pe)
+{
+	bar->nr_pe = nr_pe;
+	bar->spin_count = fhwb_spin_count();
+	atomic_store(&bar->count, 0);
+}
+
+/* Flip sense to release all PEs waiting on @bar */
+void fhwb_swbar_release(struct fhwb_swbar *bar)
+{
+	atomic_fetch_xor(&bar->sense, 1);
+	if (atomic_load(&bar->sleepers))
+		fhwb_futex_wake(&bar->sense);
+}
+
+void fhwb_swbar_abort(struct fhwb_swbar *bar)
+{
+	atomic_fetch_add(&bar->gen, 1);
+	fhwb_swbar_release(bar);
+}
+
+bool fhwb_swbar_join(struct fhwb_swbar *bar, unsigned int gen, unsigned int *token)
+{
+	/* The same as hardware, next phase is decided from current LBSY (sense) value */
+	*token = atomic_load_explicit(&bar->sense, memory_order_acquire) ^ 1;
+	if (atomic_load_explicit(&bar->gen, memory_order_relaxed) != gen)
+		return false;
+
+	if (atomic_fetch_add_explicit(&bar->count, 1, memory_order_acq_rel) + 1 != bar->nr_pe)
+		return false;
+
+	atomic_store_explicit(&bar->count, 0, memory_order_relaxed);
+
+	return true;
+}
+
+unsigned int fhwb_swbar_arrive(struct fhwb_swbar *bar, unsigned int gen)
+{
+	unsigned int token;
+
+	if (fhwb_swbar_join(bar, gen, &token))
+		fhwb_swbar_release(bar);
+
+	return token;
+}
+
+static bool deadline_passed(const struct timespec *deadline)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	return now.tv_sec > deadline->tv_sec ||
+		(now.tv_sec == deadline->tv_sec && now.tv_nsec >= deadline->tv_nsec);
+}
+
+int fhwb_swbar_wait(struct fhwb_swbar *bar, unsigned int gen, unsigned int token,
+		    const struct timespec *deadline)
+{
+	int spin;
+
+	for (spin = 0; !fhwb_swbar_done(bar, gen, token); spin++) {
+		if (spin < bar->spin_count) {
+			fhwb_cpu_relax();
+			continue;
+		}
+
+		if (deadline && deadline_passed(deadline))
+			return -ETIMEDOUT;
+
+		atomic_fetch_add(&bar->sleepers, 1);
+		fhwb_futex_wait(&bar->sense, token ^ 1, deadline);
+		atomic_fetch_sub(&bar->sleepers, 1);
+	}
+
+	return 0;
+}
+
+/* Mark @blade as used by @nr_pe PEs. Called under sw_mutex */
+static void setup_blade(struct sw_blade *blade, int nr_pe)
+{
+	blade->used = true;
+	fhwb_swbar_init(&blade->bar, nr_pe);
+}
+
+/* Free @blade and let PEs waiting on it return. Called under sw_mutex */
+static void free_blade(struct sw_blade *blade)
+{
+	blade->used = false;
+	fhwb_swbar_abort(&blade->bar);
+}
+
+/* Bind @window of calling thread to @blade */
+static void attach_window(int window, struct sw_blade *blade)
+{
+	sw_windows[window].blade = blade;
+	sw_windows[window].gen = atomic_load(&blade->bar.gen);
+	sw_windows[window].pending = false;
+}
+
+int fhwb_swb_setup(int bd, int nr_pe)
+{
+	struct sw_blade *blade;
+
+	if (!sw_ready())
+		return -ENOMEM;
+
+	pthread_mutex_lock(&sw_mutex);
+	blade = lookup_blade(bd, true);
+	if (blade)
+		setup_blade(blade, nr_pe);
+	pthread_mutex_unlock(&sw_mutex);
+
+	return blade ? 0 : -ENOMEM;
+}
+
+void fhwb_swb_release(int bd)
+{
+	struct sw_blade *blade;
+
+	pthread_mutex_lock(&sw_mutex);
+	blade = get_blade(bd);
+	if (blade)
+		free_blade(blade);
+	pthread_mutex_unlock(&sw_mutex);
+}
+
+void fhwb_swb_remask(int bd, int nr_pe)
+{
+	struct sw_blade *blade;
+
+	pthread_mutex_lock(&sw_mutex);
+	blade = get_blade(bd);
+	if (blade)
+		setup_blade(blade, nr_pe);
+	pthread_mutex_unlock(&sw_mutex);
+}
+
+void fhwb_swb_attach(int bd, int window)
+{
+	struct sw_blade *blade;
+
+	pthread_mutex_lock(&sw_mutex);
+	blade = get_blade(bd);
+	if (blade)
+		attach_window(window, blade);
+	pthread_mutex_unlock(&sw_mutex);
+}
+
+void fhwb_swb_detach(int bd)
+{
+	struct sw_blade *blade;
+	int i;
+
+	pthread_mutex_lock(&sw_mutex);
+	blade = lookup_blade(bd, false);
+	for (i = 0; i < FHWB_SW_NUM_BW; i++)
+		if (blade && sw_windows[i].blade == blade)
+			sw_windows[i].blade = NULL;
+	pthread_mutex_unlock(&sw_mutex);
+}
+
+/* Check @pemask is at least 2 PEs of one CMG and return the number of PEs */
+static int check_pemask(size_t pemask_size, cpu_set_t *pemask, int *cmg)
+{
+	int nr_pe = 0;
+	int i;
+
+	*cmg = -1;
+	for (i = 0; i < (int)(pemask_size * 8); i++) {
+		if (!CPU_ISSET_S(i, pemask_size, pemask))
+			continue;
+
+		if (i >= sw_num_pe) {
+			fhwb_error("pemask contains invalid cpu: %d", i);
+			return -EINVAL;
+		}
+		if (*cmg < 0) {
+			*cmg = i / FHWB_SW_PE_PER_CMG;
+		} else if (*cmg != i / FHWB_SW_PE_PER_CMG) {
+			fhwb_error("pemask contains PEs of several CMGs");
+			return -EINVAL;
+		}
+		nr_pe++;
+	}
+
+	/* Synchronization needs at least 2 PEs */
+	if (nr_pe < 2) {
+		fhwb_error("pemask contains less than 2 PEs");
+		return -EINVAL;
+	}
+
+	return nr_pe;
+}
+
+static int sw_init(struct fhwb_ctx *ctx, size_t pemask_size, cpu_set_t *pemask)
+{
+	struct sw_blade *blade = NULL;
+	int nr_pe;
+	int cmg;
+	int bb;
+	int i;
+
+	(void)ctx;
+
+	if (!sw_ready())
+		return -ENOMEM;
+
+	nr_pe = check_pemask(pemask_size, pemask, &cmg);
+	if (nr_pe < 0)
+		return nr_pe;
+
+	pthread_mutex_lock(&sw_mutex);
+
+	for (bb = 0; bb < FHWB_SW_NUM_BB; bb++) {
+		blade = lookup_blade(make_bd(cmg, bb), true);
+		if (!blade) {
+			pthread_mutex_unlock(&sw_mutex);
+			return -ENOMEM;
+		}
+		if (!blade->used)
+			break;
+	}
+	if (bb == FHWB_SW_NUM_BB) {
+		pthread_mutex_unlock(&sw_mutex);
+		fhwb_alloc_error(-EBUSY, "all BB in CMG %d is currently used", cmg);
+		return -EBUSY;
+	}
+
+	CPU_ZERO(&blade->mask);
+	for (i = 0; i < sw_num_pe; i++)
+		if (CPU_ISSET_S(i, pemask_size, pemask))
+			CPU_SET(i, &blade->mask);
+	setup_blade(blade, nr_pe);
+
+	pthread_mutex_unlock(&sw_mutex);
+
+	fhwb_debug("Allocate BB. CMG: %d, BB: %d, bd: 0x%x", cmg, bb, make_bd(cmg, bb));
+
+	return make_bd(cmg, bb);
+}
+
+static int sw_fini(struct fhwb_ctx *ctx, int bd)
+{
+	struct sw_blade *blade;
+	int cmg = fhwb_get_cmg_from_bd(bd);
+	int bb = fhwb_get_bb_from_bd(bd);
+	int i, j;
+
+	(void)ctx;
+
+	if (!sw_ready())
+		return -EINVAL;
+
+	pthread_mutex_lock(&sw_mutex);
+
+	blade = get_blade(bd);
+	if (!blade) {
+		pthread_mutex_unlock(&sw_mutex);
+		fhwb_error("BB is not allocated. CMG: %d, BB: %d, bd: 0x%x", cmg, bb, bd);
+		return -EINVAL;
+	}
+
+	/* Like the driver, free windows which are still assigned to the bb */
+	for (i = 0; i < sw_num_pe; i++) {
+		if (!CPU_ISSET(i, &blade->mask))
+			continue;
+		for (j = 0; j < FHWB_SW_NUM_BW; j++)
+			if (sw_pes[i].bb[j] == bb)
+				sw_pes[i].bb[j] = -1;
+	}
+
+	free_blade(blade);
+
+	pthread_mutex_unlock(&sw_mutex);
+
+	fhwb_debug("Free BB. CMG: %d, BB: %d, bd: 0x%x", cmg, bb, bd);
+
+	return 0;
+}
+
+static int sw_remask(struct fhwb_ctx *ctx, int bd, size_t pemask_size, cpu_set_t *pemask)
+{
+	struct sw_blade *blade;
+	int cmg = fhwb_get_cmg_from_bd(bd);
+	int bb = fhwb_get_bb_from_bd(bd);
+	int new_cmg;
+	int nr_pe;
+	int i, j;
+
+	(void)ctx;
+
+	if (!sw_ready())
+		return -EINVAL;
+
+	nr_pe = check_pemask(pemask_size, pemask, &new_cmg);
+	if (nr_pe < 0)
+		return nr_pe;
+	if (new_cmg != cmg) {
+		fhwb_error("pemask contains PEs of other CMG than BB. CMG: %d, BB: %d, bd: 0x%x", cmg, bb, bd);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&sw_mutex);
+
+	blade = get_blade(bd);
+	if (!blade) {
+		pthread_mutex_unlock(&sw_mutex);
+		fhwb_error("BB is not allocated. CMG: %d, BB: %d, bd: 0x%x", cmg, bb, bd);
+		return -EINVAL;
+	}
+
+	/* Like the driver, leaving PEs must have unassigned their windows */
+	for (i = 0; i < sw_num_pe; i++) {
+		if (!CPU_ISSET(i, &blade->mask) || (i < (int)(pemask_size * 8) && CPU_ISSET_S(i, pemask_size, pemask)))
+			continue;
+		for (j = 0; j < FHWB_SW_NUM_BW; j++) {
+			if (sw_pes[i].bb[j] == bb) {
+				pthread_mutex_unlock(&sw_mutex);
+				fhwb_error("leaving PE %d is still assigned to window %d. CMG: %d, BB: %d", i, j, cmg, bb);
+				return -EBUSY;
+			}
+		}
+	}
+
+	CPU_ZERO(&blade->mask);
+	for (i = 0; i < sw_num_pe; i++)
+		if (CPU_ISSET_S(i, pemask_size, pemask))
+			CPU_SET(i, &blade->mask);
+	setup_blade(blade, nr_pe);
+
+	pthread_mutex_unlock(&sw_mutex);
+
+	fhwb_debug("Change PEs of BB. CMG: %d, BB: %d, bd: 0x%x", cmg, bb, bd);
+
+	return 0;
+}
+
+static int sw_assign(struct fhwb_ctx *ctx, int bd, int window)
+{
+	struct sw_blade *blade;
+	struct sw_pe *pe;
+	int cmg = fhwb_get_cmg_from_bd(bd);
+	int bb = fhwb_get_bb_from_bd(bd);
+	int cpu;
+	int i;
+
+	(void)ctx;
+
+	if (!sw_ready())
+		return -EINVAL;
+
+	cpu = fhwb_get_bound_cpu();
+	if (cpu < 0 || cpu >= sw_num_pe) {
+		fhwb_error("caller is not bound to one PE");
+		return -EPERM;
+	}
+
+	if (window < -1 || window >= FHWB_SW_NUM_BW) {
+		fhwb_error("window number is invalid: %d", window);
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&sw_mutex);
+
+	blade = get_blade(bd);
+	if (!blade || !CPU_ISSET(cpu, &blade->mask)) {
+		pthread_mutex_unlock(&sw_mutex);
+		fhwb_error("BB is not allocated or PE does not join synchronization. CMG: %d, BB: %d, bd: 0x%x",
+					cmg, bb, bd);
+		return -EINVAL;
+	}
+
+	pe = &sw_pes[cpu];
+	for (i = 0; i < FHWB_SW_NUM_BW; i++) {
+		if (pe->bb[i] == bb) {
+			pthread_mutex_unlock(&sw_mutex);
+			fhwb_error("PE is already assigned to window %d. CMG: %d, BB: %d", i, cmg, bb);
+			return -EINVAL;
+		}
+	}
+
+	if (window == -1) {
+		for (i = 0; i < FHWB_SW_NUM_BW; i++)
+			if (pe->bb[i] < 0)
+				break;
+		window = i;
+	}
+	if (window == FHWB_SW_NUM_BW || pe->bb[window] >= 0) {
+		pthread_mutex_unlock(&sw_mutex);
+		fhwb_error("barrier window is busy. CMG: %d, BB: %d", cmg, bb);
+		return -EBUSY;
+	}
+
+	pe->bb[window] = bb;
+	attach_window(window, blade);
+
+	pthread_mutex_unlock(&sw_mutex);
+
+	fhwb_debug("Assign window. CMG: %d, BB: %d, window: %d, bd: 0x%x", cmg, bb, window, bd);
+
+	return window;
+}
+
+static int sw_unassign(struct fhwb_ctx *ctx, int bd)
+{
+	struct sw_blade *blade;
+	struct sw_pe *pe;
+	int cmg = fhwb_get_cmg_from_bd(bd);
+	int bb = fhwb_get_bb_from_bd(bd);
+	int cpu;
+	int i;
+
+	(void)ctx;
+
+	if (!sw_ready())
+		return -EINVAL;
+
+	cpu = fhwb_get_bound_cpu();
+	if (cpu < 0 || cpu >= sw_num_pe) {
+		fhwb_error("caller is not bound to one PE");
+		return -EPERM;
+	}
+
+	pthread_mutex_lock(&sw_mutex);
+
+	blade = get_blade(bd);
+	if (!blade) {
+		pthread_mutex_unlock(&sw_mutex);
+		fhwb_error("BB is not allocated. CMG: %d, BB: %d, bd: 0x%x", cmg, bb, bd);
+		return -EINVAL;
+	}
+
+	pe = &sw_pes[cpu];
+	for (i = 0; i < FHWB_SW_NUM_BW; i++)
+		if (pe->bb[i] == bb)
+			break;
+	if (i == FHWB_SW_NUM_BW) {
+		pthread_mutex_unlock(&sw_mutex);
+		fhwb_error("PE is not assigned to a window. CMG: %d, BB: %d, bd: 0x%x", cmg, bb, bd);
+		return -EINVAL;
+	}
+
+	pe->bb[i] = -1;
+	sw_windows[i].blade = NULL;
+
+	pthread_mutex_unlock(&sw_mutex);
+
+	fhwb_debug("Unassign window. CMG: %d, BB: %d, bd: 0x%x", cmg, bb, bd);
+
+	return 0;
+}
+
+/* Return state of @window of calling thread, or NULL if @window cannot be used */
+static struct sw_window *get_window(int window)
+{
+	struct sw_window *w;
+
+	if (window < 0 || window >= FHWB_SW_NUM_BW) {
+		fhwb_error("window number is invalid: %d", window);
+		return NULL;
+	}
+
+	w = &sw_windows[window];
+	if (!w->blade) {
+		/* Accessing unassigned window register traps on hardware */
+		raise(SIGILL);
+		return NULL;
+	}
+
+	return w;
+}
+
+/* Arrive at current phase of @w and return the sense value which completes the phase */
+static inline unsigned int window_arrive(struct sw_window *w)
+{
+	return fhwb_swbar_arrive(&w->blade->bar, w->gen);
+}
+
+/* Check the phase completed by @token has completed (or the bb has been freed) */
+static inline bool window_done(struct sw_window *w, unsigned int token)
+{
+	return fhwb_swbar_done(&w->blade->bar, w->gen, token);
+}
+
+/*
+ * Wait until the phase completed by @token completes.
+ * Give up at absolute CLOCK_MONOTONIC @deadline if it is not NULL.
+ */
+static inline int window_wait(struct sw_window *w, unsigned int token, const struct timespec *deadline)
+{
+	return fhwb_swbar_wait(&w->blade->bar, w->gen, token, deadline);
+}
+
+void fhwb_swb_sync(int window)
+{
+	struct sw_window *w;
+	unsigned int token;
+
+	w = get_window(window);
+	if (!w)
+		return;
+
+	if (w->pending) {
+		/* Complete the phase which fhwb_sync_timeout() gave up waiting */
+		token = w->token;
+		w->pending = false;
+	} else {
+		token = window_arrive(w);
+	}
+
+	/* Measure waiting time only if other PEs have not arrived yet */
+	if (FHWB_STATS && !window_done(w, token)) {
+		uint64_t start = fhwb_read_clock();
+
+		window_wait(w, token, NULL);
+		fhwb_stats_sync(window, fhwb_read_clock() - start);
+		return;
+	}
+
+	window_wait(w, token, NULL);
+	fhwb_stats_sync(window, 0);
+}
+
+int fhwb_swb_sync_timeout(int window, uint64_t timeout_ns)
+{
+	struct timespec deadline;
+	struct sw_window *w;
+	int ret;
+
+	w = get_window(window);
+	if (!w)
+		return -EINVAL;
+
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += timeout_ns / 1000000000;
+	deadline.tv_nsec += timeout_ns % 1000000000;
+	if (deadline.tv_nsec >= 1000000000) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000;
+	}
+
+	if (!w->pending) {
+		w->token = window_arrive(w);
+		w->pending = true;
+	}
+
+	ret = window_wait(w, w->token, &deadline);
+	if (ret == 0)
+		w->pending = false;
+
+	return ret;
+}
+
+int fhwb_swb_arrive(int window)
+{
+	struct sw_window *w;
+
+	w = get_window(window);
+	if (!w)
+		return -EINVAL;
+
+	if (w->pending) {
+		/* The phase which fhwb_sync_timeout() gave up waiting */
+		w->pending = false;
+		return w->token;
+	}
+
+	return window_arrive(w);
+}
+
+int fhwb_swb_test(int window, int token)
+{
+	struct sw_window *w;
+
+	w = get_window(window);
+	if (!w)
+		return -EINVAL;
+
+	return window_done(w, token);
+}
+
+int fhwb_swb_wait(int window, int token)
+{
+	struct sw_window *w;
+
+	w = get_window(window);
+	if (!w)
+		return -EINVAL;
+
+	return window_wait(w, token, NULL);
+}
+
+static int sw_get_pe_info(struct fhwb_pe_info *info)
+{
+	int cpu;
+
+	cpu = sched_getcpu();
+	if (cpu < 0) {
+		fhwb_error("sched_getcpu failed: %m");
+		return -errno;
+	}
+
+	info->cmg = cpu / FHWB_SW_PE_PER_CMG;
+	info->physical_pe = cpu % FHWB_SW_PE_PER_CMG;
+
+	fhwb_debug("PE info (CPU %d) ... CMG: %u, Physical PE: %u",
+				cpu, info->cmg, info->physical_pe);
+
+	return 0;
+}
+
+static int sw_load_topology(struct fhwb_pe_info *list, int num_pe)
+{
+	int cpu;
+
+	for (cpu = 0; cpu < num_pe; cpu++) {
+		list[cpu].cmg = cpu / FHWB_SW_PE_PER_CMG;
+		list[cpu].physical_pe = cpu % FHWB_SW_PE_PER_CMG;
+	}
+
+	return 0;
+}
+
+const struct fhwb_backend fhwb_backend_sw = {
+	.name = "sw",
+	.init = sw_init,
+	.fini = sw_fini,
+	.assign = sw_assign,
+	.unassign = sw_unassign,
+	.remask = sw_remask,
+	.sync = fhwb_swb_sync,
+	.sync_timeout = fhwb_swb_sync_timeout,
+	.arrive = fhwb_swb_arrive,
+	.test = fhwb_swb_test,
+	.wait = fhwb_swb_wait,
+	.get_pe_info = sw_get_pe_info,
+	.load_topology = sw_load_topology,
+};
@@ -0,0 +1,159 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Binding of calling thread to the PE of its barrier windows
+ *
+ * fhwb_assign_on() binds an unpinned thread to a PE before fhwb_assign() and
+ * the affinity the thread had before is restored when its last window assigned
+ * by fhwb_assign_on() is released, either by fhwb_unassign_on(), fhwb_unassign()
+ * or fhwb_fini() of the thread.
+ *
+ * Window registers belong to the PE, so a thread moved to another PE after
+ * fhwb_assign() (e.g. by sched_setaffinity() of a runtime) synchronizes on
+ * windows of the other PE. In debug mode, the cpu of each window is recorded
+ * upon assign and fhwb_sync() reports the first migration of the thread.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+
+/* Window state of calling thread */
+struct bind_window {
+	int bd;      /* -1 if not assigned */
+	int cpu;     /* cpu upon assign (only in debug mode, otherwise -1) */
+	bool on;     /* assigned by fhwb_assign_on() */
+};
+
+static __thread struct bind_window bind_windows[FHWB_WINDOW_3 + 1] = {
+	{-1, -1, false}, {-1, -1, false}, {-1, -1, false}, {-1, -1, false},
+};
+/* cpu bound by fhwb_assign_on() and number of its windows */
+static __thread int bind_cpu = -1;
+static __thread int bind_count;
+/* Affinity before the first fhwb_assign_on() */
+static __thread cpu_set_t bind_saved;
+
+void fhwb_bind_attach(int bd, int window)
+{
+	struct bind_window *w = &bind_windows[window];
+
+	w->bd = bd;
+	w->cpu = fhwb_debug_enabled ? sched_getcpu() : -1;
+	w->on = false;
+}
+
+void fhwb_bind_detach(int bd)
+{
+	int i;
+
+	for (i = 0; i <= FHWB_WINDOW_3; i++) {
+		if (bind_windows[i].bd != bd)
+			continue;
+
+		/* The last window assigned by fhwb_assign_on() */
+		if (bind_windows[i].on && --bind_count == 0) {
+			bind_cpu = -1;
+			if (sched_setaffinity(0, sizeof(cpu_set_t), &bind_saved) < 0)
+				fhwb_debug("cannot restore affinity: %m");
+		}
+		bind_windows[i].bd = -1;
+		bind_windows[i].cpu = -1;
+		bind_windows[i].on = false;
+	}
+}
+
+void fhwb_bind_check(int window)
+{
+	struct bind_window *w;
+	int cpu;
+
+	if (window < 0 || window > FHWB_WINDOW_3)
+		return;
+
+	w = &bind_windows[window];
+	if (w->cpu < 0)
+		return;
+
+	cpu = sched_getcpu();
+	if (cpu >= 0 && cpu != w->cpu) {
+		fhwb_error("thread has moved from cpu %d to cpu %d after assigning window %d (bd: 0x%x)",
+				w->cpu, cpu, window, w->bd);
+		/* Report once */
+		w->cpu = -1;
+	}
+}
+
+int fhwb_assign_on(int bd, int cpu, int window)
+{
+	cpu_set_t set;
+	int ret;
+
+	if (cpu < 0 || cpu >= CPU_SETSIZE) {
+		fhwb_error("cpu is invalid: %d", cpu);
+		return -EINVAL;
+	}
+	if (bind_count > 0 && cpu != bind_cpu) {
+		fhwb_error("thread is already bound to cpu %d by fhwb_assign_on()", bind_cpu);
+		return -EINVAL;
+	}
+
+	if (bind_count == 0) {
+		if (sched_getaffinity(0, sizeof(cpu_set_t), &bind_saved) < 0) {
+			fhwb_error("sched_getaffinity failed: %m");
+			return -errno;
+		}
+
+		CPU_ZERO(&set);
+		CPU_SET(cpu, &set);
+		if (sched_setaffinity(0, sizeof(cpu_set_t), &set) < 0) {
+			ret = -errno;
+			fhwb_error("cannot bind thread to cpu %d: %m", cpu);
+			return ret;
+		}
+		/* The kernel moves the thread before returning from sched_setaffinity() */
+		if (sched_getcpu() != cpu) {
+			fhwb_error("thread does not run on cpu %d", cpu);
+			ret = -EPERM;
+			goto restore;
+		}
+	}
+
+	ret = fhwb_assign(bd, window);
+	if (ret < 0)
+		goto restore;
+
+	bind_windows[ret].on = true;
+	bind_cpu = cpu;
+	bind_count++;
+
+	return ret;
+
+restore:
+	if (bind_count == 0)
+		sched_setaffinity(0, sizeof(cpu_set_t), &bind_saved);
+
+	return ret;
+}
+
+int fhwb_unassign_on(int bd)
+{
+	int i;
+
+	for (i = 0; i <= FHWB_WINDOW_3; i++)
+		if (bind_windows[i].bd == bd && bind_windows[i].on)
+			break;
+	if (i > FHWB_WINDOW_3) {
+		fhwb_error("window of bd 0x%x is not assigned by fhwb_assign_on()", bd);
+		return -EINVAL;
+	}
+
+	/* fhwb_bind_detach() restores the affinity */
+	return fhwb_unassign(bd);
+}
@@ -0,0 +1,356 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Barrier resource management through fujitsu_hwb driver's ioctl
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "fujitsu_hpc_ioctl.h"
+#include "fujitsu_hwb_emu_ioctl.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+/*
+ * Barrier driver requires all threads joining synchronization shares the same fd.
+ * So, the context opens the file when its first bb is allocated (or when the
+ * topology is read) and keeps it while it has references.
+ *
+ * The default context used by fhwb_init() closes the file when the last bb is
+ * freed and opens it again later. An explicit context holds one reference of
+ * its owner until fhwb_ctx_close().
+ */
+struct fhwb_ctx fhwb_default_ctx = {
+	.state = FHWB_CTX_STATE(-1, 0),
+	.is_default = true,
+};
+
+int fhwb_ctx_get_fd(struct fhwb_ctx *ctx)
+{
+	uint64_t state = atomic_load(&ctx->state);
+	int fd;
+
+	for (;;) {
+		if (FHWB_CTX_COUNT(state) == 0 && !ctx->is_default) {
+			fhwb_error("context is closed");
+			return -EINVAL;
+		}
+
+		fd = FHWB_CTX_FD(state);
+		if (fd >= 0) {
+			if (atomic_compare_exchange_weak(&ctx->state, &state,
+							 FHWB_CTX_STATE(fd, FHWB_CTX_COUNT(state) + 1)))
+				return fd;
+			continue;
+		}
+
+		fhwb_debug("open device file");
+		fd = open(FHWB_DEV_FILE, O_RDONLY);
+		if (fd < 0) {
+			fhwb_error("open device file failed: %m");
+			return -errno;
+		}
+		if (atomic_compare_exchange_strong(&ctx->state, &state,
+						   FHWB_CTX_STATE(fd, FHWB_CTX_COUNT(state) + 1)))
+			return fd;
+
+		/* Another thread has opened the file or the context has changed */
+		close(fd);
+	}
+}
+
+void fhwb_ctx_put(struct fhwb_ctx *ctx)
+{
+	uint64_t state = atomic_load(&ctx->state);
+	uint64_t next;
+	int _errno;
+
+	do {
+		if (FHWB_CTX_COUNT(state) > 1)
+			next = state - 1;
+		else
+			next = FHWB_CTX_STATE(-1, 0);
+	} while (!atomic_compare_exchange_weak(&ctx->state, &state, next));
+
+	if (FHWB_CTX_COUNT(next) > 0)
+		return;
+
+	/* Nobody can take the fd any more */
+	if (FHWB_CTX_FD(state) >= 0) {
+		fhwb_debug("close device file");
+		/* Keep original errno in case close() fails */
+		_errno = errno;
+		close(FHWB_CTX_FD(state));
+		errno = _errno;
+	}
+	if (!ctx->is_default)
+		free(ctx);
+}
+
+/* fd of @ctx whose reference is held by a bb */
+static inline int get_fd(struct fhwb_ctx *ctx)
+{
+	return FHWB_CTX_FD(atomic_load_explicit(&ctx->state, memory_order_relaxed));
+}
+
+int fhwb_dev_available(void)
+{
+	int fd;
+
+	fd = open(FHWB_DEV_FILE, O_RDONLY);
+	if (fd < 0)
+		return 0;
+
+	close(fd);
+
+	return 1;
+}
+
+int fhwb_dev_init(struct fhwb_ctx *ctx, size_t pemask_size, cpu_set_t *pemask)
+{
+	struct fujitsu_hwb_ioc_bb_ctl ioc_bb_ctl = {0};
+	int fd = -1;
+	int bd = 0;
+	int ret = 0;
+
+	fd = fhwb_ctx_get_fd(ctx);
+	if (fd < 0)
+		return fd;
+
+	ioc_bb_ctl.size = pemask_size;
+	ioc_bb_ctl.pemask = (unsigned long *)pemask;
+	ret = ioctl(fd, FUJITSU_HWB_IOC_BB_ALLOC, &ioc_bb_ctl);
+	if (ret < 0) {
+		ret = -errno;
+		fhwb_alloc_error(ret, "ioctl FUJITSU_HWB_IOC_BB_ALLOC failed: %m");
+		fhwb_ctx_put(ctx);
+		return ret;
+	}
+
+	bd = make_bd(ioc_bb_ctl.cmg, ioc_bb_ctl.bb);
+	fhwb_debug("Allocate BB. CMG: %u, BB: %u, bd: 0x%x", ioc_bb_ctl.cmg, ioc_bb_ctl.bb, bd);
+
+	/* The reference is dropped in fhwb_fini() */
+
+	return bd;
+}
+
+int fhwb_dev_fini(struct fhwb_ctx *ctx, int bd)
+{
+	struct fujitsu_hwb_ioc_bb_ctl ioc_bb_ctl = {0};
+	int fd = -1;
+	int ret = 0;
+
+	fd = get_fd(ctx);
+	if (fd < 0) {
+		fhwb_error("get_fd failed. fhwb_init() is not called?");
+		return -EINVAL;
+	}
+
+	ioc_bb_ctl.cmg = fhwb_get_cmg_from_bd(bd);
+	ioc_bb_ctl.bb = fhwb_get_bb_from_bd(bd);
+	ret = ioctl(fd, FUJITSU_HWB_IOC_BB_FREE, &ioc_bb_ctl);
+	if (ret < 0) {
+		fhwb_error("ioctl FUJITSU_HWB_IOC_BB_FREE failed: %m, CMG: %u, BB: %u, bd: 0x%x",
+							ioc_bb_ctl.cmg, ioc_bb_ctl.bb, bd);
+		/* Something is wrong, do not close fd */
+		fhwb_stats_ioctl_error(bd);
+		return -errno;
+	}
+
+	fhwb_debug("Free BB. CMG: %u, BB: %u, bd: 0x%x", ioc_bb_ctl.cmg, ioc_bb_ctl.bb, bd);
+	fhwb_ctx_put(ctx);
+
+	return 0;
+}
+
+int fhwb_dev_remask(struct fhwb_ctx *ctx, int bd, size_t pemask_size, cpu_set_t *pemask)
+{
+	struct fujitsu_hwb_ioc_bb_ctl ioc_bb_ctl = {0};
+	int fd = -1;
+	int ret = 0;
+
+	fd = get_fd(ctx);
+	if (fd < 0) {
+		fhwb_error("get_fd failed. fhwb_init() is not called?");
+		return -EINVAL;
+	}
+
+	ioc_bb_ctl.cmg = fhwb_get_cmg_from_bd(bd);
+	ioc_bb_ctl.bb = fhwb_get_bb_from_bd(bd);
+	ioc_bb_ctl.size = pemask_size;
+	ioc_bb_ctl.pemask = (unsigned long *)pemask;
+	ret = ioctl(fd, FUJITSU_HWB_EMU_IOC_BB_REMASK, &ioc_bb_ctl);
+	if (ret < 0) {
+		ret = -errno;
+		/* Only the emulator implements the ioctl */
+		if (ret == -ENOTTY) {
+			fhwb_error("driver does not support changing PEs of BB");
+			return -EOPNOTSUPP;
+		}
+		fhwb_error("ioctl FUJITSU_HWB_EMU_IOC_BB_REMASK failed: %m, CMG: %u, BB: %u, bd: 0x%x",
+							ioc_bb_ctl.cmg, ioc_bb_ctl.bb, bd);
+		if (ret != -EBUSY)
+			fhwb_stats_ioctl_error(bd);
+		return ret;
+	}
+
+	fhwb_debug("Change PEs of BB. CMG: %u, BB: %u, bd: 0x%x", ioc_bb_ctl.cmg, ioc_bb_ctl.bb, bd);
+
+	return 0;
+}
+
+int fhwb_dev_assign(struct fhwb_ctx *ctx, int bd, int window)
+{
+	struct fujitsu_hwb_ioc_bw_ctl ioc_bw_ctl = {0};
+	int fd = -1;
+	int ret = 0;
+
+	fd = get_fd(ctx);
+	if (fd < 0) {
+		fhwb_error("get_fd failed. fhwb_init() is not called?");
+		return -EINVAL;
+	}
+
+	ioc_bw_ctl.bb = fhwb_get_bb_from_bd(bd);
+	ioc_bw_ctl.window = window;
+	ret = ioctl(fd, FUJITSU_HWB_IOC_BW_ASSIGN, &ioc_bw_ctl);
+	if (ret < 0) {
+		fhwb_error("ioctl FUJITSU_HWB_IOC_BW_ASSIGN failed: %m, CMG: %u, BB: %u, window: %u, bd: 0x%x",
+					fhwb_get_cmg_from_bd(bd), fhwb_get_bb_from_bd(bd), ioc_bw_ctl.window, bd);
+		fhwb_stats_ioctl_error(bd);
+		return -errno;
+	}
+
+	fhwb_debug("Assign window. CMG: %u, BB: %u, window: %u, bd: 0x%x",
+			fhwb_get_cmg_from_bd(bd), fhwb_get_bb_from_bd(bd), ioc_bw_ctl.window, bd);
+
+	return ioc_bw_ctl.window;
+}
+
+int fhwb_dev_unassign(struct fhwb_ctx *ctx, int bd)
+{
+	struct fujitsu_hwb_ioc_bw_ctl ioc_bw_ctl = {0};
+	int fd = -1;
+	int ret = 0;
+
+	fd = get_fd(ctx);
+	if (fd < 0) {
+		fhwb_error("get_fd failed. fhwb_init() is not called?");
+		return -EINVAL;
+	}
+
+	ioc_bw_ctl.bb = fhwb_get_bb_from_bd(bd);
+	ret = ioctl(fd, FUJITSU_HWB_IOC_BW_UNASSIGN, &ioc_bw_ctl);
+	if (ret < 0) {
+		fhwb_error("ioctl FUJITSU_HWB_IOC_BW_UNASSIGN faied: %m, CMG: %u, BB: %u, bd: 0x%x",
+						fhwb_get_cmg_from_bd(bd), fhwb_get_bb_from_bd(bd), bd);
+		fhwb_stats_ioctl_error(bd);
+		return -errno;
+	}
+
+	fhwb_debug("Unassign window. CMG: %u, BB: %u, bd: 0x%x",
+			fhwb_get_cmg_from_bd(bd), fhwb_get_bb_from_bd(bd), bd);
+
+	return 0;
+}
+
+int fhwb_dev_get_pe_info(struct fhwb_pe_info *info)
+{
+	struct fujitsu_hwb_ioc_pe_info ioc_info = {0};
+	int fd = -1;
+	int ret = 0;
+
+	fd = fhwb_ctx_get_fd(&fhwb_default_ctx);
+	if (fd < 0)
+		return fd;
+
+	ret = ioctl(fd, FUJITSU_HWB_IOC_GET_PE_INFO, &ioc_info);
+	if (ret < 0) {
+		fhwb_error("ioctl FUJITSU_HWB_IOC_GET_PE_INFO failed: %m");
+		ret = -errno;
+		fhwb_ctx_put(&fhwb_default_ctx);
+		return ret;
+	}
+
+	info->cmg = ioc_info.cmg;
+	info->physical_pe = ioc_info.ppe;
+
+	fhwb_debug("PE info (CPU %u) ... CMG: %u, Physical PE: %u",
+				sched_getcpu(), ioc_info.cmg, ioc_info.ppe);
+	fhwb_ctx_put(&fhwb_default_ctx);
+
+	return 0;
+}
+
+const char *fhwb_dev_sysfs_root(void)
+{
+	const char *root = getenv(FHWB_SYSFS_ROOT_ENV_NAME);
+
+	return root ? root : FHWB_SYSFS_ROOT;
+}
+
+/*
+ * Read CMG/Physical PE number of each cpu from sysfs of the driver:
+ *   hwinfo        ... "<num_cmg> <num_bb> <num_bw> <max_pe_per_cmg>"
+ *   CMG<n>/core_map ... "<cpuid> <physical PE number>" for each PE of CMG n
+ */
+int fhwb_dev_load_topology(struct fhwb_pe_info *list, int num_pe)
+{
+	char path[PATH_MAX];
+	int num_cmg;
+	int count = 0;
+	int cpu, ppe;
+	int cmg;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s/hwinfo", fhwb_dev_sysfs_root());
+	fp = fopen(path, "r");
+	if (!fp) {
+		fhwb_debug("cannot open %s: %m", path);
+		return -errno;
+	}
+	if (fscanf(fp, "%d", &num_cmg) != 1 || num_cmg <= 0 || num_cmg > FHWB_BD_CMG_MASK + 1) {
+		fclose(fp);
+		fhwb_debug("unexpected format of %s", path);
+		return -EINVAL;
+	}
+	fclose(fp);
+
+	for (cmg = 0; cmg < num_cmg; cmg++) {
+		snprintf(path, sizeof(path), "%s/CMG%d/core_map", fhwb_dev_sysfs_root(), cmg);
+		fp = fopen(path, "r");
+		if (!fp) {
+			fhwb_debug("cannot open %s: %m", path);
+			return -errno;
+		}
+		while (fscanf(fp, "%d %d", &cpu, &ppe) == 2) {
+			if (cpu < 0 || cpu >= num_pe || ppe < 0 || ppe >= FHWB_INVALID_PPE)
+				continue;
+			list[cpu].cmg = cmg;
+			list[cpu].physical_pe = ppe;
+			count++;
+		}
+		fclose(fp);
+	}
+
+	if (count == 0) {
+		fhwb_debug("no PE is found in core_map");
+		return -ENOENT;
+	}
+
+	fhwb_debug("Load topology from sysfs: %d CMG, %d PE", num_cmg, count);
+
+	return 0;
+}
@@ -0,0 +1,18 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/* Copyright 2020 FUJITSU LIMITED */
+
+/*
+ * ioctl implemented only by the emulator (not part of the driver UAPI).
+ * Numbers are taken from the top of the range so that they do not collide
+ * with ioctls which the driver may add later.
+ */
+#ifndef _FUJITSU_HWB_EMU_IOCTL_H
+#define _FUJITSU_HWB_EMU_IOCTL_H
+
+#include "fujitsu_hpc_ioctl.h"
+
+/* Change PEs of an allocated bb */
+#define FUJITSU_HWB_EMU_IOC_BB_REMASK _IOW(__FUJITSU_IOCTL_MAGIC, \
+	0xf0, struct fujitsu_hwb_ioc_bb_ctl)
+
+#endif /* _FUJITSU_HWB_EMU_IOCTL_H */
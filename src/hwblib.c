@@ -4,84 +4,135 @@
 #define _GNU_SOURCE
 
 #include "fujitsu_hwb.h"
-#include "fujitsu_hpc_ioctl.h"
 #include "internal.h"
+#include "trace.h"
 
 #include <errno.h>
-#include <fcntl.h>
 #include <sched.h>
 #include <stdio.h>
-#include <sys/ioctl.h>
-#include <sys/stat.h>
+#include <string.h>
 #include <sys/sysinfo.h>
 #include <sys/types.h>
 #include <pthread.h>
 #include <unistd.h>
 
-/* Global lock for __fd management */
-static pthread_mutex_t fhwb_mutex = PTHREAD_MUTEX_INITIALIZER;
+/* Backend selected at library load time */
+static const struct fhwb_backend *backend;
+static pthread_once_t backend_once = PTHREAD_ONCE_INIT;
 
-/*
- * File descriptor of device file for ioctl
- *
- * Barrier driver requires all threads joining synchronization shares the same fd.
- * So, library opens file at fhwb_init() and close it fhwb_fini().
- */
-static int __fd = -1;
-static int open_count = 0;
+int fhwb_hwb_sync_enabled;
+
+/* Entries of bb allocated by this process */
+static pthread_mutex_t bd_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct fhwb_bd_entry *bd_entries;
 
-/* Open device file for ioctl if not currently opened */
-static int open_dev_file()
+static const struct fhwb_backend *const backends[] = {
+#ifdef __aarch64__
+	&fhwb_backend_hwb,
+#endif
+	&fhwb_backend_sw,
+	&fhwb_backend_emu,
+	NULL,
+};
+
+#ifdef __aarch64__
+/* Check CPU implementer of /proc/cpuinfo is Fujitsu (0x46) */
+static int cpu_is_a64fx(void)
 {
-	pthread_mutex_lock(&fhwb_mutex);
+	unsigned int implementer;
+	size_t len = 0;
+	char *line = NULL;
+	FILE *fp;
+	int ret = 0;
+
+	fp = fopen("/proc/cpuinfo", "r");
+	if (fp == NULL)
+		return 0;
 
-	if (__fd > 0) {
-		open_count++;
-	} else {
-		fhwb_debug("open device file");
-		__fd = open(FHWB_DEV_FILE, O_RDONLY);
-		if (__fd > 0)
-			open_count++;
+	while (getline(&line, &len, fp) != -1) {
+		if (sscanf(line, "CPU implementer : %x", &implementer) == 1) {
+			ret = (implementer == 0x46);
+			break;
+		}
 	}
 
-	pthread_mutex_unlock(&fhwb_mutex);
+	free(line);
+	fclose(fp);
 
-	return __fd;
+	return ret;
 }
+#endif
 
-static void close_dev_file()
+/*
+ * Choose hardware barrier if the driver is loaded on A64FX.
+ * If the device is not real (emulated device), use emu backend.
+ * Otherwise use software barrier.
+ */
+static const struct fhwb_backend *detect_backend(void)
 {
-	pthread_mutex_lock(&fhwb_mutex);
+	if (!fhwb_dev_available())
+		return &fhwb_backend_sw;
 
-	open_count--;
-	if (open_count == 0) {
-		int _errno;
+#ifdef __aarch64__
+	if (cpu_is_a64fx())
+		return &fhwb_backend_hwb;
+#endif
 
-		fhwb_debug("close device file");
-		/* Keep original errno in case close() fails */
-		_errno = errno;
-		close(__fd);
-		__fd = -1;
-		errno = _errno;
+	return &fhwb_backend_emu;
+}
+
+static void select_backend(void)
+{
+	const char *name = getenv(FHWB_BACKEND_ENV_NAME);
+	int i;
+
+	fhwb_log_init();
+	fhwb_pool_env_init();
+
+	if (name != NULL && strcmp(name, "auto") != 0) {
+		for (i = 0; backends[i] != NULL; i++) {
+			if (strcmp(name, backends[i]->name) == 0) {
+				backend = backends[i];
+				break;
+			}
+		}
+		if (backend == NULL)
+			fhwb_error("backend '%s' is not available, detect automatically", name);
 	}
 
-	pthread_mutex_unlock(&fhwb_mutex);
+	if (backend == NULL)
+		backend = detect_backend();
+
+#ifdef __aarch64__
+	__atomic_store_n(&fhwb_hwb_sync_enabled, backend == &fhwb_backend_hwb, __ATOMIC_RELAXED);
+#endif
+
+	fhwb_debug("use %s backend", backend->name);
 }
 
-static inline int get_fd()
+__attribute__((constructor))
+static void fhwb_load(void)
 {
-	return __fd;
+	pthread_once(&backend_once, select_backend);
 }
 
-/* Make barrier descriptor(bd) from bb/cmg num */
-static inline int make_bd(int cmg, int bb)
+static inline const struct fhwb_backend *get_backend(void)
 {
-	int bd = 0;
+	/* Only happens when called from other constructor before fhwb_load() */
+	if (__builtin_expect(backend == NULL, 0))
+		pthread_once(&backend_once, select_backend);
 
-	bd |= (cmg << FHWB_BD_CMG_SHIFT);
-	bd |= (bb  << FHWB_BD_BB_SHIFT);
+	return backend;
+}
 
-	return bd;
+const struct fhwb_backend *fhwb_get_backend(void)
+{
+	return get_backend();
+}
+
+const char *fhwb_get_backend_name(void)
+{
+	return get_backend()->name;
 }
 
 int fhwb_get_cmg_from_bd(int bd)
@@ -94,276 +145,692 @@ int fhwb_get_bb_from_bd(int bd)
 	return ((bd >> FHWB_BD_BB_SHIFT) & FHWB_BD_BB_MASK);
 }
 
-int fhwb_init(size_t pemask_size, cpu_set_t *pemask)
+int fhwb_ctx_open(fhwb_ctx_t **ctx)
 {
-	struct fujitsu_hwb_ioc_bb_ctl ioc_bb_ctl = {0};
-	int fd = -1;
-	int bd = 0;
-	int ret = 0;
+	struct fhwb_ctx *c;
 
-	if (pemask == NULL || pemask_size == 0) {
-		fhwb_error("pemask is NULL or pemask_size is 0");
+	if (ctx == NULL) {
+		fhwb_error("ctx is NULL");
 		return -EINVAL;
 	}
 
-	fd = open_dev_file();
-	if (fd < 0) {
-		fhwb_error("open_dev_file failed: %m");
-		return -errno;
+	c = calloc(1, sizeof(struct fhwb_ctx));
+	if (!c)
+		return -ENOMEM;
+	/* The reference of the owner. The device file is opened at first use */
+	atomic_init(&c->state, FHWB_CTX_STATE(-1, 1));
+	c->is_default = false;
+	*ctx = c;
+
+	return 0;
+}
+
+int fhwb_ctx_close(fhwb_ctx_t *ctx)
+{
+	if (ctx == NULL || ctx->is_default) {
+		fhwb_error("ctx is NULL or the default context");
+		return -EINVAL;
 	}
 
-	ioc_bb_ctl.size = pemask_size;
-	ioc_bb_ctl.pemask = (unsigned long *)pemask;
-	ret = ioctl(fd, FUJITSU_HWB_IOC_BB_ALLOC, &ioc_bb_ctl);
+	fhwb_ctx_put(ctx);
+
+	return 0;
+}
+
+static inline struct fhwb_ctx *get_ctx(fhwb_ctx_t *ctx)
+{
+	return ctx ? ctx : &fhwb_default_ctx;
+}
+
+int fhwb_init(size_t pemask_size, cpu_set_t *pemask)
+{
+	return fhwb_ctx_init(NULL, pemask_size, pemask);
+}
+
+__thread bool fhwb_alloc_quiet;
+
+int fhwb_init_quiet(size_t pemask_size, cpu_set_t *pemask)
+{
+	int bd;
+
+	fhwb_alloc_quiet = true;
+	bd = fhwb_ctx_init(NULL, pemask_size, pemask);
+	fhwb_alloc_quiet = false;
+
+	return bd;
+}
+
+void fhwb_bd_lock(void)
+{
+	pthread_mutex_lock(&bd_mutex);
+}
+
+void fhwb_bd_unlock(void)
+{
+	pthread_mutex_unlock(&bd_mutex);
+}
+
+struct fhwb_bd_entry *fhwb_bd_find(int bd)
+{
+	struct fhwb_bd_entry *entry;
+
+	for (entry = bd_entries; entry; entry = entry->next)
+		if (entry->bd == bd)
+			return entry;
+
+	return NULL;
+}
+
+static struct fhwb_bd_entry *bd_get(int bd)
+{
+	struct fhwb_bd_entry *entry;
+
+	fhwb_bd_lock();
+	entry = fhwb_bd_find(bd);
+	fhwb_bd_unlock();
+
+	return entry;
+}
+
+static void bd_free(struct fhwb_bd_entry *entry)
+{
+	fhwb_reduce_free(entry);
+	fhwb_profile_free(entry);
+	fhwb_stats_free(entry);
+	free(entry->pemask);
+	free(entry);
+}
+
+/* Add entry of @bd with data of each feature */
+static int bd_register(int bd, size_t pemask_size, cpu_set_t *pemask)
+{
+	struct fhwb_bd_entry *entry;
+	int ret;
+
+	entry = calloc(1, sizeof(struct fhwb_bd_entry));
+	if (entry)
+		entry->pemask = malloc(pemask_size);
+	if (!entry || !entry->pemask) {
+		fhwb_error("memory allocation failure");
+		free(entry);
+		return -ENOMEM;
+	}
+
+	entry->bd = bd;
+	entry->nr_pe = CPU_COUNT_S(pemask_size, pemask);
+	entry->pemask_size = pemask_size;
+	memcpy(entry->pemask, pemask, pemask_size);
+
+	ret = fhwb_reduce_alloc(entry);
+	if (ret == 0)
+		ret = fhwb_stats_alloc(entry);
 	if (ret < 0) {
-		fhwb_error("ioctl FUJITSU_HWB_IOC_BB_ALLOC failed: %m");
-		close_dev_file();
-		return -errno;
+		bd_free(entry);
+		return ret;
 	}
 
-	bd = make_bd(ioc_bb_ctl.cmg, ioc_bb_ctl.bb);
-	fhwb_debug("Allocate BB. CMG: %u, BB: %u, bd: 0x%x", ioc_bb_ctl.cmg, ioc_bb_ctl.bb, bd);
+	fhwb_bd_lock();
+	entry->next = bd_entries;
+	bd_entries = entry;
+	fhwb_bd_unlock();
 
-	/* Do not call close_dev_file() as it will be called in fhwb_fini() */
+	return 0;
+}
+
+static void bd_unregister(int bd)
+{
+	struct fhwb_bd_entry **p;
+	struct fhwb_bd_entry *entry = NULL;
+
+	fhwb_bd_lock();
+	for (p = &bd_entries; *p; p = &(*p)->next) {
+		if ((*p)->bd == bd) {
+			entry = *p;
+			*p = entry->next;
+			break;
+		}
+	}
+	fhwb_bd_unlock();
+
+	if (entry)
+		bd_free(entry);
+}
+
+int fhwb_ctx_init(fhwb_ctx_t *ctx, size_t pemask_size, cpu_set_t *pemask)
+{
+	const struct fhwb_backend *be = get_backend();
+	int bd;
+	int ret;
+
+	ctx = get_ctx(ctx);
+	if (pemask == NULL || pemask_size == 0) {
+		fhwb_error("pemask is NULL or pemask_size is 0");
+		return -EINVAL;
+	}
+
+	/* A blade kept by the pool for the same PEs does not need ioctl */
+	bd = fhwb_pool_get(ctx, pemask_size, pemask);
+	if (bd == -ENOENT)
+		bd = fhwb_pool_init(be, ctx, pemask_size, pemask);
+	if (bd < 0)
+		goto out;
+
+	ret = bd_register(bd, pemask_size, pemask);
+	if (ret < 0)
+		goto fini;
+
+	fhwb_trace_event(FHWB_TRACE_INIT, bd, -1, 0);
 
 	return bd;
+
+fini:
+	if (fhwb_pool_put(ctx, bd) == -ENOENT)
+		be->fini(ctx, bd);
+	bd = ret;
+out:
+	fhwb_trace_event(FHWB_TRACE_INIT, -1, -1, bd);
+
+	return bd;
+}
+
+/* Forget windows of @bd of the caller thread in per-window states */
+static void detach_windows(int bd)
+{
+	fhwb_reduce_detach(bd);
+	fhwb_profile_detach(bd);
+	fhwb_stats_detach(bd);
+	fhwb_bind_detach(bd);
 }
 
 int fhwb_fini(int bd)
 {
-	struct fujitsu_hwb_ioc_bb_ctl ioc_bb_ctl = {0};
-	int fd = -1;
+	return fhwb_ctx_fini(NULL, bd);
+}
+
+int fhwb_ctx_fini(fhwb_ctx_t *ctx, int bd)
+{
+	int ret;
+
+	ctx = get_ctx(ctx);
+	/* Keep the bb allocated if the pool takes it */
+	ret = atomic_load_explicit(&fhwb_pool_entries, memory_order_relaxed) ? fhwb_pool_put(ctx, bd) : -ENOENT;
+	if (ret == -ENOENT) {
+		ret = get_backend()->fini(ctx, bd);
+		if (ret == 0)
+			fhwb_queue_wake(bd);
+	}
+	if (ret == 0) {
+		/* Windows of the caller are freed with the bb */
+		detach_windows(bd);
+		bd_unregister(bd);
+	}
+	fhwb_trace_event(FHWB_TRACE_FINI, bd, -1, ret);
+
+	return ret;
+}
+
+/* Free blades of @bds of CMGs set in @done (each CMG has one bd in @bds) */
+static int fini_multi(int *bds, int num_bd, bool *done)
+{
 	int ret = 0;
+	int err;
+	int cmg;
+	int cpu;
+
+	for (cpu = 0; cpu < num_bd; cpu++) {
+		if (bds[cpu] < 0)
+			continue;
+		cmg = fhwb_get_cmg_from_bd(bds[cpu]);
+		if (!done[cmg])
+			continue;
+		done[cmg] = false;
 
-	fd = get_fd();
-	if (fd < 0) {
-		fhwb_error("get_fd failed. fhwb_init() is not called?");
+		err = fhwb_fini(bds[cpu]);
+		if (err < 0 && ret == 0)
+			ret = err;
+	}
+
+	return ret;
+}
+
+int fhwb_init_multi(size_t pemask_size, cpu_set_t *pemask, int **bds, int *num_bd)
+{
+	bool done[FHWB_BD_CMG_MASK + 1] = {false};
+	const struct fhwb_topology *topo;
+	cpu_set_t *masks = NULL;
+	int *table = NULL;
+	int count = 0;
+	int cmg;
+	int cpu;
+	int ret;
+
+	if (pemask == NULL || pemask_size == 0 || bds == NULL || num_bd == NULL) {
+		fhwb_error("pemask/bds/num_bd is NULL or pemask_size is 0");
 		return -EINVAL;
 	}
 
-	ioc_bb_ctl.cmg = fhwb_get_cmg_from_bd(bd);
-	ioc_bb_ctl.bb = fhwb_get_bb_from_bd(bd);
-	ret = ioctl(fd, FUJITSU_HWB_IOC_BB_FREE, &ioc_bb_ctl);
-	if (ret < 0) {
-		fhwb_error("ioctl FUJITSU_HWB_IOC_BB_FREE failed: %m, CMG: %u, BB: %u, bd: 0x%x",
-							ioc_bb_ctl.cmg, ioc_bb_ctl.bb, bd);
-		/* Something is wrong, do not close fd */
-		return -errno;
+	ret = fhwb_get_topology(&topo);
+	if (ret < 0)
+		return ret;
+
+	table = malloc(sizeof(int) * topo->num_pe);
+	masks = calloc(topo->num_cmg ? topo->num_cmg : 1, sizeof(cpu_set_t));
+	if (!table || !masks) {
+		fhwb_error("memory allocation failure");
+		ret = -ENOMEM;
+		goto out;
 	}
 
-	fhwb_debug("Free BB. CMG: %u, BB: %u, bd: 0x%x", ioc_bb_ctl.cmg, ioc_bb_ctl.bb, bd);
-	close_dev_file();
+	/* Split @pemask by CMG */
+	for (cpu = 0; cpu < (int)(pemask_size * 8); cpu++) {
+		if (!CPU_ISSET_S(cpu, pemask_size, pemask))
+			continue;
 
-	return 0;
+		if (cpu >= topo->num_pe || topo->pes[cpu].cmg == FHWB_INVALID_CMG) {
+			fhwb_error("pemask contains invalid cpu: %d", cpu);
+			ret = -EINVAL;
+			goto out;
+		}
+		CPU_SET(cpu, &masks[topo->pes[cpu].cmg]);
+		count++;
+	}
+	if (count < 2) {
+		fhwb_error("pemask contains less than 2 PEs");
+		ret = -EINVAL;
+		goto out;
+	}
+	/* Each CMG needs its own synchronization of at least 2 PEs */
+	for (cmg = 0; cmg < topo->num_cmg; cmg++) {
+		if (CPU_COUNT(&masks[cmg]) == 1) {
+			fhwb_error("pemask contains only one PE of CMG %d", cmg);
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	for (cpu = 0; cpu < topo->num_pe; cpu++)
+		table[cpu] = -1;
+	for (cmg = 0; cmg < topo->num_cmg; cmg++) {
+		if (CPU_COUNT(&masks[cmg]) == 0)
+			continue;
+
+		ret = fhwb_init(sizeof(cpu_set_t), &masks[cmg]);
+		if (ret < 0) {
+			/* Free blades of other CMGs so that nothing is left allocated */
+			fini_multi(table, topo->num_pe, done);
+			goto out;
+		}
+		for (cpu = 0; cpu < topo->num_pe; cpu++)
+			if (CPU_ISSET(cpu, &masks[cmg]))
+				table[cpu] = ret;
+		done[cmg] = true;
+	}
+
+	fhwb_debug("Allocate BB of each CMG of pemask");
+	*bds = table;
+	*num_bd = topo->num_pe;
+	table = NULL;
+	ret = 0;
+
+out:
+	free(table);
+	free(masks);
+
+	return ret;
 }
 
-int fhwb_assign(int bd, int window)
+int fhwb_fini_multi(int *bds, int num_bd)
 {
-	struct fujitsu_hwb_ioc_bw_ctl ioc_bw_ctl = {0};
-	int fd = -1;
-	int ret = 0;
+	bool done[FHWB_BD_CMG_MASK + 1];
+	int ret;
+	int i;
 
-	fd = get_fd();
-	if (fd < 0) {
-		fhwb_error("get_fd failed. fhwb_init() is not called?");
+	if (bds == NULL || num_bd < 0) {
+		fhwb_error("bds is NULL or num_bd is negative");
 		return -EINVAL;
 	}
 
-	ioc_bw_ctl.bb = fhwb_get_bb_from_bd(bd);
-	ioc_bw_ctl.window = window;
-	ret = ioctl(fd, FUJITSU_HWB_IOC_BW_ASSIGN, &ioc_bw_ctl);
-	if (ret < 0) {
-		fhwb_error("ioctl FUJITSU_HWB_IOC_BW_ASSIGN failed: %m, CMG: %u, BB: %u, window: %u, bd: 0x%x",
-					fhwb_get_cmg_from_bd(bd), fhwb_get_bb_from_bd(bd), ioc_bw_ctl.window, bd);
-		return -errno;
+	for (i = 0; i <= FHWB_BD_CMG_MASK; i++)
+		done[i] = true;
+	ret = fini_multi(bds, num_bd, done);
+	free(bds);
+
+	return ret;
+}
+
+int fhwb_assign(int bd, int window)
+{
+	return fhwb_ctx_assign(NULL, bd, window);
+}
+
+int fhwb_ctx_assign(fhwb_ctx_t *ctx, int bd, int window)
+{
+	int pooled = atomic_load_explicit(&fhwb_pool_entries, memory_order_relaxed);
+	int ret;
+
+	/* An idle bb in the pool is not allocated for the caller */
+	if (pooled) {
+		ret = fhwb_pool_attach(bd);
+		if (ret < 0)
+			goto out;
 	}
 
-	fhwb_debug("Assign window. CMG: %u, BB: %u, window: %u, bd: 0x%x",
-			fhwb_get_cmg_from_bd(bd), fhwb_get_bb_from_bd(bd), ioc_bw_ctl.window, bd);
+	ret = get_backend()->assign(get_ctx(ctx), bd, window);
+	if (ret < 0 && pooled)
+		fhwb_pool_detach(bd);
+	if (ret >= 0) {
+		struct fhwb_bd_entry *entry = bd_get(bd);
 
-	return ioc_bw_ctl.window;
+		fhwb_reduce_attach(entry, ret);
+		fhwb_profile_attach(entry, ret);
+		fhwb_stats_attach(entry, ret);
+		fhwb_bind_attach(bd, ret);
+	}
+out:
+	fhwb_trace_event(FHWB_TRACE_ASSIGN, bd, window, ret);
+
+	return ret;
 }
 
 int fhwb_unassign(int bd)
 {
-	struct fujitsu_hwb_ioc_bw_ctl ioc_bw_ctl = {0};
-	int fd = -1;
-	int ret = 0;
+	return fhwb_ctx_unassign(NULL, bd);
+}
 
-	fd = get_fd();
-	if (fd < 0) {
-		fhwb_error("get_fd failed. fhwb_init() is not called?");
-		return -EINVAL;
-	}
+int fhwb_ctx_unassign(fhwb_ctx_t *ctx, int bd)
+{
+	int ret;
 
-	ioc_bw_ctl.bb = fhwb_get_bb_from_bd(bd);
-	ret = ioctl(fd, FUJITSU_HWB_IOC_BW_UNASSIGN, &ioc_bw_ctl);
-	if (ret < 0) {
-		fhwb_error("ioctl FUJITSU_HWB_IOC_BW_UNASSIGN faied: %m, CMG: %u, BB: %u, bd: 0x%x",
-						fhwb_get_cmg_from_bd(bd), fhwb_get_bb_from_bd(bd), bd);
-		return -errno;
+	ret = get_backend()->unassign(get_ctx(ctx), bd);
+	if (ret == 0) {
+		detach_windows(bd);
+		if (atomic_load_explicit(&fhwb_pool_entries, memory_order_relaxed))
+			fhwb_pool_detach(bd);
 	}
+	fhwb_trace_event(FHWB_TRACE_UNASSIGN, bd, -1, ret);
 
-	fhwb_debug("Unassign window. CMG: %u, BB: %u, bd: 0x%x",
-			fhwb_get_cmg_from_bd(bd), fhwb_get_bb_from_bd(bd), bd);
+	return ret;
+}
 
-	return 0;
+int fhwb_remask(int bd, size_t pemask_size, cpu_set_t *pemask)
+{
+	return fhwb_ctx_remask(NULL, bd, pemask_size, pemask);
 }
 
-#define SYNC(reg, num) \
-	asm volatile(\
-			"mrs x1, " #reg "\n\t" /* read LBSY bit */\
-			"mvn x1, x1\n\t" /* negate */\
-			"and x1, x1, #1\n\t" /* clear other than first-bit */\
-			"msr " #reg ", x1\n\t" /* update BST bit */ \
-\
-			"sevl\n\t" \
-\
-		"fhwb_loop"#num":\n\t"\
-			"wfe\n\t"\
-			"mrs x2, " #reg "\n\t" /* read LBSY bit */\
-			"and x2, x2, #1\n\t" /* clear other than first-bit */\
-			"cmp x1, x2\n\t"\
-			"bne fhwb_loop"#num"\n\t" /* loop until LBSY bit changes */\
-		:\
-		:\
-		:"x1", "x2")
+int fhwb_ctx_remask(fhwb_ctx_t *ctx, int bd, size_t pemask_size, cpu_set_t *pemask)
+{
+	const struct fhwb_backend *be = get_backend();
+	int ret;
+
+	if (pemask == NULL || pemask_size == 0) {
+		fhwb_error("pemask is NULL or pemask_size is 0");
+		ret = -EINVAL;
+		goto out;
+	}
+	if (!be->remask) {
+		fhwb_error("%s backend cannot change PEs of BB", be->name);
+		ret = -EOPNOTSUPP;
+		goto out;
+	}
+
+	/* Allocate the reduction buffer first as the change of bb cannot fail afterwards */
+	ret = fhwb_reduce_remask_begin(bd, pemask_size, pemask);
+	if (ret < 0)
+		goto out;
+
+	ret = fhwb_pool_remask(be, get_ctx(ctx), bd, pemask_size, pemask);
+	fhwb_reduce_remask_end(bd, ret == 0);
+out:
+	fhwb_trace_event(FHWB_TRACE_REMASK, bd, -1, ret);
+
+	return ret;
+}
 
 void fhwb_sync(int window)
 {
-	switch (window) {
-	case 0:
-		SYNC(s3_3_c15_c15_0, 0);
-		break;
-	case 1:
-		SYNC(s3_3_c15_c15_1, 1);
-		break;
-	case 2:
-		SYNC(s3_3_c15_c15_2, 2);
-		break;
-	case 3:
-		SYNC(s3_3_c15_c15_3, 3);
-		break;
-	default:
-		fhwb_error("window number is invalid: %d", window);
-		break;
+	const struct fhwb_backend *be = get_backend();
+
+	if (__builtin_expect(fhwb_trace_enabled || fhwb_debug_enabled ||
+			atomic_load_explicit(&fhwb_profile_active, memory_order_relaxed), 0)) {
+		fhwb_bind_check(window);
+		fhwb_trace_sync(FHWB_TRACE_SYNC_BEGIN, window);
+		if (!fhwb_profile_sync(window, be->sync))
+			be->sync(window);
+		fhwb_trace_sync(FHWB_TRACE_SYNC_END, window);
+		return;
 	}
+
+	be->sync(window);
 }
 
-int fhwb_get_pe_info(struct fhwb_pe_info *info)
+int fhwb_sync_timeout(int window, uint64_t timeout_ns)
 {
-	struct fujitsu_hwb_ioc_pe_info ioc_info = {0};
-	int fd = -1;
-	int ret = 0;
+	return get_backend()->sync_timeout(window, timeout_ns);
+}
 
-	if (info == NULL) {
-		fhwb_error("pe_info is NULL");
+int fhwb_arrive(int window)
+{
+	return get_backend()->arrive(window);
+}
+
+int fhwb_test(int window, int token)
+{
+	if (token != 0 && token != 1) {
+		fhwb_error("token is invalid: %d", token);
 		return -EINVAL;
 	}
 
-	fd = open_dev_file();
-	if (fd < 0) {
-		fhwb_error("open_dev_file failed: %m");
-		return -errno;
-	}
+	return get_backend()->test(window, token);
+}
 
-	ret = ioctl(fd, FUJITSU_HWB_IOC_GET_PE_INFO, &ioc_info);
-	if (ret < 0) {
-		fhwb_error("ioctl FUJITSU_HWB_IOC_GET_PE_INFO failed: %m");
-		close_dev_file();
-		return -errno;
+int fhwb_wait(int window, int token)
+{
+	if (token != 0 && token != 1) {
+		fhwb_error("token is invalid: %d", token);
+		return -EINVAL;
 	}
 
-	info->cmg = ioc_info.cmg;
-	info->physical_pe = ioc_info.ppe;
+	return get_backend()->wait(window, token);
+}
 
-	fhwb_debug("PE info (CPU %u) ... CMG: %u, Physical PE: %u",
-				sched_getcpu(), ioc_info.cmg, ioc_info.ppe);
-	close_dev_file();
+int fhwb_get_pe_info(struct fhwb_pe_info *info)
+{
+	if (info == NULL) {
+		fhwb_error("pe_info is NULL");
+		return -EINVAL;
+	}
 
-	return 0;
+	return get_backend()->get_pe_info(info);
 }
 
-int fhwb_get_all_pe_info(struct fhwb_pe_info **list, int *entry_num)
+/*
+ * Get PE info by calling get_pe_info() on each available PE.
+ * This is used when the backend cannot provide topology without migration.
+ */
+static int sweep_topology(const struct fhwb_backend *be, struct fhwb_pe_info *list, int num_pe)
 {
-	struct fujitsu_hwb_ioc_pe_info ioc_info = {0};
-	struct fhwb_pe_info *result = NULL;
 	cpu_set_t orig;
 	cpu_set_t set;
 	int online_pe;
-	int num_pe;
 	int ret;
-	int fd;
 	int i;
 
-	if (list == NULL || entry_num == NULL) {
-		fhwb_error("list/entry_num is NULL");
-		return -EINVAL;
-	}
-
-	fd = open_dev_file();
-	if (fd < 0) {
-		fhwb_error("open_dev_file failed: %m");
-		return -errno;
-	}
-
-	/* Get number of PEs on the system (incl. offline PEs) */
-	num_pe = get_nprocs_conf();
-	result = calloc(num_pe, sizeof(struct fhwb_pe_info));
-	if (!result) {
-		fhwb_error("memory allocation failure");
-		ret = -ENOMEM;
-		goto out1;
-	}
-
 	/* Keep original affinity value */
 	ret = sched_getaffinity(0, sizeof(cpu_set_t), &orig);
 	if (ret < 0) {
 		fhwb_error("sched_getaffinity failed\n");
-		ret = -errno;
-		goto out1;
+		return -errno;
 	}
 
 	online_pe = 0;
-	/* Issue GET_PE_INFO ioctl on each available PE */
+	/* Get PE info on each available PE */
 	for (i = 0; i < num_pe; i++) {
 		CPU_ZERO(&set);
 		CPU_SET(i, &set);
 		ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
 		if (ret < 0) {
 			/* Should be offline or restricted by cgroup. Ignore it */
-			result[i].cmg = FHWB_INVALID_CMG;
-			result[i].physical_pe = FHWB_INVALID_PPE;
+			ret = 0;
 			continue;
 		}
 
-		ret = ioctl(fd, FUJITSU_HWB_IOC_GET_PE_INFO, &ioc_info);
+		ret = be->get_pe_info(&list[i]);
+		if (ret < 0)
+			break;
+
+		online_pe++;
+	}
+
+	/* Restore affinity */
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &orig) < 0)
+		fhwb_error("failed to restore cpu affinity\n");
+
+	fhwb_debug("Get %d/%d PE info", online_pe, num_pe);
+
+	return ret;
+}
+
+static struct fhwb_topology topology;
+static pthread_once_t topology_once = PTHREAD_ONCE_INIT;
+static int topology_error;
+
+static void load_topology(void)
+{
+	const struct fhwb_backend *be = get_backend();
+	struct fhwb_pe_info *pes;
+	cpu_set_t *masks;
+	int num_cmg = 0;
+	int num_pe;
+	int ret = -ENOTSUP;
+	int i;
+
+	/* Get number of PEs on the system (incl. offline PEs) */
+	num_pe = get_nprocs_conf();
+	pes = malloc(sizeof(struct fhwb_pe_info) * num_pe);
+	if (!pes)
+		goto nomem;
+	for (i = 0; i < num_pe; i++) {
+		pes[i].cmg = FHWB_INVALID_CMG;
+		pes[i].physical_pe = FHWB_INVALID_PPE;
+	}
+
+	if (be->load_topology)
+		ret = be->load_topology(pes, num_pe);
+	if (ret < 0) {
+		fhwb_debug("topology is not available from %s backend, get it on each PE", be->name);
+		ret = sweep_topology(be, pes, num_pe);
 		if (ret < 0) {
-			fhwb_error("ioctl FUJISU_HWB_IOC_GET_PE_INFO failed: %m");
-			ret = -errno;
-			goto out2;
+			free(pes);
+			topology_error = ret;
+			return;
 		}
+	}
 
-		result[i].cmg = ioc_info.cmg;
-		result[i].physical_pe = ioc_info.ppe;
+	for (i = 0; i < num_pe; i++)
+		if (pes[i].cmg != FHWB_INVALID_CMG && pes[i].cmg >= num_cmg)
+			num_cmg = pes[i].cmg + 1;
 
-		online_pe++;
+	masks = calloc(num_cmg ? num_cmg : 1, sizeof(cpu_set_t));
+	if (!masks) {
+		free(pes);
+		goto nomem;
+	}
+	for (i = 0; i < num_pe && i < CPU_SETSIZE; i++)
+		if (pes[i].cmg != FHWB_INVALID_CMG)
+			CPU_SET(i, &masks[pes[i].cmg]);
+
+	topology.num_pe = num_pe;
+	topology.num_cmg = num_cmg;
+	topology.pes = pes;
+	topology.cmg_masks = masks;
+
+	return;
+
+nomem:
+	fhwb_error("memory allocation failure");
+	topology_error = -ENOMEM;
+}
+
+int fhwb_get_topology(const struct fhwb_topology **topo)
+{
+	pthread_once(&topology_once, load_topology);
+	*topo = &topology;
+
+	return topology_error;
+}
+
+int fhwb_get_all_pe_info(struct fhwb_pe_info **list, int *entry_num)
+{
+	const struct fhwb_topology *topo;
+	struct fhwb_pe_info *result;
+	int ret;
+
+	if (list == NULL || entry_num == NULL) {
+		fhwb_error("list/entry_num is NULL");
+		return -EINVAL;
+	}
+
+	ret = fhwb_get_topology(&topo);
+	if (ret < 0)
+		return ret;
+
+	result = malloc(sizeof(struct fhwb_pe_info) * topo->num_pe);
+	if (!result) {
+		fhwb_error("memory allocation failure");
+		return -ENOMEM;
 	}
+	memcpy(result, topo->pes, sizeof(struct fhwb_pe_info) * topo->num_pe);
 
-	*entry_num = num_pe;
+	*entry_num = topo->num_pe;
 	*list = result;
-	fhwb_debug("Get %d/%d PE info", online_pe, num_pe);
 
-out2:
-	/* Restore affinity */
-	ret = sched_setaffinity(0, sizeof(cpu_set_t), &orig);
+	return 0;
+}
+
+int fhwb_get_cpu_pe_info(int cpu, struct fhwb_pe_info *info)
+{
+	const struct fhwb_topology *topo;
+	int ret;
+
+	if (info == NULL) {
+		fhwb_error("pe_info is NULL");
+		return -EINVAL;
+	}
+
+	ret = fhwb_get_topology(&topo);
 	if (ret < 0)
-		fhwb_error("failed to restore cpu affinity\n");
+		return ret;
 
-out1:
-	close_dev_file();
-	if (ret)
-		free(result);
+	if (cpu < 0 || cpu >= topo->num_pe || topo->pes[cpu].cmg == FHWB_INVALID_CMG)
+		return -EINVAL;
 
-	return ret;
+	*info = topo->pes[cpu];
+
+	return 0;
+}
+
+int fhwb_get_cmg_cpumask(int cmg, size_t mask_size, cpu_set_t *mask)
+{
+	const struct fhwb_topology *topo;
+	int cpu;
+	int ret;
+
+	if (mask == NULL || mask_size == 0) {
+		fhwb_error("mask is NULL or mask_size is 0");
+		return -EINVAL;
+	}
+
+	ret = fhwb_get_topology(&topo);
+	if (ret < 0)
+		return ret;
+
+	if (cmg < 0 || cmg >= topo->num_cmg)
+		return -EINVAL;
+
+	CPU_ZERO_S(mask_size, mask);
+	for (cpu = 0; cpu < topo->num_pe && cpu < (int)(mask_size * 8); cpu++)
+		if (topo->pes[cpu].cmg == cmg)
+			CPU_SET_S(cpu, mask_size, mask);
+
+	return 0;
 }
@@ -4,8 +4,18 @@
 #ifndef _FUJITSU_HWB_INTERNAL_H
 #define _FUJITSU_HWB_INTERNAL_H
 
+#include "fujitsu_hwb.h"
+
+#include <limits.h>
+#include <linux/futex.h>
+#include <stdatomic.h>
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/sysinfo.h>
+#include <time.h>
+#include <unistd.h>
 
 #define FHWB_BD_BB_SHIFT  0
 #define FHWB_BD_CMG_SHIFT 8
@@ -15,6 +25,21 @@
 /* fujitsu_hwb driver will create following device file upon module load */
 #define FHWB_DEV_FILE "/dev/fujitsu_hwb"
 
+/* sysfs directory of fujitsu_hwb driver, and environment variable to use another one */
+#define FHWB_SYSFS_ROOT "/sys/class/misc/fujitsu_hwb"
+#define FHWB_SYSFS_ROOT_ENV_NAME "FUJITSU_HWB_SYSFS_ROOT"
+
+/* Size used to pad shared data structures to avoid false sharing */
+#define FHWB_CACHE_LINE_SIZE 256
+
+/* Resource/topology emulated by software backend (the same as A64FX) */
+#define FHWB_SW_NUM_BB     6
+#define FHWB_SW_NUM_BW     4
+#define FHWB_SW_PE_PER_CMG 12
+
+/* Number of polling before sleeping in futex by software synchronization (only used on SMP) */
+#define FHWB_SPIN_COUNT 4096
+
 /* Macro for error message */
 #define fhwb_error(fmt, ...) do { \
 	fflush(stdout); \
@@ -22,13 +47,430 @@
 	fflush(stderr); \
 } while(0)
 
+/* Set once at library load from FHWB_DEBUG_ENV_NAME/FHWB_TRACE_ENV_NAME (trace.c) */
+extern int fhwb_debug_enabled;
+extern int fhwb_trace_enabled;
+
 /* Macro for debug message (only will be shown when FHWB_DEBUG_ENV_NAME is set) */
 #define fhwb_debug(fmt, ...) do { \
-	if (getenv(FHWB_DEBUG_ENV_NAME) != NULL) { \
+	if (__builtin_expect(fhwb_debug_enabled, 0)) { \
 		fflush(stdout); \
 		fprintf(stderr, "libFJhwb: DEBUG: %s:%d: " fmt "\n", __func__, __LINE__, ##__VA_ARGS__); \
 		fflush(stderr); \
 	} \
 } while(0)
 
+/* Set while fhwb_init_quiet() allocates a bb (hwblib.c) */
+extern __thread bool fhwb_alloc_quiet;
+
+/* Macro for allocation failure, which is not an error for -EBUSY of fhwb_init_quiet() */
+#define fhwb_alloc_error(err, fmt, ...) do { \
+	if ((err) == -EBUSY && fhwb_alloc_quiet) \
+		fhwb_debug(fmt, ##__VA_ARGS__); \
+	else \
+		fhwb_error(fmt, ##__VA_ARGS__); \
+} while(0)
+
+/* fhwb_init() which does not print error upon -EBUSY (hwblib.c) */
+int fhwb_init_quiet(size_t pemask_size, cpu_set_t *pemask);
+
+/* Make barrier descriptor(bd) from bb/cmg num */
+static inline int make_bd(int cmg, int bb)
+{
+	int bd = 0;
+
+	bd |= (cmg << FHWB_BD_CMG_SHIFT);
+	bd |= (bb  << FHWB_BD_BB_SHIFT);
+
+	return bd;
+}
+
+static inline void fhwb_cpu_relax(void)
+{
+#if defined(__aarch64__)
+	asm volatile("yield" ::: "memory");
+#elif defined(__x86_64__) || defined(__i386__)
+	asm volatile("pause" ::: "memory");
+#endif
+}
+
+/* Return cpuid if caller is bound to one PE, otherwise -1 */
+static inline int fhwb_get_bound_cpu(void)
+{
+	cpu_set_t set;
+	int i;
+
+	if (sched_getaffinity(0, sizeof(cpu_set_t), &set) < 0)
+		return -1;
+	if (CPU_COUNT(&set) != 1)
+		return -1;
+
+	for (i = 0; i < CPU_SETSIZE; i++)
+		if (CPU_ISSET(i, &set))
+			return i;
+
+	return -1;
+}
+
+/* Polling count before sleeping. Spinning only delays the last PE if there is one online cpu */
+static inline int fhwb_spin_count(void)
+{
+	return get_nprocs() > 1 ? FHWB_SPIN_COUNT : 0;
+}
+
+/* Sleep while *@addr is @val, until absolute CLOCK_MONOTONIC @deadline (NULL: no timeout) */
+static inline void fhwb_futex_wait(atomic_uint *addr, unsigned int val, const struct timespec *deadline)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_BITSET_PRIVATE, val, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static inline void fhwb_futex_wake(atomic_uint *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+}
+
+/* Timestamp for profiling: system counter on aarch64, CLOCK_MONOTONIC in ns elsewhere */
+static inline uint64_t fhwb_read_clock(void)
+{
+#ifdef __aarch64__
+	uint64_t x;
+
+	asm volatile("isb\n\t"
+		"mrs %0, cntvct_el0"
+		: "=r"(x)
+		:
+		: "memory");
+
+	return x;
+#else
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
+
+/* Ticks per second of fhwb_read_clock() */
+static inline uint64_t fhwb_clock_freq(void)
+{
+#ifdef __aarch64__
+	uint64_t x;
+
+	asm volatile("mrs %0, cntfrq_el0" : "=r"(x));
+
+	return x;
+#else
+	return 1000000000ULL;
+#endif
+}
+
+/* Convert ticks of fhwb_read_clock() to nanoseconds */
+static inline uint64_t fhwb_ticks_to_ns(uint64_t ticks)
+{
+	uint64_t freq = fhwb_clock_freq();
+
+	return ticks / freq * 1000000000ULL + ticks % freq * 1000000000ULL / freq;
+}
+
+/* Return position of @cpu in @pemask (slot index of the PE), or -1 if @cpu is not in @pemask */
+static inline int fhwb_pemask_slot(size_t pemask_size, const cpu_set_t *pemask, int cpu)
+{
+	int slot = 0;
+	int i;
+
+	if (cpu < 0 || !CPU_ISSET_S(cpu, pemask_size, pemask))
+		return -1;
+
+	for (i = 0; i < cpu; i++)
+		if (CPU_ISSET_S(i, pemask_size, pemask))
+			slot++;
+
+	return slot;
+}
+
+/*
+ * Entry of bb allocated by this process (hwblib.c)
+ *
+ * fhwb_init() adds an entry with the data of each feature module and fhwb_fini()
+ * removes it, so an entry found by fhwb_bd_find() stays valid until fhwb_fini().
+ */
+struct fhwb_reduce_buf;
+struct fhwb_profile_buf;
+struct fhwb_stats_buf;
+struct fhwb_bd_entry {
+	struct fhwb_bd_entry *next;
+	int bd;
+	/* PEs given to fhwb_init() */
+	int nr_pe;
+	size_t pemask_size;
+	cpu_set_t *pemask;
+	struct fhwb_reduce_buf *reduce;   /* reduce.c */
+	struct fhwb_profile_buf *profile; /* profile.c (NULL until fhwb_profile_start()) */
+	struct fhwb_stats_buf *stats;     /* stats.c (NULL without ENABLE_STATS) */
+};
+
+/* Lock of the entry list and of feature data changed after fhwb_init() */
+void fhwb_bd_lock(void);
+void fhwb_bd_unlock(void);
+/* Return the entry of @bd or NULL. Caller must hold fhwb_bd_lock() */
+struct fhwb_bd_entry *fhwb_bd_find(int bd);
+/* Return slot index of calling PE in PEs of @entry, or -1 */
+static inline int fhwb_bd_slot(const struct fhwb_bd_entry *entry)
+{
+	return fhwb_pemask_slot(entry->pemask_size, entry->pemask, sched_getcpu());
+}
+
+/* Counters of one PE for fhwb_get_stats(). Each counter is only written by the PE */
+struct fhwb_stats_pe {
+	atomic_uint_least64_t syncs;
+	atomic_uint_least64_t wait_ticks;
+	atomic_uint_least64_t max_wait_ticks;
+	atomic_uint_least64_t assigns;
+	atomic_uint_least64_t unassigns;
+} __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+
+/* Statistics are only collected when built with ENABLE_STATS (stats.c) */
+#ifdef FHWB_ENABLE_STATS
+#define FHWB_STATS 1
+
+/* Counters of calling PE for each window, NULL if the window is not assigned */
+extern __thread struct fhwb_stats_pe *fhwb_stats_windows[FHWB_WINDOW_3 + 1];
+
+/* Add @val to a counter written only by calling PE (atomic read-modify-write is not needed) */
+static inline void fhwb_stats_add(atomic_uint_least64_t *counter, uint64_t val)
+{
+	atomic_store_explicit(counter, atomic_load_explicit(counter, memory_order_relaxed) + val,
+			memory_order_relaxed);
+}
+
+/* Count a synchronization on valid @window which waited @wait_ticks of fhwb_read_clock() */
+static inline void fhwb_stats_sync(int window, uint64_t wait_ticks)
+{
+	struct fhwb_stats_pe *st = fhwb_stats_windows[window];
+
+	if (!st)
+		return;
+
+	fhwb_stats_add(&st->syncs, 1);
+	if (wait_ticks) {
+		fhwb_stats_add(&st->wait_ticks, wait_ticks);
+		if (wait_ticks > atomic_load_explicit(&st->max_wait_ticks, memory_order_relaxed))
+			atomic_store_explicit(&st->max_wait_ticks, wait_ticks, memory_order_relaxed);
+	}
+}
+
+int fhwb_stats_alloc(struct fhwb_bd_entry *entry);
+void fhwb_stats_free(struct fhwb_bd_entry *entry);
+void fhwb_stats_attach(struct fhwb_bd_entry *entry, int window);
+void fhwb_stats_detach(int bd);
+void fhwb_stats_ioctl_error(int bd);
+#else
+#define FHWB_STATS 0
+
+static inline void fhwb_stats_sync(int window, uint64_t wait_ticks)
+{
+	(void)window;
+	(void)wait_ticks;
+}
+
+static inline int fhwb_stats_alloc(struct fhwb_bd_entry *entry) { (void)entry; return 0; }
+static inline void fhwb_stats_free(struct fhwb_bd_entry *entry) { (void)entry; }
+static inline void fhwb_stats_attach(struct fhwb_bd_entry *entry, int window) { (void)entry; (void)window; }
+static inline void fhwb_stats_detach(int bd) { (void)bd; }
+static inline void fhwb_stats_ioctl_error(int bd) { (void)bd; }
+#endif
+
+/*
+ * Operations of barrier backend
+ *
+ * Public functions validate user arguments and then call these operations
+ * of the backend selected at library load time. Return values are the same
+ * as corresponding public functions.
+ */
+struct fhwb_backend {
+	const char *name;
+	int (*init)(struct fhwb_ctx *ctx, size_t pemask_size, cpu_set_t *pemask);
+	int (*fini)(struct fhwb_ctx *ctx, int bd);
+	int (*assign)(struct fhwb_ctx *ctx, int bd, int window);
+	int (*unassign)(struct fhwb_ctx *ctx, int bd);
+	/* Change PEs of @bd (optional) */
+	int (*remask)(struct fhwb_ctx *ctx, int bd, size_t pemask_size, cpu_set_t *pemask);
+	void (*sync)(int window);
+	int (*sync_timeout)(int window, uint64_t timeout_ns);
+	int (*arrive)(int window);
+	int (*test)(int window, int token);
+	int (*wait)(int window, int token);
+	int (*get_pe_info)(struct fhwb_pe_info *info);
+	/* Fill CMG/Physical PE number of each cpu without migration (optional) */
+	int (*load_topology)(struct fhwb_pe_info *list, int num_pe);
+};
+
+#ifdef __aarch64__
+/* fujitsu_hwb driver + BST_SYNC/LBSY_SYNC registers (A64FX only) */
+extern const struct fhwb_backend fhwb_backend_hwb;
+#endif
+/* Barrier resources and synchronization emulated in the library */
+extern const struct fhwb_backend fhwb_backend_sw;
+/* fujitsu_hwb driver (or its emulator) + software barrier synchronization */
+extern const struct fhwb_backend fhwb_backend_emu;
+
+/* Backend selected at library load time (hwblib.c) */
+const struct fhwb_backend *fhwb_get_backend(void);
+
+/*
+ * Context of barrier resources (fhwb_ctx_t)
+ *
+ * @state packs fd of the device file (upper 32 bits, -1 if not opened) and
+ * the number of references (lower 32 bits): one for the owner of an explicit
+ * context and one for each bb allocated through the context.
+ */
+struct fhwb_ctx {
+	atomic_uint_least64_t state;
+	bool is_default;
+};
+
+#define FHWB_CTX_STATE(fd, count) (((uint64_t)(uint32_t)(fd) << 32) | (uint32_t)(count))
+#define FHWB_CTX_FD(state)        ((int)(uint32_t)((state) >> 32))
+#define FHWB_CTX_COUNT(state)     ((uint32_t)(state))
+
+/* Context of fhwb_init()/fhwb_fini()/fhwb_assign()/fhwb_unassign() */
+extern struct fhwb_ctx fhwb_default_ctx;
+
+/* Operations through fujitsu_hwb driver (dev.c) */
+/* Take a reference of @ctx, opening the device file if needed. Return fd */
+int fhwb_ctx_get_fd(struct fhwb_ctx *ctx);
+/* Drop a reference of @ctx. The last one closes the device file */
+void fhwb_ctx_put(struct fhwb_ctx *ctx);
+int fhwb_dev_available(void);
+int fhwb_dev_init(struct fhwb_ctx *ctx, size_t pemask_size, cpu_set_t *pemask);
+int fhwb_dev_fini(struct fhwb_ctx *ctx, int bd);
+int fhwb_dev_remask(struct fhwb_ctx *ctx, int bd, size_t pemask_size, cpu_set_t *pemask);
+int fhwb_dev_assign(struct fhwb_ctx *ctx, int bd, int window);
+int fhwb_dev_unassign(struct fhwb_ctx *ctx, int bd);
+int fhwb_dev_get_pe_info(struct fhwb_pe_info *info);
+int fhwb_dev_load_topology(struct fhwb_pe_info *list, int num_pe);
+/* Directory of sysfs of the driver (FHWB_SYSFS_ROOT_ENV_NAME or FHWB_SYSFS_ROOT) */
+const char *fhwb_dev_sysfs_root(void);
+
+/*
+ * Sense-reversing barrier on shared memory (backend_sw.c). Like LBSY bit, sense
+ * flips when all PEs have arrived, and a PE waits until sense becomes the token
+ * returned by fhwb_swbar_arrive(). Waiting PEs spin for a while, then sleep.
+ */
+struct fhwb_swbar {
+	/* number of PEs arrived at current phase (updated by arriving PEs) */
+	atomic_uint count __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+
+	/* flips when all PEs have arrived (polled by waiting PEs) */
+	atomic_uint sense __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+	/* number of PEs sleeping in futex */
+	atomic_uint sleepers;
+	/* incremented by fhwb_swbar_abort() */
+	atomic_uint gen;
+	/* changed only while no PE is synchronizing */
+	unsigned int nr_pe;
+	int spin_count;
+};
+
+void fhwb_swbar_init(struct fhwb_swbar *bar, unsigned int nr_pe);
+/* Release waiting PEs without completing the phase. PEs arriving with older gen do not wait */
+void fhwb_swbar_abort(struct fhwb_swbar *bar);
+/*
+ * Arrive at current phase and set @token to the sense value which completes the
+ * phase. Return true if calling PE has arrived last: other PEs wait until it
+ * calls fhwb_swbar_release(), so it may do work on behalf of all PEs meanwhile
+ */
+bool fhwb_swbar_join(struct fhwb_swbar *bar, unsigned int gen, unsigned int *token);
+/* Complete current phase */
+void fhwb_swbar_release(struct fhwb_swbar *bar);
+/* fhwb_swbar_join() and fhwb_swbar_release() by the last PE. Return the token */
+unsigned int fhwb_swbar_arrive(struct fhwb_swbar *bar, unsigned int gen);
+/* Wait for @token until absolute CLOCK_MONOTONIC @deadline (NULL: no timeout) */
+int fhwb_swbar_wait(struct fhwb_swbar *bar, unsigned int gen, unsigned int token,
+		    const struct timespec *deadline);
+
+/* Check the phase of @token has completed (or @bar has been aborted since @gen) */
+static inline bool fhwb_swbar_done(struct fhwb_swbar *bar, unsigned int gen, unsigned int token)
+{
+	return atomic_load_explicit(&bar->sense, memory_order_acquire) == token ||
+		atomic_load_explicit(&bar->gen, memory_order_relaxed) != gen;
+}
+
+/* Software barrier synchronization of bb allocated elsewhere (backend_sw.c) */
+int fhwb_swb_setup(int bd, int nr_pe);
+void fhwb_swb_release(int bd);
+/* Change number of PEs of @bd. PEs must not be synchronizing on it */
+void fhwb_swb_remask(int bd, int nr_pe);
+void fhwb_swb_attach(int bd, int window);
+void fhwb_swb_detach(int bd);
+void fhwb_swb_sync(int window);
+int fhwb_swb_sync_timeout(int window, uint64_t timeout_ns);
+int fhwb_swb_arrive(int window);
+int fhwb_swb_test(int window, int token);
+int fhwb_swb_wait(int window, int token);
+
+/*
+ * Topology of the system cached at first use (hwblib.c).
+ * Entries of unavailable cpus are FHWB_INVALID_{CMG,PPE}. Never changes once loaded.
+ */
+struct fhwb_topology {
+	int num_pe;
+	int num_cmg;
+	struct fhwb_pe_info *pes; /* indexed by cpuid */
+	cpu_set_t *cmg_masks;     /* indexed by CMG number */
+};
+
+/* Set cached topology to @topo. Return error if it cannot be loaded */
+int fhwb_get_topology(const struct fhwb_topology **topo);
+
+/* Reduction buffer of bb allocated by this process (reduce.c) */
+int fhwb_reduce_alloc(struct fhwb_bd_entry *entry);
+void fhwb_reduce_free(struct fhwb_bd_entry *entry);
+/* Allocate buffer of new PEs before fhwb_remask(), then switch to it or free it */
+int fhwb_reduce_remask_begin(int bd, size_t pemask_size, cpu_set_t *pemask);
+void fhwb_reduce_remask_end(int bd, bool commit);
+void fhwb_reduce_attach(struct fhwb_bd_entry *entry, int window);
+void fhwb_reduce_detach(int bd);
+
+/* Arrival profile of bb allocated by this process (profile.c) */
+extern atomic_int fhwb_profile_active;
+/* Stop the profile of removed @entry if it is started */
+void fhwb_profile_free(struct fhwb_bd_entry *entry);
+void fhwb_profile_attach(struct fhwb_bd_entry *entry, int window);
+void fhwb_profile_detach(int bd);
+/* Perform @sync on @window with timestamps. Return 0 if @window is not profiled */
+int fhwb_profile_sync(int window, void (*sync)(int window));
+
+/* Pool of blades kept allocated across fhwb_fini()/fhwb_init() (pool.c) */
+extern atomic_int fhwb_pool_entries;
+void fhwb_pool_env_init(void);
+/* Return idle bd of the same PEs, or -ENOENT */
+int fhwb_pool_get(struct fhwb_ctx *ctx, size_t pemask_size, cpu_set_t *pemask);
+/* Allocate bd by @be (freeing idle blades upon -EBUSY) and track it if the pool is enabled */
+int fhwb_pool_init(const struct fhwb_backend *be, struct fhwb_ctx *ctx, size_t pemask_size, cpu_set_t *pemask);
+/* Return 0 if @bd is kept idle, -ENOENT if @bd must be freed by backend */
+int fhwb_pool_put(struct fhwb_ctx *ctx, int bd);
+/* Change PEs of @bd by @be unless it is idle, and track the new PEs */
+int fhwb_pool_remask(const struct fhwb_backend *be, struct fhwb_ctx *ctx, int bd,
+		size_t pemask_size, cpu_set_t *pemask);
+int fhwb_pool_attach(int bd);
+void fhwb_pool_detach(int bd);
+
+/* Wake processes waiting in fhwb_init_wait() for a bb of @bd's CMG (queue.c) */
+void fhwb_queue_wake(int bd);
+
+/* Window binding of calling thread (bind.c) */
+void fhwb_bind_attach(int bd, int window);
+void fhwb_bind_detach(int bd);
+/* Report if calling thread has moved from the cpu @window was assigned on (debug mode) */
+void fhwb_bind_check(int window);
+
+/* Debug message switch and event trace (trace.c) */
+void fhwb_log_init(void);
+/* Record FHWB_TRACE_* event of init/fini/assign/unassign/remask with its return value */
+void fhwb_trace_event(int type, int bd, int window, int result);
+/* Record FHWB_TRACE_SYNC_{BEGIN,END} on @window */
+void fhwb_trace_sync(int type, int window);
+
 #endif /* _FUJITSU_HWB_INTERNAL_H */
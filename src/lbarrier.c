@@ -0,0 +1,577 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Logical barriers mapped onto barrier blades and windows on demand
+ *
+ * A logical barrier synchronizes either on a barrier blade or, when no blade is
+ * available, on shared memory (fhwb_swbar). Each PE assigns a window of the
+ * blade when it synchronizes on the barrier. If all windows of the PE are used,
+ * the least recently used mapping of another logical barrier (not pinned) is
+ * unassigned, since the state of synchronization is kept in the blade.
+ *
+ * A barrier on shared memory tries to take a blade every LBAR_RETRY phases, or
+ * when another logical barrier has freed one. The PE arriving last does it while
+ * the other PEs wait in the phase, since all PEs of a barrier must use the same
+ * mechanism. If no blade is free, it frees the blade of the least recently used
+ * logical barrier of the CMG which has not been used since the previous attempt.
+ *
+ * A blade is freed (or a window of it unassigned) only while its barrier is
+ * quiescent: a PE sets its busy flag before looking at the blade and clears it
+ * after synchronization, and the thread freeing the blade sets the switching
+ * flag and then checks that no PE is busy, which means all PEs have completed
+ * the same number of synchronizations. PEs wait for the change instead of
+ * entering the barrier meanwhile. A busy barrier is skipped rather than waited
+ * for, as its PEs may be waiting for the caller.
+ *
+ * Mappings of each PE are kept in thread local storage, so each PE must be used
+ * by one thread. The windows of a freed blade are freed by fhwb_fini() and
+ * their mappings are forgotten when the PE maps another barrier.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* Phases on shared memory between attempts to take a blade */
+#define LBAR_RETRY 16
+
+/* State of a PE of a logical barrier */
+struct lbar_pe {
+	/* set while the PE uses the blade or the shared memory barrier */
+	atomic_uint busy;
+} __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+
+struct fhwb_lbarrier {
+	/* Shared memory barrier used when bd < 0 */
+	struct fhwb_swbar sw;
+
+	/* set while a thread changes the blade or unassigns a window of it */
+	atomic_uint switching __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+	/* blade (-1: shared memory) and its generation, changed only while quiescent */
+	atomic_int bd;
+	atomic_uint gen;
+	/* lbar_clock when a PE synchronized on the barrier last */
+	atomic_uint_least64_t last_use;
+	/* number of PEs which pin the barrier */
+	atomic_int pins;
+	/* below is only used by the PE arriving last on shared memory */
+	unsigned int phases;
+	/* lbar_clock and lbar_released upon the last attempt to take a blade */
+	uint64_t tried;
+	uint64_t released;
+
+	struct fhwb_lbarrier *next;
+	uint64_t id;
+	int cmg;
+	unsigned int count;
+	size_t pemask_size;
+	cpu_set_t *pemask;
+	struct lbar_pe *pes;
+
+	atomic_uint_least64_t maps;
+	atomic_uint_least64_t evictions;
+	atomic_uint_least64_t blades;
+};
+
+/* Logical barrier mapped to each window of calling PE */
+struct lbar_map {
+	struct fhwb_lbarrier *lb;
+	uint64_t id;          /* 0: not mapped */
+	unsigned int gen;     /* gen of the blade */
+	int slot;             /* slot of the PE in the barrier */
+	uint64_t last_use;
+	bool pinned;
+};
+
+static __thread struct lbar_map lbar_maps[FHWB_WINDOW_3 + 1];
+static __thread uint64_t lbar_tick;
+
+/* Protects the list against fhwb_lbarrier_destroy() while mapping */
+static pthread_rwlock_t lbar_lock = PTHREAD_RWLOCK_INITIALIZER;
+static struct fhwb_lbarrier *lbar_list;
+static atomic_uint_least64_t lbar_next_id = 1;
+/* Incremented upon each attempt to take a blade */
+static atomic_uint_least64_t lbar_clock;
+/* Incremented when a logical barrier frees its blade */
+static atomic_uint_least64_t lbar_released;
+
+/* Wait until nobody changes the blade of @lb and mark calling PE busy */
+static void lbar_enter(struct fhwb_lbarrier *lb, int slot)
+{
+	atomic_uint *busy = &lb->pes[slot].busy;
+
+	for (;;) {
+		atomic_store(busy, 1);
+		if (!atomic_load(&lb->switching))
+			return;
+		atomic_store(busy, 0);
+		fhwb_futex_wait(&lb->switching, 1, NULL);
+	}
+}
+
+static inline void lbar_leave(struct fhwb_lbarrier *lb, int slot)
+{
+	atomic_store_explicit(&lb->pes[slot].busy, 0, memory_order_release);
+}
+
+/* Stop PEs from entering @lb. Return false if some PE is in it */
+static bool lbar_quiesce(struct fhwb_lbarrier *lb)
+{
+	unsigned int zero = 0;
+	unsigned int i;
+
+	/* Others changing @lb do not wait for anything */
+	while (!atomic_compare_exchange_strong(&lb->switching, &zero, 1)) {
+		fhwb_futex_wait(&lb->switching, 1, NULL);
+		zero = 0;
+	}
+
+	for (i = 0; i < lb->count; i++) {
+		if (atomic_load(&lb->pes[i].busy)) {
+			atomic_store(&lb->switching, 0);
+			fhwb_futex_wake(&lb->switching);
+			return false;
+		}
+	}
+
+	return true;
+}
+
+static void lbar_resume(struct fhwb_lbarrier *lb)
+{
+	atomic_store(&lb->switching, 0);
+	fhwb_futex_wake(&lb->switching);
+}
+
+/* Change the blade of quiescent @lb */
+static void lbar_set_blade(struct fhwb_lbarrier *lb, int bd)
+{
+	atomic_store(&lb->bd, bd);
+	atomic_fetch_add(&lb->gen, 1);
+}
+
+static inline void lbar_touch(struct fhwb_lbarrier *lb)
+{
+	uint64_t now = atomic_load_explicit(&lbar_clock, memory_order_relaxed);
+
+	/* Avoid writing the shared cache line on every synchronization */
+	if (atomic_load_explicit(&lb->last_use, memory_order_relaxed) != now)
+		atomic_store_explicit(&lb->last_use, now, memory_order_relaxed);
+}
+
+/* Caller must hold lbar_lock */
+static bool lbar_alive(struct lbar_map *map)
+{
+	struct fhwb_lbarrier *lb;
+
+	for (lb = lbar_list; lb; lb = lb->next)
+		if (lb == map->lb && lb->id == map->id)
+			return true;
+
+	return false;
+}
+
+static inline struct lbar_map *find_map(struct fhwb_lbarrier *lb)
+{
+	int w;
+
+	for (w = 0; w <= FHWB_WINDOW_3; w++)
+		if (lbar_maps[w].id == lb->id)
+			return &lbar_maps[w];
+
+	return NULL;
+}
+
+/* Forget mappings of destroyed barriers and freed blades. Caller must hold lbar_lock */
+static void forget_stale(void)
+{
+	int w;
+
+	for (w = 0; w <= FHWB_WINDOW_3; w++)
+		if (lbar_maps[w].id != 0 &&
+		    (!lbar_alive(&lbar_maps[w]) || lbar_maps[w].gen != atomic_load(&lbar_maps[w].lb->gen)))
+			memset(&lbar_maps[w], 0, sizeof(struct lbar_map));
+}
+
+/*
+ * Free the blade of the least recently used barrier which has not been used since
+ * the previous attempt of @lb. Caller must hold lbar_lock
+ */
+static bool lbar_steal(struct fhwb_lbarrier *lb)
+{
+	struct fhwb_lbarrier *victim = NULL;
+	struct fhwb_lbarrier *v;
+	int bd;
+
+	if (lb->cmg < 0)
+		return false;
+
+	for (v = lbar_list; v; v = v->next) {
+		if (v == lb || v->cmg != lb->cmg || atomic_load(&v->bd) < 0 ||
+		    atomic_load(&v->last_use) >= lb->tried)
+			continue;
+		if (!victim || atomic_load(&v->last_use) < atomic_load(&victim->last_use))
+			victim = v;
+	}
+	if (!victim || !lbar_quiesce(victim))
+		return false;
+
+	/* Pins do not change while the barrier is quiescent */
+	bd = atomic_load(&victim->bd);
+	if (atomic_load(&victim->pins) || fhwb_fini(bd) < 0) {
+		lbar_resume(victim);
+		return false;
+	}
+	lbar_set_blade(victim, -1);
+	lbar_resume(victim);
+
+	fhwb_debug("Take blade of logical barrier %lu for %lu", (unsigned long)victim->id, (unsigned long)lb->id);
+
+	return true;
+}
+
+/*
+ * Try to take a blade for @lb on shared memory. Called by the PE arriving last
+ * while the other PEs wait, so nobody uses the blade of @lb
+ */
+static void lbar_acquire(struct fhwb_lbarrier *lb)
+{
+	uint64_t released = atomic_load(&lbar_released);
+	int bd = -EBUSY;
+
+	if (++lb->phases % LBAR_RETRY != 0 && lb->released == released)
+		return;
+
+	pthread_rwlock_rdlock(&lbar_lock);
+
+	/* A blade has been freed by another logical barrier */
+	if (lb->released != released) {
+		lb->released = released;
+		bd = fhwb_init(lb->pemask_size, lb->pemask);
+	}
+	if (bd == -EBUSY && lbar_steal(lb))
+		bd = fhwb_init(lb->pemask_size, lb->pemask);
+	lb->tried = atomic_fetch_add(&lbar_clock, 1) + 1;
+
+	pthread_rwlock_unlock(&lbar_lock);
+
+	if (bd >= 0) {
+		lbar_set_blade(lb, bd);
+		atomic_fetch_add_explicit(&lb->blades, 1, memory_order_relaxed);
+		fhwb_debug("Logical barrier %lu uses bd: 0x%x", (unsigned long)lb->id, bd);
+	}
+}
+
+/*
+ * Assign a window of calling PE to @bd of @lb, unassigning the least recently
+ * used mapping of a quiescent barrier if needed. Caller must hold lbar_lock and
+ * be busy on @lb
+ */
+static int lbar_map(struct fhwb_lbarrier *lb, int bd, unsigned int gen, int slot)
+{
+	struct lbar_map *victim;
+	unsigned int tried = 0;
+	int window;
+	int ret;
+	int w;
+
+	forget_stale();
+
+	window = fhwb_assign(bd, -1);
+	while (window == -EBUSY) {
+		victim = NULL;
+		for (w = 0; w <= FHWB_WINDOW_3; w++) {
+			if (lbar_maps[w].id != 0 && !lbar_maps[w].pinned && !(tried & (1U << w)) &&
+			    (!victim || lbar_maps[w].last_use < victim->last_use))
+				victim = &lbar_maps[w];
+		}
+		if (!victim)
+			break;
+		w = victim - lbar_maps;
+		tried |= 1U << w;
+
+		/* Other PEs must not be synchronizing on the blade while the window is unassigned */
+		if (!lbar_quiesce(victim->lb))
+			continue;
+
+		ret = 0;
+		if (victim->gen == atomic_load(&victim->lb->gen)) {
+			fhwb_debug("Unmap logical barrier %lu from window %d", (unsigned long)victim->id, w);
+			ret = fhwb_unassign(atomic_load(&victim->lb->bd));
+			if (ret == 0)
+				atomic_fetch_add_explicit(&victim->lb->evictions, 1, memory_order_relaxed);
+		}
+		lbar_resume(victim->lb);
+		memset(victim, 0, sizeof(struct lbar_map));
+
+		window = ret < 0 ? ret : fhwb_assign(bd, w);
+	}
+	if (window >= 0) {
+		lbar_maps[window].lb = lb;
+		lbar_maps[window].id = lb->id;
+		lbar_maps[window].gen = gen;
+		lbar_maps[window].slot = slot;
+		lbar_maps[window].pinned = false;
+		atomic_fetch_add_explicit(&lb->maps, 1, memory_order_relaxed);
+	}
+
+	return window;
+}
+
+/* Slot of calling PE in @lb, or -1 if the PE does not join the barrier */
+static int lbar_slot(struct fhwb_lbarrier *lb)
+{
+	struct lbar_map *map = find_map(lb);
+	int slot;
+
+	if (map)
+		return map->slot;
+
+	slot = fhwb_pemask_slot(lb->pemask_size, lb->pemask, sched_getcpu());
+	if (slot < 0)
+		fhwb_error("PE does not join logical barrier %lu", (unsigned long)lb->id);
+
+	return slot;
+}
+
+/* CMG of PEs in @pemask, or -1 if unknown */
+static int get_cmg(size_t pemask_size, cpu_set_t *pemask)
+{
+	const struct fhwb_topology *topo;
+	int cpu;
+
+	if (fhwb_get_topology(&topo) < 0)
+		return -1;
+
+	for (cpu = 0; cpu < topo->num_pe && cpu < (int)(pemask_size * 8); cpu++)
+		if (CPU_ISSET_S(cpu, pemask_size, pemask))
+			return topo->pes[cpu].cmg;
+
+	return -1;
+}
+
+static void lbar_free(struct fhwb_lbarrier *lb)
+{
+	free(lb->pes);
+	free(lb->pemask);
+	free(lb);
+}
+
+int fhwb_lbarrier_create(size_t pemask_size, cpu_set_t *pemask, struct fhwb_lbarrier **barrier)
+{
+	struct fhwb_lbarrier *lb;
+	int count;
+	int bd;
+
+	if (pemask == NULL || pemask_size == 0 || barrier == NULL) {
+		fhwb_error("pemask is NULL, pemask_size is 0 or barrier is NULL");
+		return -EINVAL;
+	}
+
+	count = CPU_COUNT_S(pemask_size, pemask);
+	if (count < 2) {
+		fhwb_error("pemask contains less than 2 PEs");
+		return -EINVAL;
+	}
+
+	if (posix_memalign((void **)&lb, FHWB_CACHE_LINE_SIZE, sizeof(struct fhwb_lbarrier)))
+		return -ENOMEM;
+	memset(lb, 0, sizeof(struct fhwb_lbarrier));
+	lb->pemask = malloc(pemask_size);
+	if (posix_memalign((void **)&lb->pes, FHWB_CACHE_LINE_SIZE, sizeof(struct lbar_pe) * count))
+		lb->pes = NULL;
+	if (!lb->pemask || !lb->pes) {
+		fhwb_error("memory allocation failure");
+		lbar_free(lb);
+		return -ENOMEM;
+	}
+	memcpy(lb->pemask, pemask, pemask_size);
+	memset(lb->pes, 0, sizeof(struct lbar_pe) * count);
+	lb->pemask_size = pemask_size;
+	lb->count = count;
+	lb->cmg = get_cmg(pemask_size, pemask);
+	lb->id = atomic_fetch_add(&lbar_next_id, 1);
+	lb->released = atomic_load(&lbar_released);
+	fhwb_swbar_init(&lb->sw, count);
+
+	bd = fhwb_init(pemask_size, pemask);
+	if (bd == -EBUSY) {
+		fhwb_debug("No barrier blade for logical barrier %lu, use shared memory", (unsigned long)lb->id);
+		bd = -1;
+	} else if (bd < 0) {
+		lbar_free(lb);
+		return bd;
+	} else {
+		lb->blades = 1;
+	}
+	lb->bd = bd;
+
+	pthread_rwlock_wrlock(&lbar_lock);
+	lb->next = lbar_list;
+	lbar_list = lb;
+	pthread_rwlock_unlock(&lbar_lock);
+
+	*barrier = lb;
+
+	return 0;
+}
+
+int fhwb_lbarrier_destroy(struct fhwb_lbarrier *barrier)
+{
+	struct fhwb_lbarrier **p;
+	int ret = 0;
+
+	if (barrier == NULL) {
+		fhwb_error("barrier is NULL");
+		return -EINVAL;
+	}
+
+	pthread_rwlock_wrlock(&lbar_lock);
+	for (p = &lbar_list; *p; p = &(*p)->next) {
+		if (*p == barrier) {
+			*p = barrier->next;
+			break;
+		}
+	}
+	/* Windows still assigned on any PE are freed together */
+	if (barrier->bd >= 0) {
+		ret = fhwb_fini(barrier->bd);
+		atomic_fetch_add(&lbar_released, 1);
+	}
+	pthread_rwlock_unlock(&lbar_lock);
+
+	lbar_free(barrier);
+
+	return ret;
+}
+
+int fhwb_lbarrier_sync(struct fhwb_lbarrier *barrier)
+{
+	struct lbar_map *map;
+	unsigned int token;
+	unsigned int gen;
+	int window;
+	int slot;
+	int ret = 0;
+	int bd;
+
+	slot = lbar_slot(barrier);
+	if (slot < 0)
+		return -EINVAL;
+
+	atomic_thread_fence(memory_order_seq_cst);
+
+	lbar_enter(barrier, slot);
+	lbar_touch(barrier);
+
+	bd = atomic_load_explicit(&barrier->bd, memory_order_relaxed);
+	if (bd < 0) {
+		gen = atomic_load_explicit(&barrier->sw.gen, memory_order_relaxed);
+		if (fhwb_swbar_join(&barrier->sw, gen, &token)) {
+			lbar_acquire(barrier);
+			fhwb_swbar_release(&barrier->sw);
+		}
+		fhwb_swbar_wait(&barrier->sw, gen, token, NULL);
+		goto out;
+	}
+
+	gen = atomic_load_explicit(&barrier->gen, memory_order_relaxed);
+	map = find_map(barrier);
+	if (__builtin_expect(!map || map->gen != gen, 0)) {
+		pthread_rwlock_rdlock(&lbar_lock);
+		window = lbar_map(barrier, bd, gen, slot);
+		pthread_rwlock_unlock(&lbar_lock);
+		if (window < 0) {
+			ret = window;
+			goto out;
+		}
+		map = &lbar_maps[window];
+	}
+	map->last_use = ++lbar_tick;
+	fhwb_sync(map - lbar_maps);
+
+out:
+	lbar_leave(barrier, slot);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	return ret;
+}
+
+int fhwb_lbarrier_pin(struct fhwb_lbarrier *barrier, int pin)
+{
+	struct lbar_map *map;
+	int pinned = 0;
+	int window = 0;
+	int slot;
+	int bd;
+	int w;
+
+	if (barrier == NULL) {
+		fhwb_error("barrier is NULL");
+		return -EINVAL;
+	}
+
+	map = find_map(barrier);
+	if (!pin) {
+		if (map && map->pinned) {
+			map->pinned = false;
+			atomic_fetch_sub(&barrier->pins, 1);
+		}
+		return 0;
+	}
+
+	slot = lbar_slot(barrier);
+	if (slot < 0)
+		return -EINVAL;
+
+	pthread_rwlock_rdlock(&lbar_lock);
+	lbar_enter(barrier, slot);
+	forget_stale();
+	map = find_map(barrier);
+
+	/* Keep one window for barriers not pinned */
+	for (w = 0; w <= FHWB_WINDOW_3; w++)
+		if (&lbar_maps[w] != map && lbar_maps[w].pinned)
+			pinned++;
+	bd = atomic_load(&barrier->bd);
+	if (pinned >= FHWB_WINDOW_3) {
+		fhwb_error("too many logical barriers are pinned");
+		window = -EBUSY;
+	} else if (bd >= 0 && !map) {
+		window = lbar_map(barrier, bd, atomic_load(&barrier->gen), slot);
+		map = window >= 0 ? &lbar_maps[window] : NULL;
+	}
+	/* Barriers on shared memory have nothing to pin */
+	if (map && !map->pinned) {
+		map->pinned = true;
+		atomic_fetch_add(&barrier->pins, 1);
+	}
+
+	lbar_leave(barrier, slot);
+	pthread_rwlock_unlock(&lbar_lock);
+
+	return window < 0 ? window : 0;
+}
+
+int fhwb_lbarrier_get_stats(struct fhwb_lbarrier *barrier, struct fhwb_lbarrier_stats *stats)
+{
+	if (barrier == NULL || stats == NULL) {
+		fhwb_error("barrier or stats is NULL");
+		return -EINVAL;
+	}
+
+	stats->hardware = atomic_load(&barrier->bd) >= 0;
+	stats->maps = atomic_load_explicit(&barrier->maps, memory_order_relaxed);
+	stats->evictions = atomic_load_explicit(&barrier->evictions, memory_order_relaxed);
+	stats->blades = atomic_load_explicit(&barrier->blades, memory_order_relaxed);
+
+	return 0;
+}
@@ -0,0 +1,350 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Node-wide hierarchical barrier
+ *
+ * Synchronization of one episode is performed as follows:
+ *  1. All PEs of a CMG synchronize by hardware barrier (gather)
+ *  2. Leader PE of each CMG performs dissemination barrier with other leaders
+ *     on shared memory
+ *  3. All PEs of a CMG synchronize by hardware barrier again. Since the leader
+ *     arrives after step 2, this releases PEs after all CMGs have gathered
+ * A CMG which has only one PE in the mask has no barrier blade and its PE
+ * only performs step 2.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* ceil(log2(number of CMGs)) is enough since CMG number of bd is 8 bits */
+#define NODE_MAX_ROUNDS 8
+
+/* Flag of dissemination barrier notified by another leader */
+struct node_flag {
+	/* last episode notified */
+	atomic_uint episode __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+	/* number of leaders sleeping in futex */
+	atomic_uint sleepers;
+};
+
+struct node_cmg {
+	struct node_flag flags[NODE_MAX_ROUNDS];
+	/* episode number of the leader (only accessed by the leader) */
+	unsigned int episode __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+	int bd;
+	cpu_set_t mask;
+};
+
+struct node_pe {
+	int16_t cmg;    /* index of node_cmg or -1 if not joining */
+	int8_t window;  /* assigned window or -1 */
+	bool leader;
+};
+
+struct fhwb_node_barrier {
+	struct node_cmg *cmgs;
+	struct node_pe *pes;
+	int nr_cmg;
+	int nr_rounds;
+	int nr_pe;
+	int spin_count;
+};
+
+static void node_free(struct fhwb_node_barrier *nb)
+{
+	free(nb->cmgs);
+	free(nb->pes);
+	free(nb);
+}
+
+/*
+ * Group PEs of @pemask by CMG and fill nb->cmgs/nb->pes.
+ * CMGs are indexed in ascending order of cpuid of their first PE.
+ */
+static int node_setup(struct fhwb_node_barrier *nb, size_t pemask_size, cpu_set_t *pemask)
+{
+	const struct fhwb_topology *topo;
+	const struct fhwb_pe_info *info;
+	int cmg_index[FHWB_BD_CMG_MASK + 1];
+	int num_pe;
+	int count = 0;
+	int ret;
+	int i;
+
+	ret = fhwb_get_topology(&topo);
+	if (ret < 0)
+		return ret;
+	info = topo->pes;
+	num_pe = topo->num_pe;
+
+	nb->nr_pe = num_pe;
+	nb->pes = calloc(num_pe, sizeof(struct node_pe));
+	/* At most one CMG for each PE */
+	if (posix_memalign((void **)&nb->cmgs, FHWB_CACHE_LINE_SIZE, sizeof(struct node_cmg) * num_pe))
+		nb->cmgs = NULL;
+	if (!nb->pes || !nb->cmgs) {
+		fhwb_error("memory allocation failure");
+		return -ENOMEM;
+	}
+	memset(nb->cmgs, 0, sizeof(struct node_cmg) * num_pe);
+
+	for (i = 0; i < FHWB_BD_CMG_MASK + 1; i++)
+		cmg_index[i] = -1;
+	for (i = 0; i < num_pe; i++) {
+		nb->pes[i].cmg = -1;
+		nb->pes[i].window = -1;
+	}
+
+	for (i = 0; i < (int)(pemask_size * 8); i++) {
+		struct node_cmg *cmg;
+		int idx;
+
+		if (!CPU_ISSET_S(i, pemask_size, pemask))
+			continue;
+
+		if (i >= num_pe || info[i].cmg == FHWB_INVALID_CMG) {
+			fhwb_error("pemask contains invalid cpu: %d", i);
+			return -EINVAL;
+		}
+
+		idx = cmg_index[info[i].cmg];
+		if (idx < 0) {
+			idx = nb->nr_cmg++;
+			cmg_index[info[i].cmg] = idx;
+			nb->pes[i].leader = true;
+			CPU_ZERO(&nb->cmgs[idx].mask);
+		}
+		cmg = &nb->cmgs[idx];
+		CPU_SET(i, &cmg->mask);
+		nb->pes[i].cmg = idx;
+		count++;
+	}
+
+	if (count < 2) {
+		fhwb_error("pemask contains less than 2 PEs");
+		return -EINVAL;
+	}
+
+	while ((1 << nb->nr_rounds) < nb->nr_cmg)
+		nb->nr_rounds++;
+
+	return 0;
+}
+
+int fhwb_node_barrier_init(size_t pemask_size, cpu_set_t *pemask, struct fhwb_node_barrier **barrier)
+{
+	struct fhwb_node_barrier *nb;
+	int ret;
+	int i;
+
+	if (pemask == NULL || pemask_size == 0 || barrier == NULL) {
+		fhwb_error("pemask/barrier is NULL or pemask_size is 0");
+		return -EINVAL;
+	}
+
+	nb = calloc(1, sizeof(struct fhwb_node_barrier));
+	if (!nb) {
+		fhwb_error("memory allocation failure");
+		return -ENOMEM;
+	}
+
+	ret = node_setup(nb, pemask_size, pemask);
+	if (ret < 0) {
+		node_free(nb);
+		return ret;
+	}
+
+	for (i = 0; i < nb->nr_cmg; i++) {
+		struct node_cmg *cmg = &nb->cmgs[i];
+
+		cmg->bd = -1;
+		if (CPU_COUNT(&cmg->mask) < 2)
+			continue;
+
+		ret = fhwb_init(sizeof(cpu_set_t), &cmg->mask);
+		if (ret < 0) {
+			while (--i >= 0)
+				if (nb->cmgs[i].bd >= 0)
+					fhwb_fini(nb->cmgs[i].bd);
+			node_free(nb);
+			return ret;
+		}
+		cmg->bd = ret;
+	}
+
+	nb->spin_count = fhwb_spin_count();
+	*barrier = nb;
+
+	fhwb_debug("Create node barrier. %d CMG, %d rounds", nb->nr_cmg, nb->nr_rounds);
+
+	return 0;
+}
+
+int fhwb_node_barrier_fini(struct fhwb_node_barrier *barrier)
+{
+	int ret = 0;
+	int err;
+	int i;
+
+	if (barrier == NULL) {
+		fhwb_error("barrier is NULL");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < barrier->nr_cmg; i++) {
+		if (barrier->cmgs[i].bd < 0)
+			continue;
+		err = fhwb_fini(barrier->cmgs[i].bd);
+		if (err < 0 && ret == 0)
+			ret = err;
+	}
+
+	node_free(barrier);
+
+	return ret;
+}
+
+/* Return state of calling PE in @barrier, or NULL with error in @err */
+static struct node_pe *get_pe(struct fhwb_node_barrier *barrier, int *err)
+{
+	int cpu;
+
+	if (barrier == NULL) {
+		fhwb_error("barrier is NULL");
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	cpu = fhwb_get_bound_cpu();
+	if (cpu < 0) {
+		fhwb_error("caller is not bound to one PE");
+		*err = -EPERM;
+		return NULL;
+	}
+
+	if (cpu >= barrier->nr_pe || barrier->pes[cpu].cmg < 0) {
+		fhwb_error("PE does not join synchronization: %d", cpu);
+		*err = -EINVAL;
+		return NULL;
+	}
+
+	return &barrier->pes[cpu];
+}
+
+int fhwb_node_barrier_assign(struct fhwb_node_barrier *barrier)
+{
+	struct node_pe *pe;
+	int ret;
+
+	pe = get_pe(barrier, &ret);
+	if (!pe)
+		return ret;
+
+	if (barrier->cmgs[pe->cmg].bd < 0)
+		return 0;
+
+	ret = fhwb_assign(barrier->cmgs[pe->cmg].bd, -1);
+	if (ret < 0)
+		return ret;
+	pe->window = ret;
+
+	return 0;
+}
+
+int fhwb_node_barrier_unassign(struct fhwb_node_barrier *barrier)
+{
+	struct node_pe *pe;
+	int ret;
+
+	pe = get_pe(barrier, &ret);
+	if (!pe)
+		return ret;
+
+	if (barrier->cmgs[pe->cmg].bd < 0)
+		return 0;
+
+	if (pe->window < 0) {
+		fhwb_error("PE is not assigned");
+		return -EINVAL;
+	}
+
+	ret = fhwb_unassign(barrier->cmgs[pe->cmg].bd);
+	if (ret < 0)
+		return ret;
+	pe->window = -1;
+
+	return 0;
+}
+
+static void notify_flag(struct node_flag *flag, unsigned int episode)
+{
+	atomic_store(&flag->episode, episode);
+	if (atomic_load(&flag->sleepers))
+		fhwb_futex_wake(&flag->episode);
+}
+
+static void wait_flag(struct fhwb_node_barrier *barrier, struct node_flag *flag, unsigned int episode)
+{
+	unsigned int val;
+	int spin;
+
+	/* Episode may have been notified for next episode already */
+	for (spin = 0; (int)((val = atomic_load(&flag->episode)) - episode) < 0; spin++) {
+		if (spin < barrier->spin_count) {
+			fhwb_cpu_relax();
+			continue;
+		}
+
+		atomic_fetch_add(&flag->sleepers, 1);
+		fhwb_futex_wait(&flag->episode, val, NULL);
+		atomic_fetch_sub(&flag->sleepers, 1);
+	}
+}
+
+/* Dissemination barrier among leaders: in round r, notify (i + 2^r)'th leader and wait for notification */
+static void leader_sync(struct fhwb_node_barrier *barrier, int idx)
+{
+	struct node_cmg *cmg = &barrier->cmgs[idx];
+	unsigned int episode = ++cmg->episode;
+	int r;
+
+	for (r = 0; r < barrier->nr_rounds; r++) {
+		int peer = (idx + (1 << r)) % barrier->nr_cmg;
+
+		notify_flag(&barrier->cmgs[peer].flags[r], episode);
+		wait_flag(barrier, &cmg->flags[r], episode);
+	}
+}
+
+void fhwb_node_barrier_sync(struct fhwb_node_barrier *barrier)
+{
+	struct node_pe *pe;
+	int cpu;
+
+	cpu = sched_getcpu();
+	if (cpu < 0 || cpu >= barrier->nr_pe || barrier->pes[cpu].cmg < 0) {
+		fhwb_error("PE does not join synchronization: %d", cpu);
+		return;
+	}
+	pe = &barrier->pes[cpu];
+
+	if (barrier->nr_cmg == 1) {
+		fhwb_sync(pe->window);
+		return;
+	}
+
+	if (barrier->cmgs[pe->cmg].bd >= 0)
+		fhwb_sync(pe->window);
+	if (pe->leader)
+		leader_sync(barrier, pe->cmg);
+	if (barrier->cmgs[pe->cmg].bd >= 0)
+		fhwb_sync(pe->window);
+}
@@ -0,0 +1,349 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Pool of barrier blades kept allocated across fhwb_fini()/fhwb_init()
+ *
+ * When enabled, fhwb_fini() of a bb without assigned windows keeps the bb
+ * allocated in the driver (idle), and fhwb_init() with the same set of PEs
+ * of the same context reuses it without ioctl. The device file of the context
+ * also stays opened while the pool has its blades. Idle blades of a CMG are
+ * freed when allocation of the CMG fails with -EBUSY, or when the pool size
+ * is reduced.
+ *
+ * Every bb allocated while the pool is enabled has an entry which counts
+ * windows assigned by this process, since a bb can only be reused when its
+ * windows have been unassigned.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <string.h>
+
+struct pool_entry {
+	struct pool_entry *next;
+	struct fhwb_ctx *ctx;
+	int bd;
+	bool idle;
+	int assigned;     /* windows assigned by this process */
+	size_t pemask_size;
+	cpu_set_t *pemask;
+};
+
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static struct pool_entry *pool_entries;
+/* Maximum number of idle blades (0: disabled). Checked without lock by fhwb_init() */
+static atomic_int pool_size;
+static int pool_idle;
+static uint64_t pool_hits;
+static uint64_t pool_misses;
+static uint64_t pool_evictions;
+
+/* Checked without lock by fhwb_assign()/fhwb_unassign() to skip the pool */
+atomic_int fhwb_pool_entries;
+
+/* Whether two masks have the same set of PEs regardless of their size */
+static bool same_mask(size_t size1, const cpu_set_t *mask1, size_t size2, const cpu_set_t *mask2)
+{
+	size_t size = size1 > size2 ? size1 : size2;
+	size_t i;
+
+	for (i = 0; i < size * 8; i++) {
+		bool set1 = i < size1 * 8 && CPU_ISSET_S(i, size1, mask1);
+		bool set2 = i < size2 * 8 && CPU_ISSET_S(i, size2, mask2);
+
+		if (set1 != set2)
+			return false;
+	}
+
+	return true;
+}
+
+/* Caller must hold pool_mutex */
+static struct pool_entry *find_entry(int bd)
+{
+	struct pool_entry *e;
+
+	for (e = pool_entries; e; e = e->next)
+		if (e->bd == bd)
+			return e;
+
+	return NULL;
+}
+
+/* Unlink @e from the list. Caller must hold pool_mutex */
+static void remove_entry(struct pool_entry *e)
+{
+	struct pool_entry **p;
+
+	for (p = &pool_entries; *p; p = &(*p)->next) {
+		if (*p == e) {
+			*p = e->next;
+			break;
+		}
+	}
+	if (e->idle)
+		pool_idle--;
+	atomic_fetch_sub(&fhwb_pool_entries, 1);
+	free(e->pemask);
+	free(e);
+}
+
+/*
+ * Free at most @max idle blades of @cmg (-1: all CMGs).
+ * Caller must hold pool_mutex. Return number of freed blades
+ */
+static int evict(const struct fhwb_backend *be, int cmg, int max)
+{
+	struct pool_entry *e, *next;
+	int count = 0;
+
+	for (e = pool_entries; e && count < max; e = next) {
+		next = e->next;
+		if (!e->idle || (cmg >= 0 && fhwb_get_cmg_from_bd(e->bd) != cmg))
+			continue;
+
+		fhwb_debug("Evict pooled BB. bd: 0x%x", e->bd);
+		if (be->fini(e->ctx, e->bd) == 0)
+			fhwb_queue_wake(e->bd);
+		remove_entry(e);
+		pool_evictions++;
+		count++;
+	}
+
+	return count;
+}
+
+void fhwb_pool_env_init(void)
+{
+	const char *env = getenv(FHWB_POOL_ENV_NAME);
+
+	if (env)
+		atomic_store(&pool_size, atoi(env) > 0 ? atoi(env) : 0);
+}
+
+int fhwb_pool_get(struct fhwb_ctx *ctx, size_t pemask_size, cpu_set_t *pemask)
+{
+	struct pool_entry *e;
+	int bd = -ENOENT;
+
+	/* Do not take the lock while the pool is disabled */
+	if (atomic_load_explicit(&pool_size, memory_order_relaxed) == 0)
+		return -ENOENT;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	if (pool_size == 0)
+		goto out;
+
+	for (e = pool_entries; e; e = e->next) {
+		if (e->idle && e->ctx == ctx && same_mask(e->pemask_size, e->pemask, pemask_size, pemask)) {
+			e->idle = false;
+			pool_idle--;
+			pool_hits++;
+			bd = e->bd;
+			fhwb_debug("Reuse pooled BB. bd: 0x%x", bd);
+			goto out;
+		}
+	}
+	pool_misses++;
+
+out:
+	pthread_mutex_unlock(&pool_mutex);
+
+	return bd;
+}
+
+int fhwb_pool_init(const struct fhwb_backend *be, struct fhwb_ctx *ctx, size_t pemask_size, cpu_set_t *pemask)
+{
+	const struct fhwb_topology *topo;
+	struct pool_entry *e;
+	int evicted;
+	int bd;
+	int cpu;
+
+	bd = be->init(ctx, pemask_size, pemask);
+	if (bd == -EBUSY && atomic_load(&fhwb_pool_entries) && fhwb_get_topology(&topo) == 0) {
+		/* Make room from idle blades of the CMG and retry */
+		for (cpu = 0; cpu < topo->num_pe && cpu < (int)(pemask_size * 8); cpu++)
+			if (CPU_ISSET_S(cpu, pemask_size, pemask))
+				break;
+
+		do {
+			pthread_mutex_lock(&pool_mutex);
+			evicted = cpu < topo->num_pe ? evict(be, topo->pes[cpu].cmg, 1) : 0;
+			pthread_mutex_unlock(&pool_mutex);
+			if (evicted == 0)
+				break;
+			bd = be->init(ctx, pemask_size, pemask);
+		} while (bd == -EBUSY);
+	}
+	if (bd < 0 || atomic_load_explicit(&pool_size, memory_order_relaxed) == 0)
+		return bd;
+
+	pthread_mutex_lock(&pool_mutex);
+	if (pool_size == 0)
+		goto out;
+
+	/* The bb just cannot be pooled if memory is not available */
+	e = calloc(1, sizeof(struct pool_entry));
+	if (!e)
+		goto out;
+	e->pemask = malloc(pemask_size);
+	if (!e->pemask) {
+		free(e);
+		goto out;
+	}
+	memcpy(e->pemask, pemask, pemask_size);
+	e->pemask_size = pemask_size;
+	e->ctx = ctx;
+	e->bd = bd;
+	e->next = pool_entries;
+	pool_entries = e;
+	atomic_fetch_add(&fhwb_pool_entries, 1);
+
+out:
+	pthread_mutex_unlock(&pool_mutex);
+
+	return bd;
+}
+
+int fhwb_pool_put(struct fhwb_ctx *ctx, int bd)
+{
+	struct pool_entry *e;
+	int ret = -ENOENT;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	e = find_entry(bd);
+	if (!e)
+		goto out;
+
+	if (e->idle || e->ctx != ctx) {
+		fhwb_error("BB is not allocated by the context. bd: 0x%x", bd);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (e->assigned > 0 || pool_idle >= pool_size) {
+		/* Free by backend (windows are freed together) */
+		remove_entry(e);
+		goto out;
+	}
+
+	e->idle = true;
+	pool_idle++;
+	ret = 0;
+	fhwb_debug("Keep BB in pool. bd: 0x%x", bd);
+
+out:
+	pthread_mutex_unlock(&pool_mutex);
+
+	return ret;
+}
+
+int fhwb_pool_remask(const struct fhwb_backend *be, struct fhwb_ctx *ctx, int bd,
+		size_t pemask_size, cpu_set_t *pemask)
+{
+	struct pool_entry *e;
+	cpu_set_t *copy;
+	int ret;
+
+	pthread_mutex_lock(&pool_mutex);
+
+	e = find_entry(bd);
+	if (e && (e->idle || e->ctx != ctx)) {
+		fhwb_error("BB is not allocated by the context. bd: 0x%x", bd);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	ret = be->remask(ctx, bd, pemask_size, pemask);
+	if (ret < 0 || !e)
+		goto out;
+
+	/* Reuse by fhwb_init() is keyed by the new PEs */
+	copy = malloc(pemask_size);
+	if (!copy) {
+		remove_entry(e);
+		goto out;
+	}
+	memcpy(copy, pemask, pemask_size);
+	free(e->pemask);
+	e->pemask = copy;
+	e->pemask_size = pemask_size;
+
+out:
+	pthread_mutex_unlock(&pool_mutex);
+
+	return ret;
+}
+
+int fhwb_pool_attach(int bd)
+{
+	struct pool_entry *e;
+	int ret = 0;
+
+	pthread_mutex_lock(&pool_mutex);
+	e = find_entry(bd);
+	if (e && e->idle) {
+		fhwb_error("BB is not allocated. bd: 0x%x", bd);
+		ret = -EINVAL;
+	} else if (e) {
+		e->assigned++;
+	}
+	pthread_mutex_unlock(&pool_mutex);
+
+	return ret;
+}
+
+void fhwb_pool_detach(int bd)
+{
+	struct pool_entry *e;
+
+	pthread_mutex_lock(&pool_mutex);
+	e = find_entry(bd);
+	if (e && e->assigned > 0)
+		e->assigned--;
+	pthread_mutex_unlock(&pool_mutex);
+}
+
+int fhwb_pool_set_size(int size)
+{
+	if (size < 0) {
+		fhwb_error("size is negative");
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&pool_mutex);
+	atomic_store(&pool_size, size);
+	if (pool_idle > size)
+		evict(fhwb_get_backend(), -1, pool_idle - size);
+	pthread_mutex_unlock(&pool_mutex);
+
+	return 0;
+}
+
+int fhwb_pool_get_stats(struct fhwb_pool_stats *stats)
+{
+	if (stats == NULL) {
+		fhwb_error("stats is NULL");
+		return -EINVAL;
+	}
+
+	pthread_mutex_lock(&pool_mutex);
+	stats->hits = pool_hits;
+	stats->misses = pool_misses;
+	stats->evictions = pool_evictions;
+	stats->idle = pool_idle;
+	pthread_mutex_unlock(&pool_mutex);
+
+	return 0;
+}
@@ -0,0 +1,294 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Arrival profile of barrier synchronization
+ *
+ * After fhwb_profile_start(), fhwb_sync() of PEs assigned to the bb records
+ * timestamps of arrival and release into a ring buffer of the PE. Since every PE
+ * performs the same sequence of synchronizations, n'th entries of all PEs belong
+ * to the same episode, and the report compares them to find the last PE.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <string.h>
+
+struct profile_entry {
+	uint64_t arrive;
+	uint64_t release;
+};
+
+/* Profile of one PE (only written by the PE) */
+struct profile_pe {
+	/* number of profiled synchronizations */
+	atomic_uint_least64_t seq;
+	/* cumulative clock ticks in synchronization */
+	uint64_t wait;
+	struct profile_entry *ring;
+	int depth;
+	int cpu;
+} __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+
+/* Profile buffer of a bb */
+struct fhwb_profile_buf {
+	/* ring buffer depth */
+	int depth;
+	struct profile_pe *pes;
+	struct profile_entry *entries;
+};
+
+struct profile_window {
+	int bd;
+	struct profile_pe *pe;
+};
+
+/* fhwb_hwb_sync_enabled before the first profile is started (under fhwb_bd_lock()) */
+static int saved_hwb_sync_enabled;
+
+static __thread struct profile_window profile_windows[FHWB_WINDOW_3 + 1];
+
+atomic_int fhwb_profile_active;
+
+void fhwb_profile_free(struct fhwb_bd_entry *entry)
+{
+	struct fhwb_profile_buf *buf = entry->profile;
+
+	if (!buf)
+		return;
+
+	/* Enable inlined hardware barrier again when no profile is running */
+	fhwb_bd_lock();
+	if (atomic_fetch_sub(&fhwb_profile_active, 1) == 1)
+		__atomic_store_n(&fhwb_hwb_sync_enabled, saved_hwb_sync_enabled, __ATOMIC_RELAXED);
+	fhwb_bd_unlock();
+
+	free(buf->entries);
+	free(buf->pes);
+	free(buf);
+	entry->profile = NULL;
+}
+
+void fhwb_profile_attach(struct fhwb_bd_entry *entry, int window)
+{
+	struct profile_window *w = &profile_windows[window];
+	int slot;
+
+	w->pe = NULL;
+	if (!atomic_load(&fhwb_profile_active) || !entry || !entry->profile)
+		return;
+
+	slot = fhwb_bd_slot(entry);
+	if (slot < 0)
+		return;
+
+	w->bd = entry->bd;
+	w->pe = &entry->profile->pes[slot];
+	w->pe->cpu = sched_getcpu();
+}
+
+void fhwb_profile_detach(int bd)
+{
+	int i;
+
+	for (i = 0; i <= FHWB_WINDOW_3; i++)
+		if (profile_windows[i].pe && profile_windows[i].bd == bd)
+			profile_windows[i].pe = NULL;
+}
+
+int fhwb_profile_sync(int window, void (*sync)(int window))
+{
+	struct profile_entry *e;
+	struct profile_pe *pe;
+	uint64_t seq;
+
+	if (window < 0 || window > FHWB_WINDOW_3)
+		return 0;
+	pe = profile_windows[window].pe;
+	if (!pe)
+		return 0;
+
+	seq = atomic_load_explicit(&pe->seq, memory_order_relaxed);
+	e = &pe->ring[seq % pe->depth];
+
+	e->arrive = fhwb_read_clock();
+	sync(window);
+	e->release = fhwb_read_clock();
+
+	pe->wait += e->release - e->arrive;
+	atomic_store_explicit(&pe->seq, seq + 1, memory_order_release);
+
+	return 1;
+}
+
+int fhwb_profile_start(int bd, int depth)
+{
+	struct fhwb_bd_entry *entry;
+	struct fhwb_profile_buf *buf = NULL;
+	struct profile_pe *pes = NULL;
+	struct profile_entry *entries = NULL;
+	int ret = 0;
+	int i;
+
+	if (depth <= 0) {
+		fhwb_error("depth is invalid: %d", depth);
+		return -EINVAL;
+	}
+
+	fhwb_bd_lock();
+	entry = fhwb_bd_find(bd);
+	if (!entry) {
+		fhwb_error("bd is not allocated by this process: %d", bd);
+		ret = -EINVAL;
+		goto out;
+	}
+	if (entry->profile) {
+		fhwb_error("profile is already started: %d", bd);
+		ret = -EBUSY;
+		goto out;
+	}
+
+	buf = malloc(sizeof(struct fhwb_profile_buf));
+	if (posix_memalign((void **)&pes, FHWB_CACHE_LINE_SIZE, sizeof(struct profile_pe) * entry->nr_pe))
+		pes = NULL;
+	entries = calloc((size_t)entry->nr_pe * depth, sizeof(struct profile_entry));
+	if (!buf || !pes || !entries) {
+		fhwb_error("memory allocation failure");
+		free(buf);
+		free(pes);
+		free(entries);
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	memset(pes, 0, sizeof(struct profile_pe) * entry->nr_pe);
+	for (i = 0; i < entry->nr_pe; i++) {
+		pes[i].ring = &entries[(size_t)i * depth];
+		pes[i].depth = depth;
+		pes[i].cpu = -1;
+	}
+	buf->pes = pes;
+	buf->entries = entries;
+	buf->depth = depth;
+	entry->profile = buf;
+
+	/* Inlined fhwb_sync_w0..w3() bypass fhwb_sync(), so let them call it while profiling */
+	if (atomic_fetch_add(&fhwb_profile_active, 1) == 0) {
+		saved_hwb_sync_enabled = __atomic_load_n(&fhwb_hwb_sync_enabled, __ATOMIC_RELAXED);
+		__atomic_store_n(&fhwb_hwb_sync_enabled, 0, __ATOMIC_RELAXED);
+	}
+
+	fhwb_debug("Start profile of bd %d, depth %d", bd, depth);
+
+out:
+	fhwb_bd_unlock();
+
+	return ret;
+}
+
+int fhwb_profile_get_report(int bd, struct fhwb_profile_report **report)
+{
+	struct fhwb_profile_episode *episodes;
+	struct fhwb_profile_report *rep;
+	struct fhwb_profile_pe *pes;
+	struct fhwb_bd_entry *entry;
+	struct fhwb_profile_buf *buf;
+	uint64_t first = 0;
+	uint64_t end = UINT64_MAX;
+	uint64_t seq;
+	uint64_t n;
+	int ret = 0;
+	int i;
+
+	if (report == NULL) {
+		fhwb_error("report is NULL");
+		return -EINVAL;
+	}
+
+	fhwb_bd_lock();
+	entry = fhwb_bd_find(bd);
+	buf = entry ? entry->profile : NULL;
+	if (!buf) {
+		fhwb_error("profile is not started: %d", bd);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	/* Episodes which all PEs have completed and still keep in their ring */
+	for (i = 0; i < entry->nr_pe; i++) {
+		seq = atomic_load_explicit(&buf->pes[i].seq, memory_order_acquire);
+		if (seq < end)
+			end = seq;
+		if (seq > (uint64_t)buf->depth && seq - buf->depth > first)
+			first = seq - buf->depth;
+	}
+	if (first > end)
+		first = end;
+
+	rep = malloc(sizeof(struct fhwb_profile_report) +
+			sizeof(struct fhwb_profile_pe) * entry->nr_pe +
+			sizeof(struct fhwb_profile_episode) * (end - first));
+	if (!rep) {
+		fhwb_error("memory allocation failure");
+		ret = -ENOMEM;
+		goto out;
+	}
+	pes = (struct fhwb_profile_pe *)(rep + 1);
+	episodes = (struct fhwb_profile_episode *)(pes + entry->nr_pe);
+
+	rep->num_pe = entry->nr_pe;
+	rep->num_episodes = end - first;
+	rep->pes = pes;
+	rep->episodes = episodes;
+
+	for (i = 0; i < entry->nr_pe; i++) {
+		pes[i].cpu = buf->pes[i].cpu;
+		pes[i].episodes = atomic_load_explicit(&buf->pes[i].seq, memory_order_acquire);
+		pes[i].wait_ns = fhwb_ticks_to_ns(buf->pes[i].wait);
+		pes[i].late_ns = 0;
+		pes[i].last_count = 0;
+	}
+
+	for (n = first; n < end; n++) {
+		struct fhwb_profile_episode *ep = &episodes[n - first];
+		uint64_t min_arrive = UINT64_MAX;
+		uint64_t max_arrive = 0;
+		uint64_t min_release = UINT64_MAX;
+		int last = 0;
+
+		for (i = 0; i < entry->nr_pe; i++) {
+			const struct profile_entry *e = &buf->pes[i].ring[n % buf->depth];
+
+			if (e->arrive < min_arrive)
+				min_arrive = e->arrive;
+			if (e->arrive >= max_arrive) {
+				max_arrive = e->arrive;
+				last = i;
+			}
+			if (e->release < min_release)
+				min_release = e->release;
+		}
+
+		for (i = 0; i < entry->nr_pe; i++)
+			pes[i].late_ns += fhwb_ticks_to_ns(buf->pes[i].ring[n % buf->depth].arrive - min_arrive);
+		pes[last].last_count++;
+
+		ep->seq = n;
+		ep->last_cpu = buf->pes[last].cpu;
+		ep->skew_ns = fhwb_ticks_to_ns(max_arrive - min_arrive);
+		ep->sync_ns = min_release > max_arrive ? fhwb_ticks_to_ns(min_release - max_arrive) : 0;
+	}
+
+	*report = rep;
+
+out:
+	fhwb_bd_unlock();
+
+	return ret;
+}
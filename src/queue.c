@@ -0,0 +1,321 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * FIFO queue of processes waiting for a barrier blade (fhwb_init_wait())
+ *
+ * Waiters of each CMG take a ticket and only the waiter whose ticket is at
+ * the head of the queue retries allocation. fhwb_fini() wakes waiters by futex
+ * on the registry. The registry is a shared memory under /dev/shm per driver
+ * and user (named after its sysfs root so that each emulated node has its own,
+ * and private to the user so that other users cannot corrupt it), and all-zero
+ * memory is its initial state, so no process needs to initialize it. Each process
+ * maps the registry once, upon its first wait or fhwb_fini(), so that any
+ * fhwb_fini() wakes the waiter at the head of the queue.
+ *
+ * Processes may die while waiting. Each ticket records the pid of its waiter
+ * and the head is skipped when the waiter has gone or given up. Waiters also
+ * wake up every FHWB_QUEUE_POLL_NS to check it and to retry allocation after
+ * blades freed without fhwb_fini() (e.g. cleanup of a killed process).
+ *
+ * With sw backend, barrier resources are per process and the registry is
+ * anonymous memory of the process.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#define FHWB_QUEUE_NAME    "/fujitsu_hwb_queue.2"
+#define FHWB_QUEUE_MAX_CMG 64
+#define FHWB_QUEUE_SLOTS   64
+#define FHWB_QUEUE_POLL_NS (10 * 1000 * 1000ULL)
+
+struct queue_slot {
+	atomic_uint ticket;
+	atomic_int pid;      /* 0: the waiter has left */
+};
+
+struct queue_cmg {
+	atomic_uint head;    /* ticket allowed to allocate */
+	atomic_uint tail;    /* next ticket */
+	atomic_uint seq;     /* futex word changed upon free or head change */
+	struct queue_slot slots[FHWB_QUEUE_SLOTS];
+} __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+
+struct queue_registry {
+	struct queue_cmg cmgs[FHWB_QUEUE_MAX_CMG];
+};
+
+static pthread_once_t queue_once = PTHREAD_ONCE_INIT;
+/* NULL if the registry is not available */
+static struct queue_registry *queue_registry;
+
+/* The registry is shared with other processes, so futex must not be private */
+static inline void queue_futex_wait(atomic_uint *addr, unsigned int val, const struct timespec *deadline)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_BITSET, val, deadline, NULL, FUTEX_BITSET_MATCH_ANY);
+}
+
+static inline void queue_futex_wake(atomic_uint *addr)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static int map_registry(struct queue_registry **reg)
+{
+	char name[NAME_MAX];
+	struct stat st;
+	const char *p;
+	void *addr;
+	size_t len;
+	int ret;
+	int fd;
+
+	if (fhwb_get_backend() == &fhwb_backend_sw) {
+		addr = mmap(NULL, sizeof(struct queue_registry), PROT_READ | PROT_WRITE,
+			    MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (addr == MAP_FAILED)
+			return -errno;
+		*reg = addr;
+		return 0;
+	}
+
+	len = snprintf(name, sizeof(name), "%s.%u", FHWB_QUEUE_NAME, (unsigned int)getuid());
+	for (p = fhwb_dev_sysfs_root(); *p && len < sizeof(name) - 1; p++)
+		name[len++] = *p == '/' ? '_' : *p;
+	name[len] = '\0';
+
+	fd = shm_open(name, O_RDWR | O_CREAT, 0600);
+	if (fd < 0)
+		return -errno;
+
+	/* Zero-filled by whichever process extends it first */
+	if (fstat(fd, &st) < 0 ||
+	    (st.st_size < (off_t)sizeof(struct queue_registry) &&
+	     ftruncate(fd, sizeof(struct queue_registry)) < 0)) {
+		ret = -errno;
+		fhwb_error("cannot set size of %s: %m", name);
+		close(fd);
+		return ret;
+	}
+	addr = mmap(NULL, sizeof(struct queue_registry), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (addr == MAP_FAILED)
+		return -errno;
+
+	fhwb_debug("Map wait queue %s", name);
+	*reg = addr;
+
+	return 0;
+}
+
+static void setup_registry(void)
+{
+	if (map_registry(&queue_registry) < 0) {
+		fhwb_debug("wait queue is not available");
+		queue_registry = NULL;
+	}
+}
+
+/* Return the queue of @cmg, or NULL if it is not available */
+static struct queue_cmg *get_queue(int cmg)
+{
+	if (cmg < 0 || cmg >= FHWB_QUEUE_MAX_CMG)
+		return NULL;
+
+	pthread_once(&queue_once, setup_registry);
+
+	return queue_registry ? &queue_registry->cmgs[cmg] : NULL;
+}
+
+static void queue_kick(struct queue_cmg *q)
+{
+	atomic_fetch_add(&q->seq, 1);
+	queue_futex_wake(&q->seq);
+}
+
+/* Whether the waiter of @ticket is still waiting */
+static bool ticket_alive(struct queue_cmg *q, unsigned int ticket)
+{
+	struct queue_slot *slot = &q->slots[ticket % FHWB_QUEUE_SLOTS];
+	int pid = atomic_load(&slot->pid);
+
+	if (atomic_load(&slot->ticket) != ticket || pid == 0)
+		return false;
+
+	return kill(pid, 0) == 0 || errno != ESRCH;
+}
+
+/* Move the head from @ticket to the next ticket */
+static void advance(struct queue_cmg *q, unsigned int ticket)
+{
+	if (atomic_compare_exchange_strong(&q->head, &ticket, ticket + 1))
+		queue_kick(q);
+}
+
+/*
+ * Move the head over tickets whose waiters have left or died, which nobody else
+ * may do when no live waiter remains. Return the head
+ */
+static unsigned int reclaim(struct queue_cmg *q)
+{
+	unsigned int head;
+
+	for (;;) {
+		head = atomic_load(&q->head);
+		if (head == atomic_load(&q->tail) || ticket_alive(q, head))
+			return head;
+		fhwb_debug("Skip waiter of ticket %u", head);
+		advance(q, head);
+	}
+}
+
+static int take_ticket(struct queue_cmg *q, unsigned int *ticket)
+{
+	struct queue_slot *slot;
+	unsigned int t;
+
+	/* Do not take a ticket whose slot may still be used by a live waiter */
+	t = atomic_load(&q->tail);
+	do {
+		if (t - reclaim(q) >= FHWB_QUEUE_SLOTS)
+			return -EBUSY;
+	} while (!atomic_compare_exchange_weak(&q->tail, &t, t + 1));
+
+	slot = &q->slots[t % FHWB_QUEUE_SLOTS];
+	atomic_store(&slot->pid, 0);
+	atomic_store(&slot->ticket, t);
+	atomic_store(&slot->pid, getpid());
+	*ticket = t;
+
+	return 0;
+}
+
+static void leave(struct queue_cmg *q, unsigned int ticket)
+{
+	atomic_store(&q->slots[ticket % FHWB_QUEUE_SLOTS].pid, 0);
+	if (atomic_load(&q->head) == ticket)
+		advance(q, ticket);
+	else
+		queue_kick(q);
+}
+
+static int get_cmg(size_t pemask_size, cpu_set_t *pemask)
+{
+	const struct fhwb_topology *topo;
+	int cpu;
+
+	if (fhwb_get_topology(&topo) < 0)
+		return -1;
+
+	for (cpu = 0; cpu < topo->num_pe && cpu < (int)(pemask_size * 8); cpu++)
+		if (CPU_ISSET_S(cpu, pemask_size, pemask))
+			return topo->pes[cpu].cmg;
+
+	return -1;
+}
+
+int fhwb_init_wait(size_t pemask_size, cpu_set_t *pemask, uint64_t timeout_ns)
+{
+	struct queue_cmg *q;
+	struct timespec ts;
+	uint64_t deadline;
+	uint64_t wake;
+	uint64_t now;
+	unsigned int ticket;
+	unsigned int head;
+	unsigned int seq;
+	int cmg;
+	int bd;
+
+	if (pemask == NULL || pemask_size == 0) {
+		fhwb_error("pemask is NULL or pemask_size is 0");
+		return -EINVAL;
+	}
+
+	if (timeout_ns == 0)
+		return fhwb_init(pemask_size, pemask);
+
+	cmg = get_cmg(pemask_size, pemask);
+	q = get_queue(cmg);
+	if (!q) {
+		fhwb_debug("wait queue is not available");
+		return fhwb_init(pemask_size, pemask);
+	}
+
+	/* Do not overtake live waiters. -EBUSY is reported only upon timeout */
+	if (reclaim(q) == atomic_load(&q->tail)) {
+		bd = fhwb_init_quiet(pemask_size, pemask);
+		if (bd != -EBUSY)
+			return bd;
+	}
+
+	now = now_ns();
+	deadline = timeout_ns > UINT64_MAX - now ? UINT64_MAX : now + timeout_ns;
+
+	/* The queue is full of live waiters. Try once without waiting */
+	if (take_ticket(q, &ticket) < 0)
+		return fhwb_init(pemask_size, pemask);
+
+	for (;;) {
+		seq = atomic_load(&q->seq);
+		head = atomic_load(&q->head);
+
+		if (head == ticket) {
+			bd = fhwb_init_quiet(pemask_size, pemask);
+			if (bd != -EBUSY) {
+				leave(q, ticket);
+				return bd;
+			}
+		} else if ((int)(ticket - head) < 0) {
+			/* Skipped before the slot was written. Queue again at the tail */
+			if (take_ticket(q, &ticket) < 0)
+				return fhwb_init(pemask_size, pemask);
+			continue;
+		} else if (reclaim(q) != head) {
+			continue;
+		}
+
+		now = now_ns();
+		if (now >= deadline) {
+			leave(q, ticket);
+			fhwb_error("no BB in CMG %d became available in %lu ns", cmg, (unsigned long)timeout_ns);
+			return -ETIMEDOUT;
+		}
+
+		wake = deadline - now > FHWB_QUEUE_POLL_NS ? now + FHWB_QUEUE_POLL_NS : deadline;
+		ts.tv_sec = wake / 1000000000ULL;
+		ts.tv_nsec = wake % 1000000000ULL;
+		queue_futex_wait(&q->seq, seq, &ts);
+	}
+}
+
+void fhwb_queue_wake(int bd)
+{
+	struct queue_cmg *q = get_queue(fhwb_get_cmg_from_bd(bd));
+
+	if (q && atomic_load(&q->head) != atomic_load(&q->tail))
+		queue_kick(q);
+}
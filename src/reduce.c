@@ -0,0 +1,325 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Allreduce of small payload on top of barrier synchronization
+ *
+ * Each bb allocated in this process has a buffer which has one cache line slot
+ * for each PE of the bb. A PE writes its contribution to its slot, performs
+ * one synchronization and then folds all slots in the same order, so that all
+ * PEs get the same result. Two buffers are used alternately: a PE can overwrite
+ * a buffer only after next synchronization, which other PEs reach after they
+ * have read the buffer.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <string.h>
+
+/* One slot of a PE (FHWB_ALLREDUCE_MAX_COUNT elements) */
+union reduce_slot {
+	int64_t i64[FHWB_ALLREDUCE_MAX_COUNT];
+	double f64[FHWB_ALLREDUCE_MAX_COUNT];
+} __attribute__((aligned(FHWB_CACHE_LINE_SIZE)));
+
+/* Reduction buffer of a bb (PEs follow fhwb_remask() unlike the entry of the bb) */
+struct fhwb_reduce_buf {
+	/* incremented when PEs of the bb are changed */
+	unsigned int gen;
+	int nr_pe;
+	size_t pemask_size;
+	cpu_set_t *pemask;
+	/* slots[phase * nr_pe + slot] */
+	union reduce_slot *slots;
+	/* buffer of new PEs while fhwb_remask() is in progress */
+	union reduce_slot *new_slots;
+	size_t new_pemask_size;
+	cpu_set_t *new_pemask;
+};
+
+/* Barrier window state of calling thread */
+struct reduce_window {
+	struct fhwb_reduce_buf *buf;
+	int bd;
+	/* slot index of calling PE */
+	int slot;
+	/* gen of buf when slot is decided */
+	unsigned int gen;
+	/* number of fhwb_allreduce() performed on this window */
+	unsigned int seq;
+};
+
+static __thread struct reduce_window reduce_windows[FHWB_WINDOW_3 + 1];
+
+/* Allocate two phases of slots and a copy of @pemask */
+static int alloc_slots(size_t pemask_size, cpu_set_t *pemask, union reduce_slot **slots, cpu_set_t **mask)
+{
+	*mask = malloc(pemask_size);
+	if (!*mask)
+		goto err;
+	memcpy(*mask, pemask, pemask_size);
+
+	if (posix_memalign((void **)slots, FHWB_CACHE_LINE_SIZE,
+				sizeof(union reduce_slot) * 2 * CPU_COUNT_S(pemask_size, pemask))) {
+		free(*mask);
+		goto err;
+	}
+
+	return 0;
+
+err:
+	fhwb_error("memory allocation failure");
+
+	return -ENOMEM;
+}
+
+int fhwb_reduce_alloc(struct fhwb_bd_entry *entry)
+{
+	struct fhwb_reduce_buf *buf;
+	int ret;
+
+	buf = calloc(1, sizeof(struct fhwb_reduce_buf));
+	if (!buf) {
+		fhwb_error("memory allocation failure");
+		return -ENOMEM;
+	}
+
+	ret = alloc_slots(entry->pemask_size, entry->pemask, &buf->slots, &buf->pemask);
+	if (ret < 0) {
+		free(buf);
+		return ret;
+	}
+	buf->nr_pe = entry->nr_pe;
+	buf->pemask_size = entry->pemask_size;
+	entry->reduce = buf;
+
+	return 0;
+}
+
+void fhwb_reduce_free(struct fhwb_bd_entry *entry)
+{
+	if (!entry->reduce)
+		return;
+
+	free(entry->reduce->slots);
+	free(entry->reduce->pemask);
+	free(entry->reduce);
+	entry->reduce = NULL;
+}
+
+/* Attach @w to @buf at the slot of calling PE. Return false if the PE does not join @buf */
+static bool set_slot(struct reduce_window *w, struct fhwb_reduce_buf *buf)
+{
+	w->seq = 0;
+	w->slot = fhwb_pemask_slot(buf->pemask_size, buf->pemask, sched_getcpu());
+	if (w->slot < 0)
+		return false;
+
+	w->gen = buf->gen;
+	w->buf = buf;
+
+	return true;
+}
+
+int fhwb_reduce_remask_begin(int bd, size_t pemask_size, cpu_set_t *pemask)
+{
+	struct fhwb_bd_entry *entry;
+	union reduce_slot *slots;
+	cpu_set_t *mask;
+	int ret;
+
+	ret = alloc_slots(pemask_size, pemask, &slots, &mask);
+	if (ret < 0)
+		return ret;
+
+	fhwb_bd_lock();
+	entry = fhwb_bd_find(bd);
+	if (entry && entry->reduce) {
+		entry->reduce->new_slots = slots;
+		entry->reduce->new_pemask = mask;
+		entry->reduce->new_pemask_size = pemask_size;
+	}
+	fhwb_bd_unlock();
+
+	if (!entry || !entry->reduce) {
+		free(slots);
+		free(mask);
+	}
+
+	return 0;
+}
+
+void fhwb_reduce_remask_end(int bd, bool commit)
+{
+	struct fhwb_bd_entry *entry;
+	struct fhwb_reduce_buf *buf;
+	union reduce_slot *slots = NULL;
+	cpu_set_t *mask = NULL;
+
+	/* No PE performs fhwb_allreduce() on the bb during the change */
+	fhwb_bd_lock();
+	entry = fhwb_bd_find(bd);
+	buf = entry ? entry->reduce : NULL;
+	if (buf && buf->new_slots) {
+		slots = buf->new_slots;
+		mask = buf->new_pemask;
+		if (commit) {
+			slots = buf->slots;
+			mask = buf->pemask;
+			buf->slots = buf->new_slots;
+			buf->pemask = buf->new_pemask;
+			buf->pemask_size = buf->new_pemask_size;
+			buf->nr_pe = CPU_COUNT_S(buf->pemask_size, buf->pemask);
+			buf->gen++;
+		}
+		buf->new_slots = NULL;
+		buf->new_pemask = NULL;
+	}
+	fhwb_bd_unlock();
+
+	free(slots);
+	free(mask);
+}
+
+void fhwb_reduce_attach(struct fhwb_bd_entry *entry, int window)
+{
+	struct reduce_window *w = &reduce_windows[window];
+
+	w->buf = NULL;
+	if (entry && entry->reduce) {
+		w->bd = entry->bd;
+		set_slot(w, entry->reduce);
+	}
+}
+
+void fhwb_reduce_detach(int bd)
+{
+	int i;
+
+	for (i = 0; i <= FHWB_WINDOW_3; i++)
+		if (reduce_windows[i].buf && reduce_windows[i].bd == bd)
+			reduce_windows[i].buf = NULL;
+}
+
+static void fold_int64(int op, int64_t *out, const union reduce_slot *slots, int nr_pe, int count)
+{
+	int i, j;
+
+	for (j = 0; j < count; j++) {
+		int64_t val = slots[0].i64[j];
+
+		for (i = 1; i < nr_pe; i++) {
+			int64_t x = slots[i].i64[j];
+
+			switch (op) {
+			case FHWB_OP_SUM:
+				/* Wrap around on overflow */
+				val = (int64_t)((uint64_t)val + (uint64_t)x);
+				break;
+			case FHWB_OP_MIN:
+				val = x < val ? x : val;
+				break;
+			case FHWB_OP_MAX:
+				val = x > val ? x : val;
+				break;
+			case FHWB_OP_LAND:
+				val = val && x;
+				break;
+			case FHWB_OP_LOR:
+				val = val || x;
+				break;
+			}
+		}
+		if (op == FHWB_OP_LAND || op == FHWB_OP_LOR)
+			val = !!val;
+		out[j] = val;
+	}
+}
+
+static void fold_double(int op, double *out, const union reduce_slot *slots, int nr_pe, int count)
+{
+	int i, j;
+
+	for (j = 0; j < count; j++) {
+		double val = slots[0].f64[j];
+
+		for (i = 1; i < nr_pe; i++) {
+			double x = slots[i].f64[j];
+
+			switch (op) {
+			case FHWB_OP_SUM:
+				val += x;
+				break;
+			case FHWB_OP_MIN:
+				val = x < val ? x : val;
+				break;
+			case FHWB_OP_MAX:
+				val = x > val ? x : val;
+				break;
+			case FHWB_OP_LAND:
+				val = val != 0 && x != 0;
+				break;
+			case FHWB_OP_LOR:
+				val = val != 0 || x != 0;
+				break;
+			}
+		}
+		if (op == FHWB_OP_LAND || op == FHWB_OP_LOR)
+			val = val != 0;
+		out[j] = val;
+	}
+}
+
+int fhwb_allreduce(int window, int op, int type, const void *in, void *out, int count)
+{
+	struct reduce_window *w;
+	union reduce_slot *slots;
+
+	if (window < 0 || window > FHWB_WINDOW_3) {
+		fhwb_error("window number is invalid: %d", window);
+		return -EINVAL;
+	}
+	if (op < FHWB_OP_SUM || op > FHWB_OP_LOR ||
+	    (type != FHWB_TYPE_INT64 && type != FHWB_TYPE_DOUBLE)) {
+		fhwb_error("op/type is invalid: %d/%d", op, type);
+		return -EINVAL;
+	}
+	if (in == NULL || out == NULL || count < 0 || count > FHWB_ALLREDUCE_MAX_COUNT) {
+		fhwb_error("in/out is NULL or count is invalid: %d", count);
+		return -EINVAL;
+	}
+
+	w = &reduce_windows[window];
+	if (!w->buf) {
+		fhwb_error("window is not assigned: %d", window);
+		return -EINVAL;
+	}
+	/* PEs of the bb have been changed by fhwb_remask() */
+	if (__builtin_expect(w->gen != w->buf->gen, 0) && !set_slot(w, w->buf)) {
+		w->buf = NULL;
+		fhwb_error("PE does not join the barrier of window %d", window);
+		return -EINVAL;
+	}
+
+	slots = &w->buf->slots[(w->seq++ & 1) * w->buf->nr_pe];
+	memcpy(&slots[w->slot], in, sizeof(int64_t) * count);
+
+	/* Hardware barrier does not order memory access by itself */
+	atomic_thread_fence(memory_order_seq_cst);
+	fhwb_sync(window);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	if (type == FHWB_TYPE_INT64)
+		fold_int64(op, out, slots, w->buf->nr_pe, count);
+	else
+		fold_double(op, out, slots, w->buf->nr_pe, count);
+
+	return 0;
+}
@@ -0,0 +1,163 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Synchronization statistics of barrier blades
+ *
+ * Each bb allocated in this process has one cache line of counters per PE.
+ * A PE only updates its own counters with plain relaxed stores, so counting
+ * costs one increment per fhwb_sync() (plus clock reads on PEs which have to
+ * wait anyway). fhwb_get_stats() sums counters of all PEs without locking them.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#ifdef FHWB_ENABLE_STATS
+
+/* Statistics buffer of a bb */
+struct fhwb_stats_buf {
+	/* failed ioctl on the bb (by any thread) */
+	atomic_uint_least64_t ioctl_errors;
+	struct fhwb_stats_pe *pes;
+};
+
+__thread struct fhwb_stats_pe *fhwb_stats_windows[FHWB_WINDOW_3 + 1];
+/* bd of each window of calling thread (valid if fhwb_stats_windows[] is not NULL) */
+static __thread int stats_bds[FHWB_WINDOW_3 + 1];
+
+int fhwb_stats_alloc(struct fhwb_bd_entry *entry)
+{
+	struct fhwb_stats_buf *buf;
+
+	buf = calloc(1, sizeof(struct fhwb_stats_buf));
+	if (!buf)
+		goto err;
+
+	if (posix_memalign((void **)&buf->pes, FHWB_CACHE_LINE_SIZE,
+				sizeof(struct fhwb_stats_pe) * entry->nr_pe)) {
+		free(buf);
+		goto err;
+	}
+	memset(buf->pes, 0, sizeof(struct fhwb_stats_pe) * entry->nr_pe);
+	entry->stats = buf;
+
+	return 0;
+
+err:
+	fhwb_error("memory allocation failure");
+
+	return -ENOMEM;
+}
+
+void fhwb_stats_free(struct fhwb_bd_entry *entry)
+{
+	if (!entry->stats)
+		return;
+
+	free(entry->stats->pes);
+	free(entry->stats);
+	entry->stats = NULL;
+}
+
+void fhwb_stats_attach(struct fhwb_bd_entry *entry, int window)
+{
+	struct fhwb_stats_pe *st;
+	int slot;
+
+	fhwb_stats_windows[window] = NULL;
+	if (!entry || !entry->stats)
+		return;
+
+	slot = fhwb_bd_slot(entry);
+	if (slot < 0)
+		return;
+
+	st = &entry->stats->pes[slot];
+	fhwb_stats_add(&st->assigns, 1);
+	stats_bds[window] = entry->bd;
+	fhwb_stats_windows[window] = st;
+}
+
+void fhwb_stats_detach(int bd)
+{
+	int i;
+
+	for (i = 0; i <= FHWB_WINDOW_3; i++) {
+		if (fhwb_stats_windows[i] && stats_bds[i] == bd) {
+			fhwb_stats_add(&fhwb_stats_windows[i]->unassigns, 1);
+			fhwb_stats_windows[i] = NULL;
+		}
+	}
+}
+
+void fhwb_stats_ioctl_error(int bd)
+{
+	struct fhwb_bd_entry *entry;
+
+	fhwb_bd_lock();
+	entry = fhwb_bd_find(bd);
+	if (entry && entry->stats)
+		atomic_fetch_add_explicit(&entry->stats->ioctl_errors, 1, memory_order_relaxed);
+	fhwb_bd_unlock();
+}
+
+int fhwb_get_stats(int bd, struct fhwb_stats *stats)
+{
+	struct fhwb_bd_entry *entry;
+	uint64_t wait_ticks = 0;
+	uint64_t max_wait_ticks = 0;
+	int i;
+
+	if (stats == NULL) {
+		fhwb_error("stats is NULL");
+		return -EINVAL;
+	}
+
+	fhwb_bd_lock();
+	entry = fhwb_bd_find(bd);
+	if (!entry || !entry->stats) {
+		fhwb_bd_unlock();
+		fhwb_error("bd is not allocated by this process: %d", bd);
+		return -EINVAL;
+	}
+
+	memset(stats, 0, sizeof(*stats));
+	for (i = 0; i < entry->nr_pe; i++) {
+		struct fhwb_stats_pe *st = &entry->stats->pes[i];
+		uint64_t max;
+
+		stats->syncs += atomic_load_explicit(&st->syncs, memory_order_relaxed);
+		stats->assigns += atomic_load_explicit(&st->assigns, memory_order_relaxed);
+		stats->unassigns += atomic_load_explicit(&st->unassigns, memory_order_relaxed);
+		wait_ticks += atomic_load_explicit(&st->wait_ticks, memory_order_relaxed);
+		max = atomic_load_explicit(&st->max_wait_ticks, memory_order_relaxed);
+		if (max > max_wait_ticks)
+			max_wait_ticks = max;
+	}
+	stats->ioctl_errors = atomic_load_explicit(&entry->stats->ioctl_errors, memory_order_relaxed);
+	fhwb_bd_unlock();
+
+	stats->wait_ns = fhwb_ticks_to_ns(wait_ticks);
+	stats->max_wait_ns = fhwb_ticks_to_ns(max_wait_ticks);
+
+	return 0;
+}
+
+#else
+
+int fhwb_get_stats(int bd, struct fhwb_stats *stats)
+{
+	(void)bd;
+	(void)stats;
+
+	return -EOPNOTSUPP;
+}
+
+#endif /* FHWB_ENABLE_STATS */
@@ -0,0 +1,317 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Persistent team of pinned worker threads running fork-join regions
+ *
+ * Workers are created once with their windows assigned and wait in fhwb_sync().
+ * fhwb_team_run() publishes the function and releases the workers by the entry
+ * synchronization, and the exit synchronization waits for completion of all
+ * ranks. So a parallel region costs two barrier synchronizations instead of
+ * waking up threads.
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdbool.h>
+#include <string.h>
+
+struct team_worker {
+	struct fhwb_team *team;
+	pthread_t thread;
+	int cpu;
+	int rank;
+};
+
+struct fhwb_team {
+	/* Region published by the master before the entry synchronization (NULL: exit) */
+	fhwb_team_fn fn;
+	void *arg;
+
+	int bd;
+	int size;
+	int master_rank;
+	int master_window;
+	pthread_t master;
+	struct team_worker *workers; /* size - 1 entries */
+	int *windows;                /* window of each rank */
+
+	/* Startup handshake of workers */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int ready;
+	int error;
+	bool abort;
+};
+
+/* Run published region after the entry synchronization. Return false if team is exiting */
+static bool team_run_region(struct fhwb_team *team, int rank)
+{
+	fhwb_team_fn fn;
+	void *arg;
+
+	/* Barrier synchronization does not order memory access by itself */
+	atomic_thread_fence(memory_order_seq_cst);
+	fn = team->fn;
+	arg = team->arg;
+	if (!fn)
+		return false;
+	fn(arg, rank);
+	atomic_thread_fence(memory_order_seq_cst);
+
+	return true;
+}
+
+static void *team_worker_main(void *p)
+{
+	struct team_worker *w = p;
+	struct fhwb_team *team = w->team;
+	cpu_set_t set;
+	int window;
+
+	CPU_ZERO(&set);
+	CPU_SET(w->cpu, &set);
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &set) < 0) {
+		fhwb_error("sched_setaffinity failed: %m, cpu: %d", w->cpu);
+		window = -errno;
+	} else {
+		window = fhwb_assign(team->bd, -1);
+	}
+
+	pthread_mutex_lock(&team->lock);
+	if (window < 0) {
+		if (!team->error)
+			team->error = window;
+	} else {
+		team->windows[w->rank] = window;
+	}
+	team->ready++;
+	pthread_cond_broadcast(&team->cond);
+	while (!team->abort && team->ready >= 0)
+		pthread_cond_wait(&team->cond, &team->lock);
+	pthread_mutex_unlock(&team->lock);
+
+	if (team->abort) {
+		if (window >= 0)
+			fhwb_unassign(team->bd);
+		return NULL;
+	}
+
+	for (;;) {
+		fhwb_sync(window);
+		if (!team_run_region(team, w->rank))
+			break;
+		fhwb_sync(window);
+	}
+
+	fhwb_unassign(team->bd);
+
+	return NULL;
+}
+
+/* Wait for all started workers, then release them (@abort: to exit) */
+static int team_start(struct fhwb_team *team, int started, bool abort)
+{
+	int ret;
+
+	pthread_mutex_lock(&team->lock);
+	while (team->ready < started)
+		pthread_cond_wait(&team->cond, &team->lock);
+	ret = team->error;
+	team->abort = abort || ret < 0;
+	team->ready = -1;
+	pthread_cond_broadcast(&team->cond);
+	pthread_mutex_unlock(&team->lock);
+
+	return abort ? 0 : ret;
+}
+
+static void team_free(struct fhwb_team *team)
+{
+	pthread_cond_destroy(&team->cond);
+	pthread_mutex_destroy(&team->lock);
+	free(team->workers);
+	free(team->windows);
+	free(team);
+}
+
+int fhwb_team_create(size_t pemask_size, cpu_set_t *pemask, struct fhwb_team **team)
+{
+	struct fhwb_team *t;
+	int started = 0;
+	int cpu;
+	int ret;
+	int i;
+
+	if (pemask == NULL || pemask_size == 0 || team == NULL) {
+		fhwb_error("pemask/team is NULL or pemask_size is 0");
+		return -EINVAL;
+	}
+
+	cpu = fhwb_get_bound_cpu();
+	if (cpu < 0) {
+		fhwb_error("caller is not bound to one PE");
+		return -EPERM;
+	}
+	if (cpu >= (int)(pemask_size * 8) || !CPU_ISSET_S(cpu, pemask_size, pemask)) {
+		fhwb_error("caller's PE is not in pemask: %d", cpu);
+		return -EINVAL;
+	}
+
+	t = calloc(1, sizeof(struct fhwb_team));
+	if (!t) {
+		fhwb_error("memory allocation failure");
+		return -ENOMEM;
+	}
+	pthread_mutex_init(&t->lock, NULL);
+	pthread_cond_init(&t->cond, NULL);
+	t->master = pthread_self();
+	t->size = CPU_COUNT_S(pemask_size, pemask);
+	t->windows = calloc(t->size, sizeof(int));
+	t->workers = calloc(t->size, sizeof(struct team_worker));
+	if (!t->windows || !t->workers) {
+		fhwb_error("memory allocation failure");
+		ret = -ENOMEM;
+		goto free;
+	}
+
+	t->bd = fhwb_init(pemask_size, pemask);
+	if (t->bd < 0) {
+		ret = t->bd;
+		goto free;
+	}
+
+	t->master_window = fhwb_assign(t->bd, -1);
+	if (t->master_window < 0) {
+		ret = t->master_window;
+		goto fini;
+	}
+
+	/* Ranks are positions of PEs in @pemask in ascending order of cpuid */
+	for (i = 0; i < cpu; i++)
+		if (CPU_ISSET_S(i, pemask_size, pemask))
+			t->master_rank++;
+	t->windows[t->master_rank] = t->master_window;
+
+	for (i = 0, ret = 0; i < (int)(pemask_size * 8); i++) {
+		struct team_worker *w;
+
+		if (!CPU_ISSET_S(i, pemask_size, pemask) || i == cpu)
+			continue;
+
+		w = &t->workers[started];
+		w->team = t;
+		w->cpu = i;
+		w->rank = started < t->master_rank ? started : started + 1;
+
+		ret = -pthread_create(&w->thread, NULL, team_worker_main, w);
+		if (ret < 0) {
+			fhwb_error("pthread_create failed: %s", strerror(-ret));
+			break;
+		}
+		started++;
+	}
+
+	if (ret < 0) {
+		team_start(t, started, true);
+	} else {
+		ret = team_start(t, started, false);
+		if (ret == 0) {
+			*team = t;
+			fhwb_debug("Create team. bd: 0x%x, size: %d, master rank: %d",
+					t->bd, t->size, t->master_rank);
+			return 0;
+		}
+	}
+
+	for (i = 0; i < started; i++)
+		pthread_join(t->workers[i].thread, NULL);
+	fhwb_unassign(t->bd);
+fini:
+	fhwb_fini(t->bd);
+free:
+	team_free(t);
+
+	return ret;
+}
+
+int fhwb_team_run(struct fhwb_team *team, fhwb_team_fn fn, void *arg)
+{
+	if (team == NULL || fn == NULL) {
+		fhwb_error("team/fn is NULL");
+		return -EINVAL;
+	}
+
+	if (!pthread_equal(pthread_self(), team->master)) {
+		fhwb_error("caller is not the thread which created team");
+		return -EPERM;
+	}
+
+	team->fn = fn;
+	team->arg = arg;
+	atomic_thread_fence(memory_order_seq_cst);
+
+	/* Entry: release workers */
+	fhwb_sync(team->master_window);
+	team_run_region(team, team->master_rank);
+	/* Exit: wait for all ranks */
+	fhwb_sync(team->master_window);
+
+	return 0;
+}
+
+void fhwb_team_barrier(struct fhwb_team *team, int rank)
+{
+	fhwb_sync(team->windows[rank]);
+}
+
+int fhwb_team_size(struct fhwb_team *team)
+{
+	if (team == NULL) {
+		fhwb_error("team is NULL");
+		return -EINVAL;
+	}
+
+	return team->size;
+}
+
+int fhwb_team_destroy(struct fhwb_team *team)
+{
+	int ret;
+	int err;
+	int i;
+
+	if (team == NULL) {
+		fhwb_error("team is NULL");
+		return -EINVAL;
+	}
+
+	if (!pthread_equal(pthread_self(), team->master)) {
+		fhwb_error("caller is not the thread which created team");
+		return -EPERM;
+	}
+
+	/* Entry synchronization without function lets workers exit */
+	team->fn = NULL;
+	atomic_thread_fence(memory_order_seq_cst);
+	fhwb_sync(team->master_window);
+
+	for (i = 0; i < team->size - 1; i++)
+		pthread_join(team->workers[i].thread, NULL);
+
+	ret = fhwb_unassign(team->bd);
+	err = fhwb_fini(team->bd);
+	if (err < 0 && ret == 0)
+		ret = err;
+
+	fhwb_debug("Destroy team. bd: 0x%x", team->bd);
+	team_free(team);
+
+	return ret;
+}
@@ -0,0 +1,352 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Debug message switch and binary event trace
+ *
+ * Both are configured by environment variables once at library load.
+ * When tracing is enabled, each thread records events into its own ring buffer
+ * without locking. Rings are linked into a list which is only appended, so that
+ * the signal handler can dump them with async-signal-safe write(2).
+ */
+
+#define _GNU_SOURCE
+
+#include "fujitsu_hwb.h"
+#include "internal.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Default number of events kept per thread */
+#define TRACE_DEFAULT_SIZE 16384
+
+struct trace_ring {
+	struct trace_ring *next;
+	uint32_t tid;
+	/* power of 2 */
+	uint32_t size;
+	/* number of events recorded */
+	atomic_uint_least64_t head;
+	struct fhwb_trace_event events[];
+};
+
+/* Window state of calling thread used for sync events */
+struct trace_window {
+	bool assigned;
+	int bd;
+	int cpu;
+	/* number of fhwb_sync() since fhwb_assign() */
+	unsigned long seq;
+};
+
+int fhwb_debug_enabled;
+int fhwb_trace_enabled;
+
+static char trace_path[PATH_MAX];
+static uint32_t trace_size = TRACE_DEFAULT_SIZE;
+/* Record one in trace_sample synchronizations */
+static unsigned long trace_sample = 1;
+/* Write Chrome trace event format at exit instead of binary */
+static int trace_chrome;
+static _Atomic(struct trace_ring *) trace_rings;
+
+static __thread struct trace_ring *thread_ring;
+static __thread struct trace_window trace_windows[FHWB_WINDOW_3 + 1];
+
+/* Write whole @buf to @fd (async-signal-safe) */
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const char *p = buf;
+	ssize_t ret;
+
+	while (len > 0) {
+		ret = write(fd, p, len);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += ret;
+		len -= ret;
+	}
+
+	return 0;
+}
+
+/* Dump all rings to trace_path (async-signal-safe) */
+static void trace_dump(void)
+{
+	struct fhwb_trace_header header = {
+		.magic = FHWB_TRACE_MAGIC,
+		.version = FHWB_TRACE_VERSION,
+		.pid = getpid(),
+		.clock_freq = fhwb_clock_freq(),
+	};
+	struct trace_ring *ring;
+	int saved_errno = errno;
+	int fd;
+
+	fd = open(trace_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0)
+		goto out;
+
+	if (write_all(fd, &header, sizeof(header)))
+		goto close;
+
+	for (ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+		struct fhwb_trace_ring_header rh;
+		uint64_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+		uint32_t first;
+
+		rh.tid = ring->tid;
+		rh.num_events = head < ring->size ? head : ring->size;
+		rh.dropped = head - rh.num_events;
+		first = head % ring->size;
+		if (head < ring->size)
+			first = 0;
+
+		if (write_all(fd, &rh, sizeof(rh)))
+			goto close;
+		/* Oldest events are from @first to the end of buffer when wrapped around */
+		if (rh.dropped && write_all(fd, &ring->events[first],
+					sizeof(struct fhwb_trace_event) * (ring->size - first)))
+			goto close;
+		if (write_all(fd, ring->events, sizeof(struct fhwb_trace_event) * (rh.dropped ? first : rh.num_events)))
+			goto close;
+	}
+
+close:
+	close(fd);
+out:
+	errno = saved_errno;
+}
+
+static void trace_signal_handler(int sig)
+{
+	(void)sig;
+	trace_dump();
+}
+
+/* Write all rings to "<trace_path>.json" in Chrome trace event format */
+static void trace_dump_chrome(void)
+{
+	struct fhwb_trace_event *events;
+	struct fhwb_trace_chrome ct;
+	struct trace_ring *ring;
+	char path[PATH_MAX + 8];
+	uint64_t base = UINT64_MAX;
+	FILE *fp;
+
+	snprintf(path, sizeof(path), "%s.json", trace_path);
+	fp = fopen(path, "w");
+	events = malloc(sizeof(struct fhwb_trace_event) * trace_size);
+	if (!fp || !events) {
+		fhwb_error("cannot write trace to %s: %m", path);
+		goto out;
+	}
+
+	/* Oldest event of all threads is time 0 */
+	for (ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+		uint64_t head = atomic_load(&ring->head);
+
+		if (head && ring->events[head < ring->size ? 0 : head % ring->size].time < base)
+			base = ring->events[head < ring->size ? 0 : head % ring->size].time;
+	}
+
+	fhwb_trace_chrome_begin(&ct, fp, fhwb_clock_freq(), base);
+	for (ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+		uint64_t head = atomic_load(&ring->head);
+		uint32_t first = head < ring->size ? 0 : head % ring->size;
+		uint32_t num = head < ring->size ? head : ring->size;
+
+		/* Copy to oldest first order */
+		memcpy(events, &ring->events[first], sizeof(struct fhwb_trace_event) * (num - first));
+		memcpy(&events[num - first], ring->events, sizeof(struct fhwb_trace_event) * first);
+		fhwb_trace_chrome_thread(&ct, ring->tid, events, num);
+	}
+	fhwb_trace_chrome_end(&ct);
+
+out:
+	free(events);
+	if (fp)
+		fclose(fp);
+}
+
+__attribute__((destructor))
+static void trace_exit(void)
+{
+	if (!fhwb_trace_enabled)
+		return;
+
+	if (trace_chrome)
+		trace_dump_chrome();
+	else
+		trace_dump();
+}
+
+void fhwb_log_init(void)
+{
+	const char *path;
+	const char *env;
+	struct sigaction sa;
+	long val;
+
+	fhwb_debug_enabled = getenv(FHWB_DEBUG_ENV_NAME) != NULL;
+
+	path = getenv(FHWB_TRACE_ENV_NAME);
+	if (path == NULL || path[0] == '\0')
+		return;
+
+	/* Each process writes its own file */
+	if (snprintf(trace_path, sizeof(trace_path), "%s.%d", path, getpid()) >= (int)sizeof(trace_path)) {
+		fhwb_error("trace file path is too long: %s", path);
+		return;
+	}
+
+	env = getenv(FHWB_TRACE_SIZE_ENV_NAME);
+	if (env != NULL) {
+		val = strtol(env, NULL, 0);
+		if (val <= 0 || val > (1L << 24))
+			fhwb_error("invalid trace size: %s, use %d", env, TRACE_DEFAULT_SIZE);
+		else
+			for (trace_size = 1; trace_size < val; trace_size <<= 1)
+				;
+	}
+
+	env = getenv(FHWB_TRACE_SAMPLE_ENV_NAME);
+	if (env != NULL) {
+		val = strtol(env, NULL, 0);
+		if (val <= 0)
+			fhwb_error("invalid trace sampling rate: %s, record all", env);
+		else
+			trace_sample = val;
+	}
+
+	env = getenv(FHWB_TRACE_FORMAT_ENV_NAME);
+	if (env != NULL) {
+		if (strcmp(env, "chrome") == 0)
+			trace_chrome = 1;
+		else if (strcmp(env, "binary") != 0)
+			fhwb_error("unknown trace format: %s, use binary", env);
+	}
+
+	env = getenv(FHWB_TRACE_SIGNAL_ENV_NAME);
+	if (env != NULL) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_handler = trace_signal_handler;
+		sa.sa_flags = SA_RESTART;
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(atoi(env), &sa, NULL) < 0)
+			fhwb_error("cannot set handler of signal %s: %m", env);
+	}
+
+	fhwb_trace_enabled = 1;
+	fhwb_debug("trace to %s%s, %u events per thread, sample 1/%lu", trace_path,
+			trace_chrome ? ".json" : "", trace_size, trace_sample);
+}
+
+/* Return ring of calling thread, allocating it at the first event */
+static struct trace_ring *get_ring(void)
+{
+	struct trace_ring *ring = thread_ring;
+
+	if (__builtin_expect(ring != NULL, 1))
+		return ring;
+
+	ring = calloc(1, sizeof(struct trace_ring) + sizeof(struct fhwb_trace_event) * trace_size);
+	if (!ring)
+		return NULL;
+	ring->tid = syscall(SYS_gettid);
+	ring->size = trace_size;
+
+	/* Push to the list. Rings are never freed since the dump may happen at any time */
+	ring->next = atomic_load(&trace_rings);
+	while (!atomic_compare_exchange_weak(&trace_rings, &ring->next, ring))
+		;
+	thread_ring = ring;
+
+	return ring;
+}
+
+static void record(int type, int cpu, int bd, int window, int result)
+{
+	struct trace_ring *ring = get_ring();
+	struct fhwb_trace_event *ev;
+	uint64_t head;
+
+	if (!ring)
+		return;
+
+	head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+	ev = &ring->events[head & (ring->size - 1)];
+	ev->time = fhwb_read_clock();
+	ev->cpu = cpu;
+	ev->type = type;
+	ev->window = window;
+	ev->cmg = bd < 0 ? 0xff : fhwb_get_cmg_from_bd(bd);
+	ev->bb = bd < 0 ? 0xff : fhwb_get_bb_from_bd(bd);
+	ev->result = result < 0 ? result : 0;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void fhwb_trace_event(int type, int bd, int window, int result)
+{
+	if (!fhwb_trace_enabled)
+		return;
+
+	if (type == FHWB_TRACE_ASSIGN && result >= 0) {
+		trace_windows[result].assigned = true;
+		trace_windows[result].bd = bd;
+		trace_windows[result].cpu = sched_getcpu();
+		trace_windows[result].seq = 0;
+		window = result;
+	} else if (type == FHWB_TRACE_UNASSIGN) {
+		for (window = FHWB_WINDOW_3; window >= 0; window--)
+			if (trace_windows[window].assigned && trace_windows[window].bd == bd)
+				break;
+		if (window >= 0 && result == 0)
+			trace_windows[window].assigned = false;
+	}
+
+	record(type, sched_getcpu(), bd, window, result);
+}
+
+void fhwb_trace_sync(int type, int window)
+{
+	struct trace_window *w;
+
+	if (!fhwb_trace_enabled)
+		return;
+
+	if (window < 0 || window > FHWB_WINDOW_3) {
+		record(type, 0xffff, -1, window, -EINVAL);
+		return;
+	}
+
+	/* Calling thread is bound to the PE since fhwb_assign() */
+	w = &trace_windows[window];
+
+	/*
+	 * PEs count synchronizations from fhwb_assign() and sample the same episodes.
+	 * The release before a sampled episode is also recorded as the end of compute.
+	 */
+	if (type == FHWB_TRACE_SYNC_BEGIN) {
+		if (w->seq % trace_sample != 0)
+			return;
+	} else {
+		unsigned long seq = w->seq++;
+
+		if (seq % trace_sample != 0 && (seq + 1) % trace_sample != 0)
+			return;
+	}
+	record(type, w->cpu, w->bd, window, 0);
+}
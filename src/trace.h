@@ -0,0 +1,77 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/* Copyright 2020 FUJITSU LIMITED */
+
+/*
+ * Binary format of trace file written by the library (see FHWB_TRACE_ENV_NAME)
+ *
+ * struct fhwb_trace_header
+ * For each thread which recorded events:
+ *   struct fhwb_trace_ring_header
+ *   struct fhwb_trace_event * num_events (oldest first)
+ *
+ * All values are in native byte order of the traced machine.
+ */
+
+#ifndef _FUJITSU_HWB_TRACE_H
+#define _FUJITSU_HWB_TRACE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define FHWB_TRACE_MAGIC   "FHWBTRC"
+#define FHWB_TRACE_VERSION 1
+
+/* Event types */
+#define FHWB_TRACE_INIT       1
+#define FHWB_TRACE_FINI       2
+#define FHWB_TRACE_ASSIGN     3
+#define FHWB_TRACE_UNASSIGN   4
+#define FHWB_TRACE_SYNC_BEGIN 5
+#define FHWB_TRACE_SYNC_END   6
+#define FHWB_TRACE_REMASK     7
+
+struct fhwb_trace_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t pid;
+	/* ticks per second of timestamps */
+	uint64_t clock_freq;
+};
+
+struct fhwb_trace_ring_header {
+	uint32_t tid;
+	uint32_t num_events;
+	/* events overwritten before dump */
+	uint64_t dropped;
+};
+
+struct fhwb_trace_event {
+	uint64_t time;
+	uint16_t cpu;
+	uint8_t type;
+	int8_t window;  /* -1 if not applicable */
+	uint8_t cmg;
+	uint8_t bb;
+	int16_t result; /* 0 or negative errno */
+};
+
+/* Writer of Chrome trace event format (trace_chrome.c) */
+#define FHWB_TRACE_CHROME_MAX_CPU 4096
+
+struct fhwb_trace_chrome {
+	FILE *fp;
+	uint64_t clock_freq;
+	/* timestamp shown as 0 */
+	uint64_t base;
+	int nr_events;
+	uint64_t cmg_named[256 / 64];
+	uint64_t cpu_named[FHWB_TRACE_CHROME_MAX_CPU / 64];
+};
+
+void fhwb_trace_chrome_begin(struct fhwb_trace_chrome *ct, FILE *fp, uint64_t clock_freq, uint64_t base);
+/* Write events of one thread (oldest first) */
+void fhwb_trace_chrome_thread(struct fhwb_trace_chrome *ct, uint32_t tid,
+		const struct fhwb_trace_event *events, uint32_t num);
+void fhwb_trace_chrome_end(struct fhwb_trace_chrome *ct);
+
+#endif /* _FUJITSU_HWB_TRACE_H */
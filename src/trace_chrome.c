@@ -0,0 +1,146 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Convert trace events to Chrome trace event format (JSON), which can be
+ * opened by chrome://tracing and Perfetto UI.
+ *
+ * Each CMG is shown as a process and each PE (cpu) as a thread of it. For every
+ * recorded synchronization, a "sync" slice covers from arrival to release, and
+ * a "compute" slice covers from the previous release on the same window.
+ *
+ * This file is shared by the library and fhwb_trace_decode.
+ */
+
+#include "trace.h"
+
+#include <inttypes.h>
+#include <string.h>
+
+#define NO_ID 0xff
+
+static double to_us(const struct fhwb_trace_chrome *ct, uint64_t time)
+{
+	return (double)(time - ct->base) * 1000000.0 / ct->clock_freq;
+}
+
+static void separator(struct fhwb_trace_chrome *ct)
+{
+	fprintf(ct->fp, "%s\n", ct->nr_events++ ? "," : "");
+}
+
+static int pid_of(const struct fhwb_trace_event *ev)
+{
+	return ev->cmg == NO_ID ? -1 : ev->cmg;
+}
+
+static int tid_of(const struct fhwb_trace_event *ev)
+{
+	return ev->cpu == 0xffff ? -1 : ev->cpu;
+}
+
+/* Name CMG/PE of @ev when first seen */
+static void name_pe(struct fhwb_trace_chrome *ct, const struct fhwb_trace_event *ev)
+{
+	int pid = pid_of(ev);
+	int tid = tid_of(ev);
+
+	if (ev->cmg != NO_ID && !(ct->cmg_named[ev->cmg / 64] & (1ULL << (ev->cmg % 64)))) {
+		ct->cmg_named[ev->cmg / 64] |= 1ULL << (ev->cmg % 64);
+		separator(ct);
+		fprintf(ct->fp, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": %d, "
+				"\"args\": {\"name\": \"CMG %d\"}}", pid, pid);
+	}
+
+	if (ev->cpu != 0xffff && ev->cpu < FHWB_TRACE_CHROME_MAX_CPU &&
+	    !(ct->cpu_named[ev->cpu / 64] & (1ULL << (ev->cpu % 64)))) {
+		ct->cpu_named[ev->cpu / 64] |= 1ULL << (ev->cpu % 64);
+		separator(ct);
+		fprintf(ct->fp, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": %d, \"tid\": %d, "
+				"\"args\": {\"name\": \"CPU %d\"}}", pid, tid, tid);
+	}
+}
+
+static void slice(struct fhwb_trace_chrome *ct, const char *name, const struct fhwb_trace_event *ev,
+		uint64_t begin, uint64_t end, uint32_t tid)
+{
+	separator(ct);
+	fprintf(ct->fp, "{\"name\": \"%s\", \"cat\": \"barrier\", \"ph\": \"X\", \"ts\": %.3f, "
+			"\"dur\": %.3f, \"pid\": %d, \"tid\": %d, "
+			"\"args\": {\"bb\": %d, \"window\": %d, \"thread\": %" PRIu32 "}}",
+			name, to_us(ct, begin), to_us(ct, end) - to_us(ct, begin),
+			pid_of(ev), tid_of(ev), ev->bb, ev->window, tid);
+}
+
+void fhwb_trace_chrome_begin(struct fhwb_trace_chrome *ct, FILE *fp, uint64_t clock_freq, uint64_t base)
+{
+	memset(ct, 0, sizeof(*ct));
+	ct->fp = fp;
+	ct->clock_freq = clock_freq;
+	ct->base = base;
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [");
+}
+
+void fhwb_trace_chrome_thread(struct fhwb_trace_chrome *ct, uint32_t tid,
+		const struct fhwb_trace_event *events, uint32_t num)
+{
+	static const char *const names[] = {
+		[FHWB_TRACE_INIT] = "init",
+		[FHWB_TRACE_FINI] = "fini",
+		[FHWB_TRACE_ASSIGN] = "assign",
+		[FHWB_TRACE_UNASSIGN] = "unassign",
+		[FHWB_TRACE_REMASK] = "remask",
+	};
+	/* Timestamps of the last sync begin/end of each window (0 if none) */
+	uint64_t begin[4] = {0};
+	uint64_t end[4] = {0};
+	uint32_t i;
+
+	for (i = 0; i < num; i++) {
+		const struct fhwb_trace_event *ev = &events[i];
+		int w = ev->window;
+
+		name_pe(ct, ev);
+
+		switch (ev->type) {
+		case FHWB_TRACE_SYNC_BEGIN:
+			if (w < 0 || w > 3)
+				break;
+			/* Previous release of this window is the end of compute */
+			if (end[w])
+				slice(ct, "compute", ev, end[w], ev->time, tid);
+			begin[w] = ev->time;
+			end[w] = 0;
+			break;
+		case FHWB_TRACE_SYNC_END:
+			if (w < 0 || w > 3)
+				break;
+			if (begin[w])
+				slice(ct, "sync", ev, begin[w], ev->time, tid);
+			begin[w] = 0;
+			end[w] = ev->time;
+			break;
+		case FHWB_TRACE_ASSIGN:
+		case FHWB_TRACE_UNASSIGN:
+			if (w >= 0 && w <= 3)
+				begin[w] = end[w] = 0;
+			/* fall through */
+		case FHWB_TRACE_INIT:
+		case FHWB_TRACE_FINI:
+		case FHWB_TRACE_REMASK:
+			separator(ct);
+			fprintf(ct->fp, "{\"name\": \"%s\", \"cat\": \"setup\", \"ph\": \"i\", \"s\": \"t\", "
+					"\"ts\": %.3f, \"pid\": %d, \"tid\": %d, "
+					"\"args\": {\"bb\": %d, \"window\": %d, \"result\": %d, \"thread\": %" PRIu32 "}}",
+					names[ev->type], to_us(ct, ev->time), pid_of(ev), tid_of(ev),
+					ev->bb == NO_ID ? -1 : ev->bb, ev->window, ev->result, tid);
+			break;
+		}
+	}
+}
+
+void fhwb_trace_chrome_end(struct fhwb_trace_chrome *ct)
+{
+	fprintf(ct->fp, "\n]}\n");
+}
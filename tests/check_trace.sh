@@ -0,0 +1,69 @@
+#!/bin/bash
+# SPDX-License-Identifier: LGPL-3.0-only
+# Copyright 2020 FUJITSU LIMITED
+#
+# Usage: ./check_trace.sh <decoder> <program> <args>
+# Run <program> with event trace enabled, then check decoded events are paired
+# and Chrome trace event format is written
+
+decoder=$1
+shift
+prog=("$@")
+
+dir=$(mktemp -d)
+trap 'rm -rf $dir' EXIT
+
+FUJITSU_HWBLIB_TRACE=$dir/trace "${prog[@]}"
+error=$?
+if [[ $error -ne 0 ]]; then
+	echo exit status of \"${prog[@]}\": $error
+	exit $error
+fi
+
+files=($dir/trace.*)
+if [[ ${#files[@]} -ne 1 || ! -f ${files[0]} ]]; then
+	echo "trace file is not written"
+	exit 1
+fi
+
+$decoder ${files[0]} > $dir/decoded || exit 1
+head -5 $dir/decoded
+
+count() {
+	awk -v ev=$1 '$4 == ev' $dir/decoded | wc -l
+}
+
+for pair in "init fini" "assign unassign" "sync_begin sync_end"; do
+	set -- $pair
+	if [[ $(count $1) -eq 0 || $(count $1) -ne $(count $2) ]]; then
+		echo "number of $1/$2 events does not match: $(count $1)/$(count $2)"
+		exit 1
+	fi
+done
+
+# every sync_begin is recorded with cmg/bb of the assigned window
+if awk '$4 == "sync_begin" && ($5 < 0 || $6 < 0 || $8 != 0)' $dir/decoded | grep -q .; then
+	echo "sync event without valid window"
+	exit 1
+fi
+
+# converted Chrome trace has a sync slice for each sync_begin/sync_end pair
+$decoder -c ${files[0]} > $dir/chrome.json || exit 1
+slices=$(grep -c '"name": "sync", "cat": "barrier", "ph": "X"' $dir/chrome.json)
+if [[ $slices -ne $(count sync_begin) ]]; then
+	echo "number of sync slices does not match: $slices/$(count sync_begin)"
+	exit 1
+fi
+
+# library writes Chrome trace at exit, sampling one in 4 synchronizations
+rm -f $dir/trace.*
+FUJITSU_HWBLIB_TRACE=$dir/trace FUJITSU_HWBLIB_TRACE_FORMAT=chrome FUJITSU_HWBLIB_TRACE_SAMPLE=4 "${prog[@]}" > /dev/null || exit 1
+files=($dir/trace.*.json)
+if [[ ! -f ${files[0]} ]] || ! grep -q '"name": "sync"' ${files[0]}; then
+	echo "Chrome trace file is not written"
+	exit 1
+fi
+if command -v python3 > /dev/null && ! python3 -m json.tool ${files[0]} > /dev/null; then
+	echo "Chrome trace file is not valid JSON"
+	exit 1
+fi
@@ -7,7 +7,7 @@
 # If <multi_bw> is 1, launch num_bw process per CMG. otherwise 1 process per CMG.
 # If <check_error> is 1, check each process's return value.
 
-SYSFS_PATH=/sys/class/misc/fujitsu_hwb/hwinfo
+SYSFS_PATH=${FUJITSU_HWB_SYSFS_ROOT:-/sys/class/misc/fujitsu_hwb}/hwinfo
 LOOP=$4
 
 # check specified program exists
@@ -0,0 +1,209 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check fhwb_allreduce() results of all operations and types
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define COUNT 4
+
+static int _bd;
+static int _loop;
+static int _num_threads;
+
+struct thread_info {
+	pthread_t thread_id;
+	int index;
+	int cpuid;
+	int ret;
+};
+
+/* Check int64 reduction of values (index + i + k) for k = 0 .. COUNT-1 */
+static int check_int64(int window, int index, int i)
+{
+	int64_t in[COUNT], out[COUNT];
+	int64_t n = _num_threads;
+	int k;
+
+	for (k = 0; k < COUNT; k++)
+		in[k] = index + i + k;
+
+	if (fhwb_allreduce(window, FHWB_OP_SUM, FHWB_TYPE_INT64, in, out, COUNT))
+		return -1;
+	for (k = 0; k < COUNT; k++)
+		if (out[k] != n * (n - 1) / 2 + n * (i + k))
+			return -1;
+
+	if (fhwb_allreduce(window, FHWB_OP_MIN, FHWB_TYPE_INT64, in, out, COUNT))
+		return -1;
+	for (k = 0; k < COUNT; k++)
+		if (out[k] != i + k)
+			return -1;
+
+	if (fhwb_allreduce(window, FHWB_OP_MAX, FHWB_TYPE_INT64, in, out, COUNT))
+		return -1;
+	for (k = 0; k < COUNT; k++)
+		if (out[k] != n - 1 + i + k)
+			return -1;
+
+	/* only the first PE has 0 (false) in in[0] when i == 0 */
+	if (fhwb_allreduce(window, FHWB_OP_LAND, FHWB_TYPE_INT64, in, out, COUNT))
+		return -1;
+	if (out[0] != (i != 0) || out[1] != 1)
+		return -1;
+
+	if (fhwb_allreduce(window, FHWB_OP_LOR, FHWB_TYPE_INT64, in, in, 1))
+		return -1;
+	if (in[0] != 1)
+		return -1;
+
+	return 0;
+}
+
+static int check_double(int window, int index, int i)
+{
+	double in = (index == _num_threads - 1) ? -0.5 * i : index;
+	double out;
+
+	if (fhwb_allreduce(window, FHWB_OP_MIN, FHWB_TYPE_DOUBLE, &in, &out, 1))
+		return -1;
+	if (out != (i ? -0.5 * i : 0))
+		return -1;
+
+	in = 0.5;
+	if (fhwb_allreduce(window, FHWB_OP_SUM, FHWB_TYPE_DOUBLE, &in, &out, 1))
+		return -1;
+	if (out != 0.5 * _num_threads)
+		return -1;
+
+	in = (index == 0);
+	if (fhwb_allreduce(window, FHWB_OP_LAND, FHWB_TYPE_DOUBLE, &in, &out, 1))
+		return -1;
+	if (out != 0)
+		return -1;
+
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int64_t dummy = 0;
+	int window;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	window = fhwb_assign(_bd, -1);
+	if (window < 0) {
+		info->ret = window;
+		pthread_exit(NULL);
+	}
+
+	/* invalid arguments are rejected before synchronization */
+	if (fhwb_allreduce(window, FHWB_OP_LOR + 1, FHWB_TYPE_INT64, &dummy, &dummy, 1) != -EINVAL ||
+	    fhwb_allreduce(window, FHWB_OP_SUM, FHWB_TYPE_INT64, &dummy, &dummy,
+			   FHWB_ALLREDUCE_MAX_COUNT + 1) != -EINVAL) {
+		fprintf(stderr, "cpu %d: invalid argument is accepted\n", info->cpuid);
+		info->ret = -1;
+		goto out;
+	}
+
+	for (i = 0; i < _loop; i++) {
+		if (check_int64(window, info->index, i) || check_double(window, info->index, i)) {
+			fprintf(stderr, "cpu %d: wrong result at %d\n", info->cpuid, i);
+			info->ret = -1;
+			break;
+		}
+	}
+
+out:
+	ret = fhwb_unassign(_bd);
+	if (!info->ret)
+		info->ret = ret;
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info *th_info;
+	int64_t dummy = 0;
+	cpu_set_t set;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = fill_cpumask_for_cmg(cmg, &set);
+	ASSERT_SUCCESS(ret);
+	_num_threads = CPU_COUNT(&set);
+
+	printf("test1: check fhwb_allreduce on unassigned window (%s backend)\n",
+			fhwb_get_backend_name());
+	ret = fhwb_allreduce(0, FHWB_OP_SUM, FHWB_TYPE_INT64, &dummy, &dummy, 1);
+	ASSERT(ret == -EINVAL);
+
+	printf("test2: check fhwb_allreduce by %d PEs of CMG %d\n", _num_threads, cmg);
+	if (_num_threads < 2) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	th_info = calloc(_num_threads, sizeof(struct thread_info));
+	ASSERT(th_info != NULL);
+
+	ret = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(ret);
+	_bd = ret;
+
+	cpu = -1;
+	for (i = 0; i < _num_threads; i++) {
+		cpu = get_next_cpu(&set, cpu);
+		th_info[i].index = i;
+		th_info[i].cpuid = cpu;
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+
+	for (i = 0; i < _num_threads; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+	free(th_info);
+
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
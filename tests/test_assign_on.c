@@ -0,0 +1,189 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check fhwb_assign_on() binds unpinned threads to PEs of a CMG and
+ * fhwb_unassign_on(), fhwb_unassign() and fhwb_fini() restore their affinity
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_THREADS 4
+
+static int _loop;
+static int _bd;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid;
+	int other_cpuid;
+	int ret;
+};
+
+static int run(struct thread_info *info)
+{
+	cpu_set_t before, after;
+	int window;
+	int ret;
+	int i;
+
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), &before);
+	if (ret)
+		return -errno;
+
+	window = fhwb_assign_on(_bd, info->cpuid, -1);
+	if (window < 0)
+		return window;
+	if (sched_getcpu() != info->cpuid) {
+		fprintf(stderr, "thread runs on cpu %d (expected: %d)\n", sched_getcpu(), info->cpuid);
+		return -1;
+	}
+	/* Other windows must be on the same cpu */
+	ret = fhwb_assign_on(_bd, info->other_cpuid, -1);
+	if (ret != -EINVAL) {
+		fprintf(stderr, "fhwb_assign_on() on other cpu returned %d\n", ret);
+		return -1;
+	}
+
+	for (i = 0; i < _loop; i++)
+		fhwb_sync(window);
+
+	ret = fhwb_unassign_on(_bd);
+	if (ret)
+		return ret;
+	ret = fhwb_unassign_on(_bd);
+	if (ret != -EINVAL) {
+		fprintf(stderr, "second fhwb_unassign_on() returned %d\n", ret);
+		return -1;
+	}
+
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), &after);
+	if (ret)
+		return -errno;
+	if (!CPU_EQUAL(&before, &after)) {
+		fprintf(stderr, "affinity is not restored (%d cpus, expected: %d)\n",
+				CPU_COUNT(&after), CPU_COUNT(&before));
+		return -1;
+	}
+
+	/* fhwb_unassign() also releases the binding */
+	window = fhwb_assign_on(_bd, info->cpuid, -1);
+	if (window < 0)
+		return window;
+	ret = fhwb_unassign(_bd);
+	if (ret)
+		return ret;
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), &after);
+	if (ret)
+		return -errno;
+	if (!CPU_EQUAL(&before, &after)) {
+		fprintf(stderr, "affinity is not restored by fhwb_unassign() (%d cpus, expected: %d)\n",
+				CPU_COUNT(&after), CPU_COUNT(&before));
+		return -1;
+	}
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+
+	/* Not bound to any PE before fhwb_assign_on() */
+	info->ret = run(info);
+
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info th_info[NUM_THREADS] = {0};
+	cpu_set_t before, after;
+	cpu_set_t cmg_set;
+	cpu_set_t set;
+	int window;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = fill_cpumask_for_cmg(cmg, &cmg_set);
+	ASSERT_SUCCESS(ret);
+	if (CPU_COUNT(&cmg_set) < NUM_THREADS + 1) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	CPU_ZERO(&set);
+	cpu = -1;
+	for (i = 0; i < NUM_THREADS; i++) {
+		cpu = get_next_cpu(&cmg_set, cpu);
+		th_info[i].cpuid = cpu;
+		CPU_SET(cpu, &set);
+	}
+	for (i = 0; i < NUM_THREADS; i++)
+		th_info[i].other_cpuid = th_info[(i + 1) % NUM_THREADS].cpuid;
+	/* PE of the CMG which does not join synchronization */
+	cpu = get_next_cpu(&cmg_set, cpu);
+
+	_bd = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(_bd);
+
+	printf("test1: check invalid arguments (%s backend)\n", fhwb_get_backend_name());
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), &before);
+	ASSERT_SUCCESS(ret);
+	ret = fhwb_assign_on(_bd, -1, -1);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_assign_on(_bd, CPU_SETSIZE, -1);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_unassign_on(_bd);
+	ASSERT(ret == -EINVAL);
+	/* Affinity is restored when fhwb_assign() fails */
+	ret = fhwb_assign_on(_bd, cpu, -1);
+	ASSERT(ret == -EINVAL);
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), &after);
+	ASSERT_SUCCESS(ret);
+	ASSERT(CPU_EQUAL(&before, &after));
+
+	printf("test2: check unpinned threads synchronize on their cpu\n");
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+
+	printf("test3: check fhwb_fini() restores affinity of the caller\n");
+	window = fhwb_assign_on(_bd, th_info[0].cpuid, -1);
+	ASSERT(window >= 0);
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), &after);
+	ASSERT_SUCCESS(ret);
+	ASSERT(CPU_EQUAL(&before, &after));
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
@@ -0,0 +1,214 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check two contexts allocate and free barrier resources concurrently and
+ * a bb is only managed through the context which allocated it
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_CTX 2
+#define NUM_THREADS 2
+
+static int _loop;
+
+/* One user of a context (e.g. a library) synchronizing on its own PEs */
+struct ctx_user {
+	pthread_t thread_id;
+	fhwb_ctx_t *ctx;
+	int cpus[NUM_THREADS];
+	pthread_barrier_t barrier;
+	int bd;
+	int ret;
+};
+
+struct thread_info {
+	pthread_t thread_id;
+	struct ctx_user *user;
+	int cpuid;
+	int ret;
+};
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	struct ctx_user *user = info->user;
+	cpu_set_t set;
+	int window;
+	int ret;
+	int i, j;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+	}
+
+	for (i = 0; i < _loop; i++) {
+		/* The user allocates bb of this round */
+		pthread_barrier_wait(&user->barrier);
+		if (info->ret == 0) {
+			window = fhwb_ctx_assign(user->ctx, user->bd, -1);
+			if (window < 0) {
+				info->ret = window;
+			} else {
+				for (j = 0; j < 10; j++)
+					fhwb_sync(window);
+				info->ret = fhwb_ctx_unassign(user->ctx, user->bd);
+			}
+		}
+		pthread_barrier_wait(&user->barrier);
+	}
+
+	pthread_exit(NULL);
+}
+
+static void *user_main(void *arg)
+{
+	struct ctx_user *user = (struct ctx_user *)arg;
+	struct thread_info th_info[NUM_THREADS] = {0};
+	cpu_set_t set;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	for (i = 0; i < NUM_THREADS; i++)
+		CPU_SET(user->cpus[i], &set);
+
+	pthread_barrier_init(&user->barrier, NULL, NUM_THREADS + 1);
+	for (i = 0; i < NUM_THREADS; i++) {
+		th_info[i].user = user;
+		th_info[i].cpuid = user->cpus[i];
+		pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+	}
+
+	for (i = 0; i < _loop; i++) {
+		user->bd = fhwb_ctx_init(user->ctx, sizeof(cpu_set_t), &set);
+		if (user->bd < 0) {
+			fprintf(stderr, "fhwb_ctx_init failed: %d\n", user->bd);
+			abort();
+		}
+		pthread_barrier_wait(&user->barrier);
+		pthread_barrier_wait(&user->barrier);
+		ret = fhwb_ctx_fini(user->ctx, user->bd);
+		if (ret < 0)
+			user->ret = ret;
+	}
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		pthread_join(th_info[i].thread_id, NULL);
+		if (th_info[i].ret)
+			user->ret = th_info[i].ret;
+	}
+	pthread_barrier_destroy(&user->barrier);
+
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct ctx_user users[NUM_CTX] = {0};
+	cpu_set_t cmg_set;
+	cpu_set_t set;
+	int use_driver;
+	int cmg;
+	int cpu;
+	int bd;
+	int ret;
+	int i, j;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = fill_cpumask_for_cmg(cmg, &cmg_set);
+	ASSERT_SUCCESS(ret);
+	if (CPU_COUNT(&cmg_set) < NUM_CTX * NUM_THREADS) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+	/* sw backend does not use the driver */
+	use_driver = strcmp(fhwb_get_backend_name(), "sw") != 0;
+
+	cpu = -1;
+	for (i = 0; i < NUM_CTX; i++) {
+		for (j = 0; j < NUM_THREADS; j++) {
+			cpu = get_next_cpu(&cmg_set, cpu);
+			users[i].cpus[j] = cpu;
+		}
+	}
+
+	printf("test1: check invalid arguments (%s backend)\n", fhwb_get_backend_name());
+	ret = fhwb_ctx_open(NULL);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_ctx_close(NULL);
+	ASSERT(ret == -EINVAL);
+
+	printf("test2: check %d contexts are used concurrently\n", NUM_CTX);
+	for (i = 0; i < NUM_CTX; i++) {
+		ret = fhwb_ctx_open(&users[i].ctx);
+		ASSERT_SUCCESS(ret);
+	}
+	for (i = 0; i < NUM_CTX; i++) {
+		ret = pthread_create(&users[i].thread_id, NULL, &user_main, &users[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	for (i = 0; i < NUM_CTX; i++) {
+		ret = pthread_join(users[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(users[i].ret);
+	}
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	printf("test3: check bb cannot be freed through other contexts\n");
+	CPU_ZERO(&set);
+	for (j = 0; j < NUM_THREADS; j++)
+		CPU_SET(users[0].cpus[j], &set);
+	bd = fhwb_ctx_init(users[0].ctx, sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(bd);
+	if (use_driver) {
+		ret = fhwb_ctx_fini(users[1].ctx, bd);
+		ASSERT_FAIL(ret);
+		ret = fhwb_fini(bd);
+		ASSERT_FAIL(ret);
+	}
+
+	printf("test4: check bb can be freed after its context is closed\n");
+	for (i = 0; i < NUM_CTX; i++) {
+		ret = fhwb_ctx_close(users[i].ctx);
+		ASSERT_SUCCESS(ret);
+	}
+	if (use_driver)
+		ASSERT(check_sysfs_status() != 0);
+	ret = fhwb_ctx_fini(users[0].ctx, bd);
+	ASSERT_SUCCESS(ret);
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	/* The default context is independent of others */
+	bd = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(bd);
+	ret = fhwb_fini(bd);
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
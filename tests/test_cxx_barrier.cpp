@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check fhwb::barrier (C++20) runs completion function once per phase before
+ * release on hardware barrier and on shared memory, including arrive_and_drop()
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#include <fujitsu_hwb.hpp>
+extern "C" {
+#include "util.h"
+}
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+static int _loop;
+static std::atomic<int> arrived(0);
+static std::atomic<int> errors(0);
+
+/* Count phases, and record cpu calling completion (-1: not bound) */
+struct Completion {
+	int *phases;
+	int *cpu;
+
+	void operator()() noexcept
+	{
+		(*phases)++;
+		*cpu = sched_getcpu();
+	}
+};
+
+static void bind_cpu(int cpuid)
+{
+	cpu_set_t set;
+
+	if (cpuid < 0)
+		return;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpuid, &set);
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &set))
+		throw std::system_error(errno, std::generic_category(), "sched_setaffinity");
+}
+
+/* Run a thread bound to each of @cpus calling @fn(barrier, index) */
+template <class Barrier, class Fn>
+static void run_threads(Barrier &bar, const std::vector<int> &cpus, Fn fn)
+{
+	std::vector<std::thread> threads;
+
+	for (std::size_t i = 0; i < cpus.size(); i++) {
+		threads.emplace_back([&, i]() {
+			try {
+				bind_cpu(cpus[i]);
+				fn(bar, (int)i);
+			} catch (const std::exception &e) {
+				fprintf(stderr, "thread %zu: %s\n", i, e.what());
+				errors++;
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+}
+
+/* Each phase checks completion has been called before release */
+static void check_completion(std::vector<int> &cpus, bool hw, bool split)
+{
+	int phases = 0;
+	int cpu = -1;
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	for (int c : cpus)
+		CPU_SET(c, &set);
+
+	auto run = [&](auto &bar) {
+		ASSERT(bar.hardware() == hw);
+		run_threads(bar, cpus, [&](auto &b, int) {
+			for (int i = 0; i < _loop; i++) {
+				if (split)
+					b.wait(b.arrive());
+				else
+					b.arrive_and_wait();
+				if (phases != 2 * i + 1)
+					errors++;
+				/* nobody calls completion of the next phase before all have checked */
+				b.arrive_and_wait();
+				if (phases != 2 * i + 2)
+					errors++;
+			}
+		});
+	};
+
+	if (hw) {
+		fhwb::barrier<Completion> bar(set, Completion{&phases, &cpu});
+		run(bar);
+		/* the first PE of the mask calls completion */
+		ASSERT(cpu == cpus[0]);
+	} else {
+		fhwb::barrier<Completion> bar(cpus.size(), Completion{&phases, &cpu});
+		run(bar);
+	}
+	ASSERT(phases == 2 * _loop);
+	ASSERT(errors.load() == 0);
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<int> cpus;
+	fhwb::span<const int> cmg_cpus;
+	cpu_set_t set;
+	int cmg;
+	int ret;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	cmg_cpus = fhwb::cmg_cpus(cmg);
+	ASSERT(cmg_cpus.size() >= 4);
+	cpus.assign(cmg_cpus.begin(), cmg_cpus.end());
+
+	printf("test1: check completion on hardware barrier of %zu PEs (%s backend)\n",
+			cpus.size(), fhwb_get_backend_name());
+	check_completion(cpus, true, false);
+
+	printf("test2: check completion with arrive()/wait()\n");
+	check_completion(cpus, true, true);
+
+	printf("test3: check completion on shared memory\n");
+	std::vector<int> unbound(4, -1);
+	check_completion(unbound, false, false);
+	check_completion(unbound, false, true);
+
+	printf("test4: check barrier without completion\n");
+	CPU_ZERO(&set);
+	for (int c : cpus)
+		CPU_SET(c, &set);
+	{
+		fhwb::barrier<> bar(set);
+		int n = cpus.size();
+
+		ASSERT(bar.hardware());
+		arrived = 0;
+		run_threads(bar, cpus, [&](auto &b, int) {
+			for (int i = 0; i < _loop; i++) {
+				arrived++;
+				b.arrive_and_wait();
+				if (arrived.load() != (i + 1) * n)
+					errors++;
+				b.arrive_and_wait();
+			}
+		});
+		ASSERT(errors.load() == 0);
+	}
+
+	printf("test5: check arrive_and_drop() switches to shared memory\n");
+	{
+		int phases = 0;
+		int cpu = -1;
+		int n = cpus.size();
+		int half = _loop / 2;
+		fhwb::barrier<Completion> bar(set, Completion{&phases, &cpu});
+
+		arrived = 0;
+		run_threads(bar, cpus, [&](auto &b, int index) {
+			for (int i = 0; i < _loop; i++) {
+				/* thread 0 (the first PE) leaves at the middle */
+				arrived++;
+				if (index == 0 && i == half) {
+					b.arrive_and_drop();
+					return;
+				}
+				b.arrive_and_wait();
+				if (arrived.load() != (std::min(i, half) + 1) * n + std::max(0, i - half) * (n - 1))
+					errors++;
+				b.arrive_and_wait();
+			}
+		});
+		ASSERT(!bar.hardware());
+		ASSERT(phases == 2 * _loop);
+		ASSERT(errors.load() == 0);
+	}
+
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
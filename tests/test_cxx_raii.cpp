@@ -0,0 +1,126 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check C++ interface (fujitsu_hwb.hpp) frees resources on normal and exception paths
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#include <fujitsu_hwb.hpp>
+extern "C" {
+#include "util.h"
+}
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+static int _loop;
+static int _num_threads;
+static std::atomic<int> arrived(0);
+
+static void bind_cpu(int cpuid)
+{
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpuid, &set);
+	if (sched_setaffinity(0, sizeof(cpu_set_t), &set))
+		throw std::system_error(errno, std::generic_category(), "sched_setaffinity");
+}
+
+static void worker(const fhwb::Blade &blade, int cpuid, int *result)
+{
+	try {
+		bind_cpu(cpuid);
+
+		fhwb::Window<FHWB_WINDOW_1> window(blade);
+		for (int i = 0; i < _loop; i++) {
+			arrived++;
+			window.sync();
+			if (arrived.load() != (i + 1) * _num_threads) {
+				fprintf(stderr, "cpu %d left sync early at %d: %d\n", cpuid, i, arrived.load());
+				*result = -1;
+				break;
+			}
+			window.sync();
+		}
+
+		/* window is unassigned while unwinding */
+		throw std::runtime_error("exit worker by exception");
+	} catch (const std::runtime_error &) {
+	} catch (const std::exception &e) {
+		fprintf(stderr, "cpu %d: %s\n", cpuid, e.what());
+		*result = -1;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<std::thread> threads;
+	std::vector<int> results;
+	fhwb::span<const int> cpus;
+	cpu_set_t set;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	printf("test1: check topology view (%s backend)\n", fhwb_get_backend_name());
+	cpus = fhwb::cmg_cpus(cmg);
+	ret = fill_cpumask_for_cmg(cmg, &set);
+	ASSERT_SUCCESS(ret);
+	ASSERT((int)cpus.size() == CPU_COUNT(&set));
+	for (int cpu : cpus) {
+		ASSERT(CPU_ISSET(cpu, &set));
+		ASSERT(fhwb::all_pe_info()[cpu].cmg == cmg);
+	}
+	ASSERT(fhwb::cmg_cpus(-1).empty());
+	_num_threads = cpus.size();
+
+	printf("test2: check fhwb_init error is thrown as std::system_error\n");
+	CPU_ZERO(&set);
+	try {
+		fhwb::Blade blade(set);
+		ASSERT(0);
+	} catch (const std::system_error &e) {
+		ASSERT(e.code().value() == EINVAL);
+	}
+
+	printf("test3: check sync by %d PEs of CMG %d and cleanup by destructors\n", _num_threads, cmg);
+	if (_num_threads < 2) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+	for (int cpu : cpus)
+		CPU_SET(cpu, &set);
+
+	{
+		fhwb::Blade blade(set);
+		fhwb::Blade moved(std::move(blade));
+		ASSERT(!blade && moved);
+
+		results.resize(_num_threads, 0);
+		for (i = 0; i < _num_threads; i++)
+			threads.emplace_back(worker, std::cref(moved), cpus[i], &results[i]);
+		for (i = 0; i < _num_threads; i++) {
+			threads[i].join();
+			ASSERT_SUCCESS(results[i]);
+		}
+	}
+
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
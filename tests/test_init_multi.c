@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check fhwb_init_multi() allocates one bb for each CMG of a multi-CMG mask,
+ * and frees all of them when allocation fails on one CMG
+ *
+ * Usage: ./a.out <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PE_PER_CMG 2
+
+static int *_bds;
+static int _loop;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid;
+	int ret;
+};
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int window;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	window = fhwb_assign(_bds[info->cpuid], -1);
+	if (window < 0) {
+		info->ret = window;
+		pthread_exit(NULL);
+	}
+	for (i = 0; i < _loop; i++)
+		fhwb_sync(window);
+	info->ret = fhwb_unassign(_bds[info->cpuid]);
+
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info *th_info;
+	struct hwb_hwinfo hwinfo;
+	struct fhwb_pe_info info;
+	cpu_set_t cmg_set;
+	cpu_set_t set;
+	int bds[CPU_SETSIZE];
+	int num_thread = 0;
+	int num_bd;
+	int last_cmg = -1;
+	int cmg;
+	int cpu;
+	int ret;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: ./a.out <loop_num>\n");
+		return -1;
+	}
+	_loop = atoi(argv[1]);
+
+	ret = get_hwb_hwinfo(&hwinfo);
+	ASSERT_SUCCESS(ret);
+
+	/* First PE_PER_CMG PEs of each CMG */
+	CPU_ZERO(&set);
+	for (cmg = 0; cmg < hwinfo.num_cmg; cmg++) {
+		ret = fill_cpumask_for_cmg(cmg, &cmg_set);
+		ASSERT_SUCCESS(ret);
+		if (CPU_COUNT(&cmg_set) < PE_PER_CMG)
+			continue;
+		cpu = -1;
+		for (i = 0; i < PE_PER_CMG; i++) {
+			cpu = get_next_cpu(&cmg_set, cpu);
+			CPU_SET(cpu, &set);
+		}
+		last_cmg = cmg;
+	}
+	ASSERT(last_cmg >= 0);
+
+	printf("test1: check invalid arguments (%s backend)\n", fhwb_get_backend_name());
+	ret = fhwb_init_multi(sizeof(cpu_set_t), NULL, &_bds, &num_bd);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_init_multi(sizeof(cpu_set_t), &set, NULL, &num_bd);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_fini_multi(NULL, 0);
+	ASSERT(ret == -EINVAL);
+	/* The last CMG has only one PE */
+	ret = fill_cpumask_for_cmg(last_cmg, &cmg_set);
+	ASSERT_SUCCESS(ret);
+	CPU_CLR(get_next_cpu(&cmg_set, -1), &set);
+	ret = fhwb_init_multi(sizeof(cpu_set_t), &set, &_bds, &num_bd);
+	ASSERT(ret == -EINVAL);
+	CPU_SET(get_next_cpu(&cmg_set, -1), &set);
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	printf("test2: check one bb is allocated for each of %d CMGs\n", last_cmg + 1);
+	ret = fhwb_init_multi(sizeof(cpu_set_t), &set, &_bds, &num_bd);
+	ASSERT_SUCCESS(ret);
+	for (cpu = 0; cpu < num_bd; cpu++) {
+		if (!CPU_ISSET(cpu, &set)) {
+			ASSERT(_bds[cpu] == -1);
+			continue;
+		}
+		ret = fhwb_get_cpu_pe_info(cpu, &info);
+		ASSERT_SUCCESS(ret);
+		ASSERT_VALID_BD(_bds[cpu]);
+		ASSERT(fhwb_get_cmg_from_bd(_bds[cpu]) == info.cmg);
+		num_thread++;
+	}
+	ASSERT(num_thread == CPU_COUNT(&set));
+
+	th_info = calloc(num_thread, sizeof(struct thread_info));
+	ASSERT(th_info != NULL);
+	cpu = -1;
+	for (i = 0; i < num_thread; i++) {
+		cpu = get_next_cpu(&set, cpu);
+		th_info[i].cpuid = cpu;
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	for (i = 0; i < num_thread; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+	free(th_info);
+
+	ret = fhwb_fini_multi(_bds, num_bd);
+	ASSERT_SUCCESS(ret);
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	printf("test3: check blades are freed when the last CMG is busy\n");
+	for (i = 0; i < hwinfo.num_bb; i++) {
+		bds[i] = fhwb_init(sizeof(cpu_set_t), &cmg_set);
+		ASSERT_VALID_BD(bds[i]);
+	}
+	ret = fhwb_init_multi(sizeof(cpu_set_t), &set, &_bds, &num_bd);
+	ASSERT(ret == -EBUSY);
+	for (i = 0; i < hwinfo.num_bb; i++) {
+		ret = fhwb_fini(bds[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
@@ -61,6 +61,15 @@ out:
 	return ret;
 }
 
+int cpu_can_offline(int cpu)
+{
+	char path[PATH_MAX];
+
+	snprintf(path, PATH_MAX, PATH_FORMAT, cpu);
+
+	return access(path, W_OK) == 0;
+}
+
 int main()
 {
 	cpu_set_t set;
@@ -84,6 +93,12 @@ int main()
 	cpu = get_next_cpu(&set, -1);
 	offline_cpu = get_next_cpu(&set, cpu);
 
+	/* skip test if the cpu cannot be offlined (e.g. emulated device) */
+	if (!cpu_can_offline(offline_cpu)) {
+		printf("cpu %d cannot be offlined. Skip the test\n", offline_cpu);
+		return 77;
+	}
+
 	/* offline it */
 	ret = cpu_online(offline_cpu, 0);
 	ASSERT_SUCCESS(ret);
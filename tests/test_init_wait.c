@@ -0,0 +1,291 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check fhwb_init_wait() waits for a free bb, serves waiters in FIFO order,
+ * skips a waiter process killed in the queue, and is woken up by fhwb_fini()
+ * of a process which has never waited
+ *
+ * Usage: ./a.out <cmg_num>
+ *        ./a.out <cmg_num> -w <fd>                 (waiter process of test4)
+ *        ./a.out <cmg_num> -h <write fd> <read fd>  (holder process of test5)
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define NUM_WAITERS 3
+#define NUM_HANDOFFS 5
+#define MS (1000 * 1000ULL)
+
+static cpu_set_t _set;
+static atomic_int served;
+
+struct waiter_info {
+	pthread_t thread_id;
+	int index;
+	int order;
+	int ret;
+};
+
+static void sleep_ms(int ms)
+{
+	struct timespec ts = {ms / 1000, (ms % 1000) * MS};
+
+	nanosleep(&ts, NULL);
+}
+
+static uint64_t now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / MS;
+}
+
+static uint64_t now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+}
+
+static int compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Hold all bb without waiting and free one after each request, reporting when */
+static int holder(int num_bb, int wfd, int rfd)
+{
+	int bds[CPU_SETSIZE];
+	uint64_t t;
+	char c;
+	int i;
+
+	for (i = 0; i < num_bb; i++) {
+		bds[i] = fhwb_init(sizeof(cpu_set_t), &_set);
+		if (bds[i] < 0)
+			return 1;
+	}
+	c = 'r';
+	if (write(wfd, &c, 1) != 1)
+		return 1;
+
+	for (i = 0; i < num_bb && read(rfd, &c, 1) == 1; i++) {
+		/* Free between two polls of the requester, which retries every 10ms */
+		sleep_ms(13 + i);
+		t = now_us();
+		if (fhwb_fini(bds[i]) < 0 || write(wfd, &t, sizeof(t)) != sizeof(t))
+			return 1;
+	}
+	for (; i < num_bb; i++)
+		fhwb_fini(bds[i]);
+
+	return 0;
+}
+
+static void *waiter(void *arg)
+{
+	struct waiter_info *info = (struct waiter_info *)arg;
+	int bd;
+
+	/* Arrive in order of index */
+	sleep_ms(30 * info->index);
+	bd = fhwb_init_wait(sizeof(cpu_set_t), &_set, 5000 * MS);
+	if (bd < 0) {
+		info->ret = bd;
+		pthread_exit(NULL);
+	}
+	info->order = atomic_fetch_add(&served, 1);
+
+	/* Hand over the bb to the next waiter */
+	sleep_ms(5);
+	info->ret = fhwb_fini(bd);
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct waiter_info waiters[NUM_WAITERS] = {0};
+	struct hwb_hwinfo hwinfo;
+	cpu_set_t cmg_set;
+	int bds[CPU_SETSIZE];
+	char fd_str[16];
+	int use_driver;
+	uint64_t latency[NUM_HANDOFFS];
+	char rfd_str[16];
+	uint64_t start;
+	uint64_t t;
+	int pipefd[2];
+	int reqfd[2];
+	pid_t pid;
+	char c;
+	int cmg;
+	int cpu;
+	int ret;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: ./a.out <cmg_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+
+	ret = fill_cpumask_for_cmg(cmg, &cmg_set);
+	ASSERT_SUCCESS(ret);
+	CPU_ZERO(&_set);
+	cpu = get_next_cpu(&cmg_set, -1);
+	CPU_SET(cpu, &_set);
+	CPU_SET(get_next_cpu(&cmg_set, cpu), &_set);
+
+	if (argc >= 4 && strcmp(argv[2], "-w") == 0) {
+		/* Tell the parent and wait until killed */
+		c = 'r';
+		if (write(atoi(argv[3]), &c, 1) != 1)
+			return 1;
+		ret = fhwb_init_wait(sizeof(cpu_set_t), &_set, 10000 * MS);
+		fprintf(stderr, "waiter is not killed: %d\n", ret);
+		return 1;
+	}
+
+	ret = get_hwb_hwinfo(&hwinfo);
+	ASSERT_SUCCESS(ret);
+	if (argc >= 5 && strcmp(argv[2], "-h") == 0)
+		return holder(hwinfo.num_bb, atoi(argv[3]), atoi(argv[4]));
+
+	/* sw backend does not share barrier resources with other processes */
+	use_driver = strcmp(fhwb_get_backend_name(), "sw") != 0;
+
+	printf("test1: check invalid arguments (%s backend)\n", fhwb_get_backend_name());
+	ret = fhwb_init_wait(sizeof(cpu_set_t), NULL, MS);
+	ASSERT(ret == -EINVAL);
+
+	printf("test2: check timeout when all bb are used\n");
+	for (i = 0; i < hwinfo.num_bb; i++) {
+		bds[i] = fhwb_init_wait(sizeof(cpu_set_t), &_set, MS);
+		ASSERT_VALID_BD(bds[i]);
+	}
+	ret = fhwb_init_wait(sizeof(cpu_set_t), &_set, 0);
+	ASSERT(ret == -EBUSY);
+	start = now_ms();
+	ret = fhwb_init_wait(sizeof(cpu_set_t), &_set, 20 * MS);
+	ASSERT(ret == -ETIMEDOUT);
+	ASSERT(now_ms() - start >= 20);
+
+	printf("test3: check %d waiters are served in FIFO order\n", NUM_WAITERS);
+	for (i = 0; i < NUM_WAITERS; i++) {
+		waiters[i].index = i;
+		ret = pthread_create(&waiters[i].thread_id, NULL, &waiter, &waiters[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	/* All waiters are in the queue */
+	sleep_ms(30 * NUM_WAITERS + 50);
+	ret = fhwb_fini(bds[0]);
+	ASSERT_SUCCESS(ret);
+	for (i = 0; i < NUM_WAITERS; i++) {
+		ret = pthread_join(waiters[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(waiters[i].ret);
+		ASSERT(waiters[i].order == i);
+	}
+	bds[0] = fhwb_init(sizeof(cpu_set_t), &_set);
+	ASSERT_VALID_BD(bds[0]);
+
+	if (use_driver) {
+		printf("test4: check killed waiter process is skipped\n");
+		ret = pipe(pipefd);
+		ASSERT_SUCCESS(ret);
+		snprintf(fd_str, sizeof(fd_str), "%d", pipefd[1]);
+		pid = fork();
+		ASSERT(pid >= 0);
+		if (pid == 0) {
+			execl("/proc/self/exe", argv[0], argv[1], "-w", fd_str, NULL);
+			_exit(127);
+		}
+		ASSERT(read(pipefd[0], &c, 1) == 1);
+		sleep_ms(50);
+		kill(pid, SIGKILL);
+		ASSERT(waitpid(pid, NULL, 0) == pid);
+
+		ret = fhwb_fini(bds[0]);
+		ASSERT_SUCCESS(ret);
+		start = now_ms();
+		bds[0] = fhwb_init_wait(sizeof(cpu_set_t), &_set, 2000 * MS);
+		ASSERT_VALID_BD(bds[0]);
+		ASSERT(now_ms() - start < 1000);
+	}
+
+	for (i = 0; i < hwinfo.num_bb; i++) {
+		ret = fhwb_fini(bds[i]);
+		ASSERT_SUCCESS(ret);
+	}
+
+	if (use_driver && hwinfo.num_bb >= NUM_HANDOFFS) {
+		printf("test5: check fhwb_fini() of process which has never waited wakes up waiter\n");
+		ret = pipe(pipefd);
+		ASSERT_SUCCESS(ret);
+		ret = pipe(reqfd);
+		ASSERT_SUCCESS(ret);
+		snprintf(fd_str, sizeof(fd_str), "%d", pipefd[1]);
+		snprintf(rfd_str, sizeof(rfd_str), "%d", reqfd[0]);
+		pid = fork();
+		ASSERT(pid >= 0);
+		if (pid == 0) {
+			/* The holder sees EOF when the parent closes the request pipe */
+			close(reqfd[1]);
+			execl("/proc/self/exe", argv[0], argv[1], "-h", fd_str, rfd_str, NULL);
+			_exit(127);
+		}
+		close(reqfd[0]);
+		ASSERT(read(pipefd[0], &c, 1) == 1);
+
+		for (i = 0; i < NUM_HANDOFFS; i++) {
+			c = 'f';
+			ASSERT(write(reqfd[1], &c, 1) == 1);
+			bds[i] = fhwb_init_wait(sizeof(cpu_set_t), &_set, 2000 * MS);
+			ASSERT_VALID_BD(bds[i]);
+			latency[i] = now_us();
+			ASSERT(read(pipefd[0], &t, sizeof(t)) == sizeof(t));
+			latency[i] -= t;
+		}
+		close(reqfd[1]);
+		ASSERT(waitpid(pid, &ret, 0) == pid);
+		ASSERT(WIFEXITED(ret) && WEXITSTATUS(ret) == 0);
+
+		/* Polling alone would take 4-8ms */
+		qsort(latency, NUM_HANDOFFS, sizeof(uint64_t), compare_u64);
+		printf("min latency: %lu us\n", (unsigned long)latency[0]);
+		ASSERT(latency[0] < 2500);
+
+		for (i = 0; i < NUM_HANDOFFS; i++) {
+			ret = fhwb_fini(bds[i]);
+			ASSERT_SUCCESS(ret);
+		}
+	}
+
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
@@ -0,0 +1,257 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check more logical barriers than barrier windows (and blades) synchronize
+ * PEs correctly, a pinned barrier keeps its window, and barriers on shared
+ * memory take blades which are freed or left idle
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_THREADS 4
+
+static struct fhwb_lbarrier **_barriers;
+static atomic_int *arrived;
+/* Lets main thread check and change barriers between steps of workers */
+static pthread_barrier_t step;
+static int _num_barriers;
+static int _loop;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid;
+	int ret;
+};
+
+/* Synchronize @loop times on barrier @j only, whose arrived count is 0 */
+static int sync_loop(struct thread_info *info, int j, int loop)
+{
+	int count;
+	int ret;
+	int i;
+
+	for (i = 0; i < loop; i++) {
+		atomic_fetch_add(&arrived[j], 1);
+		ret = fhwb_lbarrier_sync(_barriers[j]);
+		if (ret)
+			return ret;
+		/* Others may have arrived at the next phase, but not passed it */
+		count = atomic_load(&arrived[j]);
+		if (count < (i + 1) * NUM_THREADS || count >= (i + 2) * NUM_THREADS) {
+			fprintf(stderr, "PE %d left barrier %d early: %d\n", info->cpuid, j, count);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int ret;
+	int i, j;
+	int k;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		goto out;
+	}
+
+	/* The first barrier is used in every step */
+	ret = fhwb_lbarrier_pin(_barriers[0], 1);
+	if (ret) {
+		info->ret = ret;
+		goto out;
+	}
+
+	for (i = 0; i < _loop; i++) {
+		for (j = 1; j < _num_barriers; j++) {
+			atomic_fetch_add(&arrived[j], 1);
+			ret = fhwb_lbarrier_sync(_barriers[j]);
+			if (ret) {
+				info->ret = ret;
+				goto out;
+			}
+			/* Nobody arrives at the barrier again before all PEs pass the next one */
+			if (atomic_load(&arrived[j]) != (i + 1) * NUM_THREADS) {
+				fprintf(stderr, "PE %d left barrier %d early: %d\n",
+						info->cpuid, j, atomic_load(&arrived[j]));
+				info->ret = -1;
+			}
+			fhwb_lbarrier_sync(_barriers[0]);
+		}
+	}
+
+out:
+	/* Steps of test4 and test5, each after main thread has prepared it */
+	for (k = 0; k < 2; k++) {
+		pthread_barrier_wait(&step);
+		pthread_barrier_wait(&step);
+		if (info->ret == 0)
+			info->ret = sync_loop(info, _num_barriers - 2 + k, _loop);
+	}
+	pthread_barrier_wait(&step);
+
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info th_info[NUM_THREADS] = {0};
+	struct fhwb_lbarrier_stats stats;
+	struct hwb_hwinfo hwinfo;
+	cpu_set_t cmg_set;
+	cpu_set_t set;
+	int hardware;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = get_hwb_hwinfo(&hwinfo);
+	ASSERT_SUCCESS(ret);
+	ret = fill_cpumask_for_cmg(cmg, &cmg_set);
+	ASSERT_SUCCESS(ret);
+	if (CPU_COUNT(&cmg_set) < NUM_THREADS) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	CPU_ZERO(&set);
+	cpu = -1;
+	for (i = 0; i < NUM_THREADS; i++) {
+		cpu = get_next_cpu(&cmg_set, cpu);
+		CPU_SET(cpu, &set);
+		th_info[i].cpuid = cpu;
+	}
+
+	printf("test1: check invalid arguments (%s backend)\n", fhwb_get_backend_name());
+	ret = fhwb_lbarrier_create(sizeof(cpu_set_t), &set, NULL);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_lbarrier_pin(NULL, 1);
+	ASSERT(ret == -EINVAL);
+
+	/* All blades are used and two barriers are on shared memory */
+	_num_barriers = hwinfo.num_bb + 2;
+	printf("test2: check %d logical barriers on %d windows\n", _num_barriers, hwinfo.num_bw);
+	_barriers = calloc(_num_barriers, sizeof(struct fhwb_lbarrier *));
+	arrived = calloc(_num_barriers, sizeof(atomic_int));
+	ASSERT(_barriers != NULL && arrived != NULL);
+	for (i = 0; i < _num_barriers; i++) {
+		ret = fhwb_lbarrier_create(sizeof(cpu_set_t), &set, &_barriers[i]);
+		ASSERT_SUCCESS(ret);
+		ret = fhwb_lbarrier_get_stats(_barriers[i], &stats);
+		ASSERT_SUCCESS(ret);
+		ASSERT(stats.hardware == (i < hwinfo.num_bb));
+	}
+
+	ret = pthread_barrier_init(&step, NULL, NUM_THREADS + 1);
+	ASSERT_SUCCESS(ret);
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	pthread_barrier_wait(&step);
+
+	printf("test3: check pinned barrier is not unmapped\n");
+	for (i = 0; i < NUM_THREADS; i++)
+		ASSERT_SUCCESS(th_info[i].ret);
+	ret = fhwb_lbarrier_get_stats(_barriers[0], &stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.maps == NUM_THREADS);
+	ASSERT(stats.evictions == 0);
+	/* Other blades take turns on the remaining windows */
+	ret = fhwb_lbarrier_get_stats(_barriers[1], &stats);
+	ASSERT_SUCCESS(ret);
+	if (hwinfo.num_bb > hwinfo.num_bw)
+		ASSERT(stats.maps == (uint64_t)_loop * NUM_THREADS && stats.evictions > 0);
+	/* Barriers used in every step keep their blades */
+	ret = fhwb_lbarrier_get_stats(_barriers[_num_barriers - 1], &stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.maps == 0 && stats.hardware == 0 && stats.blades == 0);
+
+	printf("test4: check barrier on shared memory takes a freed blade\n");
+	ret = fhwb_lbarrier_destroy(_barriers[1]);
+	ASSERT_SUCCESS(ret);
+	_barriers[1] = NULL;
+	atomic_store(&arrived[_num_barriers - 2], 0);
+	pthread_barrier_wait(&step);
+	pthread_barrier_wait(&step);
+	for (i = 0; i < NUM_THREADS; i++)
+		ASSERT_SUCCESS(th_info[i].ret);
+	ret = fhwb_lbarrier_get_stats(_barriers[_num_barriers - 2], &stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.hardware == 1 && stats.blades == 1 && stats.maps == NUM_THREADS);
+
+	printf("test5: check barrier on shared memory takes a blade of idle barrier\n");
+	atomic_store(&arrived[_num_barriers - 1], 0);
+	pthread_barrier_wait(&step);
+	pthread_barrier_wait(&step);
+	for (i = 0; i < NUM_THREADS; i++)
+		ASSERT_SUCCESS(th_info[i].ret);
+	ret = fhwb_lbarrier_get_stats(_barriers[_num_barriers - 1], &stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.hardware == 1 && stats.blades == 1);
+	/* The pinned barrier and the barrier used in test4 are not idle */
+	ret = fhwb_lbarrier_get_stats(_barriers[0], &stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.hardware == 1);
+	ret = fhwb_lbarrier_get_stats(_barriers[_num_barriers - 2], &stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.hardware == 1);
+	hardware = 0;
+	for (i = 2; i < _num_barriers; i++) {
+		ret = fhwb_lbarrier_get_stats(_barriers[i], &stats);
+		ASSERT_SUCCESS(ret);
+		hardware += stats.hardware;
+	}
+	ASSERT(hardware == hwinfo.num_bb - 1);
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+	pthread_barrier_destroy(&step);
+
+	for (i = 0; i < _num_barriers; i++) {
+		if (!_barriers[i])
+			continue;
+		ret = fhwb_lbarrier_destroy(_barriers[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	free(_barriers);
+	free(arrived);
+
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
@@ -0,0 +1,149 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check node-wide barrier synchronizes PEs of all CMGs
+ *
+ * Usage: ./a.out <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static struct fhwb_node_barrier *_barrier;
+static int _loop;
+static int _num_threads;
+static atomic_int arrived;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid;
+	int ret;
+};
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	ret = fhwb_node_barrier_assign(_barrier);
+	if (ret) {
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	for (i = 0; i < _loop; i++) {
+		atomic_fetch_add(&arrived, 1);
+		fhwb_node_barrier_sync(_barrier);
+
+		/* all PEs have arrived, and nobody arrives next phase before second sync */
+		if (atomic_load(&arrived) != (i + 1) * _num_threads) {
+			fprintf(stderr, "cpu %d left sync early at %d: %d\n",
+					info->cpuid, i, atomic_load(&arrived));
+			info->ret = -1;
+			break;
+		}
+		fhwb_node_barrier_sync(_barrier);
+	}
+
+	ret = fhwb_node_barrier_unassign(_barrier);
+	if (!info->ret)
+		info->ret = ret;
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info *th_info;
+	struct hwb_hwinfo hwinfo;
+	cpu_set_t set;
+	cpu_set_t cmg_set;
+	int cpu;
+	int ret;
+	int i;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: ./a.out <loop_num>\n");
+		return -1;
+	}
+	_loop = atoi(argv[1]);
+
+	ret = get_hwb_hwinfo(&hwinfo);
+	ASSERT_SUCCESS(ret);
+
+	printf("test1: check invalid pemask (%s backend)\n", fhwb_get_backend_name());
+	CPU_ZERO(&set);
+	ret = fhwb_node_barrier_init(sizeof(cpu_set_t), &set, &_barrier);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_node_barrier_init(sizeof(cpu_set_t), NULL, &_barrier);
+	ASSERT(ret == -EINVAL);
+
+	/* use the first PE of CMG 0 alone and all PEs of other CMGs */
+	for (i = 0; i < hwinfo.num_cmg; i++) {
+		ret = fill_cpumask_for_cmg(i, &cmg_set);
+		ASSERT_SUCCESS(ret);
+		if (i == 0) {
+			cpu = get_next_cpu(&cmg_set, -1);
+			ASSERT(cpu >= 0);
+			CPU_SET(cpu, &set);
+		} else {
+			CPU_OR(&set, &set, &cmg_set);
+		}
+	}
+	_num_threads = CPU_COUNT(&set);
+
+	printf("test2: check node barrier by %d PEs of %d CMGs\n", _num_threads, hwinfo.num_cmg);
+	if (_num_threads < 2) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	th_info = calloc(_num_threads, sizeof(struct thread_info));
+	ASSERT(th_info != NULL);
+
+	ret = fhwb_node_barrier_init(sizeof(cpu_set_t), &set, &_barrier);
+	ASSERT_SUCCESS(ret);
+
+	cpu = -1;
+	for (i = 0; i < _num_threads; i++) {
+		cpu = get_next_cpu(&set, cpu);
+		th_info[i].cpuid = cpu;
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+
+	for (i = 0; i < _num_threads; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+	free(th_info);
+
+	ret = fhwb_node_barrier_fini(_barrier);
+	ASSERT_SUCCESS(ret);
+
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
@@ -0,0 +1,203 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check OpenMP barriers routed by libFJhwb-omp.so synchronize threads of the team
+ * (linked before libgomp instead of LD_PRELOAD)
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <omp.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MAX_THREADS 64
+
+/* State of teams checked by check_barriers() */
+struct team_state {
+	atomic_int arrived;
+	atomic_int tasks_done;
+	int counts[MAX_THREADS];
+};
+
+/* Master thread other than the main thread, which runs teams of its own (test4) */
+struct master_info {
+	pthread_t thread;
+	struct team_state state;
+	int *cpus;
+	int num_threads;
+	int loop;
+};
+
+static struct team_state _state;
+static atomic_int errors;
+
+/* Bind threads of a team of @num_threads to PEs of @cpus */
+static void bind_threads(int *cpus, int num_threads)
+{
+	#pragma omp parallel num_threads(num_threads)
+	{
+		cpu_set_t set;
+
+		CPU_ZERO(&set);
+		CPU_SET(cpus[omp_get_thread_num()], &set);
+		if (sched_setaffinity(0, sizeof(cpu_set_t), &set))
+			atomic_fetch_add(&errors, 1);
+	}
+}
+
+/* Check barriers of all kinds by a team of @num_threads */
+static void check_barriers(struct team_state *s, int num_threads, int loop)
+{
+	atomic_int *arrived = &s->arrived;
+	atomic_int *tasks_done = &s->tasks_done;
+	int *counts = s->counts;
+
+	atomic_store(arrived, 0);
+	atomic_store(tasks_done, 0);
+
+	#pragma omp parallel num_threads(num_threads)
+	{
+		int n = omp_get_num_threads();
+		int i, j;
+
+		for (i = 0; i < loop; i++) {
+			/* explicit barrier */
+			atomic_fetch_add(arrived, 1);
+			#pragma omp barrier
+			if (atomic_load(arrived) != (i + 1) * n)
+				atomic_fetch_add(&errors, 1);
+			#pragma omp barrier
+
+			/* implicit barrier of worksharing loop (GOMP_loop_end) */
+			#pragma omp for schedule(dynamic)
+			for (j = 0; j < n; j++)
+				counts[j] = i + 1;
+			if (counts[(omp_get_thread_num() + 1) % n] != i + 1)
+				atomic_fetch_add(&errors, 1);
+			#pragma omp barrier
+
+			/* implicit barrier of sections (GOMP_sections_end) */
+			#pragma omp sections
+			{
+				#pragma omp section
+				counts[0] = -1;
+				#pragma omp section
+				counts[1] = -1;
+			}
+			if (counts[0] != -1 || counts[1] != -1)
+				atomic_fetch_add(&errors, 1);
+			#pragma omp barrier
+
+			/* barrier completes tasks created by tasks of another thread */
+			if (omp_get_thread_num() == 0) {
+				#pragma omp task
+				{
+					#pragma omp task
+					atomic_fetch_add(tasks_done, 1);
+				}
+			}
+			#pragma omp barrier
+			if (atomic_load(tasks_done) != i + 1)
+				atomic_fetch_add(&errors, 1);
+			#pragma omp barrier
+		}
+	}
+}
+
+/* Run teams of its own as another master thread, concurrently with other masters */
+static void *master(void *arg)
+{
+	struct master_info *info = (struct master_info *)arg;
+
+	bind_threads(info->cpus, info->num_threads);
+	check_barriers(&info->state, info->num_threads, info->loop);
+	check_barriers(&info->state, info->num_threads, info->loop);
+
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct master_info masters[2] = {0};
+	struct hwb_hwinfo hwinfo;
+	int cpus[MAX_THREADS];
+	cpu_set_t set;
+	int num_pe;
+	int cmg;
+	int loop;
+	int cpu;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	loop = atoi(argv[2]);
+
+	ret = get_hwb_hwinfo(&hwinfo);
+	ASSERT_SUCCESS(ret);
+
+	ret = fill_cpumask_for_cmg(cmg, &set);
+	ASSERT_SUCCESS(ret);
+	num_pe = CPU_COUNT(&set);
+	ASSERT(num_pe >= 2 && num_pe + 2 <= MAX_THREADS);
+
+	cpu = -1;
+	for (i = 0; i < num_pe; i++) {
+		cpu = get_next_cpu(&set, cpu);
+		cpus[i] = cpu;
+	}
+
+	printf("test1: check barriers of team bound to %d PEs of CMG %d (%s backend)\n",
+			num_pe, cmg, fhwb_get_backend_name());
+	bind_threads(cpus, num_pe);
+	check_barriers(&_state, num_pe, loop);
+	ASSERT(atomic_load(&errors) == 0);
+	/* barrier blade is kept allocated for the team (sw backend does not use the driver) */
+	if (strcmp(fhwb_get_backend_name(), "sw"))
+		ASSERT(check_sysfs_status() != 0);
+
+	printf("test2: check barriers of team with unbound threads\n");
+	check_barriers(&_state, num_pe + 2, loop);
+	ASSERT(atomic_load(&errors) == 0);
+	if (strcmp(fhwb_get_backend_name(), "sw"))
+		ASSERT(check_sysfs_status() == 0);
+
+	/* libgomp may replace threads when the team size changes */
+	printf("test3: check barriers of smaller team in the CMG\n");
+	bind_threads(cpus, num_pe / 2);
+	check_barriers(&_state, num_pe / 2, loop);
+	ASSERT(atomic_load(&errors) == 0);
+	if (strcmp(fhwb_get_backend_name(), "sw"))
+		ASSERT(check_sysfs_status() != 0);
+
+	/* Each master has its own cached team, and frees its barrier blade upon exit */
+	printf("test4: check barriers of teams of 2 masters running concurrently\n");
+	for (i = 0; i < 2; i++) {
+		masters[i].cpus = &cpus[i * (num_pe / 2)];
+		masters[i].num_threads = num_pe / 2;
+		masters[i].loop = loop;
+		ret = pthread_create(&masters[i].thread, NULL, master, &masters[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	for (i = 0; i < 2; i++) {
+		ret = pthread_join(masters[i].thread, NULL);
+		ASSERT_SUCCESS(ret);
+	}
+	ASSERT(atomic_load(&errors) == 0);
+
+	return 0;
+}
@@ -0,0 +1,240 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check the blade pool reuses a bb across fhwb_fini()/fhwb_init() with the same
+ * PEs and frees idle blades upon -EBUSY and when it is disabled
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_THREADS 2
+
+static int _bd;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid;
+	int ret;
+};
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int window;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	window = fhwb_assign(_bd, -1);
+	if (window < 0) {
+		info->ret = window;
+		pthread_exit(NULL);
+	}
+	for (i = 0; i < 10; i++)
+		fhwb_sync(window);
+
+	info->ret = fhwb_unassign(_bd);
+	pthread_exit(NULL);
+}
+
+/* Synchronize on @_bd by threads on @cpus */
+static void run_threads(int *cpus)
+{
+	struct thread_info th_info[NUM_THREADS] = {0};
+	int ret;
+	int i;
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		th_info[i].cpuid = cpus[i];
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	struct fhwb_pool_stats stats;
+	struct hwb_hwinfo hwinfo;
+	cpu_set_t cmg_set;
+	cpu_set_t set;
+	cpu_set_t pair;
+	int cpus[CPU_SETSIZE];
+	int bds[CPU_SETSIZE];
+	int use_driver;
+	int num_pe;
+	int loop;
+	int cmg;
+	int cpu;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	loop = atoi(argv[2]);
+
+	ret = get_hwb_hwinfo(&hwinfo);
+	ASSERT_SUCCESS(ret);
+	/* sw backend does not use the driver */
+	use_driver = strcmp(fhwb_get_backend_name(), "sw") != 0;
+
+	ret = fill_cpumask_for_cmg(cmg, &cmg_set);
+	ASSERT_SUCCESS(ret);
+	num_pe = CPU_COUNT(&cmg_set);
+	if (num_pe < hwinfo.num_bb + 2) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+	cpu = -1;
+	for (i = 0; i < num_pe; i++) {
+		cpu = get_next_cpu(&cmg_set, cpu);
+		cpus[i] = cpu;
+	}
+	CPU_ZERO(&set);
+	for (i = 0; i < NUM_THREADS; i++)
+		CPU_SET(cpus[i], &set);
+
+	printf("test1: check invalid arguments (%s backend)\n", fhwb_get_backend_name());
+	ret = fhwb_pool_set_size(-1);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_pool_get_stats(NULL);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_pool_get_stats(&stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.hits == 0 && stats.misses == 0 && stats.idle == 0);
+
+	printf("test2: check bb is reused %d times\n", loop);
+	ret = fhwb_pool_set_size(hwinfo.num_bb);
+	ASSERT_SUCCESS(ret);
+	for (i = 0; i < loop; i++) {
+		ret = fhwb_init(sizeof(cpu_set_t), &set);
+		ASSERT_VALID_BD(ret);
+		if (i > 0)
+			ASSERT(ret == _bd);
+		_bd = ret;
+
+		run_threads(cpus);
+
+		ret = fhwb_fini(_bd);
+		ASSERT_SUCCESS(ret);
+		/* idle bb stays allocated */
+		if (use_driver)
+			ASSERT(check_sysfs_status() != 0);
+	}
+	ret = fhwb_pool_get_stats(&stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.misses == 1);
+	ASSERT(stats.hits == (uint64_t)loop - 1);
+	ASSERT(stats.idle == 1);
+
+	printf("test3: check idle bb cannot be used\n");
+	ret = fhwb_fini(_bd);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_assign(_bd, -1);
+	ASSERT(ret == -EINVAL);
+
+	printf("test4: check bb with assigned window is freed by fhwb_fini\n");
+	ret = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT(ret == _bd);
+	CPU_ZERO(&pair);
+	CPU_SET(cpus[0], &pair);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &pair);
+	ASSERT_SUCCESS(ret);
+	ret = fhwb_assign(_bd, -1);
+	ASSERT_VALID_BW(ret);
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+	ret = fhwb_pool_get_stats(&stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.idle == 0);
+	if (use_driver)
+		ASSERT_SUCCESS(check_sysfs_status());
+
+	printf("test5: check idle bb is freed when all bb of CMG are used\n");
+	/* Fill the pool with bbs of different PEs */
+	for (i = 0; i < hwinfo.num_bb; i++) {
+		CPU_ZERO(&pair);
+		CPU_SET(cpus[0], &pair);
+		CPU_SET(cpus[i + 1], &pair);
+		bds[i] = fhwb_init(sizeof(cpu_set_t), &pair);
+		ASSERT_VALID_BD(bds[i]);
+	}
+	for (i = 0; i < hwinfo.num_bb; i++) {
+		ret = fhwb_fini(bds[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	ret = fhwb_pool_get_stats(&stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.idle == hwinfo.num_bb);
+	ASSERT(stats.evictions == 0);
+
+	CPU_ZERO(&pair);
+	CPU_SET(cpus[0], &pair);
+	CPU_SET(cpus[hwinfo.num_bb + 1], &pair);
+	_bd = fhwb_init(sizeof(cpu_set_t), &pair);
+	ASSERT_VALID_BD(_bd);
+	ret = fhwb_pool_get_stats(&stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.evictions == 1);
+	ASSERT(stats.idle == hwinfo.num_bb - 1);
+	run_threads((int[]){cpus[0], cpus[hwinfo.num_bb + 1]});
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+
+	printf("test6: check disabling the pool frees idle bbs\n");
+	ret = fhwb_pool_set_size(1);
+	ASSERT_SUCCESS(ret);
+	ret = fhwb_pool_get_stats(&stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.idle == 1);
+	ret = fhwb_pool_set_size(0);
+	ASSERT_SUCCESS(ret);
+	ret = fhwb_pool_get_stats(&stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.idle == 0);
+	ASSERT(stats.evictions == (uint64_t)hwinfo.num_bb + 1);
+	if (use_driver)
+		ASSERT_SUCCESS(check_sysfs_status());
+
+	/* Disabled pool does not keep bb */
+	_bd = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(_bd);
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+	ret = fhwb_pool_get_stats(&stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.idle == 0);
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
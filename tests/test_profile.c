@@ -0,0 +1,173 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check arrival profile reports the PE which arrives late
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define NUM_THREADS 3
+#define DEPTH 16
+/* Straggler sleeps before even episodes */
+#define DELAY_NS (5 * 1000 * 1000)
+
+static int _bd;
+static int _loop;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid;
+	int straggler;
+	int ret;
+};
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	struct timespec delay = {0, DELAY_NS};
+	cpu_set_t set;
+	int window;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	window = fhwb_assign(_bd, -1);
+	if (window < 0) {
+		info->ret = window;
+		pthread_exit(NULL);
+	}
+
+	for (i = 0; i < _loop; i++) {
+		if (info->straggler && i % 2 == 0)
+			nanosleep(&delay, NULL);
+		fhwb_sync(window);
+	}
+
+	info->ret = fhwb_unassign(_bd);
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info th_info[NUM_THREADS] = {0};
+	struct fhwb_profile_report *report;
+	cpu_set_t cmg_set;
+	cpu_set_t set;
+	int straggler_cpu = -1;
+	int delayed = 0;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = fill_cpumask_for_cmg(cmg, &cmg_set);
+	ASSERT_SUCCESS(ret);
+	if (CPU_COUNT(&cmg_set) < NUM_THREADS) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	CPU_ZERO(&set);
+	cpu = -1;
+	for (i = 0; i < NUM_THREADS; i++) {
+		cpu = get_next_cpu(&cmg_set, cpu);
+		CPU_SET(cpu, &set);
+		th_info[i].cpuid = cpu;
+	}
+	th_info[1].straggler = 1;
+	straggler_cpu = th_info[1].cpuid;
+
+	ret = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(ret);
+	_bd = ret;
+
+	printf("test1: check fhwb_profile_start/get_report with invalid arguments (%s backend)\n",
+			fhwb_get_backend_name());
+	ret = fhwb_profile_get_report(_bd, &report);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_profile_start(_bd, 0);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_profile_start(-1, DEPTH);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_profile_start(_bd, DEPTH);
+	ASSERT_SUCCESS(ret);
+	ret = fhwb_profile_start(_bd, DEPTH);
+	ASSERT(ret == -EBUSY);
+	ret = fhwb_profile_get_report(_bd, NULL);
+	ASSERT(ret == -EINVAL);
+
+	printf("test2: check cpu %d is reported as the last PE\n", straggler_cpu);
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+
+	ret = fhwb_profile_get_report(_bd, &report);
+	ASSERT_SUCCESS(ret);
+	ASSERT(report->num_pe == NUM_THREADS);
+	ASSERT(report->num_episodes == (_loop < DEPTH ? _loop : DEPTH));
+
+	for (i = 0; i < report->num_episodes; i++) {
+		struct fhwb_profile_episode *ep = &report->episodes[i];
+
+		ASSERT(ep->seq == (uint64_t)(_loop - report->num_episodes + i));
+		if (ep->seq % 2)
+			continue;
+		ASSERT(ep->last_cpu == straggler_cpu);
+		ASSERT(ep->skew_ns >= DELAY_NS / 2);
+		delayed++;
+	}
+
+	for (i = 0; i < report->num_pe; i++) {
+		struct fhwb_profile_pe *pe = &report->pes[i];
+
+		ASSERT(pe->cpu == th_info[i].cpuid);
+		ASSERT(pe->episodes == (uint64_t)_loop);
+		if (pe->cpu == straggler_cpu) {
+			ASSERT(pe->last_count >= (uint64_t)delayed);
+			ASSERT(pe->late_ns >= (uint64_t)delayed * DELAY_NS / 2);
+		} else {
+			/* Others wait for the straggler */
+			ASSERT(pe->wait_ns >= (uint64_t)delayed * DELAY_NS / 2);
+		}
+	}
+	free(report);
+
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
@@ -0,0 +1,262 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check pthread_barrier_t of libFJhwb-pthread.so synchronizes threads with or
+ * without hardware barrier (linked before libc instead of LD_PRELOAD)
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static pthread_barrier_t _barrier;
+/* Barriers destroyed by the serial thread (one per loop) */
+static pthread_barrier_t *_barriers;
+/* Thread which arrives late so that others sleep in the wait */
+static struct thread_info *_late;
+static int _loop;
+static int _num_threads;
+static atomic_int arrived;
+static atomic_int serials;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid; /* -1: not bound */
+	int ret;
+};
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int ret;
+	int i;
+
+	if (info->cpuid >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(info->cpuid, &set);
+		ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+		if (ret) {
+			perror("sched_setaffinity\n");
+			info->ret = ret;
+			pthread_exit(NULL);
+		}
+	}
+
+	for (i = 0; i < _loop; i++) {
+		atomic_fetch_add(&arrived, 1);
+		ret = pthread_barrier_wait(&_barrier);
+		if (ret == PTHREAD_BARRIER_SERIAL_THREAD)
+			atomic_fetch_add(&serials, 1);
+		else if (ret != 0)
+			info->ret = ret;
+
+		/* all threads have arrived, and nobody arrives next round before second wait */
+		if (atomic_load(&arrived) != (i + 1) * _num_threads) {
+			fprintf(stderr, "thread on cpu %d left barrier early at %d: %d\n",
+					info->cpuid, i, atomic_load(&arrived));
+			info->ret = -1;
+			break;
+		}
+		pthread_barrier_wait(&_barrier);
+	}
+
+	pthread_exit(NULL);
+}
+
+/* Wait twice on each barrier of _barriers and let the serial thread destroy it */
+static void *destroy_worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int ret;
+	int i;
+
+	if (info->cpuid >= 0) {
+		CPU_ZERO(&set);
+		CPU_SET(info->cpuid, &set);
+		ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+		if (ret) {
+			perror("sched_setaffinity\n");
+			info->ret = ret;
+			pthread_exit(NULL);
+		}
+	}
+
+	for (i = 0; i < _loop; i++) {
+		/* The second wait is on hardware if the first one has allocated a blade */
+		pthread_barrier_wait(&_barriers[i]);
+		if (info == _late)
+			usleep(1000);
+		ret = pthread_barrier_wait(&_barriers[i]);
+		if (ret == PTHREAD_BARRIER_SERIAL_THREAD) {
+			atomic_fetch_add(&serials, 1);
+			ret = pthread_barrier_destroy(&_barriers[i]);
+		}
+		if (ret != 0)
+			info->ret = ret;
+	}
+
+	pthread_exit(NULL);
+}
+
+/* Run @num_threads threads bound to @cpus (NULL: not bound) and check the barrier */
+static void run_threads(int *cpus, int num_threads, int use_driver)
+{
+	struct thread_info *th_info;
+	int ret;
+	int i;
+
+	_num_threads = num_threads;
+	atomic_store(&arrived, 0);
+	atomic_store(&serials, 0);
+
+	ret = pthread_barrier_init(&_barrier, NULL, num_threads);
+	ASSERT_SUCCESS(ret);
+
+	th_info = calloc(num_threads, sizeof(struct thread_info));
+	ASSERT(th_info != NULL);
+	for (i = 0; i < num_threads; i++) {
+		th_info[i].cpuid = cpus ? cpus[i] : -1;
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	for (i = 0; i < num_threads; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+	free(th_info);
+
+	/* exactly one thread gets PTHREAD_BARRIER_SERIAL_THREAD in each round */
+	ASSERT(atomic_load(&serials) == _loop);
+
+	/* barrier blade is allocated only for bound threads (sw backend does not use the driver) */
+	if (use_driver)
+		ASSERT((check_sysfs_status() != 0) == (cpus != NULL));
+
+	ret = pthread_barrier_destroy(&_barrier);
+	ASSERT_SUCCESS(ret);
+	if (use_driver)
+		ASSERT_SUCCESS(check_sysfs_status());
+}
+
+/* Run @num_threads threads bound to @cpus (NULL: not bound) which destroy barriers by the serial thread */
+static void run_destroy_threads(int *cpus, int num_threads, int use_driver)
+{
+	struct thread_info *th_info;
+	int ret;
+	int i;
+
+	atomic_store(&serials, 0);
+
+	_barriers = calloc(_loop, sizeof(pthread_barrier_t));
+	ASSERT(_barriers != NULL);
+	for (i = 0; i < _loop; i++) {
+		ret = pthread_barrier_init(&_barriers[i], NULL, num_threads);
+		ASSERT_SUCCESS(ret);
+	}
+
+	th_info = calloc(num_threads, sizeof(struct thread_info));
+	ASSERT(th_info != NULL);
+	_late = &th_info[0];
+	for (i = 0; i < num_threads; i++) {
+		th_info[i].cpuid = cpus ? cpus[i] : -1;
+		ret = pthread_create(&th_info[i].thread_id, NULL, &destroy_worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	for (i = 0; i < num_threads; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+	free(th_info);
+	free(_barriers);
+
+	ASSERT(atomic_load(&serials) == _loop);
+	if (use_driver)
+		ASSERT_SUCCESS(check_sysfs_status());
+}
+
+int main(int argc, char *argv[])
+{
+	struct hwb_hwinfo hwinfo;
+	pthread_barrierattr_t attr;
+	int cpus[CPU_SETSIZE];
+	int use_driver;
+	cpu_set_t set;
+	int num_pe;
+	int cmg;
+	int cpu;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = get_hwb_hwinfo(&hwinfo);
+	ASSERT_SUCCESS(ret);
+	use_driver = strcmp(fhwb_get_backend_name(), "sw") != 0;
+
+	ret = fill_cpumask_for_cmg(cmg, &set);
+	ASSERT_SUCCESS(ret);
+	num_pe = CPU_COUNT(&set);
+	cpu = -1;
+	for (i = 0; i < num_pe; i++) {
+		cpu = get_next_cpu(&set, cpu);
+		cpus[i] = cpu;
+	}
+
+	printf("test1: check invalid count and count 1 (%s backend)\n", fhwb_get_backend_name());
+	ret = pthread_barrier_init(&_barrier, NULL, 0);
+	ASSERT(ret == EINVAL);
+	ret = pthread_barrier_init(&_barrier, NULL, 1);
+	ASSERT_SUCCESS(ret);
+	for (i = 0; i < 3; i++)
+		ASSERT(pthread_barrier_wait(&_barrier) == PTHREAD_BARRIER_SERIAL_THREAD);
+	ret = pthread_barrier_destroy(&_barrier);
+	ASSERT_SUCCESS(ret);
+
+	printf("test2: check barrier of %d threads bound to CMG %d\n", num_pe, cmg);
+	run_threads(cpus, num_pe, use_driver);
+
+	printf("test3: check barrier of 3 threads not bound\n");
+	run_threads(NULL, 3, use_driver);
+
+	printf("test4: check serial thread can destroy barrier of %d threads bound to CMG %d\n", num_pe, cmg);
+	run_destroy_threads(cpus, num_pe, use_driver);
+
+	printf("test5: check serial thread can destroy barrier of 3 threads not bound\n");
+	run_destroy_threads(NULL, 3, use_driver);
+
+	printf("test6: check process-shared barrier\n");
+	ret = pthread_barrierattr_init(&attr);
+	ASSERT_SUCCESS(ret);
+	ret = pthread_barrierattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	ASSERT_SUCCESS(ret);
+	ret = pthread_barrier_init(&_barrier, &attr, 1);
+	ASSERT_SUCCESS(ret);
+	ASSERT(pthread_barrier_wait(&_barrier) == PTHREAD_BARRIER_SERIAL_THREAD);
+	ret = pthread_barrier_destroy(&_barrier);
+	ASSERT_SUCCESS(ret);
+	pthread_barrierattr_destroy(&attr);
+
+	return 0;
+}
@@ -0,0 +1,193 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check fhwb_remask() hands over a bb from PEs {0, 1, 2} to PEs {0, 1, 3}
+ * of a CMG while PE 0 and 1 keep their windows
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define NUM_THREADS 4
+#define LEAVING 2
+#define JOINING 3
+
+static pthread_barrier_t _barrier;
+static int64_t _sums[2];
+static int _loop;
+static int _bd;
+
+struct thread_info {
+	pthread_t thread_id;
+	int index;
+	int cpuid;
+	int ret;
+};
+
+/* Check all PEs of the team take part in each synchronization */
+static int check_team(int window, int64_t expected)
+{
+	int64_t in, out;
+	int ret;
+	int i;
+
+	for (i = 0; i < _loop; i++) {
+		in = sched_getcpu();
+		ret = fhwb_allreduce(window, FHWB_OP_SUM, FHWB_TYPE_INT64, &in, &out, 1);
+		if (ret)
+			return ret;
+		if (out != expected) {
+			fprintf(stderr, "sum of cpuid is %ld (expected: %ld)\n", (long)out, (long)expected);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int window = -1;
+	int ret;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+	}
+
+	/* 1. synchronize with PEs given to fhwb_init() */
+	if (info->ret == 0 && info->index != JOINING) {
+		window = fhwb_assign(_bd, -1);
+		info->ret = window < 0 ? window : check_team(window, _sums[0]);
+	}
+	pthread_barrier_wait(&_barrier);
+
+	/* 2. the leaving PE unassigns after fhwb_remask() fails with -EBUSY */
+	pthread_barrier_wait(&_barrier);
+	if (info->ret == 0 && info->index == LEAVING)
+		info->ret = fhwb_unassign(_bd);
+	pthread_barrier_wait(&_barrier);
+
+	/* 3. the joining PE assigns after fhwb_remask() */
+	pthread_barrier_wait(&_barrier);
+	if (info->ret == 0 && info->index == JOINING)
+		window = fhwb_assign(_bd, -1);
+	if (info->ret == 0 && info->index != LEAVING) {
+		info->ret = window < 0 ? window : check_team(window, _sums[1]);
+		if (info->ret == 0)
+			info->ret = fhwb_unassign(_bd);
+	}
+
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info th_info[NUM_THREADS] = {0};
+	struct hwb_hwinfo hwinfo;
+	cpu_set_t other_set;
+	cpu_set_t cmg_set;
+	cpu_set_t set;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = get_hwb_hwinfo(&hwinfo);
+	ASSERT_SUCCESS(ret);
+	ret = fill_cpumask_for_cmg(cmg, &cmg_set);
+	ASSERT_SUCCESS(ret);
+	if (CPU_COUNT(&cmg_set) < NUM_THREADS) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	cpu = -1;
+	for (i = 0; i < NUM_THREADS; i++) {
+		cpu = get_next_cpu(&cmg_set, cpu);
+		th_info[i].index = i;
+		th_info[i].cpuid = cpu;
+	}
+	_sums[0] = th_info[0].cpuid + th_info[1].cpuid + th_info[LEAVING].cpuid;
+	_sums[1] = th_info[0].cpuid + th_info[1].cpuid + th_info[JOINING].cpuid;
+
+	CPU_ZERO(&set);
+	for (i = 0; i < NUM_THREADS; i++)
+		if (i != JOINING)
+			CPU_SET(th_info[i].cpuid, &set);
+	_bd = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(_bd);
+
+	printf("test1: check invalid arguments (%s backend)\n", fhwb_get_backend_name());
+	ret = fhwb_remask(_bd, sizeof(cpu_set_t), NULL);
+	ASSERT(ret == -EINVAL);
+	CPU_ZERO(&other_set);
+	CPU_SET(th_info[0].cpuid, &other_set);
+	ret = fhwb_remask(_bd, sizeof(cpu_set_t), &other_set);
+	ASSERT(ret == -EINVAL);
+	if (fill_cpumask_for_cmg(cmg + 1, &other_set) == 0 && CPU_COUNT(&other_set) >= 2) {
+		ret = fhwb_remask(_bd, sizeof(cpu_set_t), &other_set);
+		ASSERT(ret == -EINVAL);
+	}
+
+	printf("test2: check PEs are changed without reassigning remaining PEs\n");
+	ret = pthread_barrier_init(&_barrier, NULL, NUM_THREADS + 1);
+	ASSERT_SUCCESS(ret);
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+
+	CPU_CLR(th_info[LEAVING].cpuid, &set);
+	CPU_SET(th_info[JOINING].cpuid, &set);
+	pthread_barrier_wait(&_barrier);
+	ret = fhwb_remask(_bd, sizeof(cpu_set_t), &set);
+	ASSERT(ret == -EBUSY);
+	pthread_barrier_wait(&_barrier);
+	pthread_barrier_wait(&_barrier);
+	ret = fhwb_remask(_bd, sizeof(cpu_set_t), &set);
+	ASSERT_SUCCESS(ret);
+	pthread_barrier_wait(&_barrier);
+
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+	pthread_barrier_destroy(&_barrier);
+
+	printf("test3: check PEs cannot be changed after fhwb_fini()\n");
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+	ret = fhwb_remask(_bd, sizeof(cpu_set_t), &set);
+	ASSERT(ret == -EINVAL);
+
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
@@ -0,0 +1,171 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check split-phase synchronization by fhwb_arrive()/fhwb_test()/fhwb_wait()
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int _bd;
+static int _loop;
+static int _num_threads;
+static atomic_int arrived;
+static atomic_int tested;
+
+struct thread_info {
+	pthread_t thread_id;
+	int index;
+	int cpuid;
+	int ret;
+};
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int window;
+	int token;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	window = fhwb_assign(_bd, -1);
+	if (window < 0) {
+		info->ret = window;
+		pthread_exit(NULL);
+	}
+
+	for (i = 0; i < _loop; i++) {
+		/* the last PE arrives at first phase after the first PE checks it is not completed */
+		if (i == 0 && info->index == _num_threads - 1)
+			while (!atomic_load(&tested))
+				sched_yield();
+
+		atomic_fetch_add(&arrived, 1);
+		token = fhwb_arrive(window);
+		if (token != 0 && token != 1) {
+			fprintf(stderr, "cpu %d: fhwb_arrive returns %d\n", info->cpuid, token);
+			info->ret = -1;
+			break;
+		}
+
+		if (i == 0 && info->index == 0) {
+			ret = fhwb_test(window, token);
+			if (ret != 0) {
+				fprintf(stderr, "cpu %d: sync completed before all PEs arrive: %d\n",
+						info->cpuid, ret);
+				info->ret = -1;
+				atomic_store(&tested, 1);
+				break;
+			}
+			atomic_store(&tested, 1);
+		}
+
+		/* emulate overlapped computation */
+		while ((ret = fhwb_test(window, token)) == 0)
+			sched_yield();
+		if (ret != 1 || fhwb_wait(window, token) != 0) {
+			fprintf(stderr, "cpu %d: fhwb_test/fhwb_wait failed at %d\n", info->cpuid, i);
+			info->ret = -1;
+			break;
+		}
+
+		/* all PEs have arrived, and nobody arrives next phase before fhwb_sync */
+		if (atomic_load(&arrived) != (i + 1) * _num_threads) {
+			fprintf(stderr, "cpu %d left sync early at %d: %d\n",
+					info->cpuid, i, atomic_load(&arrived));
+			info->ret = -1;
+			break;
+		}
+		fhwb_sync(window);
+	}
+
+	ret = fhwb_unassign(_bd);
+	if (!info->ret)
+		info->ret = ret;
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info *th_info;
+	cpu_set_t set;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = fill_cpumask_for_cmg(cmg, &set);
+	ASSERT_SUCCESS(ret);
+	_num_threads = CPU_COUNT(&set);
+
+	printf("test1: check invalid window/token (%s backend)\n", fhwb_get_backend_name());
+	ret = fhwb_arrive(-1);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_test(0, 2);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_wait(0, -1);
+	ASSERT(ret == -EINVAL);
+
+	printf("test2: check split-phase sync by %d PEs of CMG %d\n", _num_threads, cmg);
+	if (_num_threads < 2) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	th_info = calloc(_num_threads, sizeof(struct thread_info));
+	ASSERT(th_info != NULL);
+
+	ret = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(ret);
+	_bd = ret;
+
+	cpu = -1;
+	for (i = 0; i < _num_threads; i++) {
+		cpu = get_next_cpu(&set, cpu);
+		th_info[i].index = i;
+		th_info[i].cpuid = cpu;
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+
+	for (i = 0; i < _num_threads; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+	free(th_info);
+
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
@@ -0,0 +1,156 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check fhwb_get_stats() counts synchronizations and window assignment
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define NUM_THREADS 2
+#define DELAY_NS (1000 * 1000)
+
+static int _bd;
+static int _loop;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid;
+	int straggler;
+	int ret;
+};
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	struct timespec delay = {0, DELAY_NS};
+	cpu_set_t set;
+	int window;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	window = fhwb_assign(_bd, -1);
+	if (window < 0) {
+		info->ret = window;
+		pthread_exit(NULL);
+	}
+
+	/* The other PE waits at least DELAY_NS in the first sync */
+	if (info->straggler)
+		nanosleep(&delay, NULL);
+	for (i = 0; i < _loop; i++)
+		fhwb_sync(window);
+
+	info->ret = fhwb_unassign(_bd);
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info th_info[NUM_THREADS] = {0};
+	struct fhwb_stats stats;
+	cpu_set_t cmg_set;
+	cpu_set_t set;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = fill_cpumask_for_cmg(cmg, &cmg_set);
+	ASSERT_SUCCESS(ret);
+	if (CPU_COUNT(&cmg_set) < NUM_THREADS) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	CPU_ZERO(&set);
+	cpu = -1;
+	for (i = 0; i < NUM_THREADS; i++) {
+		cpu = get_next_cpu(&cmg_set, cpu);
+		CPU_SET(cpu, &set);
+		th_info[i].cpuid = cpu;
+	}
+	th_info[1].straggler = 1;
+
+	ret = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(ret);
+	_bd = ret;
+
+	printf("test1: check fhwb_get_stats with invalid arguments (%s backend)\n",
+			fhwb_get_backend_name());
+	ret = fhwb_get_stats(_bd, &stats);
+	if (ret == -EOPNOTSUPP) {
+		printf("library is built without statistics\n");
+		fhwb_fini(_bd);
+		return 77;
+	}
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.syncs == 0 && stats.assigns == 0);
+	ret = fhwb_get_stats(-1, &stats);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_get_stats(_bd, NULL);
+	ASSERT(ret == -EINVAL);
+
+	printf("test2: check counters after %d syncs by %d PEs\n", _loop, NUM_THREADS);
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+	for (i = 0; i < NUM_THREADS; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+
+	ret = fhwb_get_stats(_bd, &stats);
+	ASSERT_SUCCESS(ret);
+	ASSERT(stats.syncs == (uint64_t)_loop * NUM_THREADS);
+	ASSERT(stats.assigns == NUM_THREADS);
+	ASSERT(stats.unassigns == NUM_THREADS);
+	ASSERT(stats.max_wait_ns >= DELAY_NS / 2);
+	ASSERT(stats.wait_ns >= stats.max_wait_ns);
+	ASSERT(stats.ioctl_errors == 0);
+
+	printf("test3: check failed ioctl is counted\n");
+	ret = fhwb_unassign(_bd);
+	ASSERT_FAIL(ret);
+	ret = fhwb_get_stats(_bd, &stats);
+	ASSERT_SUCCESS(ret);
+	/* Software backend does not use the driver */
+	ASSERT(stats.ioctl_errors == (strcmp(fhwb_get_backend_name(), "sw") ? 1 : 0));
+	ASSERT(stats.unassigns == NUM_THREADS);
+
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
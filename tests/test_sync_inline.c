@@ -0,0 +1,145 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check inline sync functions (fhwb_sync_w0..w3) on all windows
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define NUM_WINDOW (FHWB_WINDOW_3 + 1)
+
+static int _bd[NUM_WINDOW];
+static int _loop;
+static int _num_threads;
+static atomic_int arrived;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid;
+	int ret;
+};
+
+/* Arrive before sync of @window, and after the sync check all PEs have arrived */
+#define SYNC_AND_CHECK(info, count, sync) do { \
+	atomic_fetch_add(&arrived, 1); \
+	sync; \
+	(count)++; \
+	if (atomic_load(&arrived) != (count) * _num_threads) { \
+		fprintf(stderr, "cpu %d left %s early at %d: %d\n", \
+				(info)->cpuid, #sync, (count), atomic_load(&arrived)); \
+		(info)->ret = -1; \
+	} \
+	fhwb_sync(FHWB_WINDOW_0); \
+} while (0)
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int count = 0;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	for (i = 0; i < NUM_WINDOW; i++) {
+		ret = fhwb_assign(_bd[i], i);
+		if (ret != i) {
+			fprintf(stderr, "cpu %d: fhwb_assign to window %d returns %d\n", info->cpuid, i, ret);
+			info->ret = -1;
+			pthread_exit(NULL);
+		}
+	}
+
+	for (i = 0; i < _loop && !info->ret; i++) {
+		SYNC_AND_CHECK(info, count, fhwb_sync_w0());
+		SYNC_AND_CHECK(info, count, fhwb_sync_w1());
+		SYNC_AND_CHECK(info, count, fhwb_sync_w2());
+		SYNC_AND_CHECK(info, count, fhwb_sync_w3());
+	}
+
+	for (i = 0; i < NUM_WINDOW; i++) {
+		ret = fhwb_unassign(_bd[i]);
+		if (!info->ret)
+			info->ret = ret;
+	}
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info *th_info;
+	cpu_set_t set;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = fill_cpumask_for_cmg(cmg, &set);
+	ASSERT_SUCCESS(ret);
+	_num_threads = CPU_COUNT(&set);
+
+	printf("test1: check fhwb_sync_w0..w3 by %d PEs of CMG %d (%s backend)\n",
+			_num_threads, cmg, fhwb_get_backend_name());
+	if (_num_threads < 2) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	th_info = calloc(_num_threads, sizeof(struct thread_info));
+	ASSERT(th_info != NULL);
+
+	for (i = 0; i < NUM_WINDOW; i++) {
+		ret = fhwb_init(sizeof(cpu_set_t), &set);
+		ASSERT_VALID_BD(ret);
+		_bd[i] = ret;
+	}
+
+	cpu = -1;
+	for (i = 0; i < _num_threads; i++) {
+		cpu = get_next_cpu(&set, cpu);
+		th_info[i].cpuid = cpu;
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+
+	for (i = 0; i < _num_threads; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+	free(th_info);
+
+	for (i = 0; i < NUM_WINDOW; i++) {
+		ret = fhwb_fini(_bd[i]);
+		ASSERT_SUCCESS(ret);
+	}
+
+	return 0;
+}
@@ -0,0 +1,128 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check no PE leaves fhwb_sync() before all PEs in a CMG arrive
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static int _bd;
+static int _loop;
+static int _num_threads;
+static atomic_int arrived;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid;
+	int ret;
+};
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int window;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	window = fhwb_assign(_bd, -1);
+	if (window < 0) {
+		info->ret = window;
+		pthread_exit(NULL);
+	}
+
+	for (i = 0; i < _loop; i++) {
+		atomic_fetch_add(&arrived, 1);
+		fhwb_sync(window);
+
+		/* all PEs have arrived, and nobody arrives next phase before second sync */
+		if (atomic_load(&arrived) != (i + 1) * _num_threads) {
+			fprintf(stderr, "cpu %d left sync early at %d: %d\n",
+					info->cpuid, i, atomic_load(&arrived));
+			info->ret = -1;
+			break;
+		}
+		fhwb_sync(window);
+	}
+
+	ret = fhwb_unassign(_bd);
+	if (!info->ret)
+		info->ret = ret;
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info *th_info;
+	cpu_set_t set;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = fill_cpumask_for_cmg(cmg, &set);
+	ASSERT_SUCCESS(ret);
+	_num_threads = CPU_COUNT(&set);
+
+	printf("test1: check sync by %d PEs of CMG %d (%s backend)\n",
+			_num_threads, cmg, fhwb_get_backend_name());
+	if (_num_threads < 2) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	th_info = calloc(_num_threads, sizeof(struct thread_info));
+	ASSERT(th_info != NULL);
+
+	ret = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(ret);
+	_bd = ret;
+
+	cpu = -1;
+	for (i = 0; i < _num_threads; i++) {
+		cpu = get_next_cpu(&set, cpu);
+		th_info[i].cpuid = cpu;
+		ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+		ASSERT_SUCCESS(ret);
+	}
+
+	for (i = 0; i < _num_threads; i++) {
+		ret = pthread_join(th_info[i].thread_id, NULL);
+		ASSERT_SUCCESS(ret);
+		ASSERT_SUCCESS(th_info[i].ret);
+	}
+	free(th_info);
+
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
@@ -0,0 +1,139 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check C++ inline sync function (fhwb_sync_w<W>) on all windows
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#include <fujitsu_hwb.h>
+extern "C" {
+#include "util.h"
+}
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <thread>
+#include <vector>
+
+#define NUM_WINDOW (FHWB_WINDOW_3 + 1)
+
+static int _bd[NUM_WINDOW];
+static int _loop;
+static int _num_threads;
+static std::atomic<int> arrived(0);
+
+/* Sync @W and check all PEs have arrived. Return false if some PE has not */
+template <int W>
+static bool sync_and_check(int cpuid, int &count)
+{
+	bool ok;
+
+	arrived++;
+	fhwb_sync_w<W>();
+	count++;
+	ok = (arrived.load() == count * _num_threads);
+	if (!ok)
+		fprintf(stderr, "cpu %d left window %d early at %d: %d\n", cpuid, W, count, arrived.load());
+	fhwb_sync_w<FHWB_WINDOW_0>();
+
+	return ok;
+}
+
+static void worker(int cpuid, int *result)
+{
+	cpu_set_t set;
+	int count = 0;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		*result = ret;
+		return;
+	}
+
+	for (i = 0; i < NUM_WINDOW; i++) {
+		ret = fhwb_assign(_bd[i], i);
+		if (ret != i) {
+			fprintf(stderr, "cpu %d: fhwb_assign to window %d returns %d\n", cpuid, i, ret);
+			*result = -1;
+			return;
+		}
+	}
+
+	for (i = 0; i < _loop; i++) {
+		if (!sync_and_check<FHWB_WINDOW_0>(cpuid, count) ||
+		    !sync_and_check<FHWB_WINDOW_1>(cpuid, count) ||
+		    !sync_and_check<FHWB_WINDOW_2>(cpuid, count) ||
+		    !sync_and_check<FHWB_WINDOW_3>(cpuid, count)) {
+			*result = -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < NUM_WINDOW; i++) {
+		ret = fhwb_unassign(_bd[i]);
+		if (!*result)
+			*result = ret;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	std::vector<std::thread> threads;
+	std::vector<int> results;
+	cpu_set_t set;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = fill_cpumask_for_cmg(cmg, &set);
+	ASSERT_SUCCESS(ret);
+	_num_threads = CPU_COUNT(&set);
+
+	printf("test1: check fhwb_sync_w<W> by %d PEs of CMG %d (%s backend)\n",
+			_num_threads, cmg, fhwb_get_backend_name());
+	if (_num_threads < 2) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	for (i = 0; i < NUM_WINDOW; i++) {
+		ret = fhwb_init(sizeof(cpu_set_t), &set);
+		ASSERT_VALID_BD(ret);
+		_bd[i] = ret;
+	}
+
+	results.resize(_num_threads, 0);
+	cpu = -1;
+	for (i = 0; i < _num_threads; i++) {
+		cpu = get_next_cpu(&set, cpu);
+		threads.emplace_back(worker, cpu, &results[i]);
+	}
+
+	for (i = 0; i < _num_threads; i++) {
+		threads[i].join();
+		ASSERT_SUCCESS(results[i]);
+	}
+
+	for (i = 0; i < NUM_WINDOW; i++) {
+		ret = fhwb_fini(_bd[i]);
+		ASSERT_SUCCESS(ret);
+	}
+
+	return 0;
+}
@@ -0,0 +1,191 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check fhwb_sync_timeout() returns -ETIMEDOUT when a PE does not arrive,
+ * and waiting again by fhwb_sync_timeout() or fhwb_sync() completes the same
+ * synchronization, so that following synchronizations are not passed through
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SHORT_TIMEOUT_NS (10 * 1000 * 1000ULL)
+#define LONG_TIMEOUT_NS  (60 * 1000 * 1000 * 1000ULL)
+
+static int _bd;
+static int _loop;
+/* Complete the timed out synchronization by fhwb_sync() instead of fhwb_sync_timeout() */
+static int _finish_by_sync;
+static atomic_int arrived;
+static atomic_int straggler_go;
+
+struct thread_info {
+	pthread_t thread_id;
+	int cpuid;
+	int straggler;
+	int ret;
+};
+
+static void *worker(void *arg)
+{
+	struct thread_info *info = (struct thread_info *)arg;
+	cpu_set_t set;
+	int window;
+	int ret;
+	int i;
+
+	CPU_ZERO(&set);
+	CPU_SET(info->cpuid, &set);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &set);
+	if (ret) {
+		perror("sched_setaffinity\n");
+		info->ret = ret;
+		pthread_exit(NULL);
+	}
+
+	window = fhwb_assign(_bd, -1);
+	if (window < 0) {
+		info->ret = window;
+		pthread_exit(NULL);
+	}
+
+	if (info->straggler) {
+		/* arrive only after the other PE has timed out */
+		while (!atomic_load(&straggler_go))
+			sched_yield();
+		fhwb_sync(window);
+	} else {
+		ret = fhwb_sync_timeout(window, SHORT_TIMEOUT_NS);
+		if (ret != -ETIMEDOUT) {
+			fprintf(stderr, "cpu %d: sync without straggler returns %d\n", info->cpuid, ret);
+			info->ret = -1;
+			goto out;
+		}
+
+		atomic_store(&straggler_go, 1);
+		if (_finish_by_sync) {
+			fhwb_sync(window);
+			ret = 0;
+		} else {
+			ret = fhwb_sync_timeout(window, LONG_TIMEOUT_NS);
+		}
+		if (ret) {
+			fprintf(stderr, "cpu %d: sync after timeout returns %d\n", info->cpuid, ret);
+			info->ret = -1;
+			goto out;
+		}
+	}
+
+	/* both PEs should be in the same phase */
+	for (i = 0; i < _loop; i++) {
+		atomic_fetch_add(&arrived, 1);
+		ret = fhwb_sync_timeout(window, LONG_TIMEOUT_NS);
+		if (ret || atomic_load(&arrived) != (i * 2 + 1) * 2) {
+			fprintf(stderr, "cpu %d left sync early at %d: %d, ret: %d\n",
+					info->cpuid, i, atomic_load(&arrived), ret);
+			info->ret = -1;
+			break;
+		}
+		fhwb_sync(window);
+
+		atomic_fetch_add(&arrived, 1);
+		ret = fhwb_arrive(window);
+		if (ret >= 0)
+			ret = fhwb_wait(window, ret);
+		if (ret || atomic_load(&arrived) != (i * 2 + 2) * 2) {
+			fprintf(stderr, "cpu %d left split-phase sync early at %d: %d, ret: %d\n",
+					info->cpuid, i, atomic_load(&arrived), ret);
+			info->ret = -1;
+			break;
+		}
+		fhwb_sync(window);
+	}
+
+out:
+	ret = fhwb_unassign(_bd);
+	if (!info->ret)
+		info->ret = ret;
+	pthread_exit(NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	struct thread_info th_info[2] = {0};
+	cpu_set_t cmg_set;
+	cpu_set_t set;
+	int cpu;
+	int cmg;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	_loop = atoi(argv[2]);
+
+	ret = fill_cpumask_for_cmg(cmg, &cmg_set);
+	ASSERT_SUCCESS(ret);
+	if (CPU_COUNT(&cmg_set) < 2) {
+		fprintf(stderr, "cannot perform test\n");
+		return -1;
+	}
+
+	printf("test1: check fhwb_sync_timeout with invalid window (%s backend)\n",
+			fhwb_get_backend_name());
+	ret = fhwb_sync_timeout(-1, SHORT_TIMEOUT_NS);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_sync_timeout(FHWB_WINDOW_3 + 1, SHORT_TIMEOUT_NS);
+	ASSERT(ret == -EINVAL);
+
+	CPU_ZERO(&set);
+	cpu = -1;
+	for (i = 0; i < 2; i++) {
+		cpu = get_next_cpu(&cmg_set, cpu);
+		CPU_SET(cpu, &set);
+		th_info[i].cpuid = cpu;
+		th_info[i].straggler = i;
+	}
+
+	ret = fhwb_init(sizeof(cpu_set_t), &set);
+	ASSERT_VALID_BD(ret);
+	_bd = ret;
+
+	for (_finish_by_sync = 0; _finish_by_sync < 2; _finish_by_sync++) {
+		if (_finish_by_sync)
+			printf("test3: check fhwb_sync completes the timed out synchronization\n");
+		else
+			printf("test2: check fhwb_sync_timeout with a straggler PE of CMG %d\n", cmg);
+
+		atomic_store(&arrived, 0);
+		atomic_store(&straggler_go, 0);
+		for (i = 0; i < 2; i++) {
+			th_info[i].ret = 0;
+			ret = pthread_create(&th_info[i].thread_id, NULL, &worker, &th_info[i]);
+			ASSERT_SUCCESS(ret);
+		}
+
+		for (i = 0; i < 2; i++) {
+			ret = pthread_join(th_info[i].thread_id, NULL);
+			ASSERT_SUCCESS(ret);
+			ASSERT_SUCCESS(th_info[i].ret);
+		}
+	}
+
+	ret = fhwb_fini(_bd);
+	ASSERT_SUCCESS(ret);
+	return 0;
+}
@@ -0,0 +1,140 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check team runs fork-join regions on all PEs of a CMG
+ *
+ * Usage: ./a.out <cmg_num> <loop_num>
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define MAX_RANKS 256
+
+static struct fhwb_team *_team;
+static int _size;
+static atomic_int calls[MAX_RANKS];
+static atomic_int arrived;
+static atomic_int errors;
+
+static void count_region(void *arg, int rank)
+{
+	int *cpus = arg;
+
+	if (rank < 0 || rank >= _size || sched_getcpu() != cpus[rank])
+		atomic_fetch_add(&errors, 1);
+	else
+		atomic_fetch_add(&calls[rank], 1);
+}
+
+static void barrier_region(void *arg, int rank)
+{
+	int phase = *(int *)arg;
+
+	atomic_fetch_add(&arrived, 1);
+	fhwb_team_barrier(_team, rank);
+
+	/* all ranks have arrived, and nobody arrives next phase before second sync */
+	if (atomic_load(&arrived) != (phase + 1) * _size)
+		atomic_fetch_add(&errors, 1);
+	fhwb_team_barrier(_team, rank);
+}
+
+int main(int argc, char *argv[])
+{
+	struct hwb_hwinfo hwinfo;
+	int cpus[MAX_RANKS];
+	cpu_set_t set;
+	cpu_set_t bind;
+	int cmg;
+	int loop;
+	int cpu;
+	int ret;
+	int i;
+
+	if (argc < 3) {
+		fprintf(stderr, "usage: ./a.out <cmg_num> <loop_num>\n");
+		return -1;
+	}
+	cmg = atoi(argv[1]);
+	loop = atoi(argv[2]);
+
+	ret = get_hwb_hwinfo(&hwinfo);
+	ASSERT_SUCCESS(ret);
+
+	ret = fill_cpumask_for_cmg(cmg, &set);
+	ASSERT_SUCCESS(ret);
+	_size = CPU_COUNT(&set);
+	ASSERT(_size >= 2 && _size <= MAX_RANKS);
+
+	printf("test1: check invalid arguments (%s backend)\n", fhwb_get_backend_name());
+	ret = fhwb_team_create(sizeof(cpu_set_t), NULL, &_team);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_team_create(sizeof(cpu_set_t), &set, NULL);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_team_run(NULL, count_region, NULL);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_team_size(NULL);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_team_destroy(NULL);
+	ASSERT(ret == -EINVAL);
+
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), &bind);
+	ASSERT_SUCCESS(ret);
+	if (CPU_COUNT(&bind) > 1) {
+		ret = fhwb_team_create(sizeof(cpu_set_t), &set, &_team);
+		ASSERT(ret == -EPERM);
+	}
+
+	/* master is bound to the last PE, so its rank is not 0 */
+	cpu = -1;
+	for (i = 0; i < _size; i++) {
+		cpu = get_next_cpu(&set, cpu);
+		cpus[i] = cpu;
+	}
+	CPU_ZERO(&bind);
+	CPU_SET(cpus[_size - 1], &bind);
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &bind);
+	ASSERT_SUCCESS(ret);
+
+	printf("test2: check team of %d PEs runs %d regions\n", _size, loop);
+	ret = fhwb_team_create(sizeof(cpu_set_t), &set, &_team);
+	ASSERT_SUCCESS(ret);
+	ret = fhwb_team_size(_team);
+	ASSERT(ret == _size);
+
+	for (i = 0; i < loop; i++) {
+		ret = fhwb_team_run(_team, count_region, cpus);
+		ASSERT_SUCCESS(ret);
+		/* exit synchronization waits for all ranks */
+		ASSERT(atomic_load(&calls[0]) == i + 1);
+		ASSERT(atomic_load(&calls[_size - 2]) == i + 1);
+	}
+	for (i = 0; i < _size; i++)
+		ASSERT(atomic_load(&calls[i]) == loop);
+	ASSERT(atomic_load(&errors) == 0);
+
+	printf("test3: check barrier inside regions\n");
+	for (i = 0; i < loop; i++) {
+		ret = fhwb_team_run(_team, barrier_region, &i);
+		ASSERT_SUCCESS(ret);
+	}
+	ASSERT(atomic_load(&errors) == 0);
+
+	ret = fhwb_team_destroy(_team);
+	ASSERT_SUCCESS(ret);
+
+	ret = check_sysfs_status();
+	ASSERT_SUCCESS(ret);
+
+	return 0;
+}
@@ -0,0 +1,89 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Check cached topology matches fhwb_get_pe_info() on each PE
+ */
+
+#define _GNU_SOURCE
+
+#include <fujitsu_hwb.h>
+#include "util.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+int main()
+{
+	struct fhwb_pe_info *list = NULL;
+	struct fhwb_pe_info info;
+	struct fhwb_pe_info cpu_info;
+	cpu_set_t orig;
+	cpu_set_t after;
+	cpu_set_t mask;
+	cpu_set_t set;
+	int entry_num = 0;
+	int checked = 0;
+	int ret;
+	int i;
+
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), &orig);
+	ASSERT_SUCCESS(ret);
+
+	printf("test1: check fhwb_get_all_pe_info keeps affinity (%s backend)\n",
+			fhwb_get_backend_name());
+	ret = fhwb_get_all_pe_info(&list, &entry_num);
+	ASSERT_SUCCESS(ret);
+	ret = sched_getaffinity(0, sizeof(cpu_set_t), &after);
+	ASSERT_SUCCESS(ret);
+	ASSERT(CPU_EQUAL(&orig, &after));
+
+	printf("test2: check topology of each PE\n");
+	for (i = 0; i < entry_num; i++) {
+		ret = fhwb_get_cpu_pe_info(i, &cpu_info);
+		if (list[i].cmg == FHWB_INVALID_CMG) {
+			ASSERT(ret == -EINVAL);
+			continue;
+		}
+		ASSERT_SUCCESS(ret);
+		ASSERT(cpu_info.cmg == list[i].cmg && cpu_info.physical_pe == list[i].physical_pe);
+
+		ret = fhwb_get_cmg_cpumask(list[i].cmg, sizeof(cpu_set_t), &mask);
+		ASSERT_SUCCESS(ret);
+		ASSERT(CPU_ISSET(i, &mask));
+
+		/* the same as the driver reports on the PE */
+		CPU_ZERO(&set);
+		CPU_SET(i, &set);
+		if (sched_setaffinity(0, sizeof(cpu_set_t), &set) < 0)
+			continue;
+		ret = fhwb_get_pe_info(&info);
+		ASSERT_SUCCESS(ret);
+		ASSERT(info.cmg == list[i].cmg && info.physical_pe == list[i].physical_pe);
+		checked++;
+	}
+	ASSERT(checked > 0);
+	free(list);
+
+	ret = sched_setaffinity(0, sizeof(cpu_set_t), &orig);
+	ASSERT_SUCCESS(ret);
+
+	printf("test3: check invalid arguments\n");
+	ret = fhwb_get_cpu_pe_info(-1, &info);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_get_cpu_pe_info(entry_num, &info);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_get_cpu_pe_info(0, NULL);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_get_cmg_cpumask(-1, sizeof(cpu_set_t), &mask);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_get_cmg_cpumask(FHWB_INVALID_CMG, sizeof(cpu_set_t), &mask);
+	ASSERT(ret == -EINVAL);
+	ret = fhwb_get_cmg_cpumask(0, sizeof(cpu_set_t), NULL);
+	ASSERT(ret == -EINVAL);
+
+	return 0;
+}
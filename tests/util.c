@@ -17,6 +17,8 @@
 #include <unistd.h>
 
 #define FHWB_SYSFS_ROOT "/sys/class/misc/fujitsu_hwb"
+/* Set by emulated device (libFJhwb-emu.so) */
+#define FHWB_SYSFS_ROOT_ENV_NAME "FUJITSU_HWB_SYSFS_ROOT"
 #define PATH_MAX 256
 
 #define UTIL_ERR(fmt, ...)\
@@ -25,13 +27,20 @@
 /* sysfs file size is always PAGE_SIZE */
 size_t page_size;
 
+static const char *sysfs_root()
+{
+	const char *root = getenv(FHWB_SYSFS_ROOT_ENV_NAME);
+
+	return root ? root : FHWB_SYSFS_ROOT;
+}
+
 static int __get_hwb_hwinfo(struct hwb_hwinfo *hwinfo, char *buf)
 {
 	char path[PATH_MAX];
 	int ret;
 	int fd;
 
-	ret = snprintf(path, PATH_MAX, "%s/hwinfo", FHWB_SYSFS_ROOT);
+	ret = snprintf(path, PATH_MAX, "%s/hwinfo", sysfs_root());
 	if (ret < 0) {
 		UTIL_ERR("snprintf %m");
 		return ret;
@@ -96,7 +105,7 @@ static int check_used_bb_bmap(int cmg, char *buf)
 	int ret;
 	int fd;
 
-	ret = snprintf(path, PATH_MAX, "%s/CMG%d/used_bb_bmap", FHWB_SYSFS_ROOT, cmg);
+	ret = snprintf(path, PATH_MAX, "%s/CMG%d/used_bb_bmap", sysfs_root(), cmg);
 	if (ret < 0) {
 		perror("snprintf");
 		return -1;
@@ -147,7 +156,7 @@ static int check_used_bw_bmap(int cmg)
 	int clean;
 	int ret;
 
-	ret = snprintf(path, PATH_MAX, "%s/CMG%d/used_bw_bmap", FHWB_SYSFS_ROOT, cmg);
+	ret = snprintf(path, PATH_MAX, "%s/CMG%d/used_bw_bmap", sysfs_root(), cmg);
 	if (ret < 0) {
 		UTIL_ERR("snprintf %m");
 		return -1;
@@ -194,7 +203,7 @@ static int check_init_sync(int cmg, int bb, char* buf)
 	int ret;
 	int fd;
 
-	ret = snprintf(path, PATH_MAX, "%s/CMG%d/init_sync_bb%d", FHWB_SYSFS_ROOT, cmg, bb);
+	ret = snprintf(path, PATH_MAX, "%s/CMG%d/init_sync_bb%d", sysfs_root(), cmg, bb);
 	if (ret < 0) {
 		UTIL_ERR("snprintf %m");
 		return -1;
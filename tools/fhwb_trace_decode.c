@@ -0,0 +1,187 @@
+/* SPDX-License-Identifier: LGPL-3.0-only */
+/*
+ * Copyright 2020 FUJITSU LIMITED
+ *
+ * Print events of trace file written by libFJhwb (see FHWB_TRACE_ENV_NAME)
+ *
+ * Usage: ./fhwb_trace_decode [-c] <trace_file>
+ * Without -c, events of all threads are printed in time order as:
+ *   <time_ns from first event> <tid> <cpu> <event> <cmg> <bb> <window> <result>
+ * With -c, events are converted to Chrome trace event format (JSON).
+ */
+
+#include "trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+struct event {
+	struct fhwb_trace_event ev;
+	uint32_t tid;
+};
+
+/* Events of one thread */
+struct ring {
+	uint32_t tid;
+	uint32_t num;
+	struct fhwb_trace_event *events;
+};
+
+static const char *event_names[] = {
+	[FHWB_TRACE_INIT] = "init",
+	[FHWB_TRACE_FINI] = "fini",
+	[FHWB_TRACE_ASSIGN] = "assign",
+	[FHWB_TRACE_UNASSIGN] = "unassign",
+	[FHWB_TRACE_SYNC_BEGIN] = "sync_begin",
+	[FHWB_TRACE_SYNC_END] = "sync_end",
+	[FHWB_TRACE_REMASK] = "remask",
+};
+
+static int compare_event(const void *a, const void *b)
+{
+	const struct event *x = a;
+	const struct event *y = b;
+
+	if (x->ev.time != y->ev.time)
+		return x->ev.time < y->ev.time ? -1 : 1;
+
+	return 0;
+}
+
+static void print_text(const struct fhwb_trace_header *header, const struct ring *rings, int nr_rings)
+{
+	struct event *events;
+	size_t num = 0;
+	size_t i;
+	uint32_t j;
+	int r;
+
+	for (r = 0; r < nr_rings; r++)
+		num += rings[r].num;
+	events = malloc(sizeof(struct event) * (num ? num : 1));
+	if (!events) {
+		perror("malloc");
+		exit(1);
+	}
+
+	num = 0;
+	for (r = 0; r < nr_rings; r++) {
+		for (j = 0; j < rings[r].num; j++, num++) {
+			events[num].ev = rings[r].events[j];
+			events[num].tid = rings[r].tid;
+		}
+	}
+	qsort(events, num, sizeof(struct event), compare_event);
+
+	printf("# pid %u, %zu events\n", header->pid, num);
+	for (i = 0; i < num; i++) {
+		const struct fhwb_trace_event *ev = &events[i].ev;
+		uint64_t ticks = ev->time - events[0].ev.time;
+		uint64_t ns = ticks / header->clock_freq * 1000000000ULL +
+			ticks % header->clock_freq * 1000000000ULL / header->clock_freq;
+		const char *name = ev->type < sizeof(event_names) / sizeof(event_names[0]) &&
+			event_names[ev->type] ? event_names[ev->type] : "unknown";
+
+		printf("%12lu %6u %4d %-10s %3d %3d %2d %d\n", (unsigned long)ns, events[i].tid,
+				ev->cpu == 0xffff ? -1 : ev->cpu, name,
+				ev->cmg == 0xff ? -1 : ev->cmg, ev->bb == 0xff ? -1 : ev->bb,
+				ev->window, ev->result);
+	}
+
+	free(events);
+}
+
+static void print_chrome(const struct fhwb_trace_header *header, const struct ring *rings, int nr_rings)
+{
+	struct fhwb_trace_chrome ct;
+	uint64_t base = UINT64_MAX;
+	int r;
+
+	for (r = 0; r < nr_rings; r++)
+		if (rings[r].num && rings[r].events[0].time < base)
+			base = rings[r].events[0].time;
+
+	fhwb_trace_chrome_begin(&ct, stdout, header->clock_freq, base);
+	for (r = 0; r < nr_rings; r++)
+		fhwb_trace_chrome_thread(&ct, rings[r].tid, rings[r].events, rings[r].num);
+	fhwb_trace_chrome_end(&ct);
+}
+
+int main(int argc, char *argv[])
+{
+	struct fhwb_trace_header header;
+	struct fhwb_trace_ring_header rh;
+	struct ring *rings = NULL;
+	int nr_rings = 0;
+	int chrome = 0;
+	FILE *fp;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c")) != -1) {
+		switch (opt) {
+		case 'c':
+			chrome = 1;
+			break;
+		default:
+			fprintf(stderr, "Usage: %s [-c] <trace_file>\n", argv[0]);
+			return 1;
+		}
+	}
+	if (optind >= argc) {
+		fprintf(stderr, "Usage: %s [-c] <trace_file>\n", argv[0]);
+		return 1;
+	}
+
+	fp = fopen(argv[optind], "r");
+	if (!fp) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	if (fread(&header, sizeof(header), 1, fp) != 1 ||
+	    memcmp(header.magic, FHWB_TRACE_MAGIC, sizeof(FHWB_TRACE_MAGIC)) != 0 ||
+	    header.version != FHWB_TRACE_VERSION || header.clock_freq == 0) {
+		fprintf(stderr, "%s: not a trace file of this version\n", argv[optind]);
+		return 1;
+	}
+
+	while (fread(&rh, sizeof(rh), 1, fp) == 1) {
+		struct ring *ring;
+
+		rings = realloc(rings, sizeof(struct ring) * (nr_rings + 1));
+		if (!rings) {
+			perror("realloc");
+			return 1;
+		}
+		ring = &rings[nr_rings++];
+		ring->tid = rh.tid;
+		ring->num = rh.num_events;
+		ring->events = malloc(sizeof(struct fhwb_trace_event) * (rh.num_events ? rh.num_events : 1));
+		if (!ring->events) {
+			perror("malloc");
+			return 1;
+		}
+		if (fread(ring->events, sizeof(struct fhwb_trace_event), rh.num_events, fp) != rh.num_events) {
+			fprintf(stderr, "%s: truncated\n", argv[optind]);
+			return 1;
+		}
+		if (rh.dropped)
+			fprintf(stderr, "tid %u: %lu events were overwritten\n",
+					rh.tid, (unsigned long)rh.dropped);
+	}
+	fclose(fp);
+
+	if (chrome)
+		print_chrome(&header, rings, nr_rings);
+	else
+		print_text(&header, rings, nr_rings);
+
+	while (nr_rings > 0)
+		free(rings[--nr_rings].events);
+	free(rings);
+
+	return 0;
+}